@@ -0,0 +1,58 @@
+# - Try to find the Zstandard library (libzstd)
+#
+# Once done this will define
+#
+#  ZSTD_FOUND - System has libzstd
+#  ZSTD_INCLUDE_DIR - The libzstd include directory
+#  ZSTD_LIBRARIES - The libraries needed to use libzstd
+
+# Adapted from FindGnuTLS.cmake 2012-12-06, Martin Lambers.
+# Original copyright notice:
+#=============================================================================
+# Copyright 2009 Kitware, Inc.
+# Copyright 2009 Philip Lowman <philip@yhbt.com>
+# Copyright 2009 Brad Hards <bradh@kde.org>
+# Copyright 2006 Alexander Neundorf <neundorf@kde.org>
+#
+# Distributed under the OSI-approved BSD License (the "License");
+# see accompanying file Copyright.txt for details.
+#
+# This software is distributed WITHOUT ANY WARRANTY; without even the
+# implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+# See the License for more information.
+#=============================================================================
+# (To distribute this file outside of CMake, substitute the full
+#  License text for the above reference.)
+
+
+IF(ZSTD_INCLUDE_DIR AND ZSTD_LIBRARY)
+    # in cache already
+    SET(ZSTD_FIND_QUIETLY TRUE)
+ENDIF(ZSTD_INCLUDE_DIR AND ZSTD_LIBRARY)
+
+FIND_PACKAGE(PkgConfig QUIET)
+IF(PKG_CONFIG_FOUND)
+    # try using pkg-config to get the directories and then use these values
+    # in the FIND_PATH() and FIND_LIBRARY() calls
+    PKG_CHECK_MODULES(PC_ZSTD QUIET libzstd)
+    SET(ZSTD_VERSION_STRING ${PC_ZSTD_VERSION})
+ENDIF()
+
+FIND_PATH(ZSTD_INCLUDE_DIR zstd.h HINTS ${PC_ZSTD_INCLUDE_DIRS})
+
+FIND_LIBRARY(ZSTD_LIBRARY NAMES zstd libzstd HINTS ${PC_ZSTD_LIBRARY_DIRS})
+
+MARK_AS_ADVANCED(ZSTD_INCLUDE_DIR ZSTD_LIBRARY)
+
+# handle the QUIETLY and REQUIRED arguments and set ZSTD_FOUND to TRUE if 
+# all listed variables are TRUE
+INCLUDE(FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(ZSTD
+    REQUIRED_VARS ZSTD_LIBRARY ZSTD_INCLUDE_DIR
+    VERSION_VAR ZSTD_VERSION_STRING
+)
+
+IF(ZSTD_FOUND)
+    SET(ZSTD_LIBRARIES ${ZSTD_LIBRARY})
+    SET(ZSTD_INCLUDE_DIRS ${ZSTD_INCLUDE_DIR})
+ENDIF()
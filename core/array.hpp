@@ -671,6 +671,14 @@ public:
     {
     }
 
+    /*! \brief Constructor for an array container that uses the given \a data instead of allocating
+     * its own. The data must hold at least dataSize() bytes. A custom deleter can be used to manage
+     * memory that was not allocated with new, e.g. memory-mapped files. */
+    ArrayContainer(const ArrayDescription& desc, const std::shared_ptr<unsigned char[]>& data) :
+        ArrayDescription(desc), _data(data)
+    {
+    }
+
     /*! \brief Construct an array and perform deep copy of data */
     ArrayContainer deepCopy() const
     {
@@ -0,0 +1,576 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TGD_COLOR_HPP
+#define TGD_COLOR_HPP
+
+/**
+ * \file color.hpp
+ * \brief Transfer functions and tone mapping.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
+
+#include "array.hpp"
+#include "parallel.hpp"
+
+namespace TGD {
+
+/*! \brief Global tone mapping operators, see toneMap() */
+enum ToneMapOperator {
+    /*! \brief Clamp values to [0,1] */
+    ToneMapNone = 0,
+    /*! \brief Reinhard's operator x/(1+x), applied to each color component */
+    ToneMapReinhard = 1,
+    /*! \brief Narkowicz' fit of the ACES filmic curve, applied to each color component */
+    ToneMapACES = 2
+};
+
+/*! \cond */
+namespace ColorDetail {
+
+/* Values are processed in blocks of floats. The per-value functions below
+ * avoid branches and table lookups so that the loops over a block
+ * vectorize. Since the compiler must not speculate floating point
+ * operations that might trap, it turns float comparisons followed by
+ * arithmetic into branches; therefore clamping and selecting is done on the
+ * bit patterns with integer arithmetic, which for non-negative floats
+ * preserves the order. */
+static const size_t blockSize = 256;
+
+inline float asFloat(int32_t i)
+{
+    float f;
+    std::memcpy(&f, &i, sizeof(f));
+    return f;
+}
+
+inline int32_t asInt(float f)
+{
+    int32_t i;
+    std::memcpy(&i, &f, sizeof(i));
+    return i;
+}
+
+/* Minimum and maximum of non-negative integers with arithmetic instead of
+ * comparisons; the compiler would turn comparisons with constants into
+ * branches */
+inline int32_t minInt(int32_t a, int32_t b)
+{
+    int32_t d = a - b;
+    return b + (d & (d >> 31));
+}
+
+inline int32_t maxInt(int32_t a, int32_t b)
+{
+    int32_t d = a - b;
+    return a - (d & (d >> 31));
+}
+
+/* x clamped to [0,hi] for hi > 0; NaN becomes 0 or hi */
+inline float clampPositive(float x, float hi)
+{
+    int32_t i = asInt(x);
+    i &= ~(i >> 31);
+    return asFloat(minInt(i, asInt(hi)));
+}
+
+/* x with its magnitude clamped to hi > 0 */
+inline float clampMagnitude(float x, float hi)
+{
+    int32_t i = asInt(x);
+    return asFloat((i & ~0x7fffffff) | minInt(i & 0x7fffffff, asInt(hi)));
+}
+
+/* max(x,c) and x > c for x >= 0 and c > 0 */
+inline float maxPositive(float x, float c)
+{
+    return asFloat(maxInt(asInt(x), asInt(c)));
+}
+
+inline int32_t greaterPositive(float x, float c)
+{
+    return -int32_t(asInt(x) > asInt(c));
+}
+
+/* a where mask is all ones, b where it is zero */
+inline float blend(int32_t mask, float a, float b)
+{
+    return asFloat((asInt(a) & mask) | (asInt(b) & ~mask));
+}
+
+/* log2(x) for normal x > 0. With x = 2^e * m and m in [sqrt(1/2),sqrt(2)),
+ * log2(m) = 2/ln(2) * atanh(s) with s = (m-1)/(m+1) and |s| < 0.172, and the
+ * series of atanh converges fast enough: the error is below 5e-8. */
+inline float fastLog2(float x)
+{
+    int32_t i = asInt(x);
+    int32_t e = (i >> 23) - 127;
+    float m = asFloat((i & 0x007fffff) | 0x3f800000);
+    int32_t large = -greaterPositive(m, 1.41421356f);
+    m = asFloat(asInt(m) - (large << 23)); // m / 2 if large
+    e += large;
+    float s = (m - 1.0f) / (m + 1.0f);
+    float s2 = s * s;
+    float p = 2.88539008f + s2 * (0.961796694f + s2 * (0.577078016f + s2 * 0.412198583f));
+    return float(e) + s * p;
+}
+
+/* 2^y for |y| <= 126; larger magnitudes are clamped. With y = n + f and
+ * f in [0,1), 2^f is computed with a polynomial (relative error below 3e-7)
+ * and n is added to the exponent. */
+inline float fastExp2(float y)
+{
+    y = clampMagnitude(y, 126.0f);
+    int32_t n = int32_t(y + 127.0f) - 127; // floor(y), since y + 127 > 0
+    float f = y - float(n);
+    float p = 1.0f + f * (0.693147577f + f * (0.240206874f + f * (0.0556586642f
+                    + f * (0.00919680206f + f * 0.00178966503f))));
+    return asFloat(int32_t(uint32_t(asInt(p)) + (uint32_t(n) << 23)));
+}
+
+/* x^a for x > 0 */
+inline float fastPow(float x, float a)
+{
+    return fastExp2(a * fastLog2(x));
+}
+
+/* The transfer functions expect x >= 0 */
+inline float encodeSRGB(float x)
+{
+    float p = 1.055f * fastPow(maxPositive(x, 0.0031308f), 1.0f / 2.4f) - 0.055f;
+    float l = 12.92f * x;
+    return blend(greaterPositive(x, 0.0031308f), p, l);
+}
+
+inline float decodeSRGB(float x)
+{
+    float p = fastPow((maxPositive(x, 0.04045f) + 0.055f) * (1.0f / 1.055f), 2.4f);
+    float l = x * (1.0f / 12.92f);
+    return blend(greaterPositive(x, 0.04045f), p, l);
+}
+
+inline float applyGamma(float x, float exponent)
+{
+    float p = fastPow(maxPositive(x, 1e-30f), exponent);
+    return blend(greaterPositive(x, 0.0f), p, 0.0f);
+}
+
+enum Transfer { TransferLinear, TransferSRGB, TransferGamma };
+
+/* Exposure, tone mapping operator, clamping to [0,1], and encoding */
+template<int Op, int T> inline void toneMapBlock(float* v, float scale, float invGamma)
+{
+    for (size_t i = 0; i < blockSize; i++) {
+        // the upper limit keeps the operators finite
+        float x = clampPositive(v[i] * scale, 1e18f);
+        if (Op == ToneMapReinhard)
+            x = x / (1.0f + x);
+        else if (Op == ToneMapACES)
+            x = (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+        x = clampPositive(x, 1.0f);
+        if (T == TransferSRGB)
+            x = encodeSRGB(x);
+        else if (T == TransferGamma)
+            x = applyGamma(x, invGamma);
+        v[i] = x;
+    }
+}
+
+/* Decoding to linear values */
+template<int T> inline void toLinearBlock(float* v, float, float gamma)
+{
+    for (size_t i = 0; i < blockSize; i++) {
+        float x = clampPositive(v[i], std::numeric_limits<float>::infinity());
+        if (T == TransferSRGB)
+            x = decodeSRGB(x);
+        else if (T == TransferGamma)
+            x = applyGamma(x, gamma);
+        v[i] = x;
+    }
+}
+
+/* The same computations for single values in double precision with
+ * std::pow(). These are used for the lookup tables, where speed does not
+ * matter. The input x is never negative or NaN. */
+template<int Op, int T> inline double toneMapValue(double x, double scale, double invGamma)
+{
+    x = std::min(x * scale, 1e18);
+    if (Op == ToneMapReinhard)
+        x = x / (1.0 + x);
+    else if (Op == ToneMapACES)
+        x = (x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14);
+    x = std::min(x, 1.0);
+    if (T == TransferSRGB)
+        x = (x > 0.0031308 ? 1.055 * std::pow(x, 1.0 / 2.4) - 0.055 : 12.92 * x);
+    else if (T == TransferGamma)
+        x = (x > 0.0 ? std::pow(x, invGamma) : 0.0);
+    return x;
+}
+
+template<int T> inline double toLinearValue(double x, double, double gamma)
+{
+    if (T == TransferSRGB)
+        x = (x > 0.04045 ? std::pow((x + 0.055) / 1.055, 2.4) : x / 12.92);
+    else if (T == TransferGamma)
+        x = (x > 0.0 ? std::min(std::pow(x, gamma), 0x1p126) : 0.0);
+    return x;
+}
+
+typedef void (*BlockFunction)(float*, float, float);
+typedef double (*ValueFunction)(double, double, double);
+
+struct Functions {
+    BlockFunction block;
+    ValueFunction value;
+};
+
+template<int Op, int T> inline Functions toneMapFunctions()
+{
+    return { toneMapBlock<Op, T>, toneMapValue<Op, T> };
+}
+
+template<int T> inline Functions toLinearFunctions()
+{
+    return { toLinearBlock<T>, toLinearValue<T> };
+}
+
+inline Functions selectToneMap(ToneMapOperator op, Transfer t)
+{
+    switch (op) {
+    case ToneMapReinhard:
+        return (t == TransferSRGB ? toneMapFunctions<ToneMapReinhard, TransferSRGB>()
+                : t == TransferGamma ? toneMapFunctions<ToneMapReinhard, TransferGamma>()
+                : toneMapFunctions<ToneMapReinhard, TransferLinear>());
+    case ToneMapACES:
+        return (t == TransferSRGB ? toneMapFunctions<ToneMapACES, TransferSRGB>()
+                : t == TransferGamma ? toneMapFunctions<ToneMapACES, TransferGamma>()
+                : toneMapFunctions<ToneMapACES, TransferLinear>());
+    default:
+        return (t == TransferSRGB ? toneMapFunctions<ToneMapNone, TransferSRGB>()
+                : t == TransferGamma ? toneMapFunctions<ToneMapNone, TransferGamma>()
+                : toneMapFunctions<ToneMapNone, TransferLinear>());
+    }
+}
+
+inline Functions selectToLinear(Transfer t)
+{
+    return (t == TransferSRGB ? toLinearFunctions<TransferSRGB>()
+            : t == TransferGamma ? toLinearFunctions<TransferGamma>()
+            : toLinearFunctions<TransferLinear>());
+}
+
+/* Integer values are normalized to [0,1] (unsigned) or [-1,1] (signed) */
+template<typename T> inline float loadValue(T v)
+{
+    if (std::is_floating_point<T>::value)
+        return v;
+    else
+        return float(v) * (1.0f / float(std::numeric_limits<T>::max()));
+}
+
+/* Values are never negative or NaN here. For integer types, they are
+ * rounded and saturated, in single precision for 8 and 16 bit types. */
+template<typename T> inline T storeValue(float v)
+{
+    if (std::is_floating_point<T>::value) {
+        return v;
+    } else if (sizeof(T) <= 2) {
+        const float maxVal = std::numeric_limits<T>::max();
+        return T(int32_t(std::min(v * maxVal + 0.5f, maxVal)));
+    } else {
+        double x = double(v) * double(std::numeric_limits<T>::max()) + 0.5;
+        return (x >= double(std::numeric_limits<T>::max()) ? std::numeric_limits<T>::max() : T(x));
+    }
+}
+
+/* The same for double precision values */
+template<typename T> inline T storeExactValue(double v)
+{
+    if (std::is_floating_point<T>::value) {
+        return T(v);
+    } else {
+        double x = v * double(std::numeric_limits<T>::max()) + 0.5;
+        return (x >= double(std::numeric_limits<T>::max()) ? std::numeric_limits<T>::max() : T(x));
+    }
+}
+
+template<typename TI, typename TO> inline void apply(const TI* src, TO* dst, size_t n,
+        BlockFunction f, float a, float b, unsigned int threadCount)
+{
+    const size_t chunk = 256 * blockSize;
+    parallelForChunks((n + chunk - 1) / chunk, threadCount, [&] (size_t ch) {
+        float buf[blockSize];
+        size_t end = std::min(n, (ch + 1) * chunk);
+        for (size_t i = ch * chunk; i < end; i += blockSize) {
+            size_t m = std::min(blockSize, end - i);
+            if (m == blockSize) {
+                // constant trip counts let the compiler vectorize
+                for (size_t j = 0; j < blockSize; j++)
+                    buf[j] = loadValue(src[i + j]);
+                f(buf, a, b);
+                for (size_t j = 0; j < blockSize; j++)
+                    dst[i + j] = storeValue<TO>(buf[j]);
+            } else {
+                for (size_t j = 0; j < m; j++)
+                    buf[j] = loadValue(src[i + j]);
+                for (size_t j = m; j < blockSize; j++)
+                    buf[j] = 0.0f;
+                f(buf, a, b);
+                for (size_t j = 0; j < m; j++)
+                    dst[i + j] = storeValue<TO>(buf[j]);
+            }
+        }
+    });
+}
+
+/* 8 and 16 bit input: the result for each possible input value is computed
+ * once in double precision, and the values are then looked up in the table */
+template<typename TI, typename TO> inline void applyLut(const TI* src, TO* dst, size_t n,
+        ValueFunction f, float a, float b, unsigned int threadCount)
+{
+    const size_t lutSize = size_t(1) << (8 * sizeof(TI));
+    const int64_t lutOffset = -int64_t(std::numeric_limits<TI>::min());
+    std::vector<TO> lut(lutSize);
+    for (size_t i = 0; i < lutSize; i++) {
+        double x = double(int64_t(i) - lutOffset) / double(std::numeric_limits<TI>::max());
+        lut[i] = storeExactValue<TO>(f(std::max(x, 0.0), a, b));
+    }
+    const size_t chunk = size_t(1) << 20;
+    parallelForChunks((n + chunk - 1) / chunk, threadCount, [&] (size_t ch) {
+        size_t end = std::min(n, (ch + 1) * chunk);
+        for (size_t i = ch * chunk; i < end; i++)
+            dst[i] = lut[src[i] + lutOffset];
+    });
+}
+
+template<typename TI, typename TO> inline void applyValues(const TI* src, TO* dst, size_t n,
+        Functions f, float a, float b, unsigned int threadCount, std::true_type /* use LUT */)
+{
+    applyLut(src, dst, n, f.value, a, b, threadCount);
+}
+
+template<typename TI, typename TO> inline void applyValues(const TI* src, TO* dst, size_t n,
+        Functions f, float a, float b, unsigned int threadCount, std::false_type /* use LUT */)
+{
+    apply(src, dst, n, f.block, a, b, threadCount);
+}
+
+/* Alpha components are only normalized and converted */
+template<typename TI, typename TO> inline void convertAlpha(const TI* src, TO* dst,
+        size_t elementCount, size_t componentCount, size_t c)
+{
+    for (size_t e = 0; e < elementCount; e++) {
+        float x = clampPositive(loadValue(src[e * componentCount + c]), 1.0f);
+        dst[e * componentCount + c] = storeValue<TO>(x);
+    }
+}
+
+template<typename TI, typename TO> inline void process(const TI* src, TO* dst,
+        const ArrayContainer& a, Functions f, float p0, float p1, unsigned int threadCount)
+{
+    size_t n = a.elementCount() * a.componentCount();
+    applyValues(src, dst, n, f, p0, p1, threadCount,
+            std::integral_constant<bool, (sizeof(TI) <= 2 && !std::is_floating_point<TI>::value)>());
+    for (size_t c = 0; c < a.componentCount(); c++)
+        if (a.componentTagList(c).value("INTERPRETATION") == "ALPHA")
+            convertAlpha(src, dst, a.elementCount(), a.componentCount(), c);
+}
+
+template<typename TI> inline void process(const TI* src, ArrayContainer& r,
+        const ArrayContainer& a, Functions f, float p0, float p1, unsigned int threadCount)
+{
+    void* dst = r.data();
+    switch (r.componentType()) {
+    case int8:
+        process(src, static_cast<int8_t*>(dst), a, f, p0, p1, threadCount);
+        break;
+    case uint8:
+        process(src, static_cast<uint8_t*>(dst), a, f, p0, p1, threadCount);
+        break;
+    case int16:
+        process(src, static_cast<int16_t*>(dst), a, f, p0, p1, threadCount);
+        break;
+    case uint16:
+        process(src, static_cast<uint16_t*>(dst), a, f, p0, p1, threadCount);
+        break;
+    case int32:
+        process(src, static_cast<int32_t*>(dst), a, f, p0, p1, threadCount);
+        break;
+    case uint32:
+        process(src, static_cast<uint32_t*>(dst), a, f, p0, p1, threadCount);
+        break;
+    case int64:
+        process(src, static_cast<int64_t*>(dst), a, f, p0, p1, threadCount);
+        break;
+    case uint64:
+        process(src, static_cast<uint64_t*>(dst), a, f, p0, p1, threadCount);
+        break;
+    case float32:
+        process(src, static_cast<float*>(dst), a, f, p0, p1, threadCount);
+        break;
+    case float64:
+        process(src, static_cast<double*>(dst), a, f, p0, p1, threadCount);
+        break;
+    }
+}
+
+inline void process(const ArrayContainer& a, ArrayContainer& r,
+        Functions f, float p0, float p1, unsigned int threadCount)
+{
+    const void* src = a.data();
+    switch (a.componentType()) {
+    case int8:
+        process(static_cast<const int8_t*>(src), r, a, f, p0, p1, threadCount);
+        break;
+    case uint8:
+        process(static_cast<const uint8_t*>(src), r, a, f, p0, p1, threadCount);
+        break;
+    case int16:
+        process(static_cast<const int16_t*>(src), r, a, f, p0, p1, threadCount);
+        break;
+    case uint16:
+        process(static_cast<const uint16_t*>(src), r, a, f, p0, p1, threadCount);
+        break;
+    case int32:
+        process(static_cast<const int32_t*>(src), r, a, f, p0, p1, threadCount);
+        break;
+    case uint32:
+        process(static_cast<const uint32_t*>(src), r, a, f, p0, p1, threadCount);
+        break;
+    case int64:
+        process(static_cast<const int64_t*>(src), r, a, f, p0, p1, threadCount);
+        break;
+    case uint64:
+        process(static_cast<const uint64_t*>(src), r, a, f, p0, p1, threadCount);
+        break;
+    case float32:
+        process(static_cast<const float*>(src), r, a, f, p0, p1, threadCount);
+        break;
+    case float64:
+        process(static_cast<const double*>(src), r, a, f, p0, p1, threadCount);
+        break;
+    }
+}
+
+/* Copy all tags except value ranges, and adjust color interpretations when
+ * converting between linear and sRGB */
+inline void copyTags(const ArrayContainer& a, ArrayContainer& r, bool toSRGB, bool fromSRGB)
+{
+    static const char* linearNames[] = { "RED", "GREEN", "BLUE", "XYZ/Y" };
+    static const char* srgbNames[] = { "SRGB/R", "SRGB/G", "SRGB/B", "SRGB/GRAY" };
+    r.globalTagList() = a.globalTagList();
+    for (size_t i = 0; i < a.dimensionCount(); i++)
+        r.dimensionTagList(i) = a.dimensionTagList(i);
+    for (size_t i = 0; i < a.componentCount(); i++) {
+        TagList& tl = r.componentTagList(i);
+        tl = a.componentTagList(i);
+        tl.unset("MINVAL");
+        tl.unset("MAXVAL");
+        std::string interpretation = tl.value("INTERPRETATION");
+        for (int j = 0; j < 4; j++) {
+            if (toSRGB && interpretation == linearNames[j])
+                tl.set("INTERPRETATION", srgbNames[j]);
+            else if (fromSRGB && interpretation == srgbNames[j])
+                tl.set("INTERPRETATION", linearNames[j]);
+        }
+    }
+}
+
+}
+/*! \endcond */
+
+/*! \brief Prepares linear (e.g. high dynamic range) values for display.
+ *
+ * Each value is scaled by 2^\a exposure, mapped with the operator \a op,
+ * clamped to [0,1], and encoded with the sRGB transfer function if \a gamma
+ * is zero, or with x^(1/gamma) otherwise (a \a gamma of 1 means no encoding).
+ * The result has type \a resultType; integer types represent [0,1] with their
+ * full range (e.g. 0-255 for uint8).
+ *
+ * Integer input values are first normalized to [0,1] (unsigned types) or
+ * [-1,1] (signed types). NaN values become 0 or 1. Components with the INTERPRETATION tag ALPHA are
+ * only normalized and converted. The computation uses single precision with
+ * polynomial approximations of the power function (relative error below
+ * 2e-6). For 8 and 16 bit input types, the result for each possible value is
+ * computed only once, in double precision with std::pow(), and then looked up. The values are processed by
+ * \a threadCount threads (0 means one thread per core). */
+inline ArrayContainer toneMap(const ArrayContainer& array, ToneMapOperator op = ToneMapNone,
+        float exposure = 0.0f, float gamma = 0.0f, Type resultType = uint8,
+        unsigned int threadCount = 0)
+{
+    ColorDetail::Transfer t = (gamma == 0.0f ? ColorDetail::TransferSRGB
+            : gamma == 1.0f ? ColorDetail::TransferLinear : ColorDetail::TransferGamma);
+    ArrayContainer r(array.dimensions(), array.componentCount(), resultType);
+    ColorDetail::copyTags(array, r, t == ColorDetail::TransferSRGB, false);
+    ColorDetail::process(array, r, ColorDetail::selectToneMap(op, t),
+            std::exp2(exposure), gamma == 0.0f ? 0.0f : 1.0f / gamma, threadCount);
+    return r;
+}
+
+/*! \brief Converts linear values to sRGB encoded values of type \a
+ * resultType, clamped to [0,1]. This is toneMap() without exposure and
+ * tone mapping operator. */
+inline ArrayContainer linearToSRGB(const ArrayContainer& array, Type resultType = uint8,
+        unsigned int threadCount = 0)
+{
+    return toneMap(array, ToneMapNone, 0.0f, 0.0f, resultType, threadCount);
+}
+
+/*! \brief Converts encoded values to linear values.
+ *
+ * The values are decoded with the sRGB transfer function if \a gamma is
+ * zero, or with x^gamma otherwise. Negative values become zero, and results
+ * are limited to 2^126 unless \a gamma is 1. See
+ * toneMap() for the handling of types, alpha components, precision, and
+ * threads. */
+inline ArrayContainer toLinear(const ArrayContainer& array, float gamma = 0.0f,
+        Type resultType = float32, unsigned int threadCount = 0)
+{
+    ColorDetail::Transfer t = (gamma == 0.0f ? ColorDetail::TransferSRGB
+            : gamma == 1.0f ? ColorDetail::TransferLinear : ColorDetail::TransferGamma);
+    ArrayContainer r(array.dimensions(), array.componentCount(), resultType);
+    ColorDetail::copyTags(array, r, false, t == ColorDetail::TransferSRGB);
+    ColorDetail::process(array, r, ColorDetail::selectToLinear(t),
+            0.0f, gamma, threadCount);
+    return r;
+}
+
+/*! \brief Converts sRGB encoded values to linear values of type \a
+ * resultType. This is toLinear() with the sRGB transfer function. */
+inline ArrayContainer srgbToLinear(const ArrayContainer& array, Type resultType = float32,
+        unsigned int threadCount = 0)
+{
+    return toLinear(array, 0.0f, resultType, threadCount);
+}
+
+}
+
+#endif
@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TGD_HASH_HPP
+#define TGD_HASH_HPP
+
+/**
+ * \file hash.hpp
+ * \brief Content hashes of arrays.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <array>
+#include <thread>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+# include <emmintrin.h>
+# define TGD_HASH_SSE2
+#endif
+
+#include "array.hpp"
+#include "parallel.hpp"
+
+namespace TGD {
+
+/*! \brief A 128 bit content hash.
+ *
+ * Hashes are computed by hashData(), hashDescription() and hashArray(). They
+ * are meant for detecting identical data and for caching, not for
+ * cryptographic purposes. */
+class Hash {
+public:
+    uint64_t low;   /**< \brief Lower 64 bits */
+    uint64_t high;  /**< \brief Upper 64 bits */
+
+    /*! \brief Constructor for a zero hash. */
+    Hash() : low(0), high(0)
+    {
+    }
+
+    /*! \brief Constructor. */
+    Hash(uint64_t l, uint64_t h) : low(l), high(h)
+    {
+    }
+
+    /*! \brief Comparison operators. */
+    bool operator==(const Hash& h) const { return low == h.low && high == h.high; }
+    bool operator!=(const Hash& h) const { return !(*this == h); }
+    bool operator<(const Hash& h) const { return high < h.high || (high == h.high && low < h.low); }
+
+    /*! \brief Returns the hash as 32 hexadecimal digits. */
+    std::string toString() const
+    {
+        char buf[33];
+        std::snprintf(buf, sizeof(buf), "%016llx%016llx",
+                static_cast<unsigned long long>(high), static_cast<unsigned long long>(low));
+        return buf;
+    }
+};
+
+/* Implementation details. The hash follows the design of XXH3: eight 64 bit
+ * accumulators consume 64 byte stripes with 32x32->64 bit multiplications,
+ * which map directly to SIMD instructions, and are scrambled every 1 KiB.
+ * Data is hashed in independent blocks of 1 MiB whose hashes are then
+ * combined, so that large arrays can be hashed with many threads and the
+ * result does not depend on the number of threads. */
+namespace HashDetail {
+
+static const size_t blockSize = size_t(1) << 20;
+
+inline const uint64_t* keys()
+{
+    static const std::array<uint64_t, 24> k = [] () {
+        std::array<uint64_t, 24> a;
+        uint64_t x = 0x5447442048617368ULL; // splitmix64
+        for (size_t i = 0; i < a.size(); i++) {
+            uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            a[i] = z ^ (z >> 31);
+        }
+        return a;
+    }();
+    return k.data();
+}
+
+inline uint64_t read64(const unsigned char* p)
+{
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+inline uint64_t mul128Fold64(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 p = static_cast<unsigned __int128>(a) * b;
+    return static_cast<uint64_t>(p) ^ static_cast<uint64_t>(p >> 64);
+#else
+    uint64_t aLo = a & 0xffffffffU, aHi = a >> 32;
+    uint64_t bLo = b & 0xffffffffU, bHi = b >> 32;
+    uint64_t ll = aLo * bLo, lh = aLo * bHi, hl = aHi * bLo, hh = aHi * bHi;
+    uint64_t mid = (ll >> 32) + (lh & 0xffffffffU) + (hl & 0xffffffffU);
+    uint64_t lo = (mid << 32) | (ll & 0xffffffffU);
+    uint64_t hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+    return lo ^ hi;
+#endif
+}
+
+inline uint64_t avalanche(uint64_t h)
+{
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+/* Portable version of accumulateStripe(), also used to test the SIMD version */
+inline void accumulateStripeScalar(uint64_t* acc, const unsigned char* p, const uint64_t* key)
+{
+    for (int i = 0; i < 8; i++) {
+        uint64_t d = read64(p + 8 * i);
+        uint64_t dk = d ^ key[i];
+        acc[i ^ 1] += d;
+        acc[i] += (dk & 0xffffffffU) * (dk >> 32);
+    }
+}
+
+inline void accumulateStripe(uint64_t* acc, const unsigned char* p, const uint64_t* key)
+{
+#if defined(TGD_HASH_SSE2) && !(defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    __m128i* a = reinterpret_cast<__m128i*>(acc);
+    for (int i = 0; i < 4; i++) {
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p) + i);
+        __m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key) + i);
+        __m128i dk = _mm_xor_si128(d, k);
+        __m128i product = _mm_mul_epu32(dk, _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1)));
+        __m128i swapped = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+        a[i] = _mm_add_epi64(a[i], _mm_add_epi64(product, swapped));
+    }
+#else
+    accumulateStripeScalar(acc, p, key);
+#endif
+}
+
+inline void scramble(uint64_t* acc, const uint64_t* key)
+{
+    for (int i = 0; i < 8; i++) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= key[i];
+        a *= 0x9E3779B1U;
+        acc[i] = a;
+    }
+}
+
+inline uint64_t merge(const uint64_t* acc, const uint64_t* key, uint64_t start)
+{
+    uint64_t h = start;
+    for (int i = 0; i < 4; i++)
+        h += mul128Fold64(acc[2 * i] ^ key[2 * i], acc[2 * i + 1] ^ key[2 * i + 1]);
+    return avalanche(h);
+}
+
+/* Hash at most one block; the result does not depend on \a scalar, which
+ * only selects the portable code path */
+inline Hash hashBlock(const unsigned char* p, size_t n, bool scalar = false)
+{
+    alignas(16) uint64_t acc[8] = {
+        0xC2B2AE3DU, 0x9E3779B185EBCA87ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL,
+        0x85EBCA77C2B2AE63ULL, 0x85EBCA77U, 0x27D4EB2F165667C5ULL, 0x9E3779B1U
+    };
+    const uint64_t* k = keys();
+    size_t stripes = n / 64;
+    for (size_t s = 0; s < stripes; s++) {
+        if (scalar)
+            accumulateStripeScalar(acc, p + 64 * s, k + s % 16);
+        else
+            accumulateStripe(acc, p + 64 * s, k + s % 16);
+        if (s % 16 == 15)
+            scramble(acc, k + 16);
+    }
+    // the rest, padded with zeroes; the length distinguishes the padding from data
+    alignas(16) unsigned char last[64] = { 0 };
+    if (n % 64 > 0)
+        std::memcpy(last, p + 64 * stripes, n % 64);
+    if (scalar)
+        accumulateStripeScalar(acc, last, k + 7);
+    else
+        accumulateStripe(acc, last, k + 7);
+    return Hash(merge(acc, k, n * 0x9E3779B185EBCA87ULL),
+            merge(acc, k + 8, ~(n * 0xC2B2AE3D27D4EB4FULL)));
+}
+
+inline void putUInt64(unsigned char* p, uint64_t x)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = x >> (8 * i);
+}
+
+inline void appendUInt64(std::vector<unsigned char>& v, uint64_t x)
+{
+    v.resize(v.size() + 8);
+    putUInt64(v.data() + v.size() - 8, x);
+}
+
+inline void appendTagList(std::vector<unsigned char>& v, const TagList& tl)
+{
+    appendUInt64(v, tl.size());
+    for (auto it = tl.cbegin(); it != tl.cend(); it++) {
+        v.insert(v.end(), it->first.c_str(), it->first.c_str() + it->first.length() + 1);
+        v.insert(v.end(), it->second.c_str(), it->second.c_str() + it->second.length() + 1);
+    }
+}
+
+}
+
+/*! \brief Returns a hash of \a size bytes of \a data. Large data is hashed
+ * with up to \a threadCount threads (0 means one per processor core); this
+ * does not change the result. */
+inline Hash hashData(const void* data, size_t size, unsigned int threadCount = 0)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    if (size <= HashDetail::blockSize)
+        return HashDetail::hashBlock(p, size);
+
+    size_t blockCount = (size - 1) / HashDetail::blockSize + 1;
+    std::vector<unsigned char> blockHashes(blockCount * 16);
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    // Small data is not worth starting threads
+    threadCount = std::min(size_t(threadCount), std::max(size_t(1), blockCount / 4));
+    parallelForChunks(blockCount, threadCount, [&] (size_t b) {
+        size_t offset = b * HashDetail::blockSize;
+        Hash h = HashDetail::hashBlock(p + offset, std::min(HashDetail::blockSize, size - offset));
+        HashDetail::putUInt64(blockHashes.data() + 16 * b, h.low);
+        HashDetail::putUInt64(blockHashes.data() + 16 * b + 8, h.high);
+    });
+    HashDetail::appendUInt64(blockHashes, size);
+    return HashDetail::hashBlock(blockHashes.data(), blockHashes.size());
+}
+
+/*! \brief Returns a hash of the description \a desc: its dimensions,
+ * components, component type, and all tags. */
+inline Hash hashDescription(const ArrayDescription& desc)
+{
+    std::vector<unsigned char> bytes;
+    bytes.push_back(desc.componentType());
+    HashDetail::appendUInt64(bytes, desc.componentCount());
+    HashDetail::appendUInt64(bytes, desc.dimensionCount());
+    for (size_t d = 0; d < desc.dimensionCount(); d++)
+        HashDetail::appendUInt64(bytes, desc.dimension(d));
+    HashDetail::appendTagList(bytes, desc.globalTagList());
+    for (size_t c = 0; c < desc.componentCount(); c++)
+        HashDetail::appendTagList(bytes, desc.componentTagList(c));
+    for (size_t d = 0; d < desc.dimensionCount(); d++)
+        HashDetail::appendTagList(bytes, desc.dimensionTagList(d));
+    return hashData(bytes.data(), bytes.size());
+}
+
+/*! \brief Returns a content hash of \a array that covers both its
+ * description and its data. See hashData() for \a threadCount. */
+inline Hash hashArray(const ArrayContainer& array, unsigned int threadCount = 0)
+{
+    Hash d = hashDescription(array);
+    Hash h = hashData(array.data(), array.dataSize(), threadCount);
+    std::vector<unsigned char> bytes;
+    HashDetail::appendUInt64(bytes, d.low);
+    HashDetail::appendUInt64(bytes, d.high);
+    HashDetail::appendUInt64(bytes, h.low);
+    HashDetail::appendUInt64(bytes, h.high);
+    return HashDetail::hashBlock(bytes.data(), bytes.size());
+}
+
+}
+
+#endif
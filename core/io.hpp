@@ -33,6 +33,7 @@
 #include <cerrno>
 #include <cstring>
 #include <memory>
+#include <vector>
 
 #include "array.hpp"
 
@@ -63,7 +64,61 @@ enum Error {
 /*! \brief Convert an input/output error to human-readable string */
 const char* strerror(Error e);
 
+/*! \brief Load the implementation of the file format \a format (a file name
+ * extension such as png, or a library name such as gdal) in advance, including
+ * its plugin and the initialization of the underlying library. Plugins stay
+ * loaded, so this helps long-running processes such as servers that fork
+ * workers. Returns false if the format is not available. */
+bool preloadFormat(const std::string& format);
+
 /*! \cond */
+// Helpers for boxes inside arrays. A box is given as index and size in each dimension,
+// e.g. X,Y,WIDTH,HEIGHT for 2D.
+inline bool boxIsInside(const std::vector<size_t>& box, const ArrayDescription& desc)
+{
+    if (desc.dimensionCount() == 0 || box.size() != 2 * desc.dimensionCount())
+        return false;
+    for (size_t d = 0; d < desc.dimensionCount(); d++) {
+        size_t index = box[d];
+        size_t size = box[desc.dimensionCount() + d];
+        if (size == 0 || index >= desc.dimension(d) || size > desc.dimension(d) - index)
+            return false;
+    }
+    return true;
+}
+
+inline ArrayDescription boxDescription(const std::vector<size_t>& box, const ArrayDescription& desc)
+{
+    ArrayDescription r(std::vector<size_t>(box.begin() + desc.dimensionCount(), box.end()),
+            desc.componentCount(), desc.componentType());
+    r.globalTagList() = desc.globalTagList();
+    for (size_t d = 0; d < r.dimensionCount(); d++)
+        r.dimensionTagList(d) = desc.dimensionTagList(d);
+    for (size_t c = 0; c < r.componentCount(); c++)
+        r.componentTagList(c) = desc.componentTagList(c);
+    return r;
+}
+
+// Call f(e) for each row of the box along dimension 0, in the order in which they
+// are stored in the box array. e is the linear index of the first element of
+// the row in the array described by desc.
+template<typename F> inline void forEachBoxRow(const std::vector<size_t>& box, const ArrayDescription& desc, F f)
+{
+    size_t n = desc.dimensionCount();
+    std::vector<size_t> index(box.begin(), box.begin() + n);
+    for (;;) {
+        f(desc.toLinearIndex(index));
+        size_t d = 1;
+        while (d < n && index[d] == box[d] + box[n + d] - 1) {
+            index[d] = box[d];
+            d++;
+        }
+        if (d >= n)
+            break;
+        index[d]++;
+    }
+}
+
 // This is the interface that file format converters must implement
 class FormatImportExport {
 public:
@@ -78,9 +133,58 @@ public:
     virtual int arrayCount() = 0;
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) = 0;
     virtual bool hasMore() = 0;
+    // Like readArray(), but only read the description of the array (including its tags) and skip the data.
+    // Converters should override this if they can get the information from file headers alone.
+    virtual ArrayDescription readDescription(Error* error, int arrayIndex = -1 /* -1 means next */)
+    {
+        return readArray(error, arrayIndex);
+    }
+    // Read boxes of an array (see boxIsInside()). Converters should override this if they can read
+    // parts of their data directly; the default reads the whole array and copies the boxes from it.
+    virtual std::vector<ArrayContainer> readBoxes(Error* error, const std::vector<std::vector<size_t>>& boxes,
+            int arrayIndex = -1 /* -1 means next */)
+    {
+        std::vector<ArrayContainer> r;
+        ArrayContainer array = readArray(error, arrayIndex);
+        if (*error != ErrorNone)
+            return r;
+        for (size_t i = 0; i < boxes.size(); i++) {
+            if (!boxIsInside(boxes[i], array)) {
+                *error = ErrorInvalidData;
+                return std::vector<ArrayContainer>();
+            }
+            r.emplace_back(boxDescription(boxes[i], array));
+            unsigned char* dst = static_cast<unsigned char*>(r.back().data());
+            size_t rowSize = boxes[i][array.dimensionCount()] * array.elementSize();
+            forEachBoxRow(boxes[i], array, [&] (size_t e) {
+                    std::memcpy(dst, array.get(e), rowSize);
+                    dst += rowSize;
+                    });
+        }
+        return r;
+    }
 
     // for writing / appending: (it is guaranteed that the file is opened for writing when one of these is called)
     virtual Error writeArray(const ArrayContainer& array) = 0;
+    // Write the array description and return an array whose data is mapped into the file.
+    // Converters should override this if they store uncompressed data.
+    virtual ArrayContainer mapArray(Error* error, const ArrayDescription& /* desc */)
+    {
+        *error = ErrorFeaturesUnsupported;
+        return ArrayContainer();
+    }
+    // Write a box into an array that already exists in the file (see boxIsInside()).
+    // Converters should override this if they store uncompressed data.
+    virtual Error writeBox(const ArrayContainer& /* box */, const std::vector<size_t>& /* index */, int /* arrayIndex */)
+    {
+        return ErrorFeaturesUnsupported;
+    }
+    // Finish writing and report errors that only show up at the end, e.g. from flushing an encoder.
+    // This is called before close(); converters should override this if they defer work.
+    virtual Error finish()
+    {
+        return ErrorNone;
+    }
 };
 /*! \endcond */
 
@@ -103,6 +207,12 @@ public:
      *
      * The file name is required.
      * The special file name "-" is interpreted as standard input.
+     * File names of the form shm:/name refer to POSIX shared memory objects; arrays read from
+     * them share memory with the object instead of being copied.
+     * File names of the form seq:SPEC refer to a sequence of files that is read like a single
+     * file with one array per file, e.g. seq:frame_%06d.png, seq:frame_*.png, or seq:@list.txt.
+     * File names of the form stack:SPEC refer to the same kind of file list, read as a single
+     * array with one additional dimension, e.g. a 3D volume from 2D slices.
      * The optional \a hints may be useful depending on the file format.
      * For example, raw files contain no information about array dimension or type,
      * so the hints must contain the tags COMPONENTS and TYPE as well as SIZE (for 1D arrays),
@@ -144,6 +254,26 @@ public:
      */
     ArrayContainer readArray(Error* error = nullptr, int arrayIndex = -1 /* -1 means next */);
 
+    /*! \brief Read only the description of an array from the file, i.e. its dimensions, components,
+     * type and tags, and return it. On error, the error code will be set (if \a error is not nullptr)
+     * and an empty description will be returned.
+     *
+     * This works like \a readArray() and advances to the next array in the same way, but for most
+     * file formats it only needs to read file headers instead of decoding the data.
+     */
+    ArrayDescription readDescription(Error* error = nullptr, int arrayIndex = -1 /* -1 means next */);
+
+    /*! \brief Read boxes of an array from the file and return them as separate arrays. Each box is given
+     * as index and size in each dimension, e.g. X,Y,WIDTH,HEIGHT for 2D, and must lie inside the array.
+     * On error, the error code will be set (if \a error is not nullptr) and an empty list will be returned.
+     *
+     * This advances to the next array in the same way as \a readArray(). For some file formats (currently
+     * tgd and raw), only the data inside the boxes is read, and all reads for all boxes are issued at once.
+     * This is useful if you need many small parts of large arrays, e.g. for tile servers.
+     */
+    std::vector<ArrayContainer> readBoxes(const std::vector<std::vector<size_t>>& boxes,
+            Error* error = nullptr, int arrayIndex = -1 /* -1 means next */);
+
     /*! \brief Returns whether there are more arrays in the file, i.e. whether you can read the next array
      * with \a readArray(). This information is always available, for all file formats and also for streams.
      * If (and only if) this function returns false, then it sets the error code. */
@@ -165,12 +295,15 @@ private:
     std::shared_ptr<FormatImportExport> _fie;
     bool _fileIsOpened;
 
+    Error ensureFileIsOpenedForWriting();
+
 public:
     /*! \brief Constructor. This must be initialized with \a initialize(). */
     Exporter();
 
     /*! \brief Constructor. The file name is required.
      * The special file name "-" is interpreted as standard output.
+     * File names of the form shm:/name refer to POSIX shared memory objects, see \a mapArray().
      * If the \a append flag is set, new arrays
      * will be appended to the file (if the file format supports it) instead of overwriting the
      * old file contents. The optional \a hints may include parameters for the file format,
@@ -196,6 +329,48 @@ public:
 
     /*! \brief Writes the \a array to the file. */
     Error writeArray(const ArrayContainer& array);
+
+    /*! \brief Adds an array with the description \a desc to the file and returns an array
+     * container whose data is a writable memory map of the array data in the file. Data written to
+     * the array goes directly to the file, without the need to hold the complete array in memory
+     * and without the copy made by \a writeArray(). The file is extended to its final size
+     * immediately; the new array data is initialized with zeroes. Since the file system may
+     * allocate space lazily, running out of disk space while writing to the array results in a
+     * SIGBUS signal.
+     *
+     * The mapping stays valid as long as the returned array container (or a copy) exists. The exporter
+     * flushes the mapped data to the file when it is destroyed, so the array should be complete by then.
+     *
+     * This is currently supported for the tgd, raw and shm formats, and not for standard output. For
+     * other formats, the error code is set to ErrorFeaturesUnsupported. On error, an empty array
+     * is returned.
+     */
+    ArrayContainer mapArray(const ArrayDescription& desc, Error* error = nullptr);
+
+    /*! \brief Adds a zero-filled array with the description \a desc to the file. This uses
+     * \a mapArray() if possible, so that large arrays are neither held in memory nor written
+     * byte by byte. */
+    Error createArray(const ArrayDescription& desc);
+
+    /*! \brief Writes the array \a box into the existing array with index \a arrayIndex in the
+     * file, with the first element of \a box at the element \a index. Dimensions, components and
+     * type of \a box must match those of the array in the file.
+     *
+     * This allows independent processes to compute one large array together: one process
+     * creates the file, e.g. with \a createArray(), and each process then writes its part with its
+     * own exporter. Parts that are disjoint can be written at the same time without locking.
+     * Note that the exporter must be created with the \a Append flag to write into existing files,
+     * since otherwise the file is truncated.
+     *
+     * This is currently supported for the tgd, raw and zarr formats. For raw, the array dimensions,
+     * components and type must be given in the hints, as for reading.
+     */
+    Error writeBox(const ArrayContainer& box, const std::vector<size_t>& index, int arrayIndex = 0);
+
+    /*! \brief Finishes writing and closes the file. Some formats, e.g. video formats, only
+     * complete their output at this point, and errors that happen here are returned. The destructor
+     * finishes and closes the file, too, but cannot report such errors. */
+    Error finish();
 };
 
 /*! \brief Shortcut to read a single array from a file in a single line of code. */
@@ -207,7 +382,10 @@ inline ArrayContainer load(const std::string& fileName, const TagList& hints = T
 /*! \brief Shortcut to write a single array to a file in a single line of code. */
 inline bool save(const ArrayContainer& A, const std::string& fileName, bool append = Overwrite, Error* error = nullptr, const TagList& hints = TagList())
 {
-    Error e = Exporter(fileName, append, hints).writeArray(A);
+    Exporter exporter(fileName, append, hints);
+    Error e = exporter.writeArray(A);
+    if (e == ErrorNone)
+        e = exporter.finish();
     if (error)
         *error = e;
     return (e == ErrorNone);
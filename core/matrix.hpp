@@ -0,0 +1,358 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TGD_MATRIX_HPP
+#define TGD_MATRIX_HPP
+
+/**
+ * \file matrix.hpp
+ * \brief Matrix transformations of element components.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
+
+#include "array.hpp"
+#include "parallel.hpp"
+
+namespace TGD {
+
+/*! \cond */
+namespace MatrixDetail {
+
+/* Elements are processed in blocks: the components of a block are first
+ * converted to a structure of arrays in the computation type C (float or
+ * double), then transformed, then converted to the result type. The
+ * transformation always processes whole blocks (the tail of the last block
+ * is ignored later) and loops over the elements of a block, so it
+ * vectorizes well, especially when the matrix size is known at compile
+ * time. */
+static const size_t blockSize = 256;
+
+/* Component counts 1 to 4 are known at compile time (K > 0). */
+template<size_t K, typename C, typename T> inline void load(const T* src, size_t n, size_t components, C* soa)
+{
+    if (K > 0)
+        components = K;
+    for (size_t j = 0; j < components; j++)
+        for (size_t e = 0; e < n; e++)
+            soa[j * blockSize + e] = src[e * components + j];
+}
+
+template<typename T, typename C> inline T saturate(C v)
+{
+    const C lo = std::numeric_limits<T>::min();
+    const C hi = std::numeric_limits<T>::max();
+    v += (v < C(0) ? C(-0.5) : C(0.5));
+    if (sizeof(T) == 8) {
+        // hi is not representable, so compare before converting
+        return (!(v > lo) ? std::numeric_limits<T>::min() : v >= hi ? std::numeric_limits<T>::max() : T(v));
+    } else {
+        // branch-free so that it vectorizes; NaN becomes lo
+        v = (v > lo ? v : lo);
+        v = (v < hi ? v : hi);
+        return T(v);
+    }
+}
+
+template<size_t K, typename T, typename C> inline void store(const C* soa, size_t n, size_t components, T* dst)
+{
+    if (K > 0)
+        components = K;
+    for (size_t j = 0; j < components; j++) {
+        for (size_t e = 0; e < n; e++) {
+            C v = soa[j * blockSize + e];
+            dst[e * components + j] = (std::is_floating_point<T>::value ? T(v) : saturate<T>(v));
+        }
+    }
+}
+
+/* Compute out = M * in + b for a whole block, with the output following the
+ * input in one buffer. The rows M and columns N of the linear part are known
+ * at compile time. The matrix is copied to local variables and the result
+ * is accumulated in a local array, so that the compiler can see that nothing
+ * aliases and vectorize the loops over the elements. */
+template<typename C, size_t M, size_t N> inline void kernel(C* buf,
+        const C* matrix, const C* offset, size_t, size_t)
+{
+    C m[M][N];
+    C b[M];
+    for (size_t i = 0; i < M; i++) {
+        for (size_t j = 0; j < N; j++)
+            m[i][j] = matrix[i * N + j];
+        b[i] = offset[i];
+    }
+    C o[blockSize];
+    for (size_t i = 0; i < M; i++) {
+        for (size_t e = 0; e < blockSize; e++)
+            o[e] = b[i];
+        for (size_t j = 0; j < N; j++) {
+            const C* s = buf + j * blockSize;
+            C mij = m[i][j];
+            for (size_t e = 0; e < blockSize; e++)
+                o[e] += mij * s[e];
+        }
+        std::memcpy(buf + (N + i) * blockSize, o, sizeof(o));
+    }
+}
+
+/* The same for other matrix sizes */
+template<typename C> inline void kernelGeneric(C* buf,
+        const C* matrix, const C* offset, size_t rows, size_t columns)
+{
+    for (size_t i = 0; i < rows; i++) {
+        C* o = buf + (columns + i) * blockSize;
+        for (size_t e = 0; e < blockSize; e++)
+            o[e] = offset[i];
+        for (size_t j = 0; j < columns; j++) {
+            const C* s = buf + j * blockSize;
+            C m = matrix[i * columns + j];
+            for (size_t e = 0; e < blockSize; e++)
+                o[e] += m * s[e];
+        }
+    }
+}
+
+template<typename C>
+using Kernel = void (*)(C*, const C*, const C*, size_t, size_t);
+
+template<typename C, typename T>
+using Load = void (*)(const T*, size_t, size_t, C*);
+
+template<typename T, typename C>
+using Store = void (*)(const C*, size_t, size_t, T*);
+
+template<typename C, typename T> inline Load<C, T> selectLoad(size_t components)
+{
+    switch (components) {
+    case 1:
+        return load<1, C, T>;
+    case 2:
+        return load<2, C, T>;
+    case 3:
+        return load<3, C, T>;
+    case 4:
+        return load<4, C, T>;
+    default:
+        return load<0, C, T>;
+    }
+}
+
+template<typename T, typename C> inline Store<T, C> selectStore(size_t components)
+{
+    switch (components) {
+    case 1:
+        return store<1, T, C>;
+    case 2:
+        return store<2, T, C>;
+    case 3:
+        return store<3, T, C>;
+    case 4:
+        return store<4, T, C>;
+    default:
+        return store<0, T, C>;
+    }
+}
+
+template<typename C> inline Kernel<C> selectKernel(size_t rows, size_t columns)
+{
+    if (rows == 3 && columns == 3)
+        return kernel<C, 3, 3>;
+    else if (rows == 4 && columns == 4)
+        return kernel<C, 4, 4>;
+    else if (rows == 3 && columns == 4)
+        return kernel<C, 3, 4>;
+    else if (rows == 4 && columns == 3)
+        return kernel<C, 4, 3>;
+    else
+        return kernelGeneric<C>;
+}
+
+template<typename C, typename TI, typename TO> inline void transform(const TI* src, TO* dst, size_t elementCount,
+        const std::vector<C>& matrix, const std::vector<C>& offset, size_t rows, size_t columns,
+        unsigned int threadCount)
+{
+    Load<C, TI> l = selectLoad<C, TI>(columns);
+    Kernel<C> k = selectKernel<C>(rows, columns);
+    Store<TO, C> s = selectStore<TO, C>(rows);
+    const size_t chunk = 64 * blockSize;
+    parallelForChunks<std::vector<C>>((elementCount + chunk - 1) / chunk, threadCount,
+            [&] (size_t ch, std::vector<C>& buf) {
+        buf.resize((columns + rows) * blockSize);
+        C* in = buf.data();
+        C* out = in + columns * blockSize;
+        size_t end = std::min(elementCount, (ch + 1) * chunk);
+        for (size_t e = ch * chunk; e < end; e += blockSize) {
+            size_t n = std::min(blockSize, end - e);
+            l(src + e * columns, n, columns, in);
+            k(buf.data(), matrix.data(), offset.data(), rows, columns);
+            s(out, n, rows, dst + e * rows);
+        }
+    });
+}
+
+template<typename C, typename TI> inline void transform(const TI* src, ArrayContainer& r,
+        const std::vector<C>& matrix, const std::vector<C>& offset, size_t rows, size_t columns,
+        unsigned int threadCount)
+{
+    size_t n = r.elementCount();
+    void* dst = r.data();
+    switch (r.componentType()) {
+    case int8:
+        transform(src, static_cast<int8_t*>(dst), n, matrix, offset, rows, columns, threadCount);
+        break;
+    case uint8:
+        transform(src, static_cast<uint8_t*>(dst), n, matrix, offset, rows, columns, threadCount);
+        break;
+    case int16:
+        transform(src, static_cast<int16_t*>(dst), n, matrix, offset, rows, columns, threadCount);
+        break;
+    case uint16:
+        transform(src, static_cast<uint16_t*>(dst), n, matrix, offset, rows, columns, threadCount);
+        break;
+    case int32:
+        transform(src, static_cast<int32_t*>(dst), n, matrix, offset, rows, columns, threadCount);
+        break;
+    case uint32:
+        transform(src, static_cast<uint32_t*>(dst), n, matrix, offset, rows, columns, threadCount);
+        break;
+    case int64:
+        transform(src, static_cast<int64_t*>(dst), n, matrix, offset, rows, columns, threadCount);
+        break;
+    case uint64:
+        transform(src, static_cast<uint64_t*>(dst), n, matrix, offset, rows, columns, threadCount);
+        break;
+    case float32:
+        transform(src, static_cast<float*>(dst), n, matrix, offset, rows, columns, threadCount);
+        break;
+    case float64:
+        transform(src, static_cast<double*>(dst), n, matrix, offset, rows, columns, threadCount);
+        break;
+    }
+}
+
+template<typename C> inline void transform(const ArrayContainer& a, ArrayContainer& r,
+        const std::vector<double>& matrix, size_t rows, unsigned int threadCount)
+{
+    size_t columns = a.componentCount();
+    bool affine = (matrix.size() == rows * (columns + 1));
+    std::vector<C> linear(rows * columns);
+    std::vector<C> offset(rows, C(0));
+    for (size_t i = 0; i < rows; i++) {
+        for (size_t j = 0; j < columns; j++)
+            linear[i * columns + j] = matrix[i * (columns + (affine ? 1 : 0)) + j];
+        if (affine)
+            offset[i] = matrix[i * (columns + 1) + columns];
+    }
+    const void* src = a.data();
+    switch (a.componentType()) {
+    case int8:
+        transform(static_cast<const int8_t*>(src), r, linear, offset, rows, columns, threadCount);
+        break;
+    case uint8:
+        transform(static_cast<const uint8_t*>(src), r, linear, offset, rows, columns, threadCount);
+        break;
+    case int16:
+        transform(static_cast<const int16_t*>(src), r, linear, offset, rows, columns, threadCount);
+        break;
+    case uint16:
+        transform(static_cast<const uint16_t*>(src), r, linear, offset, rows, columns, threadCount);
+        break;
+    case int32:
+        transform(static_cast<const int32_t*>(src), r, linear, offset, rows, columns, threadCount);
+        break;
+    case uint32:
+        transform(static_cast<const uint32_t*>(src), r, linear, offset, rows, columns, threadCount);
+        break;
+    case int64:
+        transform(static_cast<const int64_t*>(src), r, linear, offset, rows, columns, threadCount);
+        break;
+    case uint64:
+        transform(static_cast<const uint64_t*>(src), r, linear, offset, rows, columns, threadCount);
+        break;
+    case float32:
+        transform(static_cast<const float*>(src), r, linear, offset, rows, columns, threadCount);
+        break;
+    case float64:
+        transform(static_cast<const double*>(src), r, linear, offset, rows, columns, threadCount);
+        break;
+    }
+}
+
+/* Single precision is exact enough if no type has more than 24 bits of
+ * precision. */
+inline bool isSinglePrecisionType(Type t)
+{
+    return t == int8 || t == uint8 || t == int16 || t == uint16 || t == float32;
+}
+
+}
+/*! \endcond */
+
+/*! \brief Transforms the components of each element of \a array with a
+ * matrix and returns the result with component type \a resultType.
+ *
+ * The \a matrix has \a rows rows, stored row by row, and either N or N+1
+ * columns, where N is the component count of \a array. With N+1 columns,
+ * the last column is an offset, so that an affine transformation is
+ * computed. The result has \a rows components: component i of each element
+ * is the dot product of row i with the components of the input element
+ * (plus offset i).
+ *
+ * The computation is done in single precision if both component types allow
+ * that without loss, and in double precision otherwise. Values are rounded
+ * and clamped to the range of integer result types. The elements are
+ * processed by \a threadCount threads (0 means one thread per core).
+ * Matrix sizes 3x3, 4x4, 3x4 and 4x3 are handled by kernels that are
+ * specialized at compile time.
+ *
+ * Component tags are not copied since the meaning of the components changes. */
+inline ArrayContainer transformComponents(const ArrayContainer& array,
+        const std::vector<double>& matrix, size_t rows, Type resultType,
+        unsigned int threadCount = 0)
+{
+    assert(rows > 0);
+    assert(matrix.size() == rows * array.componentCount()
+            || matrix.size() == rows * (array.componentCount() + 1));
+    ArrayContainer r(array.dimensions(), rows, resultType);
+    r.globalTagList() = array.globalTagList();
+    for (size_t i = 0; i < array.dimensionCount(); i++)
+        r.dimensionTagList(i) = array.dimensionTagList(i);
+    if (MatrixDetail::isSinglePrecisionType(array.componentType())
+            && MatrixDetail::isSinglePrecisionType(resultType)) {
+        MatrixDetail::transform<float>(array, r, matrix, rows, threadCount);
+    } else {
+        MatrixDetail::transform<double>(array, r, matrix, rows, threadCount);
+    }
+    return r;
+}
+
+}
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TGD_PARALLEL_HPP
+#define TGD_PARALLEL_HPP
+
+/**
+ * \file parallel.hpp
+ * \brief Simple parallelization of chunked work.
+ */
+
+#include <cstddef>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+namespace TGD {
+
+/*! \brief Calls \a f(i, state) for each chunk index \a i in [0, \a chunkCount)
+ * with up to \a threadCount threads (0 means one per processor core). Chunks
+ * are handed out in order to whichever thread is free, the calling thread
+ * takes part in the work, and each thread has its own default-constructed
+ * \a state of type \a State, e.g. a reusable buffer. */
+template<typename State, typename F> inline void parallelForChunks(size_t chunkCount, unsigned int threadCount, F f)
+{
+    std::atomic<size_t> nextChunk(0);
+    auto work = [&] () {
+        State state;
+        for (;;) {
+            size_t i = nextChunk++;
+            if (i >= chunkCount)
+                break;
+            f(i, state);
+        }
+    };
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(size_t(threadCount), std::max(size_t(1), chunkCount));
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < threadCount; i++)
+        threads.push_back(std::thread(work));
+    work();
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+}
+
+/*! \brief Calls \a f(i) for each chunk index \a i in [0, \a chunkCount) with
+ * up to \a threadCount threads (0 means one per processor core). */
+template<typename F> inline void parallelForChunks(size_t chunkCount, unsigned int threadCount, F f)
+{
+    struct NoState {};
+    parallelForChunks<NoState>(chunkCount, threadCount, [&] (size_t i, NoState&) { f(i); });
+}
+
+}
+
+#endif
@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TGD_RANDOM_HPP
+#define TGD_RANDOM_HPP
+
+/**
+ * \file random.hpp
+ * \brief Reproducible random numbers.
+ */
+
+#include <cstdint>
+#include <cmath>
+#include <array>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
+
+#include "array.hpp"
+#include "parallel.hpp"
+
+namespace TGD {
+
+/*! \cond */
+namespace RandomDetail {
+
+static const uint32_t philoxM0 = 0xD2511F53;
+static const uint32_t philoxM1 = 0xCD9E8D57;
+static const uint32_t philoxW0 = 0x9E3779B9;
+static const uint32_t philoxW1 = 0xBB67AE85;
+
+/* Philox4x32-10 for N counters at once. The counters are stored as
+ * structure of arrays so that the compiler can vectorize the rounds. */
+template<size_t N> inline void philox(uint32_t c[4][N], uint64_t key)
+{
+    uint32_t k0 = key;
+    uint32_t k1 = key >> 32;
+    for (int r = 0; r < 10; r++) {
+        for (size_t j = 0; j < N; j++) {
+            uint64_t p0 = uint64_t(philoxM0) * c[0][j];
+            uint64_t p1 = uint64_t(philoxM1) * c[2][j];
+            uint32_t n0 = uint32_t(p1 >> 32) ^ c[1][j] ^ k0;
+            uint32_t n2 = uint32_t(p0 >> 32) ^ c[3][j] ^ k1;
+            c[1][j] = uint32_t(p1);
+            c[3][j] = uint32_t(p0);
+            c[0][j] = n0;
+            c[2][j] = n2;
+        }
+        k0 += philoxW0;
+        k1 += philoxW1;
+    }
+}
+
+inline double toUniform(uint32_t hi, uint32_t lo)
+{
+    return ((uint64_t(hi) << 32 | lo) >> 11) * 0x1p-53;
+}
+
+inline float toUniformFloat(uint32_t w)
+{
+    return (w >> 8) * 0x1p-24f;
+}
+
+/* Box-Muller: two uniform values give two independent normal values. The
+ * first uniform value must not be zero. */
+inline void toGaussian(uint32_t w0, uint32_t w1, uint32_t w2, uint32_t w3, double* g)
+{
+    double u0 = (((uint64_t(w0) << 32 | w1) >> 11) + 1) * 0x1p-53;
+    double r = std::sqrt(-2.0 * std::log(u0));
+    double t = 2.0 * 3.14159265358979323846 * toUniform(w2, w3);
+    g[0] = r * std::cos(t);
+    g[1] = r * std::sin(t);
+}
+
+inline void toGaussianFloat(uint32_t w0, uint32_t w1, float* g)
+{
+    float u0 = ((w0 >> 8) + 1) * 0x1p-24f;
+    float r = std::sqrt(-2.0f * std::log(u0));
+    float t = 2.0f * 3.14159265f * toUniformFloat(w1);
+    g[0] = r * std::cos(t);
+    g[1] = r * std::sin(t);
+}
+
+/* Map a standard normal value to an integer type: the mean is at the center
+ * of the value range of unsigned types and at zero for signed types, and
+ * three standard deviations span half of the range. */
+template<typename T> inline T gaussianToInteger(double g)
+{
+    double x;
+    if (std::is_signed<T>::value)
+        x = g / 3.0 * std::numeric_limits<T>::max();
+    else
+        x = (0.5 + g / 6.0) * std::numeric_limits<T>::max();
+    x = std::round(x);
+    if (x <= double(std::numeric_limits<T>::min()))
+        return std::numeric_limits<T>::min();
+    else if (x >= double(std::numeric_limits<T>::max()))
+        return std::numeric_limits<T>::max();
+    else
+        return x;
+}
+
+/* Each counter gives valuesPerCounter() values of type T, from its four
+ * 32 bit random words: 32 bit types use one word per value, 64 bit types
+ * and Gaussian integers (which are computed via double) use two. */
+template<typename T> inline size_t valuesPerCounter(bool gaussian)
+{
+    return (sizeof(T) == 8 || (gaussian && !std::is_floating_point<T>::value)) ? 2 : 4;
+}
+
+template<typename T> inline void toValues(const uint32_t w[4], bool gaussian, T* v)
+{
+    if (std::is_same<T, float>::value) {
+        float f[4];
+        if (gaussian) {
+            toGaussianFloat(w[0], w[1], f);
+            toGaussianFloat(w[2], w[3], f + 2);
+        } else {
+            for (int i = 0; i < 4; i++)
+                f[i] = toUniformFloat(w[i]);
+        }
+        for (int i = 0; i < 4; i++)
+            v[i] = f[i];
+    } else if (std::is_same<T, double>::value) {
+        double d[2];
+        if (gaussian) {
+            toGaussian(w[0], w[1], w[2], w[3], d);
+        } else {
+            d[0] = toUniform(w[0], w[1]);
+            d[1] = toUniform(w[2], w[3]);
+        }
+        v[0] = d[0];
+        v[1] = d[1];
+    } else if (gaussian) {
+        double d[2];
+        toGaussian(w[0], w[1], w[2], w[3], d);
+        v[0] = gaussianToInteger<T>(d[0]);
+        v[1] = gaussianToInteger<T>(d[1]);
+    } else if (sizeof(T) == 8) {
+        v[0] = T(uint64_t(w[0]) << 32 | w[1]);
+        v[1] = T(uint64_t(w[2]) << 32 | w[3]);
+    } else {
+        for (int i = 0; i < 4; i++)
+            v[i] = T(w[i]);
+    }
+}
+
+template<typename T> inline void fill(T* data, size_t n, uint64_t seed, uint64_t stream,
+        bool gaussian, unsigned int threadCount)
+{
+    const size_t batch = 16;
+    const size_t k = valuesPerCounter<T>(gaussian);
+    const size_t chunk = size_t(1) << 16; // values; a multiple of batch * k
+    parallelForChunks((n + chunk - 1) / chunk, threadCount, [&] (size_t ch) {
+        uint32_t c[4][batch];
+        size_t end = std::min(n, (ch + 1) * chunk);
+        for (size_t i = ch * chunk; i < end; i += batch * k) {
+            for (size_t j = 0; j < batch; j++) {
+                uint64_t counter = i / k + j;
+                c[0][j] = counter;
+                c[1][j] = counter >> 32;
+                c[2][j] = stream;
+                c[3][j] = stream >> 32;
+            }
+            philox<batch>(c, seed);
+            for (size_t j = 0; j < batch && i + j * k < end; j++) {
+                const uint32_t w[4] = { c[0][j], c[1][j], c[2][j], c[3][j] };
+                T v[4] = {};
+                toValues<T>(w, gaussian, v);
+                for (size_t l = 0; l < k && i + j * k + l < end; l++)
+                    data[i + j * k + l] = v[l];
+            }
+        }
+    });
+}
+
+inline void fill(ArrayContainer& array, uint64_t seed, uint64_t stream,
+        bool gaussian, unsigned int threadCount)
+{
+    size_t n = array.elementCount() * array.componentCount();
+    switch (array.componentType()) {
+    case int8:
+        fill(static_cast<int8_t*>(array.data()), n, seed, stream, gaussian, threadCount);
+        break;
+    case uint8:
+        fill(static_cast<uint8_t*>(array.data()), n, seed, stream, gaussian, threadCount);
+        break;
+    case int16:
+        fill(static_cast<int16_t*>(array.data()), n, seed, stream, gaussian, threadCount);
+        break;
+    case uint16:
+        fill(static_cast<uint16_t*>(array.data()), n, seed, stream, gaussian, threadCount);
+        break;
+    case int32:
+        fill(static_cast<int32_t*>(array.data()), n, seed, stream, gaussian, threadCount);
+        break;
+    case uint32:
+        fill(static_cast<uint32_t*>(array.data()), n, seed, stream, gaussian, threadCount);
+        break;
+    case int64:
+        fill(static_cast<int64_t*>(array.data()), n, seed, stream, gaussian, threadCount);
+        break;
+    case uint64:
+        fill(static_cast<uint64_t*>(array.data()), n, seed, stream, gaussian, threadCount);
+        break;
+    case float32:
+        fill(static_cast<float*>(array.data()), n, seed, stream, gaussian, threadCount);
+        break;
+    case float64:
+        fill(static_cast<double*>(array.data()), n, seed, stream, gaussian, threadCount);
+        break;
+    }
+}
+
+}
+/*! \endcond */
+
+/*! \brief Philox4x32-10 counter-based random number generator: returns four
+ * random 32 bit values for \a counter and \a key.
+ *
+ * The same counter and key always give the same values, and different
+ * counters give independent values, so random numbers can be computed in
+ * any order and in parallel. */
+inline std::array<uint32_t, 4> philox4x32(const std::array<uint32_t, 4>& counter, uint64_t key)
+{
+    uint32_t c[4][1] = { { counter[0] }, { counter[1] }, { counter[2] }, { counter[3] } };
+    RandomDetail::philox<1>(c, key);
+    return { c[0][0], c[1][0], c[2][0], c[3][0] };
+}
+
+/*! \brief Returns a uniformly distributed random value in [0,1) for value
+ * \a index of stream \a stream with the given \a seed. This is the same
+ * value that fillUniform() computes for a float64 array. */
+inline double randomUniform(uint64_t seed, uint64_t stream, uint64_t index)
+{
+    uint64_t counter = index / 2;
+    std::array<uint32_t, 4> w = philox4x32({ uint32_t(counter), uint32_t(counter >> 32),
+            uint32_t(stream), uint32_t(stream >> 32) }, seed);
+    return RandomDetail::toUniform(w[2 * (index % 2)], w[2 * (index % 2) + 1]);
+}
+
+/*! \brief Returns a normally distributed random value with mean 0 and
+ * standard deviation 1 for value \a index of stream \a stream with the
+ * given \a seed. This is the same value that fillGaussian() computes for a
+ * float64 array. */
+inline double randomGaussian(uint64_t seed, uint64_t stream, uint64_t index)
+{
+    uint64_t counter = index / 2;
+    std::array<uint32_t, 4> w = philox4x32({ uint32_t(counter), uint32_t(counter >> 32),
+            uint32_t(stream), uint32_t(stream >> 32) }, seed);
+    double g[2];
+    RandomDetail::toGaussian(w[0], w[1], w[2], w[3], g);
+    return g[index % 2];
+}
+
+/*! \brief Fills \a array with uniformly distributed random values.
+ *
+ * Floating point values are in [0,1), integer values cover the full range of
+ * the type. The component values are numbered in storage order, and each
+ * value only depends on \a seed, \a stream, and its number, so the result is
+ * the same for every \a threadCount (0 means one thread per core). Use
+ * different streams for different arrays with the same seed. */
+inline void fillUniform(ArrayContainer& array, uint64_t seed, uint64_t stream = 0, unsigned int threadCount = 0)
+{
+    RandomDetail::fill(array, seed, stream, false, threadCount);
+}
+
+/*! \brief Fills \a array with normally distributed random values.
+ *
+ * Floating point values have mean 0 and standard deviation 1. For integer
+ * types, the mean is at the center of the value range for unsigned types and
+ * at zero for signed types, three standard deviations span half of the
+ * value range, and values outside the range are clamped. See fillUniform()
+ * for the meaning of the other arguments. */
+inline void fillGaussian(ArrayContainer& array, uint64_t seed, uint64_t stream = 0, unsigned int threadCount = 0)
+{
+    RandomDetail::fill(array, seed, stream, true, threadCount);
+}
+
+}
+
+#endif
@@ -0,0 +1,403 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+#include <unistd.h>
+
+#ifdef TGD_WITH_IO_URING
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <sys/uio.h>
+# include <linux/io_uring.h>
+#endif
+
+#include "io-batchread.hpp"
+
+
+namespace TGD {
+
+// Upper limit for a single read; larger requests are split
+static const size_t maxReadSize = size_t(1) << 30;
+
+void BatchReader::addRequest(std::vector<Request>& requests, uint64_t offset, size_t size, void* data)
+{
+    if (requests.size() > 0) {
+        Request& last = requests.back();
+        if (last.offset + last.size == offset
+                && static_cast<unsigned char*>(last.data) + last.size == data
+                && last.size + size <= maxReadSize) {
+            last.size += size;
+            return;
+        }
+    }
+    requests.push_back({ offset, size, data });
+}
+
+#ifdef TGD_WITH_IO_URING
+
+/* A minimal io_uring for reading, using the raw system calls so that we
+ * do not depend on liburing. */
+struct BatchReader::Ring
+{
+    int fd;
+    unsigned int entries;
+    void* sqPtr;
+    size_t sqSize;
+    void* cqPtr;
+    size_t cqSize;
+    struct io_uring_sqe* sqes;
+    size_t sqesSize;
+    unsigned int* sqHead;
+    unsigned int* sqTail;
+    unsigned int* sqMask;
+    unsigned int* sqArray;
+    unsigned int* cqHead;
+    unsigned int* cqTail;
+    unsigned int* cqMask;
+    struct io_uring_cqe* cqes;
+
+    Ring() : fd(-1), sqPtr(MAP_FAILED), cqPtr(MAP_FAILED), sqes(static_cast<struct io_uring_sqe*>(MAP_FAILED))
+    {
+    }
+
+    ~Ring()
+    {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqesSize);
+        if (cqPtr != MAP_FAILED && cqPtr != sqPtr)
+            munmap(cqPtr, cqSize);
+        if (sqPtr != MAP_FAILED)
+            munmap(sqPtr, sqSize);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool init(unsigned int requestedEntries)
+    {
+        struct io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        fd = syscall(__NR_io_uring_setup, requestedEntries, &p);
+        if (fd < 0)
+            return false;
+        entries = p.sq_entries;
+        sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+        cqSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        bool singleMmap = (p.features & IORING_FEAT_SINGLE_MMAP);
+        if (singleMmap)
+            sqSize = cqSize = std::max(sqSize, cqSize);
+        sqPtr = mmap(nullptr, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqPtr == MAP_FAILED)
+            return false;
+        if (singleMmap) {
+            cqPtr = sqPtr;
+        } else {
+            cqPtr = mmap(nullptr, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cqPtr == MAP_FAILED)
+                return false;
+        }
+        sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+        sqes = static_cast<struct io_uring_sqe*>(mmap(nullptr, sqesSize,
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED)
+            return false;
+        unsigned char* sq = static_cast<unsigned char*>(sqPtr);
+        unsigned char* cq = static_cast<unsigned char*>(cqPtr);
+        sqHead = reinterpret_cast<unsigned int*>(sq + p.sq_off.head);
+        sqTail = reinterpret_cast<unsigned int*>(sq + p.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned int*>(sq + p.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned int*>(sq + p.sq_off.array);
+        cqHead = reinterpret_cast<unsigned int*>(cq + p.cq_off.head);
+        cqTail = reinterpret_cast<unsigned int*>(cq + p.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned int*>(cq + p.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+        return true;
+    }
+};
+
+Error BatchReader::readWithRing(int fd, const std::vector<Request>& requests)
+{
+    Ring& ring = *_ring;
+    std::vector<struct iovec> iovecs(requests.size());
+    std::vector<size_t> done(requests.size(), 0);
+    std::vector<size_t> resubmit;      // requests with short reads
+    size_t next = 0;                   // next request to submit
+    size_t inFlight = 0;               // submitted to the kernel, not yet completed
+    unsigned int queued = 0;           // in the submission queue, not yet submitted
+    Error error = ErrorNone;
+    int errorErrno = 0;
+
+    // Reap completions; returns whether there were any
+    auto reap = [&] () -> bool {
+        unsigned int head = *ring.cqHead;
+        unsigned int tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+        bool reaped = (head != tail);
+        while (head != tail) {
+            const struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cqMask];
+            size_t r = cqe->user_data;
+            int res = cqe->res;
+            head++;
+            inFlight--;
+            if (res < 0) {
+                if (res == -EINTR || res == -EAGAIN) {
+                    resubmit.push_back(r);
+                } else if (error == ErrorNone) {
+                    error = ErrorSysErrno;
+                    errorErrno = -res;
+                }
+            } else if (res == 0) {
+                if (error == ErrorNone)
+                    error = ErrorInvalidData;
+            } else {
+                done[r] += res;
+                if (done[r] < requests[r].size)
+                    resubmit.push_back(r);
+            }
+        }
+        __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+        return reaped;
+    };
+
+    while (inFlight > 0 || queued > 0 || (error == ErrorNone && (next < requests.size() || !resubmit.empty()))) {
+        // Fill the submission queue
+        unsigned int tail = *ring.sqTail;
+        unsigned int head = __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE);
+        while (error == ErrorNone && (next < requests.size() || !resubmit.empty())
+                && inFlight + queued < ring.entries && tail - head < ring.entries) {
+            size_t r;
+            if (!resubmit.empty()) {
+                r = resubmit.back();
+                resubmit.pop_back();
+            } else {
+                r = next++;
+            }
+            iovecs[r].iov_base = static_cast<unsigned char*>(requests[r].data) + done[r];
+            iovecs[r].iov_len = std::min(requests[r].size - done[r], maxReadSize);
+            unsigned int index = tail & *ring.sqMask;
+            struct io_uring_sqe* sqe = &ring.sqes[index];
+            std::memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_READV;
+            sqe->fd = fd;
+            sqe->addr = reinterpret_cast<uint64_t>(&iovecs[r]);
+            sqe->len = 1;
+            sqe->off = requests[r].offset + done[r];
+            sqe->user_data = r;
+            ring.sqArray[index] = index;
+            tail++;
+            queued++;
+        }
+        __atomic_store_n(ring.sqTail, tail, __ATOMIC_RELEASE);
+
+        // Submit and wait for at least one completion
+        int ret = syscall(__NR_io_uring_enter, ring.fd, queued, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                continue;
+            // The ring is unusable, so give up on it.
+            _ringFailed = true;
+            if (inFlight == 0)
+                return readWithThreads(fd, requests);
+            // Requests that were submitted before still write into the
+            // buffers of the caller, so wait until all of them completed.
+            // The queued ones were not submitted; take them back.
+            int enterErrno = errno;
+            __atomic_store_n(ring.sqTail, tail - queued, __ATOMIC_RELEASE);
+            queued = 0;
+            while (inFlight > 0) {
+                if (!reap() && syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0
+                        && errno != EINTR) {
+                    usleep(1000);
+                }
+            }
+            errno = enterErrno;
+            return ErrorSysErrno;
+        }
+        queued -= ret;
+        inFlight += ret;
+
+        reap();
+    }
+    if (error == ErrorSysErrno)
+        errno = errorErrno;
+    return error;
+}
+
+#endif
+
+BatchReader::BatchReader(bool useRing) :
+#ifdef TGD_WITH_IO_URING
+    _ring(nullptr), _ringFailed(!useRing),
+#endif
+    _generation(0), _quit(false), _fd(-1), _requests(nullptr), _nextRequest(0), _busyThreads(0),
+    _error(ErrorNone), _errno(0)
+{
+#ifndef TGD_WITH_IO_URING
+    (void)useRing;
+#endif
+}
+
+BatchReader::~BatchReader()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+    _workCond.notify_all();
+    for (size_t i = 0; i < _threads.size(); i++)
+        _threads[i].join();
+#ifdef TGD_WITH_IO_URING
+    delete _ring;
+#endif
+}
+
+void BatchReader::work()
+{
+    for (;;) {
+        size_t r = _nextRequest++;
+        if (r >= _requests->size())
+            break;
+        const Request& request = (*_requests)[r];
+        unsigned char* data = static_cast<unsigned char*>(request.data);
+        size_t done = 0;
+        while (done < request.size) {
+            ssize_t ret = pread(_fd, data + done, std::min(request.size - done, maxReadSize), request.offset + done);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret <= 0) {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_error == ErrorNone) {
+                    _error = (ret < 0 ? ErrorSysErrno : ErrorInvalidData);
+                    _errno = errno;
+                }
+                // let the others stop early
+                _nextRequest = _requests->size();
+                return;
+            }
+            done += ret;
+        }
+    }
+}
+
+void BatchReader::worker()
+{
+    unsigned int generation = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _workCond.wait(lock, [&] { return _quit || _generation != generation; });
+            if (_quit)
+                return;
+            generation = _generation;
+        }
+        work();
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _busyThreads--;
+        }
+        _doneCond.notify_one();
+    }
+}
+
+Error BatchReader::readWithThreads(int fd, const std::vector<Request>& requests)
+{
+    if (_threads.size() == 0 && requests.size() > 1) {
+        // Reads are I/O bound, so use a few more threads than cores
+        size_t threadCount = std::min(std::max(2u, 2 * std::thread::hardware_concurrency()), 32u);
+        for (size_t i = 0; i < threadCount; i++)
+            _threads.push_back(std::thread(&BatchReader::worker, this));
+    }
+    // Only batches with more than one request are handed to the workers.
+    // Otherwise the generation must not change, since a worker that just
+    // finished the previous batch would then work on this one, too.
+    bool useWorkers = (requests.size() > 1);
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _fd = fd;
+        _requests = &requests;
+        _nextRequest = 0;
+        _error = ErrorNone;
+        if (useWorkers) {
+            _busyThreads = _threads.size();
+            _generation++;
+        }
+    }
+    if (useWorkers)
+        _workCond.notify_all();
+    work();
+    if (useWorkers) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _doneCond.wait(lock, [&] { return _busyThreads == 0; });
+    }
+    if (_error == ErrorSysErrno)
+        errno = _errno;
+    return _error;
+}
+
+Error BatchReader::read(int fd, const std::vector<Request>& requests)
+{
+    if (requests.size() == 0)
+        return ErrorNone;
+#ifdef TGD_WITH_IO_URING
+    if (!_ring && !_ringFailed) {
+        _ring = new Ring;
+        if (!_ring->init(256)) {
+            // e.g. old kernel or forbidden by seccomp
+            delete _ring;
+            _ring = nullptr;
+            _ringFailed = true;
+        }
+    }
+    if (_ring && !_ringFailed)
+        return readWithRing(fd, requests);
+#endif
+    return readWithThreads(fd, requests);
+}
+
+Error BatchReader::readBoxes(int fd, uint64_t dataOffset, const ArrayDescription& desc,
+        const std::vector<std::vector<size_t>>& boxes, std::vector<ArrayContainer>& result)
+{
+    result.clear();
+    for (size_t i = 0; i < boxes.size(); i++) {
+        if (!boxIsInside(boxes[i], desc))
+            return ErrorInvalidData;
+    }
+    std::vector<Request> requests;
+    for (size_t i = 0; i < boxes.size(); i++) {
+        result.emplace_back(boxDescription(boxes[i], desc));
+        unsigned char* dst = static_cast<unsigned char*>(result.back().data());
+        size_t rowSize = boxes[i][desc.dimensionCount()] * desc.elementSize();
+        forEachBoxRow(boxes[i], desc, [&] (size_t e) {
+                addRequest(requests, dataOffset + e * desc.elementSize(), rowSize, dst);
+                dst += rowSize;
+                });
+    }
+    Error e = read(fd, requests);
+    if (e != ErrorNone)
+        result.clear();
+    return e;
+}
+
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TGD_IO_BATCHREAD_HPP
+#define TGD_IO_BATCHREAD_HPP
+
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "io.hpp"
+
+namespace TGD {
+
+/* Reads many byte ranges from a file at once. With io_uring (Linux), all
+ * reads of a batch are submitted with few system calls and complete
+ * asynchronously. Otherwise, or if io_uring is not available at runtime,
+ * a pool of threads issues pread() calls. */
+class BatchReader {
+public:
+    struct Request {
+        uint64_t offset;
+        size_t size;
+        void* data;
+    };
+
+    /* Append a request to a list, merging it with the previous one if
+     * both the file ranges and the memory ranges are adjacent. */
+    static void addRequest(std::vector<Request>& requests, uint64_t offset, size_t size, void* data);
+
+private:
+#ifdef TGD_WITH_IO_URING
+    struct Ring;
+    Ring* _ring;
+    bool _ringFailed;
+    Error readWithRing(int fd, const std::vector<Request>& requests);
+#endif
+
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _workCond;
+    std::condition_variable _doneCond;
+    unsigned int _generation;
+    bool _quit;
+    int _fd;
+    const std::vector<Request>* _requests;
+    std::atomic<size_t> _nextRequest;
+    size_t _busyThreads;
+    Error _error;
+    int _errno;
+
+    void work();
+    void worker();
+    Error readWithThreads(int fd, const std::vector<Request>& requests);
+
+public:
+    /* Without useRing, always use the thread pool (e.g. for testing). */
+    BatchReader(bool useRing = true);
+    ~BatchReader();
+
+    /* Execute all requests. Returns when all of them are done. */
+    Error read(int fd, const std::vector<Request>& requests);
+
+    /* Read boxes (see boxIsInside()) of an array that is stored packed at
+     * dataOffset in the file. Returns ErrorInvalidData if a box is invalid. */
+    Error readBoxes(int fd, uint64_t dataOffset, const ArrayDescription& desc,
+            const std::vector<std::vector<size_t>>& boxes, std::vector<ArrayContainer>& result);
+};
+
+}
+
+#endif
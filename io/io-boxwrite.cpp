@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "io-boxwrite.hpp"
+
+
+namespace TGD {
+
+BoxWriter::BoxWriter() : _fd(-1)
+{
+}
+
+BoxWriter::~BoxWriter()
+{
+    close();
+}
+
+Error BoxWriter::open(const std::string& fileName)
+{
+    close();
+    // This must not use O_APPEND, since pwrite() ignores the offset then
+    _fd = ::open(fileName.c_str(), O_WRONLY);
+    return (_fd >= 0 ? ErrorNone : ErrorSysErrno);
+}
+
+void BoxWriter::close()
+{
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+Error BoxWriter::write(uint64_t dataOffset, const ArrayDescription& desc,
+        const ArrayContainer& box, const std::vector<size_t>& index)
+{
+    if (box.componentCount() != desc.componentCount() || box.componentType() != desc.componentType()
+            || box.dimensionCount() != desc.dimensionCount() || index.size() != desc.dimensionCount()) {
+        return ErrorInvalidData;
+    }
+    std::vector<size_t> b(index);
+    b.insert(b.end(), box.dimensions().begin(), box.dimensions().end());
+    if (!boxIsInside(b, desc))
+        return ErrorInvalidData;
+    // Do not write beyond the end of the file
+    struct stat statbuf;
+    if (fstat(_fd, &statbuf) != 0)
+        return ErrorSysErrno;
+    if (uint64_t(statbuf.st_size) < dataOffset + desc.dataSize())
+        return ErrorInvalidData;
+
+    const unsigned char* src = static_cast<const unsigned char*>(box.data());
+    size_t rowSize = box.dimension(0) * desc.elementSize();
+    Error e = ErrorNone;
+    forEachBoxRow(b, desc, [&] (size_t element) {
+            off_t offset = dataOffset + element * desc.elementSize();
+            for (size_t written = 0; e == ErrorNone && written < rowSize; ) {
+                ssize_t r = pwrite(_fd, src + written, rowSize - written, offset + written);
+                if (r < 0 && errno == EINTR)
+                    continue;
+                if (r <= 0)
+                    e = (r < 0 ? ErrorSysErrno : ErrorInvalidData);
+                else
+                    written += r;
+            }
+            src += rowSize;
+            });
+    return e;
+}
+
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TGD_IO_BOXWRITE_HPP
+#define TGD_IO_BOXWRITE_HPP
+
+#include <string>
+#include <vector>
+
+#include "io.hpp"
+
+namespace TGD {
+
+/* Writes boxes into array data that is stored packed in an existing file,
+ * using pwrite() on a file descriptor of its own. Since no file position is
+ * shared, independent processes can write disjoint boxes into the same array
+ * at the same time without locking. */
+class BoxWriter {
+private:
+    int _fd;
+
+public:
+    BoxWriter();
+    ~BoxWriter();
+
+    Error open(const std::string& fileName);
+    void close();
+    bool isOpen() const
+    {
+        return _fd >= 0;
+    }
+
+    /* Write the array box into the array described by desc that is stored
+     * at dataOffset, with its first element at the given element index. */
+    Error write(uint64_t dataOffset, const ArrayDescription& desc,
+            const ArrayContainer& box, const std::vector<size_t>& index);
+};
+
+}
+
+#endif
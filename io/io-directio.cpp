@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "io-directio.hpp"
+
+
+namespace TGD {
+
+/* Offsets, sizes and buffer addresses for O_DIRECT must be multiples of the
+ * logical block size of the device. 4096 covers all common devices. */
+static const size_t directAlignment = 4096;
+
+static size_t alignUp(size_t x)
+{
+    return (x + directAlignment - 1) / directAlignment * directAlignment;
+}
+
+DirectIO::DirectIO() :
+    _fd(-1), _dropCache(false), _blockSize(0), _buffer(nullptr)
+{
+}
+
+DirectIO::~DirectIO()
+{
+    close();
+}
+
+void DirectIO::open(const std::string& fileName, FILE* f, bool writing, const TagList& hints)
+{
+    close();
+    struct stat statbuf;
+    if (fstat(fileno(f), &statbuf) != 0 || (statbuf.st_mode & S_IFMT) != S_IFREG)
+        return;
+
+    _dropCache = (hints.value("DROP_CACHE", 0) != 0);
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (_dropCache)
+        posix_fadvise(fileno(f), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    if (hints.value("DIRECT_IO", 0) != 0) {
+        _blockSize = alignUp(std::max(hints.value("DIRECT_IO_BLOCK_SIZE", size_t(8) << 20), directAlignment));
+        void* buffer;
+        if (posix_memalign(&buffer, directAlignment, _blockSize) != 0)
+            return;
+        _buffer = static_cast<unsigned char*>(buffer);
+        // Writing needs read access, too, to preserve the partial block
+        // in front of the data.
+#if defined(O_DIRECT)
+        _fd = ::open(fileName.c_str(), (writing ? O_RDWR : O_RDONLY) | O_DIRECT);
+#elif defined(F_NOCACHE)
+        _fd = ::open(fileName.c_str(), writing ? O_RDWR : O_RDONLY);
+        if (_fd >= 0 && fcntl(_fd, F_NOCACHE, 1) != 0) {
+            ::close(_fd);
+            _fd = -1;
+        }
+#endif
+        if (_fd < 0) {
+            // not supported by this file system; use normal I/O
+            std::free(_buffer);
+            _buffer = nullptr;
+        }
+    }
+}
+
+void DirectIO::close()
+{
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+    std::free(_buffer);
+    _buffer = nullptr;
+    _dropCache = false;
+}
+
+Error DirectIO::directRead(off_t pos, void* data, size_t size)
+{
+    off_t offset = pos / directAlignment * directAlignment;
+    size_t skip = pos - offset;
+    unsigned char* dst = static_cast<unsigned char*>(data);
+    size_t remaining = size;
+    while (remaining > 0) {
+        size_t want = std::min(_blockSize, alignUp(skip + remaining));
+        ssize_t r = pread(_fd, _buffer, want, offset);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return ErrorSysErrno;
+        }
+        if (size_t(r) <= skip)
+            return ErrorInvalidData;
+        size_t n = std::min(size_t(r) - skip, remaining);
+        std::memcpy(dst, _buffer + skip, n);
+        dst += n;
+        remaining -= n;
+        if (size_t(r) < want && remaining > 0)
+            return ErrorInvalidData;
+        offset += want;
+        skip = 0;
+    }
+    return ErrorNone;
+}
+
+Error DirectIO::directWrite(off_t pos, const void* data, size_t size)
+{
+    off_t offset = pos / directAlignment * directAlignment;
+    size_t keep = pos - offset;
+    // Preserve what is already in the file in front of pos within the first block
+    if (keep > 0) {
+        ssize_t r;
+        while ((r = pread(_fd, _buffer, directAlignment, offset)) < 0 && errno == EINTR)
+            ;
+        if (r < 0)
+            return ErrorSysErrno;
+        if (size_t(r) < keep)
+            return ErrorInvalidData;
+    }
+    const unsigned char* src = static_cast<const unsigned char*>(data);
+    size_t remaining = size;
+    while (remaining > 0) {
+        size_t n = std::min(_blockSize - keep, remaining);
+        std::memcpy(_buffer + keep, src, n);
+        size_t len = alignUp(keep + n);
+        std::memset(_buffer + keep + n, 0, len - (keep + n));
+        for (size_t written = 0; written < len; ) {
+            ssize_t r = pwrite(_fd, _buffer + written, len - written, offset + written);
+            if (r < 0) {
+                if (errno == EINTR)
+                    continue;
+                return ErrorSysErrno;
+            }
+            written += r;
+        }
+        src += n;
+        remaining -= n;
+        offset += len;
+        keep = 0;
+    }
+    // The last block was padded; cut the padding off again
+    if (offset != off_t(pos + size) && ftruncate(_fd, pos + size) != 0)
+        return ErrorSysErrno;
+    return ErrorNone;
+}
+
+void DirectIO::dropCache(FILE* f, off_t pos, size_t size, bool written)
+{
+#ifdef POSIX_FADV_DONTNEED
+    // Dirty pages cannot be dropped, so make sure written data is on disk first
+    if (!written || fdatasync(fileno(f)) == 0)
+        posix_fadvise(fileno(f), pos, size, POSIX_FADV_DONTNEED);
+#else
+    (void)f;
+    (void)pos;
+    (void)size;
+    (void)written;
+#endif
+}
+
+Error DirectIO::read(FILE* f, void* data, size_t size)
+{
+    if (size == 0)
+        return ErrorNone;
+    off_t pos = ftello(f);
+    if (_fd >= 0 && pos >= 0) {
+        Error e = directRead(pos, data, size);
+        if (e == ErrorSysErrno && errno == EINVAL) {
+            // the file system rejects our alignment after all; use normal I/O from now on
+            ::close(_fd);
+            _fd = -1;
+        } else {
+            if (e == ErrorNone && fseeko(f, pos + size, SEEK_SET) != 0)
+                e = ErrorSysErrno;
+            return e;
+        }
+    }
+    if (std::fread(data, size, 1, f) != 1)
+        return std::ferror(f) ? ErrorSysErrno : ErrorInvalidData;
+    if (_dropCache && pos >= 0)
+        dropCache(f, pos, size, false);
+    return ErrorNone;
+}
+
+Error DirectIO::write(FILE* f, const void* data, size_t size)
+{
+    if (size == 0)
+        return ErrorNone;
+    if (_fd >= 0) {
+        // Everything in front of the data must be in the file before we
+        // bypass the stdio buffer
+        if (std::fflush(f) != 0)
+            return ErrorSysErrno;
+        off_t pos = ftello(f);
+        if (pos >= 0) {
+            Error e = directWrite(pos, data, size);
+            if (e == ErrorSysErrno && errno == EINVAL && ftruncate(_fd, pos) == 0) {
+                ::close(_fd);
+                _fd = -1;
+            } else {
+                if (e == ErrorNone && fseeko(f, pos + size, SEEK_SET) != 0)
+                    e = ErrorSysErrno;
+                return e;
+            }
+        }
+    }
+    off_t pos = (_dropCache ? ftello(f) : -1);
+    if (std::fwrite(data, size, 1, f) != 1)
+        return ErrorSysErrno;
+    if (_dropCache && pos >= 0 && std::fflush(f) == 0)
+        dropCache(f, pos, size, true);
+    return ErrorNone;
+}
+
+}
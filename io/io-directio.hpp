@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TGD_IO_DIRECTIO_HPP
+#define TGD_IO_DIRECTIO_HPP
+
+#include <cstdio>
+#include <string>
+
+#include "io.hpp"
+
+namespace TGD {
+
+/* Transfers bulk array data between a stdio stream and memory, optionally
+ * bypassing or sparing the page cache. This is meant for streaming very large
+ * files once, e.g. in bulk conversions.
+ *
+ * The mode is selected with these hints:
+ * - DIRECT_IO=1: transfer data with O_DIRECT through an aligned bounce buffer
+ *   of DIRECT_IO_BLOCK_SIZE bytes (default 8 MiB). Headers still go through
+ *   the stdio stream. Falls back to normal I/O if the file system does not
+ *   support it, and for pipes such as stdin/stdout.
+ * - DROP_CACHE=1: advise the kernel that the file is read sequentially, and
+ *   drop transferred data from the page cache afterwards.
+ *
+ * Without these hints, read() and write() are plain fread() and fwrite(). */
+class DirectIO {
+private:
+    int _fd;                    // O_DIRECT file descriptor, or -1
+    bool _dropCache;
+    size_t _blockSize;
+    unsigned char* _buffer;     // aligned bounce buffer
+
+    Error directRead(off_t pos, void* data, size_t size);
+    Error directWrite(off_t pos, const void* data, size_t size);
+    void dropCache(FILE* f, off_t pos, size_t size, bool written);
+
+public:
+    DirectIO();
+    ~DirectIO();
+
+    /* Set up according to the hints. The stream f must already be open on
+     * fileName. */
+    void open(const std::string& fileName, FILE* f, bool writing, const TagList& hints);
+    void close();
+
+    /* Read or write size bytes at the current position of f, and advance f. */
+    Error read(FILE* f, void* data, size_t size);
+    Error write(FILE* f, const void* data, size_t size);
+};
+
+}
+
+#endif
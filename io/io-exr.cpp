@@ -193,6 +193,71 @@ ArrayContainer FormatImportExportEXR::readArray(Error* error, int arrayIndex)
     }
 }
 
+ArrayDescription FormatImportExportEXR::readDescription(Error* error, int arrayIndex)
+{
+    if (arrayIndex > 0) {
+        *error = ErrorSeekingNotSupported;
+        return ArrayDescription();
+    }
+
+    try {
+        // Constructing the InputFile only reads the header
+        InputFile file(_fileName.c_str());
+        Box2i dw = file.header().dataWindow();
+        int width = dw.max.x - dw.min.x + 1;
+        int height = dw.max.y - dw.min.y + 1;
+        if (width < 1 || height < 1) {
+            *error = ErrorInvalidData;
+            return ArrayDescription();
+        }
+        const ChannelList &channellist = file.header().channels();
+        size_t channelCount = 0;
+        for (ChannelList::ConstIterator iter = channellist.begin(); iter != channellist.end(); iter++) {
+            channelCount++;
+        }
+        if (channelCount < 1) {
+            *error = ErrorInvalidData;
+            return ArrayDescription();
+        }
+
+        ArrayDescription r({ size_t(width), size_t(height) }, channelCount, float32);
+        for (auto it = file.header().begin(); it != file.header().end(); it++) {
+            if (std::string(it.attribute().typeName()) == std::string("string")) {
+                r.globalTagList().set(it.name(),
+                        file.header().typedAttribute<StringAttribute>(it.name()).value());
+            }
+        }
+        // same channel order as in readArray()
+        const char* knownChannels[] = { "Y", "R", "G", "B", "A", "Z" };
+        const char* knownInterpretations[] = { "XYZ/Y", "RED", "GREEN", "BLUE", "ALPHA", "DEPTH" };
+        int channelIndex = 0;
+        for (int i = 0; i < 6; i++) {
+            if (channellist.findChannel(knownChannels[i])) {
+                r.componentTagList(channelIndex).set("INTERPRETATION", knownInterpretations[i]);
+                channelIndex++;
+            }
+        }
+        for (ChannelList::ConstIterator iter = channellist.begin(); iter != channellist.end(); iter++) {
+            if (std::strcmp(iter.name(), "Y") == 0
+                    || std::strcmp(iter.name(), "R") == 0
+                    || std::strcmp(iter.name(), "G") == 0
+                    || std::strcmp(iter.name(), "B") == 0
+                    || std::strcmp(iter.name(), "A") == 0
+                    || std::strcmp(iter.name(), "Z") == 0) {
+                continue;
+            }
+            r.componentTagList(channelIndex).set("INTERPRETATION", iter.name());
+            channelIndex++;
+        }
+        _arrayWasReadOrWritten = true;
+        return r;
+    }
+    catch (...) {
+        *error = ErrorInvalidData;
+        return ArrayDescription();
+    }
+}
+
 bool FormatImportExportEXR::hasMore()
 {
     return !_arrayWasReadOrWritten;
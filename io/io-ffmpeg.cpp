@@ -24,6 +24,11 @@
 
 #include <cerrno>
 #include <limits>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 
 extern "C" {
 #include <libavformat/avformat.h>
@@ -32,6 +37,7 @@ extern "C" {
 #include <libavutil/imgutils.h>
 #include <libavutil/pixdesc.h>
 #include <libavutil/cpu.h>
+#include <libavutil/opt.h>
 #include <libswscale/swscale.h>
 }
 
@@ -64,6 +70,19 @@ public:
     AVBufferRef* hwDeviceCtx;
     AVFrame* videoFrameFromHW;
 
+    // for encoding (the caller thread converts arrays to frames via swsCtx,
+    // the encoder thread encodes them and writes the packets):
+    AVFormatContext* outFormatCtx;
+    AVCodecContext* encCtx;
+    AVStream* outStream;
+    AVPacket* encPkt;
+    int64_t encNextPts;
+    std::thread encThread;
+    std::mutex encMutex;
+    std::condition_variable encCond;
+    std::deque<AVFrame*> encQueue; // nullptr marks the end of the stream
+    Error encError;
+
     FFmpeg() :
         formatCtx(nullptr),
         codecCtx(nullptr),
@@ -81,11 +100,20 @@ public:
         hwDeviceType(AV_HWDEVICE_TYPE_NONE),
         hwPixelFormat(AV_PIX_FMT_NONE),
         hwDeviceCtx(nullptr),
-        videoFrameFromHW(nullptr)
+        videoFrameFromHW(nullptr),
+        outFormatCtx(nullptr),
+        encCtx(nullptr),
+        outStream(nullptr),
+        encPkt(nullptr),
+        encNextPts(0),
+        encError(ErrorNone)
     {
     }
 };
 
+// Maximum number of converted frames waiting for the encoder thread
+static const size_t maxQueuedFrames = 8;
+
 FormatImportExportFFMPEG::FormatImportExportFFMPEG()
 {
     av_log_set_level(AV_LOG_ERROR);
@@ -120,15 +148,8 @@ static enum AVPixelFormat getHwFormat(AVCodecContext* ctx, const enum AVPixelFor
     return ret;
 }
 
-Error FormatImportExportFFMPEG::openForReading(const std::string& fileName, const TagList& hints)
+static void setLogLevel(const std::string& logLevel)
 {
-    if (fileName == "-")
-        return ErrorInvalidData;
-
-    _fileName = fileName;
-    _hints = hints;
-    int enableHWAccel = _hints.value("HWACCEL", 1);
-    std::string logLevel = _hints.value("LOGLEVEL", "error");
     if (logLevel == "quiet")
         av_log_set_level(AV_LOG_QUIET);
     else if (logLevel == "panic")
@@ -149,6 +170,17 @@ Error FormatImportExportFFMPEG::openForReading(const std::string& fileName, cons
         av_log_set_level(AV_LOG_TRACE);
     else
         av_log_set_level(AV_LOG_ERROR);
+}
+
+Error FormatImportExportFFMPEG::openForReading(const std::string& fileName, const TagList& hints)
+{
+    if (fileName == "-")
+        return ErrorInvalidData;
+
+    _fileName = fileName;
+    _hints = hints;
+    int enableHWAccel = _hints.value("HWACCEL", 1);
+    setLogLevel(_hints.value("LOGLEVEL", "error"));
 
     if (avformat_open_input(&(_ffmpeg->formatCtx), _fileName.c_str(), nullptr, nullptr) < 0
             || avformat_find_stream_info(_ffmpeg->formatCtx, nullptr) < 0
@@ -244,13 +276,224 @@ Error FormatImportExportFFMPEG::openForReading(const std::string& fileName, cons
     return ErrorNone;
 }
 
-Error FormatImportExportFFMPEG::openForWriting(const std::string&, bool, const TagList&)
+Error FormatImportExportFFMPEG::openForWriting(const std::string& fileName, bool append, const TagList& hints)
+{
+    if (append)
+        return ErrorAppendingNotSupported;
+    if (fileName == "-")
+        return ErrorInvalidData;
+
+    // The encoder is set up when the first array is written, because
+    // it needs to know the frame size.
+    _fileName = fileName;
+    _hints = hints;
+    setLogLevel(_hints.value("LOGLEVEL", "error"));
+    return ErrorNone;
+}
+
+static Error encodeFrame(FFmpeg* ffmpeg, AVFrame* frame)
 {
-    return ErrorFeaturesUnsupported;
+    if (avcodec_send_frame(ffmpeg->encCtx, frame) < 0)
+        return ErrorLibrary;
+    for (;;) {
+        int ret = avcodec_receive_packet(ffmpeg->encCtx, ffmpeg->encPkt);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            break;
+        else if (ret < 0)
+            return ErrorLibrary;
+        av_packet_rescale_ts(ffmpeg->encPkt, ffmpeg->encCtx->time_base, ffmpeg->outStream->time_base);
+        ffmpeg->encPkt->stream_index = ffmpeg->outStream->index;
+        if (av_interleaved_write_frame(ffmpeg->outFormatCtx, ffmpeg->encPkt) < 0)
+            return ErrorSysErrno;
+    }
+    return ErrorNone;
+}
+
+static void encoderThread(FFmpeg* ffmpeg)
+{
+    for (;;) {
+        AVFrame* frame;
+        Error e;
+        {
+            std::unique_lock<std::mutex> lock(ffmpeg->encMutex);
+            ffmpeg->encCond.wait(lock, [=] { return !ffmpeg->encQueue.empty(); });
+            frame = ffmpeg->encQueue.front();
+            ffmpeg->encQueue.pop_front();
+            e = ffmpeg->encError;
+        }
+        ffmpeg->encCond.notify_all();
+        bool endOfStream = !frame;
+        // After an error, keep consuming frames so that the writer never blocks
+        if (e == ErrorNone)
+            e = encodeFrame(ffmpeg, frame); // a null frame flushes the encoder
+        av_frame_free(&frame);
+        if (e != ErrorNone) {
+            std::unique_lock<std::mutex> lock(ffmpeg->encMutex);
+            ffmpeg->encError = e;
+        }
+        if (endOfStream)
+            break;
+    }
+}
+
+static AVPixelFormat pixFmtFromArray(const ArrayDescription& desc)
+{
+    if (desc.componentType() == uint8) {
+        return (desc.componentCount() == 1 ? AV_PIX_FMT_GRAY8
+                : desc.componentCount() == 2 ? AV_PIX_FMT_YA8
+                : desc.componentCount() == 3 ? AV_PIX_FMT_RGB24
+                : AV_PIX_FMT_RGBA);
+    } else {
+        return (desc.componentCount() == 1 ? AV_PIX_FMT_GRAY16
+                : desc.componentCount() == 2 ? AV_PIX_FMT_YA16
+                : desc.componentCount() == 3 ? AV_PIX_FMT_RGB48
+                : AV_PIX_FMT_RGBA64);
+    }
+}
+
+Error FormatImportExportFFMPEG::initEncoder(const ArrayContainer& array)
+{
+    if (array.dimensionCount() != 2
+            || array.dimension(0) < 1 || array.dimension(1) < 1
+            || array.dimension(0) > size_t(std::numeric_limits<int>::max())
+            || array.dimension(1) > size_t(std::numeric_limits<int>::max())
+            || array.componentCount() < 1 || array.componentCount() > 4
+            || (array.componentType() != uint8 && array.componentType() != uint16)) {
+        return ErrorFeaturesUnsupported;
+    }
+    _desc = ArrayDescription(array.dimensions(), array.componentCount(), array.componentType());
+
+    // Output context and codec
+    if (avformat_alloc_output_context2(&(_ffmpeg->outFormatCtx), nullptr,
+                _hints.contains("CONTAINER") ? _hints.value("CONTAINER").c_str() : nullptr,
+                _fileName.c_str()) < 0) {
+        return ErrorFormatUnsupported;
+    }
+    const AVCodec* enc = (_hints.contains("CODEC")
+            ? avcodec_find_encoder_by_name(_hints.value("CODEC").c_str())
+            : avcodec_find_encoder(_ffmpeg->outFormatCtx->oformat->video_codec));
+    if (!enc || enc->type != AVMEDIA_TYPE_VIDEO)
+        return ErrorFeaturesUnsupported;
+    _ffmpeg->outStream = avformat_new_stream(_ffmpeg->outFormatCtx, nullptr);
+    _ffmpeg->encCtx = avcodec_alloc_context3(enc);
+    _ffmpeg->encPkt = av_packet_alloc();
+    if (!_ffmpeg->outStream || !_ffmpeg->encCtx || !_ffmpeg->encPkt) {
+        errno = ENOMEM;
+        return ErrorSysErrno;
+    }
+
+    // Encoder parameters
+    AVPixelFormat srcPixFmt = pixFmtFromArray(_desc);
+    AVPixelFormat dstPixFmt = srcPixFmt;
+    if (_hints.contains("PIXFMT")) {
+        dstPixFmt = av_get_pix_fmt(_hints.value("PIXFMT").c_str());
+        if (dstPixFmt == AV_PIX_FMT_NONE)
+            return ErrorInvalidData;
+    } else if (enc->pix_fmts) {
+        bool hasAlpha = (_desc.componentCount() == 2 || _desc.componentCount() == 4);
+        dstPixFmt = avcodec_find_best_pix_fmt_of_list(enc->pix_fmts, srcPixFmt, hasAlpha, nullptr);
+    }
+    AVRational frameRate = av_d2q(_hints.value("FPS", 25.0), 100000);
+    if (frameRate.num <= 0 || frameRate.den <= 0)
+        return ErrorInvalidData;
+    _ffmpeg->encCtx->width = _desc.dimension(0);
+    _ffmpeg->encCtx->height = _desc.dimension(1);
+    _ffmpeg->encCtx->pix_fmt = dstPixFmt;
+    _ffmpeg->encCtx->framerate = frameRate;
+    _ffmpeg->encCtx->time_base = av_inv_q(frameRate);
+    _ffmpeg->outStream->time_base = _ffmpeg->encCtx->time_base;
+    if (_hints.contains("GOP"))
+        _ffmpeg->encCtx->gop_size = _hints.value("GOP", 12);
+    if (_hints.contains("BITRATE"))
+        _ffmpeg->encCtx->bit_rate = _hints.value("BITRATE", 0LL);
+    _ffmpeg->encCtx->thread_count = _hints.value("THREADS", std::min(av_cpu_count(), 16));
+    if (_ffmpeg->outFormatCtx->oformat->flags & AVFMT_GLOBALHEADER)
+        _ffmpeg->encCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    // Codec-specific options; these are ignored by codecs that do not know them
+    AVDictionary* opts = nullptr;
+    if (_hints.contains("CRF"))
+        av_dict_set(&opts, "crf", _hints.value("CRF").c_str(), 0);
+    if (_hints.contains("PRESET"))
+        av_dict_set(&opts, "preset", _hints.value("PRESET").c_str(), 0);
+    int ret = avcodec_open2(_ffmpeg->encCtx, enc, &opts);
+    av_dict_free(&opts);
+    if (ret < 0 || avcodec_parameters_from_context(_ffmpeg->outStream->codecpar, _ffmpeg->encCtx) < 0)
+        return ErrorLibrary;
+
+    // Converter
+    _ffmpeg->swsCtx = sws_getCachedContext(_ffmpeg->swsCtx,
+            _ffmpeg->encCtx->width, _ffmpeg->encCtx->height, srcPixFmt,
+            _ffmpeg->encCtx->width, _ffmpeg->encCtx->height, dstPixFmt,
+            SWS_BILINEAR, nullptr, nullptr, nullptr);
+    if (!_ffmpeg->swsCtx)
+        return ErrorLibrary;
+
+    // Output file
+    if (!(_ffmpeg->outFormatCtx->oformat->flags & AVFMT_NOFILE)) {
+        if (avio_open(&(_ffmpeg->outFormatCtx->pb), _fileName.c_str(), AVIO_FLAG_WRITE) < 0)
+            return ErrorSysErrno;
+    }
+    if (avformat_write_header(_ffmpeg->outFormatCtx, nullptr) < 0) {
+        if (!(_ffmpeg->outFormatCtx->oformat->flags & AVFMT_NOFILE))
+            avio_closep(&(_ffmpeg->outFormatCtx->pb));
+        return ErrorLibrary;
+    }
+
+    // Encoder thread
+    _ffmpeg->encNextPts = 0;
+    _ffmpeg->encError = ErrorNone;
+    _ffmpeg->encThread = std::thread(encoderThread, _ffmpeg);
+    return ErrorNone;
+}
+
+Error FormatImportExportFFMPEG::finishEncoder()
+{
+    Error e = ErrorNone;
+    if (_ffmpeg->encThread.joinable()) {
+        {
+            std::unique_lock<std::mutex> lock(_ffmpeg->encMutex);
+            _ffmpeg->encQueue.push_back(nullptr);
+        }
+        _ffmpeg->encCond.notify_all();
+        _ffmpeg->encThread.join();
+        // this includes errors from flushing the encoder with the null frame
+        e = _ffmpeg->encError;
+        if (av_write_trailer(_ffmpeg->outFormatCtx) < 0 && e == ErrorNone)
+            e = ErrorLibrary;
+        if (!(_ffmpeg->outFormatCtx->oformat->flags & AVFMT_NOFILE)) {
+            int ret = avio_closep(&(_ffmpeg->outFormatCtx->pb));
+            if (ret < 0 && e == ErrorNone) {
+                errno = AVUNERROR(ret);
+                e = ErrorSysErrno;
+            }
+        }
+    }
+    if (_ffmpeg->outFormatCtx) {
+        avformat_free_context(_ffmpeg->outFormatCtx);
+        _ffmpeg->outFormatCtx = nullptr;
+        _ffmpeg->outStream = nullptr;
+    }
+    if (_ffmpeg->encCtx) {
+        avcodec_free_context(&(_ffmpeg->encCtx));
+        _ffmpeg->encCtx = nullptr;
+    }
+    if (_ffmpeg->encPkt) {
+        av_packet_free(&(_ffmpeg->encPkt));
+        _ffmpeg->encPkt = nullptr;
+    }
+    _ffmpeg->encQueue.clear();
+    _ffmpeg->encError = ErrorNone;
+    return e;
+}
+
+Error FormatImportExportFFMPEG::finish()
+{
+    return finishEncoder();
 }
 
 void FormatImportExportFFMPEG::close()
 {
+    finishEncoder(); // errors are reported by finish(), which Exporter::finish() calls first
     if (_ffmpeg->formatCtx) {
         avformat_close_input(&(_ffmpeg->formatCtx));
         _ffmpeg->formatCtx = nullptr;
@@ -689,9 +932,61 @@ bool FormatImportExportFFMPEG::hasMore()
     }
 }
 
-Error FormatImportExportFFMPEG::writeArray(const ArrayContainer&)
+Error FormatImportExportFFMPEG::writeArray(const ArrayContainer& array)
 {
-    return ErrorFeaturesUnsupported;
+    if (!_ffmpeg->encThread.joinable()) {
+        Error e = initEncoder(array);
+        if (e != ErrorNone) {
+            finishEncoder(); // only cleans up here; the initialization error takes precedence
+            return e;
+        }
+    }
+    if (array.dimensionCount() != 2
+            || array.dimension(0) != _desc.dimension(0)
+            || array.dimension(1) != _desc.dimension(1)
+            || array.componentCount() != _desc.componentCount()
+            || array.componentType() != _desc.componentType()) {
+        return ErrorFeaturesUnsupported;
+    }
+
+    // Convert the array to a frame in the encoder's pixel format.
+    // This happens in the caller's thread while the encoder thread
+    // works on previous frames.
+    AVFrame* frame = av_frame_alloc();
+    if (!frame) {
+        errno = ENOMEM;
+        return ErrorSysErrno;
+    }
+    frame->format = _ffmpeg->encCtx->pix_fmt;
+    frame->width = _ffmpeg->encCtx->width;
+    frame->height = _ffmpeg->encCtx->height;
+    if (av_frame_get_buffer(frame, 0) < 0) {
+        av_frame_free(&frame);
+        errno = ENOMEM;
+        return ErrorSysErrno;
+    }
+    // TGD stores the bottom row first, so read the rows backwards
+    int srcStride[4] = { -int(array.dimension(0) * array.elementSize()), 0, 0, 0 };
+    const uint8_t* src[4] = { static_cast<const uint8_t*>(array.get((array.dimension(1) - 1) * array.dimension(0))),
+        nullptr, nullptr, nullptr };
+    sws_scale(_ffmpeg->swsCtx, src, srcStride, 0, frame->height, frame->data, frame->linesize);
+    frame->pts = _ffmpeg->encNextPts++;
+
+    // Hand the frame over to the encoder thread
+    Error e;
+    {
+        std::unique_lock<std::mutex> lock(_ffmpeg->encMutex);
+        _ffmpeg->encCond.wait(lock, [this] { return _ffmpeg->encQueue.size() < maxQueuedFrames; });
+        e = _ffmpeg->encError;
+        if (e == ErrorNone)
+            _ffmpeg->encQueue.push_back(frame);
+    }
+    if (e != ErrorNone) {
+        av_frame_free(&frame);
+        return e;
+    }
+    _ffmpeg->encCond.notify_all();
+    return ErrorNone;
 }
 
 extern "C" FormatImportExport* FormatImportExportFactory_ffmpeg()
@@ -45,6 +45,8 @@ private:
     int _indexOfLastReadFrame;
 
     bool hardReset(bool disableHWAccel);
+    Error initEncoder(const ArrayContainer& array);
+    Error finishEncoder();
 
 public:
     FormatImportExportFFMPEG();
@@ -61,6 +63,7 @@ public:
 
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
+    virtual Error finish() override;
 };
 
 extern "C" FormatImportExport* FormatImportExportFactory_ffmpeg();
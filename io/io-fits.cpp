@@ -92,11 +92,10 @@ int FormatImportExportFITS::arrayCount()
     return _imgHDUs.size();
 }
 
-ArrayContainer FormatImportExportFITS::readArray(Error* error, int arrayIndex)
+Error FormatImportExportFITS::readHeader(int arrayIndex, ArrayDescription& desc, int& fitsttype)
 {
     if (arrayIndex >= arrayCount()) {
-        *error = ErrorInvalidData;
-        return ArrayContainer();
+        return ErrorInvalidData;
     }
     int status = 0;
     if (arrayIndex >= 0) {
@@ -105,18 +104,15 @@ ArrayContainer FormatImportExportFITS::readArray(Error* error, int arrayIndex)
         fits_movabs_hdu(static_cast<fitsfile*>(_f), _imgHDUs[_indexOfLastReadArray + 1], nullptr, &status);
     }
     if (status) {
-        *error = ErrorSeekingNotSupported;
-        return ArrayContainer();
+        return ErrorSeekingNotSupported;
     }
 
     int fitstype;
     fits_get_img_type(static_cast<fitsfile*>(_f), &fitstype, &status);
     if (status) {
-        *error = ErrorInvalidData;
-        return ArrayContainer();
+        return ErrorInvalidData;
     }
     Type type;
-    int fitsttype;
     if (fitstype == SBYTE_IMG) {
         type = int8;
         fitsttype = TSBYTE;
@@ -150,50 +146,77 @@ ArrayContainer FormatImportExportFITS::readArray(Error* error, int arrayIndex)
         type = float64;
         fitsttype = TDOUBLE;
     } else {
-        *error = ErrorFeaturesUnsupported;
-        return ArrayContainer();
+        return ErrorFeaturesUnsupported;
     }
 
     int fitsdimcount;
     fits_get_img_dim(static_cast<fitsfile*>(_f), &fitsdimcount, &status);
     if (status) {
-        *error = ErrorInvalidData;
-        return ArrayContainer();
+        return ErrorInvalidData;
     }
     if (fitsdimcount < 1) {
-        *error = ErrorFeaturesUnsupported;
-        return ArrayContainer();
+        return ErrorFeaturesUnsupported;
     }
     std::vector<long> fitsdims(fitsdimcount, -1);
     fits_get_img_size(static_cast<fitsfile*>(_f), fitsdimcount, fitsdims.data(), &status);
     if (status) {
-        *error = ErrorInvalidData;
-        return ArrayContainer();
+        return ErrorInvalidData;
     }
     std::vector<size_t> dims(fitsdims.size());
     for (int i = 0; i < fitsdimcount; i++) {
         if (fitsdims[i] < 1) {
-            *error = ErrorFeaturesUnsupported;
-            return ArrayContainer();
+            return ErrorFeaturesUnsupported;
         }
         dims[i] = fitsdims[i];
     }
 
-    ArrayContainer r(dims, 1, type);
-    for (int i = 0; i < fitsdimcount; i++)
-        fitsdims[i] = 1;
-    fits_read_pix(static_cast<fitsfile*>(_f), fitsttype, fitsdims.data(), r.elementCount(),
+    desc = ArrayDescription(dims, 1, type);
+    return ErrorNone;
+}
+
+ArrayContainer FormatImportExportFITS::readArray(Error* error, int arrayIndex)
+{
+    ArrayDescription desc;
+    int fitsttype;
+    Error err = readHeader(arrayIndex, desc, fitsttype);
+    if (err != ErrorNone) {
+        *error = err;
+        return ArrayContainer();
+    }
+
+    int status = 0;
+    ArrayContainer r(desc);
+    std::vector<long> firstPixel(r.dimensionCount(), 1);
+    fits_read_pix(static_cast<fitsfile*>(_f), fitsttype, firstPixel.data(), r.elementCount(),
             nullptr, r.data(), nullptr, &status);
     if (status) {
         *error = ErrorInvalidData;
         return ArrayContainer();
     }
+    advance(arrayIndex);
+    return r;
+}
+
+ArrayDescription FormatImportExportFITS::readDescription(Error* error, int arrayIndex)
+{
+    ArrayDescription desc;
+    int fitsttype;
+    Error err = readHeader(arrayIndex, desc, fitsttype);
+    if (err != ErrorNone) {
+        *error = err;
+        return ArrayDescription();
+    }
+    advance(arrayIndex);
+    return desc;
+}
+
+void FormatImportExportFITS::advance(int arrayIndex)
+{
     if (arrayIndex >= 0) {
         _indexOfLastReadArray = arrayIndex;
     } else {
         _indexOfLastReadArray++;
     }
-    return r;
 }
 
 bool FormatImportExportFITS::hasMore()
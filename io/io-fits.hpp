@@ -37,6 +37,9 @@ private:
     std::vector<int> _imgHDUs;
     int _indexOfLastReadArray;
 
+    Error readHeader(int arrayIndex, ArrayDescription& desc, int& fitsttype);
+    void advance(int arrayIndex);
+
 public:
     FormatImportExportFITS();
     ~FormatImportExportFITS();
@@ -49,6 +52,7 @@ public:
     virtual int arrayCount() override;
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
+    virtual ArrayDescription readDescription(Error* error, int arrayIndex = -1 /* -1 means next */) override;
 
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
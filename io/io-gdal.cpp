@@ -23,13 +23,16 @@
  */
 
 #include <cerrno>
+#include <cstdio>
 #include <string>
+#include <sstream>
 
 #include "io-gdal.hpp"
 #include "io-utils.hpp"
 
 #include <gdal.h>
 #include <cpl_conv.h>
+#include <cpl_string.h>
 
 
 namespace TGD {
@@ -205,9 +208,15 @@ Error FormatImportExportGDAL::openForReading(const std::string& fileName, const
     return ErrorNone;
 }
 
-Error FormatImportExportGDAL::openForWriting(const std::string&, bool, const TagList&)
+Error FormatImportExportGDAL::openForWriting(const std::string& fileName, bool append, const TagList& hints)
 {
-    return ErrorFeaturesUnsupported;
+    if (append)
+        return ErrorAppendingNotSupported;
+    if (fileName == "-")
+        return ErrorInvalidData;
+    _fileName = fileName;
+    _hints = hints;
+    return ErrorNone;
 }
 
 void FormatImportExportGDAL::close()
@@ -218,6 +227,9 @@ void FormatImportExportGDAL::close()
     }
     _desc = ArrayDescription();
     _arrayWasRead = false;
+    _fileName = std::string();
+    _hints = TagList();
+    _arrayWasWritten = false;
 }
 
 int FormatImportExportGDAL::arrayCount()
@@ -246,14 +258,194 @@ ArrayContainer FormatImportExportGDAL::readArray(Error* error, int arrayIndex)
     return r;
 }
 
+ArrayDescription FormatImportExportGDAL::readDescription(Error* error, int arrayIndex)
+{
+    if (arrayIndex >= arrayCount()) {
+        *error = ErrorInvalidData;
+        return ArrayDescription();
+    }
+    _arrayWasRead = true;
+    return _desc;
+}
+
 bool FormatImportExportGDAL::hasMore()
 {
     return !_arrayWasRead;
 }
 
-Error FormatImportExportGDAL::writeArray(const ArrayContainer&)
+static GDALColorInterp colorInterpFromTag(const std::string& interpretation)
+{
+    if (interpretation == "SRGB/GRAY" || interpretation == "GRAY")
+        return GCI_GrayIndex;
+    else if (interpretation == "SRGB/R" || interpretation == "RED")
+        return GCI_RedBand;
+    else if (interpretation == "SRGB/G" || interpretation == "GREEN")
+        return GCI_GreenBand;
+    else if (interpretation == "SRGB/B" || interpretation == "BLUE")
+        return GCI_BlueBand;
+    else if (interpretation == "ALPHA")
+        return GCI_AlphaBand;
+    else if (interpretation == "HSL/H")
+        return GCI_HueBand;
+    else if (interpretation == "HSL/S")
+        return GCI_SaturationBand;
+    else if (interpretation == "HSL/L")
+        return GCI_LightnessBand;
+    else if (interpretation == "CMYK/C")
+        return GCI_CyanBand;
+    else if (interpretation == "CMYK/M")
+        return GCI_MagentaBand;
+    else if (interpretation == "CMYK/Y")
+        return GCI_YellowBand;
+    else if (interpretation == "CMYK/K")
+        return GCI_BlackBand;
+    else if (interpretation == "YCBCR/Y")
+        return GCI_YCbCr_YBand;
+    else if (interpretation == "YCBCR/CB")
+        return GCI_YCbCr_CbBand;
+    else if (interpretation == "YCBCR/CR")
+        return GCI_YCbCr_CrBand;
+    else
+        return GCI_Undefined;
+}
+
+Error FormatImportExportGDAL::writeArray(const ArrayContainer& array)
 {
-    return ErrorFeaturesUnsupported;
+    GDALDataType gdalType;
+    switch (array.componentType()) {
+    case uint8:
+        gdalType = GDT_Byte;
+        break;
+    case int16:
+        gdalType = GDT_Int16;
+        break;
+    case uint16:
+        gdalType = GDT_UInt16;
+        break;
+    case int32:
+        gdalType = GDT_Int32;
+        break;
+    case uint32:
+        gdalType = GDT_UInt32;
+        break;
+    case float32:
+        gdalType = GDT_Float32;
+        break;
+    case float64:
+        gdalType = GDT_Float64;
+        break;
+    default:
+        return ErrorFeaturesUnsupported;
+    }
+    if (array.dimensionCount() != 2
+            || array.dimension(0) < 1 || array.dimension(1) < 1
+            || array.dimension(0) > 0x7fffffffL || array.dimension(1) > 0x7fffffffL
+            || array.componentCount() < 1 || array.componentCount() > 0x7fffffffL
+            || _arrayWasWritten) {
+        return ErrorFeaturesUnsupported;
+    }
+
+    std::string driverName = _hints.value("DRIVER", "COG");
+    GDALDriverH driver = GDALGetDriverByName(driverName.c_str());
+    GDALDriverH memDriver = GDALGetDriverByName("MEM");
+    if (!driver || !memDriver)
+        return ErrorFeaturesUnsupported;
+
+    // Wrap the data in a MEM dataset without copying; the output driver reads it
+    // block by block. GDAL stores the top row first, so each band starts at our
+    // last row and uses a negative line offset.
+    const unsigned char* lastRow = static_cast<const unsigned char*>(array.get((array.dimension(1) - 1) * array.dimension(0)));
+    long long lineOffset = -static_cast<long long>(array.elementSize() * array.dimension(0));
+    GDALDatasetH memDataset = GDALCreate(memDriver, "", array.dimension(0), array.dimension(1), 0, gdalType, nullptr);
+    if (!memDataset)
+        return ErrorLibrary;
+    for (size_t i = 0; i < array.componentCount(); i++) {
+        char dataPointer[64];
+        std::snprintf(dataPointer, sizeof(dataPointer), "%p",
+                static_cast<const void*>(lastRow + i * array.componentSize()));
+        char** bandOptions = nullptr;
+        bandOptions = CSLSetNameValue(bandOptions, "DATAPOINTER", dataPointer);
+        bandOptions = CSLSetNameValue(bandOptions, "PIXELOFFSET", std::to_string(array.elementSize()).c_str());
+        bandOptions = CSLSetNameValue(bandOptions, "LINEOFFSET", std::to_string(lineOffset).c_str());
+        CPLErr err = GDALAddBand(memDataset, gdalType, bandOptions);
+        CSLDestroy(bandOptions);
+        if (err != CE_None) {
+            GDALClose(memDataset);
+            return ErrorLibrary;
+        }
+    }
+
+    // Metadata
+    const TagList& globalTags = array.globalTagList();
+    if (globalTags.contains("DESCRIPTION"))
+        GDALSetDescription(memDataset, globalTags.value("DESCRIPTION").c_str());
+    if (globalTags.contains("GDAL/PROJECTION"))
+        GDALSetProjection(memDataset, globalTags.value("GDAL/PROJECTION").c_str());
+    if (globalTags.contains("GDAL/GEO_TRANSFORM")) {
+        double geoTransform[6];
+        std::istringstream iss(globalTags.value("GDAL/GEO_TRANSFORM"));
+        for (int i = 0; i < 6; i++)
+            iss >> geoTransform[i];
+        if (!iss.fail())
+            GDALSetGeoTransform(memDataset, geoTransform);
+    }
+    for (size_t i = 0; i < array.componentCount(); i++) {
+        GDALRasterBandH band = GDALGetRasterBand(memDataset, i + 1);
+        const TagList& tags = array.componentTagList(i);
+        double value;
+        if (tags.contains("DESCRIPTION"))
+            GDALSetDescription(band, tags.value("DESCRIPTION").c_str());
+        if (tags.value("NO_DATA_VALUE", &value))
+            GDALSetRasterNoDataValue(band, value);
+        if (tags.value("GDAL/OFFSET", &value))
+            GDALSetRasterOffset(band, value);
+        if (tags.value("GDAL/SCALE", &value))
+            GDALSetRasterScale(band, value);
+        if (tags.contains("UNIT"))
+            GDALSetRasterUnitType(band, tags.value("UNIT").c_str());
+        GDALColorInterp colorInterp = colorInterpFromTag(tags.value("INTERPRETATION"));
+        if (colorInterp != GCI_Undefined)
+            GDALSetRasterColorInterpretation(band, colorInterp);
+    }
+
+    // Creation options. For the default COG driver, the result is a tiled,
+    // compressed GeoTIFF with overviews that are generated while writing.
+    char** options = nullptr;
+    options = CSLSetNameValue(options, "COMPRESS", _hints.value("COMPRESSION", "DEFLATE").c_str());
+    // Only COG knows BLOCKSIZE; GTiff needs explicit tiling with the block size
+    // for both directions
+    if (driverName == "COG") {
+        options = CSLSetNameValue(options, "BLOCKSIZE", _hints.value("BLOCKSIZE", "512").c_str());
+    } else if (driverName == "GTiff" && _hints.contains("BLOCKSIZE")) {
+        options = CSLSetNameValue(options, "TILED", "YES");
+        options = CSLSetNameValue(options, "BLOCKXSIZE", _hints.value("BLOCKSIZE").c_str());
+        options = CSLSetNameValue(options, "BLOCKYSIZE", _hints.value("BLOCKSIZE").c_str());
+    }
+    options = CSLSetNameValue(options, "NUM_THREADS", _hints.value("THREADS", "ALL_CPUS").c_str());
+    if (_hints.contains("OVERVIEWS"))
+        options = CSLSetNameValue(options, "OVERVIEWS", _hints.value("OVERVIEWS").c_str());
+    if (_hints.contains("RESAMPLING"))
+        options = CSLSetNameValue(options, "RESAMPLING", _hints.value("RESAMPLING").c_str());
+    if (_hints.contains("PREDICTOR"))
+        options = CSLSetNameValue(options, "PREDICTOR", _hints.value("PREDICTOR").c_str());
+    if (_hints.contains("LEVEL"))
+        options = CSLSetNameValue(options, "LEVEL", _hints.value("LEVEL").c_str());
+    if (_hints.contains("QUALITY"))
+        options = CSLSetNameValue(options, "QUALITY", _hints.value("QUALITY").c_str());
+    // Any other creation option can be passed as GDAL/<OPTION>=<VALUE>
+    for (auto it = _hints.cbegin(); it != _hints.cend(); it++) {
+        if (it->first.compare(0, 5, "GDAL/") == 0 && it->first.length() > 5)
+            options = CSLSetNameValue(options, it->first.substr(5).c_str(), it->second.c_str());
+    }
+
+    GDALDatasetH dataset = GDALCreateCopy(driver, _fileName.c_str(), memDataset, FALSE, options, nullptr, nullptr);
+    CSLDestroy(options);
+    GDALClose(memDataset);
+    if (!dataset)
+        return ErrorLibrary;
+    GDALClose(dataset);
+    _arrayWasWritten = true;
+    return ErrorNone;
 }
 
 extern "C" FormatImportExport* FormatImportExportFactory_gdal()
@@ -35,6 +35,9 @@ private:
     int _gdalType;
     ArrayDescription _desc;
     bool _arrayWasRead;
+    std::string _fileName;
+    TagList _hints;
+    bool _arrayWasWritten;
 
 public:
     FormatImportExportGDAL();
@@ -48,6 +51,7 @@ public:
     virtual int arrayCount() override;
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
+    virtual ArrayDescription readDescription(Error* error, int arrayIndex = -1 /* -1 means next */) override;
 
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
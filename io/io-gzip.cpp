@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+#ifdef TGD_WITH_ZLIB
+# include <zlib.h>
+#endif
+
+#include "io-gzip.hpp"
+
+
+namespace TGD {
+
+static const size_t gzipBufferSize = 1 << 16;
+
+#ifdef TGD_WITH_ZLIB
+struct GzipReader::Stream {
+    z_stream strm;
+    unsigned char buffer[gzipBufferSize];
+};
+
+struct GzipWriter::Stream {
+    z_stream strm;
+    unsigned char buffer[gzipBufferSize];
+};
+#else
+struct GzipReader::Stream {};
+struct GzipWriter::Stream {};
+#endif
+
+GzipReader::GzipReader() : _stream(nullptr), _f(nullptr)
+{
+}
+
+GzipReader::~GzipReader()
+{
+    close();
+}
+
+Error GzipReader::open(FILE* f)
+{
+    close();
+#ifdef TGD_WITH_ZLIB
+    _stream = new Stream;
+    std::memset(&(_stream->strm), 0, sizeof(z_stream));
+    // automatic detection of gzip and zlib headers
+    if (inflateInit2(&(_stream->strm), 15 + 32) != Z_OK) {
+        delete _stream;
+        _stream = nullptr;
+        return ErrorLibrary;
+    }
+    _f = f;
+    return ErrorNone;
+#else
+    (void)f;
+    return ErrorFeaturesUnsupported;
+#endif
+}
+
+void GzipReader::close()
+{
+#ifdef TGD_WITH_ZLIB
+    if (_stream) {
+        inflateEnd(&(_stream->strm));
+        delete _stream;
+        _stream = nullptr;
+    }
+#endif
+    _f = nullptr;
+}
+
+Error GzipReader::read(void* data, size_t size)
+{
+#ifdef TGD_WITH_ZLIB
+    if (!_stream)
+        return ErrorInvalidData;
+    z_stream& strm = _stream->strm;
+    unsigned char* dst = static_cast<unsigned char*>(data);
+    while (size > 0) {
+        if (strm.avail_in == 0) {
+            size_t n = std::fread(_stream->buffer, 1, gzipBufferSize, _f);
+            if (n == 0)
+                return std::ferror(_f) ? ErrorSysErrno : ErrorInvalidData;
+            strm.next_in = _stream->buffer;
+            strm.avail_in = n;
+        }
+        uInt chunk = std::min(size, size_t(std::numeric_limits<uInt>::max()));
+        strm.next_out = dst;
+        strm.avail_out = chunk;
+        int r = inflate(&strm, Z_NO_FLUSH);
+        size_t produced = chunk - strm.avail_out;
+        dst += produced;
+        size -= produced;
+        if (r == Z_STREAM_END) {
+            // another gzip member may follow
+            if (size > 0 && inflateReset(&strm) != Z_OK)
+                return ErrorLibrary;
+        } else if (r != Z_OK && !(r == Z_BUF_ERROR && strm.avail_in == 0)) {
+            return ErrorInvalidData;
+        }
+    }
+    return ErrorNone;
+#else
+    (void)data;
+    (void)size;
+    return ErrorFeaturesUnsupported;
+#endif
+}
+
+Error GzipReader::skip(size_t size)
+{
+    unsigned char buf[4096];
+    while (size > 0) {
+        size_t n = std::min(size, sizeof(buf));
+        Error e = read(buf, n);
+        if (e != ErrorNone)
+            return e;
+        size -= n;
+    }
+    return ErrorNone;
+}
+
+GzipWriter::GzipWriter() : _stream(nullptr), _f(nullptr)
+{
+}
+
+GzipWriter::~GzipWriter()
+{
+    close();
+}
+
+Error GzipWriter::open(FILE* f, int level)
+{
+    close();
+#ifdef TGD_WITH_ZLIB
+    _stream = new Stream;
+    std::memset(&(_stream->strm), 0, sizeof(z_stream));
+    if (deflateInit2(&(_stream->strm), level < 0 ? Z_DEFAULT_COMPRESSION : std::min(level, 9),
+                Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        delete _stream;
+        _stream = nullptr;
+        return ErrorLibrary;
+    }
+    _f = f;
+    return ErrorNone;
+#else
+    (void)f;
+    (void)level;
+    return ErrorFeaturesUnsupported;
+#endif
+}
+
+void GzipWriter::close()
+{
+#ifdef TGD_WITH_ZLIB
+    if (_stream) {
+        deflateEnd(&(_stream->strm));
+        delete _stream;
+        _stream = nullptr;
+    }
+#endif
+    _f = nullptr;
+}
+
+Error GzipWriter::deflateInto(int flush)
+{
+#ifdef TGD_WITH_ZLIB
+    z_stream& strm = _stream->strm;
+    int r;
+    do {
+        strm.next_out = _stream->buffer;
+        strm.avail_out = gzipBufferSize;
+        r = deflate(&strm, flush);
+        if (r == Z_STREAM_ERROR)
+            return ErrorLibrary;
+        size_t n = gzipBufferSize - strm.avail_out;
+        if (n > 0 && std::fwrite(_stream->buffer, n, 1, _f) != 1)
+            return ErrorSysErrno;
+    } while (strm.avail_out == 0 || (flush == Z_FINISH && r != Z_STREAM_END));
+    return ErrorNone;
+#else
+    (void)flush;
+    return ErrorFeaturesUnsupported;
+#endif
+}
+
+Error GzipWriter::write(const void* data, size_t size)
+{
+#ifdef TGD_WITH_ZLIB
+    if (!_stream)
+        return ErrorInvalidData;
+    const unsigned char* src = static_cast<const unsigned char*>(data);
+    while (size > 0) {
+        uInt chunk = std::min(size, size_t(std::numeric_limits<uInt>::max()));
+        _stream->strm.next_in = const_cast<unsigned char*>(src);
+        _stream->strm.avail_in = chunk;
+        Error e = deflateInto(Z_NO_FLUSH);
+        if (e != ErrorNone)
+            return e;
+        src += chunk;
+        size -= chunk;
+    }
+    return ErrorNone;
+#else
+    (void)data;
+    (void)size;
+    return ErrorFeaturesUnsupported;
+#endif
+}
+
+Error GzipWriter::finish()
+{
+#ifdef TGD_WITH_ZLIB
+    if (!_stream)
+        return ErrorInvalidData;
+    _stream->strm.avail_in = 0;
+    return deflateInto(Z_FINISH);
+#else
+    return ErrorFeaturesUnsupported;
+#endif
+}
+
+}
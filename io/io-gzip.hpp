@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TGD_IO_GZIP_HPP
+#define TGD_IO_GZIP_HPP
+
+#include <cstdio>
+#include <cstddef>
+
+#include "io.hpp"
+
+namespace TGD {
+
+/* Decompresses a gzip or zlib stream that starts at the current position of a
+ * stdio stream, directly into the caller's memory. Concatenated gzip members
+ * are read as one stream. Without zlib, open() returns
+ * ErrorFeaturesUnsupported. */
+class GzipReader {
+private:
+    struct Stream;
+    Stream* _stream;
+    FILE* _f;
+
+public:
+    GzipReader();
+    ~GzipReader();
+
+    Error open(FILE* f);
+    void close();
+
+    /* Decompress exactly size bytes into data. */
+    Error read(void* data, size_t size);
+    /* Decompress and discard size bytes. */
+    Error skip(size_t size);
+};
+
+/* Compresses data into a gzip stream at the current position of a stdio
+ * stream. finish() must be called after the last write(). */
+class GzipWriter {
+private:
+    struct Stream;
+    Stream* _stream;
+    FILE* _f;
+
+    Error deflateInto(int flush);
+
+public:
+    GzipWriter();
+    ~GzipWriter();
+
+    /* The level is a zlib compression level; -1 means the default. */
+    Error open(FILE* f, int level);
+    void close();
+
+    Error write(const void* data, size_t size);
+    Error finish();
+};
+
+}
+
+#endif
@@ -121,24 +121,22 @@ int FormatImportExportHDF5::arrayCount()
     return _datasetNames.size();
 }
 
-ArrayContainer FormatImportExportHDF5::readArray(Error* error, int arrayIndex)
+Error FormatImportExportHDF5::openDataSet(int arrayIndex, H5::DataSet& dataset, H5::DataSpace& dataspace,
+        H5::DataType& type, Type& rType, std::vector<size_t>& dims)
 {
     int datasetIndex;
     if (arrayIndex >= 0) {
         if (arrayIndex >= arrayCount()) {
-            *error = ErrorInvalidData;
-            return ArrayContainer();
+            return ErrorInvalidData;
         }
         datasetIndex = arrayIndex;
     } else {
         datasetIndex = _counter++;
         if (datasetIndex >= arrayCount()) {
-            *error = ErrorInvalidData;
-            return ArrayContainer();
+            return ErrorInvalidData;
         }
     }
     const std::string& datasetName = _datasetNames[datasetIndex];
-    H5::DataSet dataset;
     H5::DataType datatype;
     H5T_class_t typeclass;
     try {
@@ -147,11 +145,8 @@ ArrayContainer FormatImportExportHDF5::readArray(Error* error, int arrayIndex)
         typeclass = dataset.getTypeClass();
     }
     catch (H5::Exception& e) {
-        *error = ErrorLibrary;
-        return ArrayContainer();
+        return ErrorLibrary;
     }
-    H5::DataType type;
-    Type rType;
     if (typeclass == H5T_INTEGER) {
         H5::IntType inttype = dataset.getIntType();
         if (inttype.getSign() == H5T_SGN_NONE && datatype.getSize() == 1) {
@@ -179,8 +174,7 @@ ArrayContainer FormatImportExportHDF5::readArray(Error* error, int arrayIndex)
             type = H5::PredType::NATIVE_INT64;
             rType = int64;
         } else {
-            *error = ErrorFeaturesUnsupported;
-            return ArrayContainer();
+            return ErrorFeaturesUnsupported;
         }
     } else if (typeclass == H5T_FLOAT) {
         if (datatype.getSize() == 4) {
@@ -190,34 +184,26 @@ ArrayContainer FormatImportExportHDF5::readArray(Error* error, int arrayIndex)
             type = H5::PredType::NATIVE_DOUBLE;
             rType = float64;
         } else {
-            *error = ErrorFeaturesUnsupported;
-            return ArrayContainer();
+            return ErrorFeaturesUnsupported;
         }
     } else {
-        *error = ErrorFeaturesUnsupported;
-        return ArrayContainer();
+        return ErrorFeaturesUnsupported;
     }
-    H5::DataSpace dataspace = dataset.getSpace();
+    dataspace = dataset.getSpace();
     int dimCount = dataspace.getSimpleExtentNdims();
     if (dimCount < 1) {
-        *error = ErrorFeaturesUnsupported;
-        return ArrayContainer();
+        return ErrorFeaturesUnsupported;
     }
     std::vector<hsize_t> hdims(dimCount);
     dataspace.getSimpleExtentDims(hdims.data(), nullptr);
-    std::vector<size_t> dims(dimCount);
+    dims.resize(dimCount);
     for (size_t i = 0; i < dims.size(); i++)
         dims[i] = hdims[dims.size() - 1 - i];
-    ArrayContainer dataArray(dims, 1, rType);
-    try {
-        dataset.read(dataArray.data(), type, dataspace, dataspace);
-    }
-    catch (H5::Exception& e) {
-        *error = ErrorLibrary;
-        return ArrayContainer();
-    }
-    ArrayContainer r = reorderMatlabInputData(dims, rType, dataArray.data());
-    // read attributes
+    return ErrorNone;
+}
+
+static void readAttributes(const H5::DataSet& dataset, ArrayDescription& r)
+{
     H5::StrType strType(H5::PredType::C_S1, H5T_VARIABLE);
     for (int i = 0; i < dataset.getNumAttrs(); i++) {
         H5::Attribute a = dataset.openAttribute(i);
@@ -245,6 +231,47 @@ ArrayContainer FormatImportExportHDF5::readArray(Error* error, int arrayIndex)
             r.globalTagList().set(name, value);
         }
     }
+}
+
+ArrayContainer FormatImportExportHDF5::readArray(Error* error, int arrayIndex)
+{
+    H5::DataSet dataset;
+    H5::DataSpace dataspace;
+    H5::DataType type;
+    Type rType;
+    std::vector<size_t> dims;
+    Error err = openDataSet(arrayIndex, dataset, dataspace, type, rType, dims);
+    if (err != ErrorNone) {
+        *error = err;
+        return ArrayContainer();
+    }
+    ArrayContainer dataArray(dims, 1, rType);
+    try {
+        dataset.read(dataArray.data(), type, dataspace, dataspace);
+    }
+    catch (H5::Exception& e) {
+        *error = ErrorLibrary;
+        return ArrayContainer();
+    }
+    ArrayContainer r = reorderMatlabInputData(dims, rType, dataArray.data());
+    readAttributes(dataset, r);
+    return r;
+}
+
+ArrayDescription FormatImportExportHDF5::readDescription(Error* error, int arrayIndex)
+{
+    H5::DataSet dataset;
+    H5::DataSpace dataspace;
+    H5::DataType type;
+    Type rType;
+    std::vector<size_t> dims;
+    Error err = openDataSet(arrayIndex, dataset, dataspace, type, rType, dims);
+    if (err != ErrorNone) {
+        *error = err;
+        return ArrayDescription();
+    }
+    ArrayDescription r = reorderMatlabInputDescription(dims, rType);
+    readAttributes(dataset, r);
     return r;
 }
 
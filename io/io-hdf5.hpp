@@ -30,6 +30,9 @@
 
 namespace H5 {
     class H5File;
+    class DataSet;
+    class DataSpace;
+    class DataType;
 }
 
 #include "io.hpp"
@@ -41,6 +44,9 @@ private:
     H5::H5File* _f;
     std::vector<std::string> _datasetNames; // for reading only
     int _counter;
+
+    Error openDataSet(int arrayIndex, H5::DataSet& dataset, H5::DataSpace& dataspace,
+            H5::DataType& type, Type& rType, std::vector<size_t>& dims);
     
 public:
     FormatImportExportHDF5();
@@ -54,6 +60,7 @@ public:
     virtual int arrayCount() override;
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
+    virtual ArrayDescription readDescription(Error* error, int arrayIndex = -1 /* -1 means next */) override;
 
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
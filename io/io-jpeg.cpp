@@ -23,6 +23,11 @@
  */
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <algorithm>
 
 #include <setjmp.h>
 #include <jpeglib.h>
@@ -68,10 +73,11 @@ Error FormatImportExportJPEG::openForReading(const std::string& fileName, const
     return _f ? ErrorNone : ErrorSysErrno;
 }
 
-Error FormatImportExportJPEG::openForWriting(const std::string& fileName, bool append, const TagList&)
+Error FormatImportExportJPEG::openForWriting(const std::string& fileName, bool append, const TagList& hints)
 {
     if (append)
         return ErrorFeaturesUnsupported;
+    _hints = hints;
     if (fileName == "-") {
         _f = stdout;
     } else {
@@ -91,6 +97,7 @@ void FormatImportExportJPEG::close()
         _f = nullptr;
     }
     _fileName = std::string();
+    _hints = TagList();
     _arrayWasReadOrWritten = false;
 }
 
@@ -99,107 +106,289 @@ int FormatImportExportJPEG::arrayCount()
     return (_f ? 1 : -1);
 }
 
-ArrayContainer FormatImportExportJPEG::readArray(Error* error, int arrayIndex)
+Error FormatImportExportJPEG::readJpeg(int arrayIndex, ArrayDescription& desc, ArrayContainer* array)
 {
     if (arrayIndex > 0) {
-        *error = ErrorSeekingNotSupported;
-        return ArrayContainer();
+        return ErrorSeekingNotSupported;
     }
     std::rewind(_f);
 
     struct jpeg_decompress_struct cinfo;
     struct my_error_mgr jerr;
+    std::vector<JSAMPROW> jrows;
+    ImageOriginLocation originLocation = getImageOriginLocation(_fileName);
 
     cinfo.err = jpeg_std_error(&jerr.pub);
     jerr.pub.error_exit = my_error_exit;
     if (setjmp(jerr.setjmp_buffer)) {
         jpeg_destroy_decompress(&cinfo);
-        *error = ErrorInvalidData;
-        return ArrayContainer();
+        return ErrorInvalidData;
     }
     jpeg_create_decompress(&cinfo);
     jpeg_stdio_src(&cinfo, _f);
     jpeg_read_header(&cinfo, TRUE);
 
-    ArrayContainer r({cinfo.image_width, cinfo.image_height}, cinfo.num_components, uint8);
+    desc = ArrayDescription({cinfo.image_width, cinfo.image_height}, cinfo.num_components, uint8);
     if (cinfo.num_components == 1) {
-        r.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
+        desc.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
     } else {
-        r.componentTagList(0).set("INTERPRETATION", "SRGB/R");
-        r.componentTagList(1).set("INTERPRETATION", "SRGB/G");
-        r.componentTagList(2).set("INTERPRETATION", "SRGB/B");
+        desc.componentTagList(0).set("INTERPRETATION", "SRGB/R");
+        desc.componentTagList(1).set("INTERPRETATION", "SRGB/G");
+        desc.componentTagList(2).set("INTERPRETATION", "SRGB/B");
     }
-    ImageOriginLocation originLocation = getImageOriginLocation(_fileName);
+
+    if (array) {
+        *array = ArrayContainer(desc);
 #if 0
-    // These flags improve performance, but at unclear costs in quality.
-    cinfo.do_fancy_upsampling = TRUE;
-    cinfo.dct_method = JDCT_FASTEST;
+        // These flags improve performance, but at unclear costs in quality.
+        cinfo.do_fancy_upsampling = TRUE;
+        cinfo.dct_method = JDCT_FASTEST;
 #endif
-    jpeg_start_decompress(&cinfo);
-    std::vector<JSAMPROW> jrows(cinfo.output_height);
-    for (unsigned int i = 0; i < cinfo.output_height; i++) {
-        if (originLocation == OriginTopLeft)
-            jrows[i] = static_cast<unsigned char*>(r.get((cinfo.output_height - 1 - i) * cinfo.image_width));
-        else
-            jrows[i] = static_cast<unsigned char*>(r.get(i * cinfo.image_width));
-    }
-    while (cinfo.output_scanline < cinfo.image_height) {
-        jpeg_read_scanlines(&cinfo, &jrows[cinfo.output_scanline],
-                cinfo.output_height - cinfo.output_scanline);
-    }
-    jpeg_finish_decompress(&cinfo);
+        jpeg_start_decompress(&cinfo);
+        jrows.resize(cinfo.output_height);
+        for (unsigned int i = 0; i < cinfo.output_height; i++) {
+            if (originLocation == OriginTopLeft)
+                jrows[i] = static_cast<unsigned char*>(array->get((cinfo.output_height - 1 - i) * cinfo.image_width));
+            else
+                jrows[i] = static_cast<unsigned char*>(array->get(i * cinfo.image_width));
+        }
+        while (cinfo.output_scanline < cinfo.image_height) {
+            jpeg_read_scanlines(&cinfo, &jrows[cinfo.output_scanline],
+                    cinfo.output_height - cinfo.output_scanline);
+        }
+        jpeg_finish_decompress(&cinfo);
+    }
     jpeg_destroy_decompress(&cinfo);
 
-    if (originLocation != OriginTopLeft)
-        fixImageOrientation(r, originLocation);
+    if (!array)
+        desc = orientedImageDescription(desc, originLocation);
+    else if (originLocation != OriginTopLeft)
+        fixImageOrientation(*array, originLocation);
 
     _arrayWasReadOrWritten = true;
+    return ErrorNone;
+}
 
+ArrayContainer FormatImportExportJPEG::readArray(Error* error, int arrayIndex)
+{
+    ArrayDescription desc;
+    ArrayContainer r;
+    Error e = readJpeg(arrayIndex, desc, &r);
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
+    }
     return r;
 }
 
+ArrayDescription FormatImportExportJPEG::readDescription(Error* error, int arrayIndex)
+{
+    ArrayDescription desc;
+    Error e = readJpeg(arrayIndex, desc, nullptr);
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayDescription();
+    }
+    return desc;
+}
+
 bool FormatImportExportJPEG::hasMore()
 {
     return !_arrayWasReadOrWritten;
 }
 
-Error FormatImportExportJPEG::writeArray(const ArrayContainer& array)
+struct JpegSettings
 {
-    if (array.dimensionCount() != 2
-            || array.dimension(0) <= 0 || array.dimension(1) <= 0
-            || array.dimension(0) > 0x7fffffffL || array.dimension(1) > 0x7fffffffL
-            || array.componentType() != uint8
-            || (array.componentCount() != 1 && array.componentCount() != 3)
-            || _arrayWasReadOrWritten) {
-        return ErrorFeaturesUnsupported;
+    int quality;
+    int hSamp, vSamp; // sampling factors of the luma component
+    bool optimize;
+    J_DCT_METHOD dctMethod;
+};
+
+static bool getJpegSettings(const TagList& hints, JpegSettings& settings)
+{
+    settings.quality = hints.value("QUALITY", 85);
+    if (settings.quality < 1 || settings.quality > 100)
+        return false;
+    std::string subsampling = hints.value("SUBSAMPLING", "420");
+    if (subsampling == "444") {
+        settings.hSamp = 1;
+        settings.vSamp = 1;
+    } else if (subsampling == "422") {
+        settings.hSamp = 2;
+        settings.vSamp = 1;
+    } else if (subsampling == "420") {
+        settings.hSamp = 2;
+        settings.vSamp = 2;
+    } else {
+        return false;
     }
+    settings.optimize = (hints.value("OPTIMIZE", 0) != 0);
+    std::string dct = hints.value("DCT", "islow");
+    if (dct == "islow")
+        settings.dctMethod = JDCT_ISLOW;
+    else if (dct == "ifast")
+        settings.dctMethod = JDCT_IFAST;
+    else if (dct == "float")
+        settings.dctMethod = JDCT_FLOAT;
+    else
+        return false;
+    return true;
+}
 
+/* Compress the given rows (counted from the top of the image) into a
+ * complete JPEG in memory. If restartRows is not zero, a restart marker
+ * is inserted every restartRows MCU rows. */
+static bool compressRows(const ArrayContainer& array, size_t firstRow, size_t rows,
+        const JpegSettings& settings, int restartRows, std::vector<unsigned char>& out)
+{
     struct jpeg_compress_struct cinfo;
     struct my_error_mgr jerr;
+    unsigned char* buffer = nullptr;
+    unsigned long bufferSize = 0;
+    std::vector<JSAMPROW> jrows(rows);
+    for (size_t i = 0; i < rows; i++)
+        jrows[i] = static_cast<unsigned char*>(const_cast<void*>(array.get((array.dimension(1) - 1 - (firstRow + i)) * array.dimension(0))));
 
     cinfo.err = jpeg_std_error(&jerr.pub);
     jerr.pub.error_exit = my_error_exit;
     if (setjmp(jerr.setjmp_buffer)) {
         jpeg_destroy_compress(&cinfo);
-        return ErrorInvalidData;
+        free(buffer);
+        return false;
     }
     jpeg_create_compress(&cinfo);
-    jpeg_stdio_dest(&cinfo, _f);
+    jpeg_mem_dest(&cinfo, &buffer, &bufferSize);
     cinfo.image_width = array.dimension(0);
-    cinfo.image_height = array.dimension(1);
+    cinfo.image_height = rows;
     cinfo.input_components = array.componentCount();
     cinfo.in_color_space = (array.componentCount() == 1 ? JCS_GRAYSCALE : JCS_RGB);
     jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, 85, TRUE);
-
+    jpeg_set_quality(&cinfo, settings.quality, TRUE);
+    if (array.componentCount() == 3) {
+        cinfo.comp_info[0].h_samp_factor = settings.hSamp;
+        cinfo.comp_info[0].v_samp_factor = settings.vSamp;
+    }
+    cinfo.optimize_coding = (settings.optimize ? TRUE : FALSE);
+    cinfo.dct_method = settings.dctMethod;
+    cinfo.restart_in_rows = restartRows;
     jpeg_start_compress(&cinfo, TRUE);
-    std::vector<JSAMPROW> jrows(cinfo.image_height);
-    for (unsigned int i = 0; i < cinfo.image_height; i++)
-        jrows[i] = static_cast<unsigned char*>(const_cast<void*>(array.get((cinfo.image_height - 1 - i) * cinfo.image_width)));
-    jpeg_write_scanlines(&cinfo, jrows.data(), cinfo.image_height);
+    jpeg_write_scanlines(&cinfo, jrows.data(), rows);
     jpeg_finish_compress(&cinfo);
     jpeg_destroy_compress(&cinfo);
-    if (fflush(_f) != 0) {
+    out.assign(buffer, buffer + bufferSize);
+    free(buffer);
+    return true;
+}
+
+/* Find the end of the SOS marker segment, i.e. the start of the entropy-coded
+ * data, and optionally the offset of the SOF marker. Returns 0 on failure. */
+static size_t findScanData(const std::vector<unsigned char>& jpeg, size_t* sofOffset)
+{
+    size_t i = 2; // skip SOI
+    while (i + 4 <= jpeg.size()) {
+        if (jpeg[i] != 0xff)
+            return 0;
+        unsigned char marker = jpeg[i + 1];
+        size_t length = (size_t(jpeg[i + 2]) << 8) | jpeg[i + 3];
+        if (marker == 0xc0 && sofOffset)
+            *sofOffset = i;
+        if (marker == 0xda)
+            return (i + 2 + length <= jpeg.size() ? i + 2 + length : 0);
+        i += 2 + length;
+    }
+    return 0;
+}
+
+/* Encode horizontal bands of the image in parallel, with a restart marker
+ * after each MCU row, and splice them into one baseline JPEG: the headers of
+ * the first band (with the full image height), then the entropy-coded data
+ * of all bands, separated by restart markers and renumbered so that the
+ * restart marker sequence is continuous. */
+static bool compressParallel(const ArrayContainer& array, const JpegSettings& settings,
+        int threadCount, std::vector<unsigned char>& out)
+{
+    const size_t height = array.dimension(1);
+    const size_t mcuHeight = (array.componentCount() == 3 ? 8 * settings.vSamp : 8);
+    const size_t mcuRows = (height + mcuHeight - 1) / mcuHeight;
+    const size_t mcuRowsPerBand = (mcuRows + threadCount - 1) / threadCount;
+    const size_t bandCount = (mcuRows + mcuRowsPerBand - 1) / mcuRowsPerBand;
+
+    std::vector<std::vector<unsigned char>> bands(bandCount);
+    std::vector<char> ok(bandCount, 0);
+    std::vector<std::thread> threads;
+    for (size_t b = 0; b < bandCount; b++) {
+        threads.push_back(std::thread([&, b]() {
+            size_t firstRow = b * mcuRowsPerBand * mcuHeight;
+            size_t rows = std::min(mcuRowsPerBand * mcuHeight, height - firstRow);
+            ok[b] = compressRows(array, firstRow, rows, settings, 1, bands[b]);
+        }));
+    }
+    for (size_t b = 0; b < bandCount; b++)
+        threads[b].join();
+    if (std::find(ok.begin(), ok.end(), 0) != ok.end())
+        return false;
+
+    size_t sofOffset = 0;
+    size_t headerSize = findScanData(bands[0], &sofOffset);
+    if (headerSize == 0 || sofOffset == 0)
+        return false;
+    out.assign(bands[0].begin(), bands[0].begin() + headerSize);
+    out[sofOffset + 5] = height >> 8;
+    out[sofOffset + 6] = height & 0xff;
+    size_t restartInterval = 0; // index of the first restart interval of the current band
+    for (size_t b = 0; b < bandCount; b++) {
+        const std::vector<unsigned char>& band = bands[b];
+        size_t start = findScanData(band, nullptr);
+        if (start == 0 || band.size() < start + 2)
+            return false;
+        size_t end = band.size() - 2; // skip EOI
+        if (b > 0) {
+            out.push_back(0xff);
+            out.push_back(0xd0 + (restartInterval - 1) % 8);
+        }
+        for (size_t i = start; i < end; i++) {
+            out.push_back(band[i]);
+            if (band[i] == 0xff && i + 1 < end && band[i + 1] >= 0xd0 && band[i + 1] <= 0xd7) {
+                out.push_back(0xd0 + (band[i + 1] - 0xd0 + restartInterval) % 8);
+                i++;
+            }
+        }
+        restartInterval += mcuRowsPerBand;
+    }
+    out.push_back(0xff);
+    out.push_back(0xd9);
+    return true;
+}
+
+Error FormatImportExportJPEG::writeArray(const ArrayContainer& array)
+{
+    if (array.dimensionCount() != 2
+            || array.dimension(0) <= 0 || array.dimension(1) <= 0
+            || array.dimension(0) > JPEG_MAX_DIMENSION || array.dimension(1) > JPEG_MAX_DIMENSION
+            || array.componentType() != uint8
+            || (array.componentCount() != 1 && array.componentCount() != 3)
+            || _arrayWasReadOrWritten) {
+        return ErrorFeaturesUnsupported;
+    }
+    JpegSettings settings;
+    if (!getJpegSettings(_hints, settings))
+        return ErrorInvalidData;
+
+    // Parallel encoding needs the same Huffman tables for all bands,
+    // so it cannot be combined with optimized tables.
+    int threadCount = _hints.value("THREADS", int(std::max(1u, std::thread::hardware_concurrency())));
+    size_t mcuHeight = (array.componentCount() == 3 ? 8 * settings.vSamp : 8);
+    threadCount = std::min(threadCount, int((array.dimension(1) + mcuHeight - 1) / mcuHeight));
+    std::vector<unsigned char> data;
+    bool ok;
+    if (threadCount > 1 && !settings.optimize)
+        ok = compressParallel(array, settings, threadCount, data);
+    else
+        ok = compressRows(array, 0, array.dimension(1), settings, 0, data);
+    if (!ok)
+        return ErrorInvalidData;
+    if (fwrite(data.data(), data.size(), 1, _f) != 1 || fflush(_f) != 0) {
         return ErrorSysErrno;
     }
     _arrayWasReadOrWritten = true;
@@ -35,8 +35,11 @@ class FormatImportExportJPEG : public FormatImportExport {
 private:
     FILE* _f;
     std::string _fileName;
+    TagList _hints;
     bool _arrayWasReadOrWritten;
 
+    Error readJpeg(int arrayIndex, ArrayDescription& desc, ArrayContainer* array);
+
 public:
     FormatImportExportJPEG();
     ~FormatImportExportJPEG();
@@ -49,6 +52,7 @@ public:
     virtual int arrayCount() override;
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
+    virtual ArrayDescription readDescription(Error* error, int arrayIndex = -1 /* -1 means next */) override;
 
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
@@ -25,7 +25,9 @@
 #include "io-utils.hpp"
 
 #include <vector>
+#include <map>
 #include <limits>
+#include <cmath>
 
 #include <Magick++.h>
 #if MagickLibVersion < 0x700
@@ -46,7 +48,7 @@ public:
 };
 
 FormatImportExportMagick::FormatImportExportMagick() :
-    _fileName(), _triedReading(false), _magick(new TGDMagick), _lastArrayIndex(-1)
+    _fileName(), _indexed(false), _triedReading(false), _magick(new TGDMagick), _lastArrayIndex(-1)
 {
     Magick::InitializeMagick(0);
 }
@@ -56,8 +58,9 @@ FormatImportExportMagick::~FormatImportExportMagick()
     delete _magick;
 }
 
-Error FormatImportExportMagick::openForReading(const std::string& fileName, const TagList&)
+Error FormatImportExportMagick::openForReading(const std::string& fileName, const TagList& hints)
 {
+    _indexed = (hints.value("INDEXED", 0) != 0);
     if (fileName == "-")
         return ErrorInvalidData;
     FILE* f = fopen(fileName.c_str(), "rb");
@@ -95,6 +98,54 @@ static bool readImagesOnce(const std::string& fileName, bool& triedReading, std:
     return (imgs.size() > 0);
 }
 
+// Try to represent a palette image (e.g. from a GIF file) as an array of
+// uint8 indices into its color map. Returns a null array if this fails.
+static ArrayContainer readIndexedImage(Magick::Image& img, bool hasAlpha)
+{
+    if (img.classType() != Magick::PseudoClass
+            || img.colorMapSize() == 0 || img.colorMapSize() > 256)
+        return ArrayContainer();
+
+    size_t width = img.columns();
+    size_t height = img.rows();
+    size_t paletteSize = img.colorMapSize();
+    size_t paletteChannels = (hasAlpha ? 4 : 3);
+    std::vector<uint8_t> palette(paletteSize * paletteChannels, 255);
+    // Pixels are mapped back to indices by their RGBA value, which is
+    // ambiguous if two entries are the same
+    std::map<uint32_t, uint8_t> colorToIndex;
+    for (size_t i = 0; i < paletteSize; i++) {
+        Magick::ColorRGB color(img.colorMap(i));
+        uint32_t r = std::round(color.red() * 255.0);
+        uint32_t g = std::round(color.green() * 255.0);
+        uint32_t b = std::round(color.blue() * 255.0);
+        uint32_t a = (hasAlpha ? uint32_t(std::round(color.alpha() * 255.0)) : 255);
+        palette[i * paletteChannels + 0] = r;
+        palette[i * paletteChannels + 1] = g;
+        palette[i * paletteChannels + 2] = b;
+        if (hasAlpha)
+            palette[i * paletteChannels + 3] = a;
+        if (!colorToIndex.insert(std::make_pair((r << 24) | (g << 16) | (b << 8) | a, i)).second)
+            return ArrayContainer();
+    }
+
+    std::vector<uint8_t> pixels(width * height * paletteChannels);
+    img.write(0, 0, width, height, hasAlpha ? "RGBA" : "RGB", Magick::CharPixel, pixels.data());
+    ArrayContainer array({ width, height }, 1, uint8);
+    uint8_t* indices = static_cast<uint8_t*>(array.data());
+    for (size_t e = 0; e < width * height; e++) {
+        const uint8_t* p = pixels.data() + e * paletteChannels;
+        uint32_t a = (hasAlpha ? p[3] : 255);
+        auto it = colorToIndex.find((uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | a);
+        if (it == colorToIndex.end())
+            return ArrayContainer();
+        indices[e] = it->second;
+    }
+    array.componentTagList(0).set("INTERPRETATION", "INDEX");
+    array.componentTagList(0).set("PALETTE", paletteToString(palette, paletteChannels));
+    return array;
+}
+
 int FormatImportExportMagick::arrayCount()
 {
     readImagesOnce(_fileName, _triedReading, _magick->imgs);
@@ -124,16 +175,21 @@ ArrayContainer FormatImportExportMagick::readArray(Error* error, int arrayIndex)
         bool isGray = (img.colorSpaceType() == Magick::GRAYColorspace);
         unsigned int channels = (isGray ? 1 : 3) + (hasAlpha ? 1 : 0);
 
-        array = TGD::ArrayContainer({ width, height }, channels, type);
-        if (isGray) {
-            array.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
-        } else {
-            array.componentTagList(0).set("INTERPRETATION", "SRGB/R");
-            array.componentTagList(1).set("INTERPRETATION", "SRGB/G");
-            array.componentTagList(2).set("INTERPRETATION", "SRGB/B");
-        }
-        if (hasAlpha) {
-            array.componentTagList(isGray ? 1 : 3).set("INTERPRETATION", "ALPHA");
+        if (_indexed)
+            array = readIndexedImage(img, hasAlpha);
+        bool isIndexed = (array.dimensionCount() > 0);
+        if (!isIndexed) {
+            array = TGD::ArrayContainer({ width, height }, channels, type);
+            if (isGray) {
+                array.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
+            } else {
+                array.componentTagList(0).set("INTERPRETATION", "SRGB/R");
+                array.componentTagList(1).set("INTERPRETATION", "SRGB/G");
+                array.componentTagList(2).set("INTERPRETATION", "SRGB/B");
+            }
+            if (hasAlpha) {
+                array.componentTagList(isGray ? 1 : 3).set("INTERPRETATION", "ALPHA");
+            }
         }
         switch (img.orientation()) {
         case Magick::UndefinedOrientation:
@@ -164,12 +220,14 @@ ArrayContainer FormatImportExportMagick::readArray(Error* error, int arrayIndex)
             break;
         }
 
-        Magick::StorageType storageType = (type == uint8 ? Magick::CharPixel
-                : type == uint16 ? Magick::ShortPixel : Magick::FloatPixel);
-        std::string map = (isGray ? "I" : "RGB");
-        if (hasAlpha)
-            map += "A";
-        img.write(0, 0, width, height, map.c_str(), storageType, array.data());
+        if (!isIndexed) {
+            Magick::StorageType storageType = (type == uint8 ? Magick::CharPixel
+                    : type == uint16 ? Magick::ShortPixel : Magick::FloatPixel);
+            std::string map = (isGray ? "I" : "RGB");
+            if (hasAlpha)
+                map += "A";
+            img.write(0, 0, width, height, map.c_str(), storageType, array.data());
+        }
     }
     catch (...) {
         *error = ErrorInvalidData;
@@ -33,6 +33,7 @@ class TGDMagick;
 class FormatImportExportMagick : public FormatImportExport {
 private:
     std::string _fileName;
+    bool _indexed;
     bool _triedReading;
     TGDMagick* _magick;
     int _lastArrayIndex;
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cstdint>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "io-mmap.hpp"
+
+
+namespace TGD {
+
+FileMapper::FileMapper()
+{
+}
+
+FileMapper::~FileMapper()
+{
+    close();
+}
+
+bool FileMapper::isSupported(FILE* f)
+{
+    // Shared writable mappings require a regular file that is opened for reading, too
+    struct stat statbuf;
+    int flags = fcntl(fileno(f), F_GETFL);
+    return (fstat(fileno(f), &statbuf) == 0 && (statbuf.st_mode & S_IFMT) == S_IFREG
+            && flags >= 0 && (flags & O_ACCMODE) == O_RDWR);
+}
+
+ArrayContainer FileMapper::map(FILE* f, const ArrayDescription& desc, Error* error)
+{
+    struct stat statbuf;
+    if (!isSupported(f)) {
+        *error = ErrorFeaturesUnsupported;
+        return ArrayContainer();
+    }
+    off_t pos;
+    if (std::fflush(f) != 0 || (pos = ftello(f)) < 0 || fstat(fileno(f), &statbuf) != 0) {
+        *error = ErrorSysErrno;
+        return ArrayContainer();
+    }
+    size_t size = desc.dataSize();
+    if (size == 0) {
+        return ArrayContainer(desc);
+    }
+    // Grow the file to its final size. This does not allocate disk space on most
+    // file systems, and the new region reads as zeroes.
+    if (statbuf.st_size < off_t(pos + size) && ftruncate(fileno(f), pos + size) != 0) {
+        *error = ErrorSysErrno;
+        return ArrayContainer();
+    }
+    // The mapping must start at a page boundary
+    off_t pageSize = sysconf(_SC_PAGESIZE);
+    off_t offset = pos / pageSize * pageSize;
+    size_t skip = pos - offset;
+    void* addr = mmap(nullptr, skip + size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(f), offset);
+    if (addr == MAP_FAILED) {
+        // shrink the file again, but report the mmap error
+        int mmapErrno = errno;
+        if (statbuf.st_size < off_t(pos + size) && ftruncate(fileno(f), statbuf.st_size) != 0)
+            mmapErrno = errno;
+        errno = mmapErrno;
+        *error = ErrorSysErrno;
+        return ArrayContainer();
+    }
+    size_t length = skip + size;
+    std::shared_ptr<unsigned char[]> data(static_cast<unsigned char*>(addr) + skip,
+            [addr, length] (unsigned char*) { munmap(addr, length); });
+    if (fseeko(f, pos + size, SEEK_SET) != 0) {
+        *error = ErrorSysErrno;
+        return ArrayContainer();
+    }
+    // forget about mappings that are not in use anymore
+    for (size_t i = 0; i < _mappings.size(); ) {
+        if (_mappings[i].data.expired()) {
+            _mappings[i] = _mappings.back();
+            _mappings.pop_back();
+        } else {
+            i++;
+        }
+    }
+    _mappings.push_back({ data, addr, length });
+    return ArrayContainer(desc, data);
+}
+
+void FileMapper::close()
+{
+    for (size_t i = 0; i < _mappings.size(); i++) {
+        // keep the mapping alive while we flush it
+        std::shared_ptr<unsigned char[]> data = _mappings[i].data.lock();
+        if (data)
+            msync(_mappings[i].addr, _mappings[i].length, MS_SYNC);
+    }
+    _mappings.clear();
+}
+
+ArrayContainer mapFileData(FILE* f, off_t offset, const ArrayDescription& desc)
+{
+    struct stat statbuf;
+    size_t size = desc.dataSize();
+    if (size == 0 || offset < 0 || fstat(fileno(f), &statbuf) != 0 || (statbuf.st_mode & S_IFMT) != S_IFREG
+            || uint64_t(offset) + size > uint64_t(statbuf.st_size)) {
+        return ArrayContainer();
+    }
+    // The mapping must start at a page boundary
+    off_t pageSize = sysconf(_SC_PAGESIZE);
+    off_t start = offset / pageSize * pageSize;
+    size_t skip = offset - start;
+    size_t length = skip + size;
+    void* addr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(f), start);
+    if (addr == MAP_FAILED)
+        return ArrayContainer();
+    return ArrayContainer(desc, std::shared_ptr<unsigned char[]>(static_cast<unsigned char*>(addr) + skip,
+                [addr, length] (unsigned char*) { munmap(addr, length); }));
+}
+
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TGD_IO_MMAP_HPP
+#define TGD_IO_MMAP_HPP
+
+#include <cstdio>
+#include <vector>
+#include <memory>
+
+#include "io.hpp"
+
+namespace TGD {
+
+/* Maps array data regions of an output file into memory, for
+ * FormatImportExport::mapArray(). The mappings are owned by the returned
+ * arrays; the mapper only keeps track of them so that their data can be
+ * flushed when the file is closed. */
+class FileMapper {
+private:
+    struct Mapping {
+        std::weak_ptr<unsigned char[]> data;
+        void* addr;
+        size_t length;
+    };
+    std::vector<Mapping> _mappings;
+
+public:
+    FileMapper();
+    ~FileMapper();
+
+    /* Return whether the data of f can be mapped, i.e. whether f is a regular file
+     * opened for reading and writing. */
+    static bool isSupported(FILE* f);
+
+    /* Extend the file by desc.dataSize() bytes at the current position of f,
+     * map that region, and advance f past it. Everything in front of the
+     * region must already be written to f. */
+    ArrayContainer map(FILE* f, const ArrayDescription& desc, Error* error);
+
+    /* Flush the data of all mappings that are still in use. */
+    void close();
+};
+
+/* Map desc.dataSize() bytes at the given offset of f privately, so that
+ * changes to the array do not affect the file. Returns an array without data
+ * if f is not a regular file, is too short, or cannot be mapped; the caller
+ * then reads the data instead. Does not change the file position. */
+ArrayContainer mapFileData(FILE* f, off_t offset, const ArrayDescription& desc);
+
+}
+
+#endif
@@ -0,0 +1,642 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <cctype>
+#include <vector>
+#include <algorithm>
+
+#include "io-nifti.hpp"
+#include "io-mmap.hpp"
+#include "io-utils.hpp"
+
+
+namespace TGD {
+
+/* Header field access in file byte order */
+
+static uint64_t getBytes(const unsigned char* p, size_t n, bool swap)
+{
+    unsigned char b[8];
+    for (size_t i = 0; i < n; i++)
+        b[i] = p[swap ? n - 1 - i : i];
+    uint64_t v = 0;
+    if (n == 2) {
+        uint16_t x;
+        std::memcpy(&x, b, 2);
+        v = x;
+    } else if (n == 4) {
+        uint32_t x;
+        std::memcpy(&x, b, 4);
+        v = x;
+    } else {
+        std::memcpy(&v, b, 8);
+    }
+    return v;
+}
+
+static int16_t getInt16(const unsigned char* p, bool swap) { return getBytes(p, 2, swap); }
+static int32_t getInt32(const unsigned char* p, bool swap) { return getBytes(p, 4, swap); }
+static int64_t getInt64(const unsigned char* p, bool swap) { return getBytes(p, 8, swap); }
+
+static float getFloat(const unsigned char* p, bool swap)
+{
+    uint32_t x = getBytes(p, 4, swap);
+    float v;
+    std::memcpy(&v, &x, 4);
+    return v;
+}
+
+static double getDouble(const unsigned char* p, bool swap)
+{
+    uint64_t x = getBytes(p, 8, swap);
+    double v;
+    std::memcpy(&v, &x, 8);
+    return v;
+}
+
+template<typename T> static void put(unsigned char* p, T value)
+{
+    std::memcpy(p, &value, sizeof(T));
+}
+
+static std::string numberToString(double v)
+{
+    if (v == 0.0) // no negative zero
+        v = 0.0;
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.9g", v);
+    return buf;
+}
+
+static std::vector<double> numbersFromString(const std::string& s)
+{
+    std::vector<double> v;
+    const char* p = s.c_str();
+    for (;;) {
+        char* end;
+        double x = std::strtod(p, &end);
+        if (end == p)
+            break;
+        v.push_back(x);
+        p = end;
+    }
+    return v;
+}
+
+/* Convert a SAMPLE_DISTANCE tag to millimeters (spatial) or seconds (temporal) */
+static double sampleDistanceFromTag(const std::string& s, bool spatial)
+{
+    char* end;
+    double v = std::strtod(s.c_str(), &end);
+    if (end == s.c_str() || !(v > 0.0))
+        return 1.0;
+    while (*end == ' ')
+        end++;
+    std::string unit(end);
+    if (spatial) {
+        if (unit == "m")
+            v *= 1000.0;
+        else if (unit == "um" || unit == "µm")
+            v *= 0.001;
+    } else {
+        if (unit == "ms")
+            v *= 0.001;
+        else if (unit == "us" || unit == "µs")
+            v *= 0.000001;
+    }
+    return v;
+}
+
+static bool typeFromNiftiDatatype(int datatype, Type* type, size_t* components)
+{
+    *components = 1;
+    switch (datatype) {
+    case 2:    *type = uint8;   break;
+    case 4:    *type = int16;   break;
+    case 8:    *type = int32;   break;
+    case 16:   *type = float32; break;
+    case 32:   *type = float32; *components = 2; break;
+    case 64:   *type = float64; break;
+    case 128:  *type = uint8;   *components = 3; break;
+    case 256:  *type = int8;    break;
+    case 512:  *type = uint16;  break;
+    case 768:  *type = uint32;  break;
+    case 1024: *type = int64;   break;
+    case 1280: *type = uint64;  break;
+    case 1792: *type = float64; *components = 2; break;
+    case 2304: *type = uint8;   *components = 4; break;
+    default:   return false;
+    }
+    return true;
+}
+
+static int niftiDatatypeFromType(Type type, size_t components)
+{
+    if (components == 1) {
+        switch (type) {
+        case int8:    return 256;
+        case uint8:   return 2;
+        case int16:   return 4;
+        case uint16:  return 512;
+        case int32:   return 8;
+        case uint32:  return 768;
+        case int64:   return 1024;
+        case uint64:  return 1280;
+        case float32: return 16;
+        case float64: return 64;
+        }
+    } else if (components == 2 && type == float32) {
+        return 32;
+    } else if (components == 2 && type == float64) {
+        return 1792;
+    } else if (components == 3 && type == uint8) {
+        return 128;
+    } else if (components == 4 && type == uint8) {
+        return 2304;
+    }
+    return 0;
+}
+
+static bool endsWith(const std::string& s, const std::string& suffix)
+{
+    if (s.length() < suffix.length())
+        return false;
+    for (size_t i = 0; i < suffix.length(); i++)
+        if (std::tolower(s[s.length() - suffix.length() + i]) != suffix[i])
+            return false;
+    return true;
+}
+
+FormatImportExportNIfTI::FormatImportExportNIfTI() :
+    _f(nullptr), _dataF(nullptr), _gzip(false), _swap(false), _dataOffset(0), _pos(0), _done(false)
+{
+}
+
+FormatImportExportNIfTI::~FormatImportExportNIfTI()
+{
+    close();
+}
+
+Error FormatImportExportNIfTI::readBytes(void* data, size_t size)
+{
+    Error e;
+    if (_gzip)
+        e = _gzipReader.read(data, size);
+    else if (size > 0 && std::fread(data, size, 1, _dataF) != 1)
+        e = std::ferror(_dataF) ? ErrorSysErrno : ErrorInvalidData;
+    else
+        e = ErrorNone;
+    if (e == ErrorNone)
+        _pos += size;
+    return e;
+}
+
+/* Start reading the file f, which may be gzip-compressed */
+static Error startReading(FILE* f, bool* gzip, GzipReader& gzipReader)
+{
+    int c = std::getc(f);
+    if (c == EOF)
+        return std::ferror(f) ? ErrorSysErrno : ErrorInvalidData;
+    if (std::ungetc(c, f) == EOF)
+        return ErrorSysErrno;
+    // No NIfTI header starts with the first byte of the gzip magic number
+    *gzip = (c == 0x1f);
+    return *gzip ? gzipReader.open(f) : ErrorNone;
+}
+
+Error FormatImportExportNIfTI::readHeader()
+{
+    unsigned char h[540];
+    Error e = readBytes(h, 348);
+    if (e != ErrorNone)
+        return e;
+    int version;
+    int32_t sizeofHdr = getInt32(h, false);
+    if (sizeofHdr == 348 || sizeofHdr == 540) {
+        _swap = false;
+    } else {
+        sizeofHdr = getInt32(h, true);
+        if (sizeofHdr != 348 && sizeofHdr != 540)
+            return ErrorInvalidData;
+        _swap = true;
+    }
+    version = (sizeofHdr == 348 ? 1 : 2);
+    if (version == 2 && (e = readBytes(h + 348, 540 - 348)) != ErrorNone)
+        return e;
+
+    bool pair;
+    int datatype;
+    int64_t dim[8];
+    double pixdim[8];
+    double sclSlope, sclInter;
+    int qformCode, sformCode;
+    double quatern[3], qoffset[3], srow[3][4];
+    int xyztUnits;
+    char descrip[81];
+    if (version == 1) {
+        if (std::memcmp(h + 344, "n+1", 4) != 0 && std::memcmp(h + 344, "ni1", 4) != 0)
+            return ErrorInvalidData;
+        pair = (h[345] == 'i');
+        datatype = getInt16(h + 70, _swap);
+        for (int i = 0; i < 8; i++) {
+            dim[i] = getInt16(h + 40 + 2 * i, _swap);
+            pixdim[i] = getFloat(h + 76 + 4 * i, _swap);
+        }
+        _dataOffset = getFloat(h + 108, _swap);
+        sclSlope = getFloat(h + 112, _swap);
+        sclInter = getFloat(h + 116, _swap);
+        xyztUnits = h[123];
+        std::memcpy(descrip, h + 148, 80);
+        qformCode = getInt16(h + 252, _swap);
+        sformCode = getInt16(h + 254, _swap);
+        for (int i = 0; i < 3; i++) {
+            quatern[i] = getFloat(h + 256 + 4 * i, _swap);
+            qoffset[i] = getFloat(h + 268 + 4 * i, _swap);
+            for (int j = 0; j < 4; j++)
+                srow[i][j] = getFloat(h + 280 + 16 * i + 4 * j, _swap);
+        }
+    } else {
+        if ((std::memcmp(h + 4, "n+2", 4) != 0 && std::memcmp(h + 4, "ni2", 4) != 0)
+                || std::memcmp(h + 8, "\r\n\032\n", 4) != 0)
+            return ErrorInvalidData;
+        pair = (h[5] == 'i');
+        datatype = getInt16(h + 12, _swap);
+        for (int i = 0; i < 8; i++) {
+            dim[i] = getInt64(h + 16 + 8 * i, _swap);
+            pixdim[i] = getDouble(h + 104 + 8 * i, _swap);
+        }
+        _dataOffset = getInt64(h + 168, _swap);
+        sclSlope = getDouble(h + 176, _swap);
+        sclInter = getDouble(h + 184, _swap);
+        std::memcpy(descrip, h + 240, 80);
+        qformCode = getInt32(h + 344, _swap);
+        sformCode = getInt32(h + 348, _swap);
+        for (int i = 0; i < 3; i++) {
+            quatern[i] = getDouble(h + 352 + 8 * i, _swap);
+            qoffset[i] = getDouble(h + 376 + 8 * i, _swap);
+            for (int j = 0; j < 4; j++)
+                srow[i][j] = getDouble(h + 400 + 32 * i + 8 * j, _swap);
+        }
+        xyztUnits = getInt32(h + 500, _swap);
+    }
+    descrip[80] = '\0';
+
+    Type type;
+    size_t components;
+    if (dim[0] < 1 || dim[0] > 7 || (!pair && _dataOffset < sizeofHdr) || _dataOffset < 0)
+        return ErrorInvalidData;
+    if (!typeFromNiftiDatatype(datatype, &type, &components))
+        return ErrorFeaturesUnsupported;
+    std::vector<size_t> dimensions(dim[0]);
+    for (int i = 0; i < dim[0]; i++) {
+        if (dim[i + 1] < 1)
+            return ErrorInvalidData;
+        dimensions[i] = dim[i + 1];
+    }
+    _desc = ArrayDescription(dimensions, components, type);
+    if (_swap && _desc.componentSize() == 1)
+        _swap = false;
+
+    if (descrip[0])
+        _desc.globalTagList().set("DESCRIPTION", descrip);
+    if (sclSlope != 0.0 && !(sclSlope == 1.0 && sclInter == 0.0)) {
+        _desc.globalTagList().set("NIFTI/SCL_SLOPE", numberToString(sclSlope));
+        _desc.globalTagList().set("NIFTI/SCL_INTER", numberToString(sclInter));
+    }
+    const char* spaceUnit = ((xyztUnits & 0x07) == 1 ? " m" : (xyztUnits & 0x07) == 2 ? " mm"
+            : (xyztUnits & 0x07) == 3 ? " um" : "");
+    const char* timeUnit = ((xyztUnits & 0x38) == 8 ? " s" : (xyztUnits & 0x38) == 16 ? " ms"
+            : (xyztUnits & 0x38) == 24 ? " us" : "");
+    for (size_t i = 0; i < dimensions.size(); i++)
+        if (pixdim[i + 1] > 0.0)
+            _desc.dimensionTagList(i).set("SAMPLE_DISTANCE", numberToString(pixdim[i + 1]) + (i < 3 ? spaceUnit : timeUnit));
+
+    // The orientation; the sform takes precedence. An sform with a zero
+    // column has no orientation, so it is ignored instead of failing.
+    double m[3][3], origin[3];
+    bool haveOrientation = false;
+    double norm[3] = { 0.0, 0.0, 0.0 };
+    for (int j = 0; sformCode > 0 && j < 3; j++) {
+        norm[j] = std::sqrt(srow[0][j] * srow[0][j] + srow[1][j] * srow[1][j] + srow[2][j] * srow[2][j]);
+        if (!(norm[j] > 0.0))
+            sformCode = 0;
+    }
+    if (sformCode > 0) {
+        for (int j = 0; j < 3; j++) {
+            for (int i = 0; i < 3; i++)
+                m[i][j] = srow[i][j] / norm[j];
+            if (size_t(j) < dimensions.size())
+                _desc.dimensionTagList(j).set("SAMPLE_DISTANCE", numberToString(norm[j]) + spaceUnit);
+        }
+        for (int i = 0; i < 3; i++)
+            origin[i] = srow[i][3];
+        _desc.globalTagList().set("NIFTI/XFORM_CODE", std::to_string(sformCode));
+        haveOrientation = true;
+    } else if (qformCode > 0) {
+        double b = quatern[0], c = quatern[1], d = quatern[2];
+        double a = 1.0 - (b * b + c * c + d * d);
+        if (a < 1e-7) {
+            a = 1.0 / std::sqrt(b * b + c * c + d * d);
+            b *= a;
+            c *= a;
+            d *= a;
+            a = 0.0;
+        } else {
+            a = std::sqrt(a);
+        }
+        double qfac = (pixdim[0] < 0.0 ? -1.0 : 1.0);
+        m[0][0] = a * a + b * b - c * c - d * d;
+        m[0][1] = 2.0 * (b * c - a * d);
+        m[0][2] = 2.0 * (b * d + a * c) * qfac;
+        m[1][0] = 2.0 * (b * c + a * d);
+        m[1][1] = a * a + c * c - b * b - d * d;
+        m[1][2] = 2.0 * (c * d - a * b) * qfac;
+        m[2][0] = 2.0 * (b * d - a * c);
+        m[2][1] = 2.0 * (c * d + a * b);
+        m[2][2] = (a * a + d * d - c * c - b * b) * qfac;
+        for (int i = 0; i < 3; i++)
+            origin[i] = qoffset[i];
+        _desc.globalTagList().set("NIFTI/XFORM_CODE", std::to_string(qformCode));
+        haveOrientation = true;
+    }
+    if (haveOrientation) {
+        _desc.globalTagList().set("SPACE", "RAS");
+        _desc.globalTagList().set("ORIGIN", numberToString(origin[0]) + ' '
+                + numberToString(origin[1]) + ' ' + numberToString(origin[2]));
+        for (size_t j = 0; j < std::min(dimensions.size(), size_t(3)); j++)
+            _desc.dimensionTagList(j).set("DIRECTION", numberToString(m[0][j]) + ' '
+                    + numberToString(m[1][j]) + ' ' + numberToString(m[2][j]));
+    }
+
+    return pair ? openDataFile() : ErrorNone;
+}
+
+/* Switch to the .img file of a .hdr/.img pair */
+Error FormatImportExportNIfTI::openDataFile()
+{
+    std::string imgName;
+    if (endsWith(_fileName, ".hdr"))
+        imgName = _fileName.substr(0, _fileName.length() - 3) + (_fileName.back() == 'R' ? "IMG" : "img");
+    else if (endsWith(_fileName, ".hdr.gz"))
+        imgName = _fileName.substr(0, _fileName.length() - 6) + "img.gz";
+    else
+        return ErrorInvalidData;
+    _gzipReader.close();
+    _dataF = fopen(imgName.c_str(), "rb");
+    if (!_dataF)
+        return ErrorSysErrno;
+    _pos = 0;
+    return startReading(_dataF, &_gzip, _gzipReader);
+}
+
+Error FormatImportExportNIfTI::openForReading(const std::string& fileName, const TagList& hints)
+{
+    if (fileName == "-")
+        _f = stdin;
+    else
+        _f = fopen(fileName.c_str(), "rb");
+    if (!_f)
+        return ErrorSysErrno;
+    _fileName = fileName;
+    _hints = hints;
+    _dataF = _f;
+    _pos = 0;
+    _done = false;
+    Error e = startReading(_f, &_gzip, _gzipReader);
+    if (e == ErrorNone)
+        e = readHeader();
+    return e;
+}
+
+Error FormatImportExportNIfTI::openForWriting(const std::string& fileName, bool append, const TagList& hints)
+{
+    // A file holds only one array
+    if (append)
+        return ErrorAppendingNotSupported;
+    if (fileName == "-")
+        _f = stdout;
+    else
+        _f = fopen(fileName.c_str(), "wb");
+    _fileName = fileName;
+    _hints = hints;
+    _done = false;
+    return _f ? ErrorNone : ErrorSysErrno;
+}
+
+void FormatImportExportNIfTI::close()
+{
+    _gzipReader.close();
+    if (_dataF && _dataF != _f)
+        fclose(_dataF);
+    _dataF = nullptr;
+    if (_f) {
+        if (_f != stdin && _f != stdout) {
+            fclose(_f);
+        }
+        _f = nullptr;
+    }
+}
+
+int FormatImportExportNIfTI::arrayCount()
+{
+    return 1;
+}
+
+ArrayContainer FormatImportExportNIfTI::readArray(Error* error, int arrayIndex)
+{
+    if (arrayIndex > 0 || (arrayIndex < 0 && _done)) {
+        *error = ErrorInvalidData;
+        return ArrayContainer();
+    }
+    _done = true;
+    if (!_gzip && !_swap) {
+        ArrayContainer array = mapFileData(_dataF, _dataOffset, _desc);
+        if (array.data())
+            return array;
+    }
+    Error e = ErrorNone;
+    if (_dataOffset < _pos) {
+        // the data was already read, or the offset points into the header
+        if (_gzip || fseeko(_dataF, _dataOffset, SEEK_SET) != 0)
+            e = ErrorSeekingNotSupported;
+        _pos = _dataOffset;
+    } else if (_gzip) {
+        e = _gzipReader.skip(_dataOffset - _pos);
+    } else if (!skipBytes(_dataF, _dataOffset - _pos)) {
+        e = std::ferror(_dataF) ? ErrorSysErrno : ErrorInvalidData;
+    }
+    _pos = _dataOffset;
+    ArrayContainer array;
+    if (e == ErrorNone) {
+        array = ArrayContainer(_desc);
+        e = readBytes(array.data(), array.dataSize());
+    }
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
+    }
+    if (_swap)
+        swapEndianness(array);
+    return array;
+}
+
+bool FormatImportExportNIfTI::hasMore()
+{
+    return !_done;
+}
+
+ArrayDescription FormatImportExportNIfTI::readDescription(Error* error, int arrayIndex)
+{
+    if (arrayIndex > 0 || (arrayIndex < 0 && _done)) {
+        *error = ErrorInvalidData;
+        return ArrayDescription();
+    }
+    _done = true;
+    return _desc;
+}
+
+Error FormatImportExportNIfTI::writeArray(const ArrayContainer& array)
+{
+    if (_done)
+        return ErrorFeaturesUnsupported;
+    int datatype = niftiDatatypeFromType(array.componentType(), array.componentCount());
+    if (datatype == 0 || array.dimensionCount() > 7)
+        return ErrorFeaturesUnsupported;
+    _done = true;
+
+    int version = 1;
+    for (size_t i = 0; i < array.dimensionCount(); i++)
+        if (array.dimension(i) > 32767)
+            version = 2;
+    int64_t dim[8] = { int64_t(array.dimensionCount()), 1, 1, 1, 1, 1, 1, 1 };
+    double pixdim[8] = { 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0 };
+    for (size_t i = 0; i < array.dimensionCount(); i++) {
+        dim[i + 1] = array.dimension(i);
+        if (array.dimensionTagList(i).contains("SAMPLE_DISTANCE"))
+            pixdim[i + 1] = sampleDistanceFromTag(array.dimensionTagList(i).value("SAMPLE_DISTANCE"), i < 3);
+    }
+    double sclSlope = std::strtod(array.globalTagList().value("NIFTI/SCL_SLOPE", "0").c_str(), nullptr);
+    double sclInter = std::strtod(array.globalTagList().value("NIFTI/SCL_INTER", "0").c_str(), nullptr);
+    std::string descrip = array.globalTagList().value("DESCRIPTION").substr(0, 79);
+
+    // The sform from the orientation tags, if complete
+    int sformCode = 0;
+    double srow[3][4] = { { 0.0 } };
+    std::string space = array.globalTagList().value("SPACE");
+    std::vector<double> origin = numbersFromString(array.globalTagList().value("ORIGIN"));
+    if ((space == "RAS" || space == "LPS") && origin.size() == 3) {
+        sformCode = std::max(1, std::atoi(array.globalTagList().value("NIFTI/XFORM_CODE", "1").c_str()));
+        for (int j = 0; j < 3; j++) {
+            std::vector<double> direction;
+            if (size_t(j) < array.dimensionCount())
+                direction = numbersFromString(array.dimensionTagList(j).value("DIRECTION"));
+            else
+                direction = { j == 0 ? 1.0 : 0.0, j == 1 ? 1.0 : 0.0, j == 2 ? 1.0 : 0.0 };
+            if (direction.size() != 3) {
+                sformCode = 0;
+                break;
+            }
+            for (int i = 0; i < 3; i++)
+                srow[i][j] = direction[i] * pixdim[j + 1];
+        }
+        for (int i = 0; i < 3; i++)
+            srow[i][3] = origin[i];
+        if (space == "LPS") {
+            for (int j = 0; j < 4; j++) {
+                srow[0][j] = -srow[0][j];
+                srow[1][j] = -srow[1][j];
+            }
+        }
+    }
+
+    unsigned char h[544];
+    std::memset(h, 0, sizeof(h));
+    size_t headerSize;
+    if (version == 1) {
+        headerSize = 352;
+        put(h + 0, int32_t(348));
+        h[38] = 'r';
+        for (int i = 0; i < 8; i++) {
+            put(h + 40 + 2 * i, int16_t(dim[i]));
+            put(h + 76 + 4 * i, float(pixdim[i]));
+        }
+        put(h + 70, int16_t(datatype));
+        put(h + 72, int16_t(array.elementSize() * 8));
+        put(h + 108, float(headerSize));
+        put(h + 112, float(sclSlope));
+        put(h + 116, float(sclInter));
+        h[123] = 2 | 8; // mm, s
+        std::memcpy(h + 148, descrip.c_str(), descrip.length());
+        put(h + 254, int16_t(sformCode));
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 4; j++)
+                put(h + 280 + 16 * i + 4 * j, float(srow[i][j]));
+        std::memcpy(h + 344, "n+1", 4);
+    } else {
+        headerSize = 544;
+        put(h + 0, int32_t(540));
+        std::memcpy(h + 4, "n+2\0\r\n\032\n", 8);
+        put(h + 12, int16_t(datatype));
+        put(h + 14, int16_t(array.elementSize() * 8));
+        for (int i = 0; i < 8; i++) {
+            put(h + 16 + 8 * i, dim[i]);
+            put(h + 104 + 8 * i, pixdim[i]);
+        }
+        put(h + 168, int64_t(headerSize));
+        put(h + 176, sclSlope);
+        put(h + 184, sclInter);
+        std::memcpy(h + 240, descrip.c_str(), descrip.length());
+        put(h + 348, int32_t(sformCode));
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 4; j++)
+                put(h + 400 + 32 * i + 8 * j, srow[i][j]);
+        put(h + 500, int32_t(2 | 8));
+    }
+
+    if (endsWith(_fileName, ".gz")) {
+        GzipWriter writer;
+        Error e = writer.open(_f, _hints.value("LEVEL", -1));
+        if (e == ErrorNone)
+            e = writer.write(h, headerSize);
+        if (e == ErrorNone)
+            e = writer.write(array.data(), array.dataSize());
+        if (e == ErrorNone)
+            e = writer.finish();
+        if (e == ErrorNone && std::fflush(_f) != 0)
+            e = ErrorSysErrno;
+        return e;
+    }
+    if (std::fwrite(h, headerSize, 1, _f) != 1
+            || (array.dataSize() > 0 && std::fwrite(array.data(), array.dataSize(), 1, _f) != 1)
+            || std::fflush(_f) != 0) {
+        return ErrorSysErrno;
+    }
+    return ErrorNone;
+}
+
+}
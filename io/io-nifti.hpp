@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TGD_IO_NIFTI_HPP
+#define TGD_IO_NIFTI_HPP
+
+/*
+ * NIfTI-1 and NIfTI-2 volumes: single .nii files, gzip-compressed .nii.gz
+ * files, and .hdr/.img pairs (the latter only with FORMAT=nifti, since .hdr
+ * is also used by Radiance files).
+ *
+ * The NIfTI axes x, y, z, t, ... are the TGD dimensions 0, 1, 2, 3, ..., and
+ * RGB24, RGBA32 and complex voxels become 3, 4 and 2 components. Uncompressed
+ * data in regular files is memory-mapped; compressed data is decompressed
+ * directly into the array.
+ *
+ * The voxel spacing is stored in the dimension tags SAMPLE_DISTANCE (with
+ * unit). If the file has an sform or qform, the axis directions in RAS space
+ * are stored in the dimension tags DIRECTION, and the global tags SPACE=RAS
+ * and ORIGIN give the space and the position of the first voxel. Writing
+ * uses these tags for the sform; SPACE=LPS is converted. The scaling
+ * parameters are kept in NIFTI/SCL_SLOPE and NIFTI/SCL_INTER but not applied.
+ *
+ * Written files are NIfTI-1 unless a dimension is too large for it. Output
+ * files ending in .gz are gzip-compressed (output tag LEVEL), which requires
+ * zlib.
+ */
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+
+#include "io.hpp"
+#include "io-gzip.hpp"
+
+namespace TGD {
+
+class FormatImportExportNIfTI : public FormatImportExport {
+private:
+    FILE* _f;
+    FILE* _dataF;           // the .img file of a pair, or _f
+    bool _gzip;
+    GzipReader _gzipReader;
+    std::string _fileName;
+    TagList _hints;
+    ArrayDescription _desc;
+    bool _swap;
+    int64_t _dataOffset;
+    int64_t _pos;           // position in the (decompressed) data file
+    bool _done;
+
+    Error readBytes(void* data, size_t size);
+    Error readHeader();
+    Error openDataFile();
+
+public:
+    FormatImportExportNIfTI();
+    ~FormatImportExportNIfTI();
+
+    virtual Error openForReading(const std::string& fileName, const TagList& hints) override;
+    virtual Error openForWriting(const std::string& fileName, bool append, const TagList& hints) override;
+    virtual void close() override;
+
+    // for reading:
+    virtual int arrayCount() override;
+    virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+    virtual bool hasMore() override;
+    virtual ArrayDescription readDescription(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+
+    // for writing / appending:
+    virtual Error writeArray(const ArrayContainer& array) override;
+};
+
+}
+
+#endif
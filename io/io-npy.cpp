@@ -0,0 +1,776 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cstring>
+#include <cerrno>
+#include <limits>
+#include <algorithm>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef TGD_WITH_ZLIB
+# include <zlib.h>
+#endif
+
+#include "io-npy.hpp"
+#include "io-mmap.hpp"
+#include "io-utils.hpp"
+
+
+namespace TGD {
+
+static uint16_t get16(const unsigned char* p)
+{
+    return p[0] | (uint16_t(p[1]) << 8);
+}
+
+static uint32_t get32(const unsigned char* p)
+{
+    return get16(p) | (uint32_t(get16(p + 2)) << 16);
+}
+
+static uint64_t get64(const unsigned char* p)
+{
+    return get32(p) | (uint64_t(get32(p + 4)) << 32);
+}
+
+static void put16(std::string& s, uint16_t x)
+{
+    s.push_back(x & 0xff);
+    s.push_back(x >> 8);
+}
+
+static void put32(std::string& s, uint32_t x)
+{
+    put16(s, x & 0xffff);
+    put16(s, x >> 16);
+}
+
+static void put64(std::string& s, uint64_t x)
+{
+    put32(s, x & 0xffffffff);
+    put32(s, x >> 32);
+}
+
+static uint32_t crc32Update(uint32_t crc, const void* data, size_t size)
+{
+#ifdef TGD_WITH_ZLIB
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    while (size > 0) {
+        uInt n = std::min(size, size_t(std::numeric_limits<uInt>::max()));
+        crc = crc32(crc, p, n);
+        p += n;
+        size -= n;
+    }
+    return crc;
+#else
+    static uint32_t table[256];
+    static bool tableInitialized = false;
+    if (!tableInitialized) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+            table[i] = c;
+        }
+        tableInitialized = true;
+    }
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+#endif
+}
+
+/* The .npy format starts with a prefix of 10 (version 1) or 12 (version 2 and 3)
+ * bytes, followed by a Python dictionary literal. Given at least 12 bytes,
+ * return the size of the prefix and of the dictionary. */
+static Error npyHeaderSize(const unsigned char* prefix, size_t& prefixSize, size_t& dictSize)
+{
+    if (std::memcmp(prefix, "\x93NUMPY", 6) != 0)
+        return ErrorInvalidData;
+    if (prefix[6] == 1) {
+        prefixSize = 10;
+        dictSize = get16(prefix + 8);
+    } else if (prefix[6] == 2 || prefix[6] == 3) {
+        prefixSize = 12;
+        dictSize = get32(prefix + 8);
+    } else {
+        return ErrorFeaturesUnsupported;
+    }
+    return ErrorNone;
+}
+
+static bool findKey(const std::string& dict, const char* key, size_t& pos)
+{
+    for (char quote : { '\'', '"' }) {
+        std::string k = quote + std::string(key) + quote;
+        size_t i = dict.find(k);
+        if (i != std::string::npos) {
+            i = dict.find_first_not_of(" \t\n", i + k.length());
+            if (i != std::string::npos && dict[i] == ':') {
+                pos = dict.find_first_not_of(" \t\n", i + 1);
+                return pos != std::string::npos;
+            }
+        }
+    }
+    return false;
+}
+
+static Error parseNpyDict(const std::string& dict, bool components, ArrayDescription& desc, bool& swap)
+{
+    size_t pos;
+
+    // descr: e.g. '<f4'; structured types are lists and not supported
+    if (!findKey(dict, "descr", pos))
+        return ErrorInvalidData;
+    if (dict[pos] != '\'' && dict[pos] != '"')
+        return ErrorFeaturesUnsupported;
+    size_t end = dict.find(dict[pos], pos + 1);
+    if (end == std::string::npos)
+        return ErrorInvalidData;
+    Type type;
+    if (!typeFromNumpyDescr(dict.substr(pos + 1, end - pos - 1), &type, &swap))
+        return ErrorFeaturesUnsupported;
+
+    // fortran_order: True or False
+    if (!findKey(dict, "fortran_order", pos))
+        return ErrorInvalidData;
+    bool fortranOrder;
+    if (dict.compare(pos, 4, "True") == 0)
+        fortranOrder = true;
+    else if (dict.compare(pos, 5, "False") == 0)
+        fortranOrder = false;
+    else
+        return ErrorInvalidData;
+
+    // shape: a tuple of integers, e.g. (480, 640, 3) or (1000,) or ()
+    if (!findKey(dict, "shape", pos) || dict[pos] != '(')
+        return ErrorInvalidData;
+    std::vector<size_t> shape;
+    pos++;
+    for (;;) {
+        pos = dict.find_first_not_of(" \t\n", pos);
+        if (pos == std::string::npos)
+            return ErrorInvalidData;
+        if (dict[pos] == ')')
+            break;
+        if (dict[pos] < '0' || dict[pos] > '9')
+            return ErrorInvalidData;
+        errno = 0;
+        char* p;
+        unsigned long long s = std::strtoull(dict.c_str() + pos, &p, 10);
+        if (errno != 0)
+            return ErrorInvalidData;
+        shape.push_back(s);
+        pos = p - dict.c_str();
+        if (dict[pos] == 'L') // written by Python 2
+            pos++;
+        pos = dict.find_first_not_of(" \t\n", pos);
+        if (pos == std::string::npos)
+            return ErrorInvalidData;
+        if (dict[pos] == ',')
+            pos++;
+        else if (dict[pos] != ')')
+            return ErrorInvalidData;
+    }
+
+    // Map the shape to dimensions, fastest varying axis first
+    if (!fortranOrder)
+        std::reverse(shape.begin(), shape.end());
+    size_t componentCount = 1;
+    if (components && shape.size() >= 2) {
+        componentCount = shape[0];
+        shape.erase(shape.begin());
+    }
+    if (shape.size() == 0) // a scalar
+        shape.push_back(1);
+    if (componentCount == 0 || std::find(shape.begin(), shape.end(), size_t(0)) != shape.end())
+        return ErrorFeaturesUnsupported;
+    desc = ArrayDescription(shape, componentCount, type);
+    return ErrorNone;
+}
+
+static std::string npyHeader(const ArrayDescription& desc)
+{
+    std::string dict = "{'descr': '" + numpyDescrFromType(desc.componentType());
+    dict += "', 'fortran_order': False, 'shape': (";
+    for (size_t i = 0; i < desc.dimensionCount(); i++) {
+        dict += std::to_string(desc.dimension(desc.dimensionCount() - 1 - i));
+        dict += ", ";
+    }
+    if (desc.componentCount() > 1)
+        dict += std::to_string(desc.componentCount()) + ", ";
+    // keep the comma only for 1-tuples
+    dict.erase(dict.length() - (desc.dimensionCount() + (desc.componentCount() > 1 ? 1 : 0) > 1 ? 2 : 1));
+    dict += "), }";
+    // numpy pads the header with spaces and a newline to a multiple of 64 bytes
+    size_t prefixSize = (dict.length() + 64 <= 65535 ? 10 : 12);
+    dict.append(63 - (prefixSize + dict.length()) % 64, ' ');
+    dict += '\n';
+    std::string header = "\x93NUMPY";
+    if (prefixSize == 10) {
+        header += '\x01';
+        header += '\x00';
+        put16(header, dict.length());
+    } else {
+        header += '\x02';
+        header += '\x00';
+        put32(header, dict.length());
+    }
+    return header + dict;
+}
+
+/* Write the given buffers with as few system calls as possible. */
+static Error writeBuffers(FILE* f, std::vector<struct iovec> iov)
+{
+    if (std::fflush(f) != 0)
+        return ErrorSysErrno;
+    size_t i = 0;
+    while (i < iov.size()) {
+        ssize_t r = writev(fileno(f), iov.data() + i, std::min(iov.size() - i, size_t(IOV_MAX)));
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return ErrorSysErrno;
+        }
+        while (i < iov.size() && size_t(r) >= iov[i].iov_len) {
+            r -= iov[i].iov_len;
+            i++;
+        }
+        if (i < iov.size()) {
+            iov[i].iov_base = static_cast<char*>(iov[i].iov_base) + r;
+            iov[i].iov_len -= r;
+        }
+    }
+    // keep the stdio position in sync
+    if (fseeko(f, 0, SEEK_CUR) != 0 && errno != ESPIPE)
+        return ErrorSysErrno;
+    return ErrorNone;
+}
+
+FormatImportExportNPY::FormatImportExportNPY() :
+    _f(nullptr), _writing(false), _regular(false), _zip(false), _components(false),
+    _arrayCount(-2), _entryIndex(0), _zipOffset(0)
+{
+}
+
+FormatImportExportNPY::~FormatImportExportNPY()
+{
+    close();
+}
+
+Error FormatImportExportNPY::openForReading(const std::string& fileName, const TagList& hints)
+{
+    if (fileName == "-")
+        _f = stdin;
+    else
+        _f = fopen(fileName.c_str(), "rb");
+    if (!_f)
+        return ErrorSysErrno;
+    struct stat statbuf;
+    _regular = (fstat(fileno(_f), &statbuf) == 0 && (statbuf.st_mode & S_IFMT) == S_IFREG);
+    _components = (hints.value("NPY_COMPONENTS", 0) != 0);
+    // .npz archives need random access; streams are always .npy
+    if (_regular) {
+        unsigned char magic[4];
+        _zip = (std::fread(magic, 4, 1, _f) == 1 && std::memcmp(magic, "PK\x03\x04", 4) == 0);
+        if (fseeko(_f, 0, SEEK_SET) != 0)
+            return ErrorSysErrno;
+        if (_zip)
+            return readZipDirectory();
+    }
+    return ErrorNone;
+}
+
+Error FormatImportExportNPY::openForWriting(const std::string& fileName, bool append, const TagList&)
+{
+    _zip = (getExtension(fileName) == "npz");
+    if (_zip && append)
+        return ErrorAppendingNotSupported;
+    if (fileName == "-")
+        _f = stdout;
+    else
+        _f = fopen(fileName.c_str(), append ? "ab" : "wb");
+    _writing = true;
+    return _f ? ErrorNone : ErrorSysErrno;
+}
+
+Error FormatImportExportNPY::finish()
+{
+    Error e = ErrorNone;
+    if (_f && _writing) {
+        if (_zip)
+            e = writeZipDirectory();
+        if (std::fflush(_f) != 0 && e == ErrorNone)
+            e = ErrorSysErrno;
+        _writing = false;
+    }
+    return e;
+}
+
+void FormatImportExportNPY::close()
+{
+    if (_f) {
+        if (_f != stdin && _f != stdout)
+            fclose(_f);
+        _f = nullptr;
+    }
+    _writing = false;
+    _arrayCount = -2;
+    _arrayOffsets.clear();
+    _entries.clear();
+    _entryIndex = 0;
+    _zipOffset = 0;
+}
+
+Error FormatImportExportNPY::readZipDirectory()
+{
+    // Find the end of central directory record; it is followed by a comment of at most 65535 bytes
+    if (fseeko(_f, 0, SEEK_END) != 0)
+        return ErrorSysErrno;
+    off_t fileSize = ftello(_f);
+    if (fileSize < 0)
+        return ErrorSysErrno;
+    off_t tailSize = std::min(fileSize, off_t(22 + 65535));
+    std::vector<unsigned char> tail(tailSize);
+    if (fseeko(_f, fileSize - tailSize, SEEK_SET) != 0 || std::fread(tail.data(), tailSize, 1, _f) != 1)
+        return ErrorSysErrno;
+    off_t eocd = -1;
+    for (off_t i = tailSize - 22; i >= 0; i--) {
+        if (get32(tail.data() + i) == 0x06054b50) {
+            eocd = i;
+            break;
+        }
+    }
+    if (eocd < 0)
+        return ErrorInvalidData;
+    uint64_t entryCount = get16(tail.data() + eocd + 10);
+    uint64_t directorySize = get32(tail.data() + eocd + 12);
+    uint64_t directoryOffset = get32(tail.data() + eocd + 16);
+    if (entryCount == 0xffff || directorySize == 0xffffffff || directoryOffset == 0xffffffff) {
+        // Zip64: the locator precedes the end of central directory record
+        unsigned char buf[56];
+        off_t locator = fileSize - tailSize + eocd - 20;
+        if (locator < 0 || fseeko(_f, locator, SEEK_SET) != 0 || std::fread(buf, 20, 1, _f) != 1
+                || get32(buf) != 0x07064b50
+                || fseeko(_f, get64(buf + 8), SEEK_SET) != 0 || std::fread(buf, 56, 1, _f) != 1
+                || get32(buf) != 0x06064b50) {
+            return ErrorInvalidData;
+        }
+        entryCount = get64(buf + 32);
+        directorySize = get64(buf + 40);
+        directoryOffset = get64(buf + 48);
+    }
+    if (directoryOffset + directorySize > uint64_t(fileSize))
+        return ErrorInvalidData;
+    std::vector<unsigned char> dir(directorySize);
+    if (fseeko(_f, directoryOffset, SEEK_SET) != 0
+            || (directorySize > 0 && std::fread(dir.data(), directorySize, 1, _f) != 1))
+        return ErrorSysErrno;
+
+    const unsigned char* p = dir.data();
+    const unsigned char* dirEnd = dir.data() + dir.size();
+    for (uint64_t i = 0; i < entryCount; i++) {
+        if (dirEnd - p < 46 || get32(p) != 0x02014b50)
+            return ErrorInvalidData;
+        ZipEntry entry;
+        entry.method = get16(p + 10);
+        entry.crc = get32(p + 16);
+        entry.compressedSize = get32(p + 20);
+        entry.size = get32(p + 24);
+        size_t nameLength = get16(p + 28);
+        size_t extraLength = get16(p + 30);
+        size_t commentLength = get16(p + 32);
+        entry.offset = get32(p + 42);
+        if (size_t(dirEnd - p) < 46 + nameLength + extraLength + commentLength)
+            return ErrorInvalidData;
+        entry.name = std::string(reinterpret_cast<const char*>(p + 46), nameLength);
+        // Zip64 extended information: only the fields that are saturated above, in this order
+        const unsigned char* extra = p + 46 + nameLength;
+        const unsigned char* extraEnd = extra + extraLength;
+        while (extraEnd - extra >= 4) {
+            uint16_t id = get16(extra);
+            uint16_t size = get16(extra + 2);
+            const unsigned char* field = extra + 4;
+            if (extraEnd - field < size)
+                return ErrorInvalidData;
+            if (id == 0x0001) {
+                const unsigned char* fieldEnd = field + size;
+                for (uint64_t* value : { &entry.size, &entry.compressedSize, &entry.offset }) {
+                    if (*value == 0xffffffff) {
+                        if (fieldEnd - field < 8)
+                            return ErrorInvalidData;
+                        *value = get64(field);
+                        field += 8;
+                    }
+                }
+            }
+            extra += 4 + size;
+        }
+        p += 46 + nameLength + extraLength + commentLength;
+        if (entry.name.length() > 4 && entry.name.compare(entry.name.length() - 4, 4, ".npy") == 0) {
+            entry.name.erase(entry.name.length() - 4);
+            _entries.push_back(entry);
+        }
+    }
+    return ErrorNone;
+}
+
+/* Read a .npy header and, if array is not null, its data from the current
+ * position. At most maxSize bytes belong to it. */
+Error FormatImportExportNPY::readNpy(ArrayContainer* array, ArrayDescription& desc, uint64_t maxSize)
+{
+    unsigned char prefix[12];
+    size_t prefixSize, dictSize;
+    if (std::fread(prefix, 10, 1, _f) != 1)
+        return std::ferror(_f) ? ErrorSysErrno : ErrorInvalidData;
+    if (prefix[6] != 1 && std::fread(prefix + 10, 2, 1, _f) != 1)
+        return std::ferror(_f) ? ErrorSysErrno : ErrorInvalidData;
+    Error e = npyHeaderSize(prefix, prefixSize, dictSize);
+    if (e != ErrorNone)
+        return e;
+    std::string dict(dictSize, ' ');
+    if (dictSize > 0 && std::fread(&(dict[0]), dictSize, 1, _f) != 1)
+        return std::ferror(_f) ? ErrorSysErrno : ErrorInvalidData;
+    bool swap;
+    if ((e = parseNpyDict(dict, _components, desc, swap)) != ErrorNone)
+        return e;
+    if (prefixSize + dictSize > maxSize || desc.dataSize() > maxSize - prefixSize - dictSize)
+        return ErrorInvalidData;
+    if (!array)
+        return skipBytes(_f, desc.dataSize()) ? ErrorNone : std::ferror(_f) ? ErrorSysErrno : ErrorInvalidData;
+
+    // Map the data instead of reading it if possible
+    off_t pos = (_regular ? ftello(_f) : -1);
+    if (pos >= 0) {
+        *array = mapFileData(_f, pos, desc);
+        if (array->data() && fseeko(_f, pos + desc.dataSize(), SEEK_SET) != 0)
+            return ErrorSysErrno;
+    }
+    if (!array->data()) {
+        *array = ArrayContainer(desc);
+        if (std::fread(array->data(), array->dataSize(), 1, _f) != 1)
+            return std::ferror(_f) ? ErrorSysErrno : ErrorInvalidData;
+    }
+    if (swap)
+        swapEndianness(*array);
+    return ErrorNone;
+}
+
+Error FormatImportExportNPY::readEntry(ArrayContainer* array, ArrayDescription& desc, int arrayIndex)
+{
+    size_t index = (arrayIndex >= 0 ? arrayIndex : _entryIndex);
+    if (index >= _entries.size())
+        return ErrorInvalidData;
+    _entryIndex = index + 1;
+    const ZipEntry& entry = _entries[index];
+
+    unsigned char local[30];
+    if (fseeko(_f, entry.offset, SEEK_SET) != 0 || std::fread(local, 30, 1, _f) != 1)
+        return ErrorSysErrno;
+    if (get32(local) != 0x04034b50)
+        return ErrorInvalidData;
+    off_t dataOffset = entry.offset + 30 + get16(local + 26) + get16(local + 28);
+    if (fseeko(_f, dataOffset, SEEK_SET) != 0)
+        return ErrorSysErrno;
+
+    Error e;
+    if (entry.method == 0) {
+        e = readNpy(array, desc, entry.compressedSize);
+    } else if (entry.method == 8) {
+#ifdef TGD_WITH_ZLIB
+        // Inflate everything, or only enough for the header if no data is requested
+        size_t size = entry.size;
+        if (!array)
+            size = std::min(size, size_t(1) << 16);
+        std::vector<unsigned char> compressed(entry.compressedSize);
+        std::shared_ptr<unsigned char[]> data(new unsigned char[std::max(size, size_t(12))]);
+        if (compressed.size() > 0 && std::fread(compressed.data(), compressed.size(), 1, _f) != 1)
+            return std::ferror(_f) ? ErrorSysErrno : ErrorInvalidData;
+        z_stream strm;
+        std::memset(&strm, 0, sizeof(strm));
+        if (inflateInit2(&strm, -MAX_WBITS) != Z_OK)
+            return ErrorLibrary;
+        strm.next_in = compressed.data();
+        strm.next_out = data.get();
+        int r = Z_OK;
+        while (r == Z_OK && strm.total_out < size) {
+            size_t inRemaining = compressed.size() - strm.total_in;
+            size_t outRemaining = size - strm.total_out;
+            strm.avail_in = std::min(inRemaining, size_t(std::numeric_limits<uInt>::max()));
+            strm.avail_out = std::min(outRemaining, size_t(std::numeric_limits<uInt>::max()));
+            r = inflate(&strm, Z_NO_FLUSH);
+        }
+        size_t available = strm.total_out;
+        inflateEnd(&strm);
+        if ((r != Z_OK && r != Z_STREAM_END) || available < 12)
+            return ErrorInvalidData;
+        size_t prefixSize, dictSize;
+        bool swap;
+        if ((e = npyHeaderSize(data.get(), prefixSize, dictSize)) != ErrorNone)
+            return e;
+        if (prefixSize + dictSize > available)
+            return ErrorInvalidData;
+        std::string dict(reinterpret_cast<char*>(data.get()) + prefixSize, dictSize);
+        if ((e = parseNpyDict(dict, _components, desc, swap)) != ErrorNone)
+            return e;
+        if (array) {
+            if (prefixSize + dictSize + desc.dataSize() > available)
+                return ErrorInvalidData;
+            // the array shares the inflated buffer
+            *array = ArrayContainer(desc, std::shared_ptr<unsigned char[]>(data, data.get() + prefixSize + dictSize));
+            if (swap)
+                swapEndianness(*array);
+        }
+#else
+        e = ErrorFeaturesUnsupported;
+#endif
+    } else {
+        e = ErrorFeaturesUnsupported;
+    }
+    if (e == ErrorNone) {
+        desc.globalTagList().set("NAME", entry.name);
+        if (array)
+            array->globalTagList().set("NAME", entry.name);
+    }
+    return e;
+}
+
+int FormatImportExportNPY::arrayCount()
+{
+    if (_zip)
+        return _entries.size();
+    if (_arrayCount >= -1)
+        return _arrayCount;
+    if (!_regular) {
+        _arrayCount = -1;
+        return _arrayCount;
+    }
+    off_t pos = ftello(_f);
+    if (pos < 0 || fseeko(_f, 0, SEEK_SET) != 0) {
+        _arrayCount = -1;
+        return _arrayCount;
+    }
+    while (hasMore()) {
+        off_t offset = ftello(_f);
+        ArrayDescription desc;
+        if (readNpy(nullptr, desc, std::numeric_limits<uint64_t>::max()) != ErrorNone)
+            break;
+        _arrayOffsets.push_back(offset);
+    }
+    _arrayCount = _arrayOffsets.size();
+    if (fseeko(_f, pos, SEEK_SET) != 0)
+        _arrayCount = -1;
+    return _arrayCount;
+}
+
+ArrayContainer FormatImportExportNPY::readArray(Error* error, int arrayIndex)
+{
+    ArrayContainer array;
+    ArrayDescription desc;
+    Error e;
+    if (_zip) {
+        e = readEntry(&array, desc, arrayIndex);
+    } else {
+        e = ErrorNone;
+        if (arrayIndex >= 0) {
+            if (arrayCount() < 0)
+                e = ErrorSeekingNotSupported;
+            else if (arrayIndex >= arrayCount())
+                e = ErrorInvalidData;
+            else if (fseeko(_f, _arrayOffsets[arrayIndex], SEEK_SET) != 0)
+                e = ErrorSysErrno;
+        }
+        if (e == ErrorNone)
+            e = readNpy(&array, desc, std::numeric_limits<uint64_t>::max());
+    }
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
+    }
+    return array;
+}
+
+bool FormatImportExportNPY::hasMore()
+{
+    if (_zip)
+        return _entryIndex < _entries.size();
+    int c = fgetc(_f);
+    if (c == EOF) {
+        return false;
+    } else {
+        ungetc(c, _f);
+        return true;
+    }
+}
+
+ArrayDescription FormatImportExportNPY::readDescription(Error* error, int arrayIndex)
+{
+    ArrayDescription desc;
+    Error e;
+    if (_zip) {
+        e = readEntry(nullptr, desc, arrayIndex);
+    } else {
+        e = ErrorNone;
+        if (arrayIndex >= 0) {
+            if (arrayCount() < 0)
+                e = ErrorSeekingNotSupported;
+            else if (arrayIndex >= arrayCount())
+                e = ErrorInvalidData;
+            else if (fseeko(_f, _arrayOffsets[arrayIndex], SEEK_SET) != 0)
+                e = ErrorSysErrno;
+        }
+        if (e == ErrorNone)
+            e = readNpy(nullptr, desc, std::numeric_limits<uint64_t>::max());
+    }
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayDescription();
+    }
+    return desc;
+}
+
+Error FormatImportExportNPY::writeArray(const ArrayContainer& array)
+{
+    std::string header = npyHeader(array);
+    void* data = const_cast<void*>(array.data());
+    if (!_zip) {
+        // header and data in one system call
+        return writeBuffers(_f, { { &(header[0]), header.size() }, { data, array.dataSize() } });
+    }
+
+    // An uncompressed archive member, using Zip64 fields if necessary
+    ZipEntry entry;
+    entry.name = array.globalTagList().value("NAME");
+    if (entry.name.empty())
+        entry.name = std::string("arr_") + std::to_string(_entries.size());
+    entry.name += ".npy";
+    entry.method = 0;
+    entry.crc = crc32Update(crc32Update(0, header.data(), header.size()), array.data(), array.dataSize());
+    entry.size = entry.compressedSize = header.size() + array.dataSize();
+    entry.offset = _zipOffset;
+    bool zip64 = (entry.size >= 0xffffffff);
+    std::string local;
+    put32(local, 0x04034b50);
+    put16(local, zip64 ? 45 : 20);          // version needed to extract
+    put16(local, 0);                        // flags
+    put16(local, 0);                        // method: stored
+    put16(local, 0);                        // modification time
+    put16(local, 0x21);                     // modification date: 1980-01-01
+    put32(local, entry.crc);
+    put32(local, zip64 ? 0xffffffff : entry.compressedSize);
+    put32(local, zip64 ? 0xffffffff : entry.size);
+    put16(local, entry.name.length());
+    put16(local, zip64 ? 20 : 0);
+    local += entry.name;
+    if (zip64) {
+        put16(local, 0x0001);
+        put16(local, 16);
+        put64(local, entry.size);
+        put64(local, entry.compressedSize);
+    }
+    Error e = writeBuffers(_f, { { &(local[0]), local.size() }, { &(header[0]), header.size() },
+            { data, array.dataSize() } });
+    if (e != ErrorNone)
+        return e;
+    _zipOffset += local.size() + entry.size;
+    _entries.push_back(entry);
+    return ErrorNone;
+}
+
+Error FormatImportExportNPY::writeZipDirectory()
+{
+    std::string dir;
+    for (size_t i = 0; i < _entries.size(); i++) {
+        const ZipEntry& entry = _entries[i];
+        std::string extra;
+        if (entry.size >= 0xffffffff) {
+            put64(extra, entry.size);
+            put64(extra, entry.compressedSize);
+        }
+        if (entry.offset >= 0xffffffff)
+            put64(extra, entry.offset);
+        if (!extra.empty()) {
+            std::string header;
+            put16(header, 0x0001);
+            put16(header, extra.size());
+            extra = header + extra;
+        }
+        put32(dir, 0x02014b50);
+        put16(dir, extra.empty() ? 20 : 45); // version made by
+        put16(dir, extra.empty() ? 20 : 45); // version needed to extract
+        put16(dir, 0);
+        put16(dir, entry.method);
+        put16(dir, 0);
+        put16(dir, 0x21);
+        put32(dir, entry.crc);
+        put32(dir, entry.size >= 0xffffffff ? 0xffffffff : entry.compressedSize);
+        put32(dir, entry.size >= 0xffffffff ? 0xffffffff : entry.size);
+        put16(dir, entry.name.length());
+        put16(dir, extra.size());
+        put16(dir, 0);                       // comment length
+        put16(dir, 0);                       // disk number
+        put16(dir, 0);                       // internal attributes
+        put32(dir, 0);                       // external attributes
+        put32(dir, entry.offset >= 0xffffffff ? 0xffffffff : entry.offset);
+        dir += entry.name;
+        dir += extra;
+    }
+    uint64_t dirOffset = _zipOffset;
+    uint64_t dirSize = dir.size();
+    if (_entries.size() >= 0xffff || dirOffset >= 0xffffffff || dirSize >= 0xffffffff) {
+        uint64_t zip64Offset = dirOffset + dirSize;
+        put32(dir, 0x06064b50);
+        put64(dir, 44);
+        put16(dir, 45);
+        put16(dir, 45);
+        put32(dir, 0);
+        put32(dir, 0);
+        put64(dir, _entries.size());
+        put64(dir, _entries.size());
+        put64(dir, dirSize);
+        put64(dir, dirOffset);
+        put32(dir, 0x07064b50);
+        put32(dir, 0);
+        put64(dir, zip64Offset);
+        put32(dir, 1);
+    }
+    put32(dir, 0x06054b50);
+    put16(dir, 0);
+    put16(dir, 0);
+    put16(dir, std::min(_entries.size(), size_t(0xffff)));
+    put16(dir, std::min(_entries.size(), size_t(0xffff)));
+    put32(dir, std::min(dirSize, uint64_t(0xffffffff)));
+    put32(dir, std::min(dirOffset, uint64_t(0xffffffff)));
+    put16(dir, 0);
+    return writeBuffers(_f, { { &(dir[0]), dir.size() } });
+}
+
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TGD_IO_NPY_HPP
+#define TGD_IO_NPY_HPP
+
+/*
+ * NumPy .npy files (one or more arrays, as written by successive calls of
+ * numpy.save() to the same file) and .npz archives (one .npy member per
+ * array, as written by numpy.savez() and numpy.savez_compressed()).
+ *
+ * An array with shape (S0, S1, ..., Sn) in C order has the TGD dimensions
+ * Sn, ..., S1, S0; in Fortran order, it has the dimensions S0, S1, ..., Sn.
+ * With the hint NPY_COMPONENTS=1, the innermost axis (Sn in C order, S0 in
+ * Fortran order) becomes the components of the TGD array instead.
+ * Neither case requires reordering the data.
+ *
+ * Uncompressed arrays in regular files are memory-mapped (privately, so that
+ * changes to the array do not affect the file) instead of read.
+ *
+ * Written .npy arrays are in C order, with the components as innermost axis
+ * if there is more than one. Written .npz archives are uncompressed and name
+ * their members after the NAME tag of the arrays, or arr_0, arr_1, ...
+ * otherwise; reading sets the NAME tag accordingly.
+ */
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "io.hpp"
+
+namespace TGD {
+
+class FormatImportExportNPY : public FormatImportExport {
+private:
+    struct ZipEntry {
+        std::string name;
+        uint16_t method;
+        uint32_t crc;
+        uint64_t compressedSize;
+        uint64_t size;
+        uint64_t offset; // of the local header
+    };
+
+    FILE* _f;
+    bool _writing;
+    bool _regular;
+    bool _zip;
+    bool _components;
+    // .npy reading
+    int _arrayCount;
+    std::vector<off_t> _arrayOffsets;
+    // .npz reading and writing
+    std::vector<ZipEntry> _entries;
+    size_t _entryIndex;
+    uint64_t _zipOffset;
+
+    Error readZipDirectory();
+    Error readNpy(ArrayContainer* array, ArrayDescription& desc, uint64_t maxSize);
+    Error readEntry(ArrayContainer* array, ArrayDescription& desc, int arrayIndex);
+    Error writeZipDirectory();
+
+public:
+    FormatImportExportNPY();
+    ~FormatImportExportNPY();
+
+    virtual Error openForReading(const std::string& fileName, const TagList& hints) override;
+    virtual Error openForWriting(const std::string& fileName, bool append, const TagList& hints) override;
+    virtual void close() override;
+
+    // for reading:
+    virtual int arrayCount() override;
+    virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+    virtual bool hasMore() override;
+    virtual ArrayDescription readDescription(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+
+    // for writing / appending:
+    virtual Error writeArray(const ArrayContainer& array) override;
+    virtual Error finish() override;
+};
+
+}
+
+#endif
@@ -0,0 +1,744 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <limits>
+#include <cctype>
+#include <vector>
+#include <algorithm>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "io-nrrd.hpp"
+#include "io-mmap.hpp"
+#include "io-utils.hpp"
+
+
+namespace TGD {
+
+static Error readLine(FILE* f, std::string& line, size_t maxLength, bool* eof)
+{
+    line.clear();
+    *eof = false;
+    for (;;) {
+        int c = getc_unlocked(f);
+        if (c == EOF) {
+            if (std::ferror(f))
+                return ErrorSysErrno;
+            *eof = true;
+            break;
+        }
+        if (c == '\n')
+            break;
+        if (line.length() >= maxLength)
+            return ErrorInvalidData;
+        line += char(c);
+    }
+    if (line.length() > 0 && line.back() == '\r')
+        line.pop_back();
+    return ErrorNone;
+}
+
+static std::string numberToString(double v)
+{
+    if (v == 0.0) // no negative zero
+        v = 0.0;
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.15g", v);
+    return buf;
+}
+
+static std::vector<double> numbersFromString(const std::string& s)
+{
+    std::vector<double> v;
+    const char* p = s.c_str();
+    for (;;) {
+        char* end;
+        double x = std::strtod(p, &end);
+        if (end == p)
+            break;
+        v.push_back(x);
+        p = end;
+    }
+    return v;
+}
+
+static std::vector<std::string> splitWords(const std::string& s)
+{
+    std::vector<std::string> words;
+    size_t pos = 0;
+    for (;;) {
+        pos = s.find_first_not_of(" \t", pos);
+        if (pos == std::string::npos)
+            break;
+        size_t end = s.find_first_of(" \t", pos);
+        if (end == std::string::npos)
+            end = s.length();
+        words.push_back(s.substr(pos, end - pos));
+        pos = end;
+    }
+    return words;
+}
+
+/* Split a list of quoted strings such as "mm" "mm" "" */
+static std::vector<std::string> splitQuoted(const std::string& s)
+{
+    std::vector<std::string> words;
+    size_t pos = 0;
+    for (;;) {
+        pos = s.find('"', pos);
+        if (pos == std::string::npos)
+            break;
+        size_t end = s.find('"', pos + 1);
+        if (end == std::string::npos)
+            break;
+        words.push_back(s.substr(pos + 1, end - pos - 1));
+        pos = end + 1;
+    }
+    return words;
+}
+
+/* Split a list of vectors such as none (1,0,0) (0,1.5,0); an empty vector means none */
+static bool splitVectors(const std::string& s, std::vector<std::vector<double>>& vectors)
+{
+    size_t pos = 0;
+    for (;;) {
+        pos = s.find_first_not_of(" \t", pos);
+        if (pos == std::string::npos)
+            break;
+        if (s.compare(pos, 4, "none") == 0) {
+            vectors.push_back(std::vector<double>());
+            pos += 4;
+        } else if (s[pos] == '(') {
+            size_t end = s.find(')', pos);
+            if (end == std::string::npos)
+                return false;
+            std::string v = s.substr(pos + 1, end - pos - 1);
+            std::replace(v.begin(), v.end(), ',', ' ');
+            vectors.push_back(numbersFromString(v));
+            if (vectors.back().empty())
+                return false;
+            pos = end + 1;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Key/value pairs and the content field escape newlines and backslashes as \n and \\ */
+static std::string escapeString(const std::string& s)
+{
+    std::string r;
+    for (size_t i = 0; i < s.length(); i++) {
+        if (s[i] == '\n')
+            r += "\\n";
+        else if (s[i] == '\\')
+            r += "\\\\";
+        else
+            r += s[i];
+    }
+    return r;
+}
+
+static std::string unescapeString(const std::string& s)
+{
+    std::string r;
+    for (size_t i = 0; i < s.length(); i++) {
+        if (s[i] == '\\' && i + 1 < s.length() && (s[i + 1] == 'n' || s[i + 1] == '\\')) {
+            i++;
+            r += (s[i] == 'n' ? '\n' : '\\');
+        } else {
+            r += s[i];
+        }
+    }
+    return r;
+}
+
+static std::string vectorToString(const std::vector<double>& v)
+{
+    std::string s = "(";
+    for (size_t i = 0; i < v.size(); i++)
+        s += (i > 0 ? "," : "") + numberToString(v[i]);
+    return s + ')';
+}
+
+static bool typeFromNrrdType(const std::string& t, Type* type)
+{
+    if (t == "signed char" || t == "int8" || t == "int8_t")
+        *type = int8;
+    else if (t == "uchar" || t == "unsigned char" || t == "uint8" || t == "uint8_t")
+        *type = uint8;
+    else if (t == "short" || t == "short int" || t == "signed short" || t == "signed short int"
+            || t == "int16" || t == "int16_t")
+        *type = int16;
+    else if (t == "ushort" || t == "unsigned short" || t == "unsigned short int" || t == "uint16" || t == "uint16_t")
+        *type = uint16;
+    else if (t == "int" || t == "signed int" || t == "int32" || t == "int32_t")
+        *type = int32;
+    else if (t == "uint" || t == "unsigned int" || t == "uint32" || t == "uint32_t")
+        *type = uint32;
+    else if (t == "longlong" || t == "long long" || t == "long long int" || t == "signed long long"
+            || t == "signed long long int" || t == "int64" || t == "int64_t")
+        *type = int64;
+    else if (t == "ulonglong" || t == "unsigned long long" || t == "unsigned long long int"
+            || t == "uint64" || t == "uint64_t")
+        *type = uint64;
+    else if (t == "float")
+        *type = float32;
+    else if (t == "double")
+        *type = float64;
+    else
+        return false;
+    return true;
+}
+
+static const char* nrrdTypeFromType(Type type)
+{
+    switch (type) {
+    case int8:    return "int8";
+    case uint8:   return "uint8";
+    case int16:   return "int16";
+    case uint16:  return "uint16";
+    case int32:   return "int32";
+    case uint32:  return "uint32";
+    case int64:   return "int64";
+    case uint64:  return "uint64";
+    case float32: return "float";
+    case float64: return "double";
+    }
+    return nullptr;
+}
+
+static std::string shortSpaceName(const std::string& space)
+{
+    static const char* names[][2] = {
+        { "right-anterior-superior", "RAS" },
+        { "left-anterior-superior", "LAS" },
+        { "left-posterior-superior", "LPS" },
+        { "right-anterior-superior-time", "RAST" },
+        { "left-anterior-superior-time", "LAST" },
+        { "left-posterior-superior-time", "LPST" }
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        if (space == names[i][0])
+            return names[i][1];
+    return space;
+}
+
+FormatImportExportNRRD::FormatImportExportNRRD() :
+    _f(nullptr), _dataF(nullptr), _swap(false), _lineSkip(0), _byteSkip(0), _done(false)
+{
+}
+
+FormatImportExportNRRD::~FormatImportExportNRRD()
+{
+    close();
+}
+
+Error FormatImportExportNRRD::readHeader()
+{
+    std::string line;
+    bool eof;
+    Error e = readLine(_f, line, 4096, &eof);
+    if (e != ErrorNone)
+        return e;
+    if (line.length() != 8 || line.compare(0, 7, "NRRD000") != 0)
+        return ErrorInvalidData;
+
+    std::string typeName, endian, dataFile, space, spaceDirections, spaceOrigin;
+    std::string spacings, units, spaceUnits, kinds, content;
+    std::vector<size_t> sizes;
+    int dimension = -1;
+    std::vector<std::pair<std::string, std::string>> keyValues;
+    _encoding.clear();
+    _lineSkip = 0;
+    _byteSkip = 0;
+    while (!eof) {
+        if ((e = readLine(_f, line, 1 << 20, &eof)) != ErrorNone)
+            return e;
+        if (line.empty())
+            break;
+        if (line[0] == '#')
+            continue;
+        size_t kv = line.find(":=");
+        size_t colon = line.find(": ");
+        if (kv != std::string::npos && (colon == std::string::npos || kv < colon)) {
+            keyValues.push_back(std::make_pair(unescapeString(line.substr(0, kv)), unescapeString(line.substr(kv + 2))));
+            continue;
+        }
+        if (colon == std::string::npos)
+            return ErrorInvalidData;
+        std::string field = line.substr(0, colon);
+        std::string value = line.substr(line.find_first_not_of(' ', colon + 1) == std::string::npos
+                ? line.length() : line.find_first_not_of(' ', colon + 1));
+        if (field == "type") {
+            typeName = value;
+        } else if (field == "dimension") {
+            dimension = std::atoi(value.c_str());
+        } else if (field == "sizes") {
+            std::vector<std::string> words = splitWords(value);
+            for (size_t i = 0; i < words.size(); i++)
+                sizes.push_back(std::strtoull(words[i].c_str(), nullptr, 10));
+        } else if (field == "encoding") {
+            _encoding = value;
+        } else if (field == "endian") {
+            endian = value;
+        } else if (field == "line skip" || field == "lineskip") {
+            _lineSkip = std::atoll(value.c_str());
+        } else if (field == "byte skip" || field == "byteskip") {
+            _byteSkip = std::atoll(value.c_str());
+        } else if (field == "data file" || field == "datafile") {
+            dataFile = value;
+        } else if (field == "space") {
+            space = value;
+        } else if (field == "space directions") {
+            spaceDirections = value;
+        } else if (field == "space origin") {
+            spaceOrigin = value;
+        } else if (field == "spacings") {
+            spacings = value;
+        } else if (field == "units") {
+            units = value;
+        } else if (field == "space units") {
+            spaceUnits = value;
+        } else if (field == "kinds") {
+            kinds = value;
+        } else if (field == "content") {
+            content = unescapeString(value);
+        }
+    }
+
+    Type type;
+    if (!typeFromNrrdType(typeName, &type))
+        return typeName == "block" ? ErrorFeaturesUnsupported : ErrorInvalidData;
+    if (dimension < 1 || sizes.size() != size_t(dimension) || _lineSkip < 0 || _byteSkip < -1)
+        return ErrorInvalidData;
+    for (size_t i = 0; i < sizes.size(); i++)
+        if (sizes[i] == 0)
+            return ErrorInvalidData;
+    if (_encoding == "gz")
+        _encoding = "gzip";
+    else if (_encoding == "text" || _encoding == "txt")
+        _encoding = "ascii";
+    if (_encoding != "raw" && _encoding != "gzip" && _encoding != "ascii")
+        return ErrorFeaturesUnsupported;
+    if (_encoding != "raw" && _byteSkip == -1)
+        return ErrorInvalidData;
+    std::vector<std::string> kindList = splitWords(kinds);
+    std::vector<std::vector<double>> directions;
+    if (!splitVectors(spaceDirections, directions) || (!spaceDirections.empty() && directions.size() != sizes.size()))
+        return ErrorInvalidData;
+
+    // The first axis holds the components if it is not a domain axis
+    bool componentAxis = false;
+    if (sizes.size() >= 2) {
+        if (kindList.size() == sizes.size()) {
+            const std::string& k = kindList[0];
+            componentAxis = !(k == "domain" || k == "space" || k == "time" || k == "???" || k == "none");
+        } else if (directions.size() > 0) {
+            componentAxis = directions[0].empty();
+        }
+    }
+    size_t axisOffset = (componentAxis ? 1 : 0);
+    std::vector<size_t> dimensions(sizes.begin() + axisOffset, sizes.end());
+    _desc = ArrayDescription(dimensions, componentAxis ? sizes[0] : 1, type);
+    _swap = (_encoding != "ascii" && _desc.componentSize() > 1
+            && (endian == "big" ? hostIsLittleEndian() : endian == "little" ? !hostIsLittleEndian() : false));
+
+    // Tags
+    std::vector<std::string> spaceUnitList = splitQuoted(spaceUnits);
+    std::vector<std::string> unitList = splitQuoted(units);
+    std::vector<std::string> spacingList = splitWords(spacings);
+    for (size_t d = 0; d < dimensions.size(); d++) {
+        size_t axis = d + axisOffset;
+        if (axis < directions.size() && !directions[axis].empty()) {
+            const std::vector<double>& v = directions[axis];
+            double norm = 0.0;
+            for (size_t i = 0; i < v.size(); i++)
+                norm += v[i] * v[i];
+            norm = std::sqrt(norm);
+            if (norm > 0.0) {
+                std::string direction;
+                for (size_t i = 0; i < v.size(); i++)
+                    direction += (i > 0 ? " " : "") + numberToString(v[i] / norm);
+                _desc.dimensionTagList(d).set("DIRECTION", direction);
+                std::string unit = (spaceUnitList.size() > 0 && !spaceUnitList[0].empty() ? ' ' + spaceUnitList[0] : "");
+                _desc.dimensionTagList(d).set("SAMPLE_DISTANCE", numberToString(norm) + unit);
+            }
+        } else if (axis < spacingList.size() && std::isfinite(std::strtod(spacingList[axis].c_str(), nullptr))) {
+            std::string unit = (axis < unitList.size() && !unitList[axis].empty() ? ' ' + unitList[axis] : "");
+            _desc.dimensionTagList(d).set("SAMPLE_DISTANCE", spacingList[axis] + unit);
+        }
+    }
+    if (!space.empty())
+        _desc.globalTagList().set("SPACE", shortSpaceName(space));
+    std::vector<std::vector<double>> origin;
+    if (splitVectors(spaceOrigin, origin) && origin.size() == 1 && !origin[0].empty()) {
+        std::string s;
+        for (size_t i = 0; i < origin[0].size(); i++)
+            s += (i > 0 ? " " : "") + numberToString(origin[0][i]);
+        _desc.globalTagList().set("ORIGIN", s);
+    }
+    if (!content.empty())
+        _desc.globalTagList().set("DESCRIPTION", content);
+    for (size_t i = 0; i < keyValues.size(); i++)
+        if (!keyValues[i].first.empty())
+            _desc.globalTagList().set(keyValues[i].first, keyValues[i].second);
+
+    // The data file
+    if (dataFile.empty()) {
+        _dataF = _f;
+    } else {
+        if (dataFile == "LIST" || dataFile.find('%') != std::string::npos)
+            return ErrorFeaturesUnsupported;
+        if (dataFile[0] != '/') {
+            size_t slash = _fileName.find_last_of('/');
+            if (slash != std::string::npos)
+                dataFile = _fileName.substr(0, slash + 1) + dataFile;
+        }
+        _dataF = fopen(dataFile.c_str(), "rb");
+        if (!_dataF)
+            return ErrorSysErrno;
+    }
+    return ErrorNone;
+}
+
+Error FormatImportExportNRRD::openForReading(const std::string& fileName, const TagList& hints)
+{
+    if (fileName == "-")
+        _f = stdin;
+    else
+        _f = fopen(fileName.c_str(), "rb");
+    if (!_f)
+        return ErrorSysErrno;
+    _fileName = fileName;
+    _hints = hints;
+    _done = false;
+    return readHeader();
+}
+
+Error FormatImportExportNRRD::openForWriting(const std::string& fileName, bool append, const TagList& hints)
+{
+    // A file holds only one array
+    if (append)
+        return ErrorAppendingNotSupported;
+    if (fileName == "-")
+        _f = stdout;
+    else
+        _f = fopen(fileName.c_str(), "wb");
+    _fileName = fileName;
+    _hints = hints;
+    _done = false;
+    return _f ? ErrorNone : ErrorSysErrno;
+}
+
+void FormatImportExportNRRD::close()
+{
+    _gzipReader.close();
+    if (_dataF && _dataF != _f)
+        fclose(_dataF);
+    _dataF = nullptr;
+    if (_f) {
+        if (_f != stdin && _f != stdout) {
+            fclose(_f);
+        }
+        _f = nullptr;
+    }
+}
+
+int FormatImportExportNRRD::arrayCount()
+{
+    return 1;
+}
+
+Error FormatImportExportNRRD::readAscii(ArrayContainer& array)
+{
+    char token[128];
+    size_t n = array.elementCount() * array.componentCount();
+    for (size_t i = 0; i < n; i++) {
+        if (std::fscanf(_dataF, "%127s", token) != 1)
+            return std::ferror(_dataF) ? ErrorSysErrno : ErrorInvalidData;
+        // values may be separated by commas, too
+        char* p = token;
+        if (*p == ',')
+            p++;
+        long long ll = std::strtoll(p, nullptr, 10);
+        unsigned long long ull = std::strtoull(p, nullptr, 10);
+        double d = std::strtod(p, nullptr);
+        unsigned char* dst = static_cast<unsigned char*>(array.data()) + i * array.componentSize();
+        switch (array.componentType()) {
+        case int8:    { int8_t v = ll;    std::memcpy(dst, &v, sizeof(v)); } break;
+        case uint8:   { uint8_t v = ull;  std::memcpy(dst, &v, sizeof(v)); } break;
+        case int16:   { int16_t v = ll;   std::memcpy(dst, &v, sizeof(v)); } break;
+        case uint16:  { uint16_t v = ull; std::memcpy(dst, &v, sizeof(v)); } break;
+        case int32:   { int32_t v = ll;   std::memcpy(dst, &v, sizeof(v)); } break;
+        case uint32:  { uint32_t v = ull; std::memcpy(dst, &v, sizeof(v)); } break;
+        case int64:   { int64_t v = ll;   std::memcpy(dst, &v, sizeof(v)); } break;
+        case uint64:  { uint64_t v = ull; std::memcpy(dst, &v, sizeof(v)); } break;
+        case float32: { float v = d;      std::memcpy(dst, &v, sizeof(v)); } break;
+        case float64: { double v = d;     std::memcpy(dst, &v, sizeof(v)); } break;
+        }
+        if (std::strchr(p, ',') && std::strchr(p, ',')[1] != '\0')
+            return ErrorInvalidData;
+    }
+    return ErrorNone;
+}
+
+ArrayContainer FormatImportExportNRRD::readArray(Error* error, int arrayIndex)
+{
+    if (arrayIndex > 0 || (arrayIndex < 0 && _done)) {
+        *error = ErrorInvalidData;
+        return ArrayContainer();
+    }
+    _done = true;
+
+    Error e = ErrorNone;
+    std::string line;
+    bool eof;
+    for (int64_t i = 0; e == ErrorNone && i < _lineSkip; i++)
+        e = readLine(_dataF, line, std::numeric_limits<size_t>::max(), &eof);
+    ArrayContainer array;
+    if (e == ErrorNone && _encoding == "raw") {
+        off_t pos = ftello(_dataF);
+        if (_byteSkip == -1) {
+            // the data is at the end of the file
+            struct stat statbuf;
+            if (fstat(fileno(_dataF), &statbuf) != 0 || uint64_t(statbuf.st_size) < _desc.dataSize()) {
+                e = ErrorInvalidData;
+            } else {
+                pos = statbuf.st_size - _desc.dataSize();
+                if (fseeko(_dataF, pos, SEEK_SET) != 0)
+                    e = ErrorSeekingNotSupported;
+            }
+        } else if (!skipBytes(_dataF, _byteSkip)) {
+            e = std::ferror(_dataF) ? ErrorSysErrno : ErrorInvalidData;
+        } else if (pos >= 0) {
+            pos += _byteSkip;
+        }
+        if (e == ErrorNone && pos >= 0 && !_swap)
+            array = mapFileData(_dataF, pos, _desc);
+        if (e == ErrorNone && !array.data()) {
+            array = ArrayContainer(_desc);
+            if (array.dataSize() > 0 && std::fread(array.data(), array.dataSize(), 1, _dataF) != 1)
+                e = std::ferror(_dataF) ? ErrorSysErrno : ErrorInvalidData;
+        }
+    } else if (e == ErrorNone && _encoding == "gzip") {
+        e = _gzipReader.open(_dataF);
+        if (e == ErrorNone)
+            e = _gzipReader.skip(_byteSkip);
+        if (e == ErrorNone) {
+            array = ArrayContainer(_desc);
+            e = _gzipReader.read(array.data(), array.dataSize());
+        }
+    } else if (e == ErrorNone) {
+        if (!skipBytes(_dataF, _byteSkip)) {
+            e = std::ferror(_dataF) ? ErrorSysErrno : ErrorInvalidData;
+        } else {
+            array = ArrayContainer(_desc);
+            e = readAscii(array);
+        }
+    }
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
+    }
+    if (_swap)
+        swapEndianness(array);
+    return array;
+}
+
+bool FormatImportExportNRRD::hasMore()
+{
+    return !_done;
+}
+
+ArrayDescription FormatImportExportNRRD::readDescription(Error* error, int arrayIndex)
+{
+    if (arrayIndex > 0 || (arrayIndex < 0 && _done)) {
+        *error = ErrorInvalidData;
+        return ArrayDescription();
+    }
+    _done = true;
+    return _desc;
+}
+
+Error FormatImportExportNRRD::writeArray(const ArrayContainer& array)
+{
+    if (_done)
+        return ErrorFeaturesUnsupported;
+    _done = true;
+    std::string compression = _hints.value("COMPRESSION", "none");
+    if (compression != "none" && compression != "gzip")
+        return ErrorInvalidData;
+    bool gzip = (compression == "gzip");
+    bool componentAxis = (array.componentCount() > 1);
+    size_t n = array.dimensionCount();
+
+    std::string header = "NRRD0004\n"
+        "# Complete NRRD file format specification at:\n"
+        "# http://teem.sourceforge.net/nrrd/format.html\n";
+    header += std::string("type: ") + nrrdTypeFromType(array.componentType()) + '\n';
+    header += "dimension: " + std::to_string(n + (componentAxis ? 1 : 0)) + '\n';
+
+    // Orientation: only if every spatial dimension has a direction of the size of the origin.
+    // Dimensions beyond the space dimension without a direction (e.g. time) are non-spatial.
+    std::vector<double> origin = numbersFromString(array.globalTagList().value("ORIGIN"));
+    std::vector<std::vector<double>> directions(n);
+    std::vector<double> spacings(n, std::nan(""));
+    std::vector<std::string> units(n);
+    bool haveOrientation = !origin.empty();
+    bool haveSpacings = false;
+    for (size_t d = 0; d < n; d++) {
+        directions[d] = numbersFromString(array.dimensionTagList(d).value("DIRECTION"));
+        if (directions[d].size() != origin.size() && !(directions[d].empty() && d >= origin.size()))
+            haveOrientation = false;
+        std::string sd = array.dimensionTagList(d).value("SAMPLE_DISTANCE");
+        char* end;
+        double s = std::strtod(sd.c_str(), &end);
+        if (end != sd.c_str()) {
+            spacings[d] = s;
+            while (*end == ' ')
+                end++;
+            units[d] = end;
+            haveSpacings = true;
+        }
+    }
+    if (haveOrientation) {
+        if (array.globalTagList().contains("SPACE"))
+            header += "space: " + array.globalTagList().value("SPACE") + '\n';
+        else
+            header += "space dimension: " + std::to_string(origin.size()) + '\n';
+    }
+    header += "sizes:";
+    if (componentAxis)
+        header += ' ' + std::to_string(array.componentCount());
+    for (size_t d = 0; d < n; d++)
+        header += ' ' + std::to_string(array.dimension(d));
+    header += '\n';
+    if (haveOrientation) {
+        header += "space directions:";
+        if (componentAxis)
+            header += " none";
+        for (size_t d = 0; d < n; d++) {
+            if (directions[d].empty()) {
+                header += " none";
+                continue;
+            }
+            double s = (std::isfinite(spacings[d]) ? spacings[d] : 1.0);
+            std::vector<double> v = directions[d];
+            for (size_t i = 0; i < v.size(); i++)
+                v[i] *= s;
+            header += ' ' + vectorToString(v);
+        }
+        header += '\n';
+        if (!units[0].empty()) {
+            header += "space units:";
+            for (size_t i = 0; i < origin.size(); i++)
+                header += " \"" + units[0] + '"';
+            header += '\n';
+        }
+        // Spacings of non-spatial dimensions are stored separately
+        haveSpacings = false;
+        for (size_t d = 0; d < n; d++) {
+            if (directions[d].empty()) {
+                haveSpacings = haveSpacings || std::isfinite(spacings[d]);
+            } else {
+                spacings[d] = std::nan("");
+                units[d].clear();
+            }
+        }
+    }
+    if (haveSpacings) {
+        header += "spacings:";
+        if (componentAxis)
+            header += " nan";
+        for (size_t d = 0; d < n; d++)
+            header += ' ' + (std::isfinite(spacings[d]) ? numberToString(spacings[d]) : std::string("nan"));
+        header += "\nunits:";
+        if (componentAxis)
+            header += " \"\"";
+        for (size_t d = 0; d < n; d++)
+            header += " \"" + units[d] + '"';
+        header += '\n';
+    }
+    header += "kinds:";
+    if (componentAxis)
+        header += " vector";
+    for (size_t d = 0; d < n; d++)
+        header += " domain";
+    header += '\n';
+    if (array.componentSize() > 1)
+        header += std::string("endian: ") + (hostIsLittleEndian() ? "little" : "big") + '\n';
+    header += std::string("encoding: ") + (gzip ? "gzip" : "raw") + '\n';
+    if (haveOrientation)
+        header += "space origin: " + vectorToString(origin) + '\n';
+    if (array.globalTagList().contains("DESCRIPTION"))
+        header += "content: " + escapeString(array.globalTagList().value("DESCRIPTION")) + '\n';
+
+    // A detached header names the data file
+    std::string dataFileName;
+    size_t nameLength = _fileName.length();
+    if (nameLength > 5 && _fileName.compare(nameLength - 5, 5, ".nhdr") == 0) {
+        dataFileName = _fileName.substr(0, nameLength - 5) + (gzip ? ".raw.gz" : ".raw");
+        size_t slash = dataFileName.find_last_of('/');
+        header += "data file: " + (slash == std::string::npos ? dataFileName : dataFileName.substr(slash + 1)) + '\n';
+    }
+    for (auto it = array.globalTagList().cbegin(); it != array.globalTagList().cend(); it++)
+        if (it->first != "SPACE" && it->first != "ORIGIN" && it->first != "DESCRIPTION"
+                && it->first.find(":=") == std::string::npos)
+            header += escapeString(it->first) + ":=" + escapeString(it->second) + '\n';
+    header += '\n';
+    if (std::fwrite(header.data(), header.size(), 1, _f) != 1)
+        return ErrorSysErrno;
+
+    FILE* dataF = _f;
+    if (!dataFileName.empty()) {
+        dataF = fopen(dataFileName.c_str(), "wb");
+        if (!dataF)
+            return ErrorSysErrno;
+    }
+    Error e = ErrorNone;
+    if (gzip) {
+        GzipWriter writer;
+        e = writer.open(dataF, _hints.value("LEVEL", -1));
+        if (e == ErrorNone)
+            e = writer.write(array.data(), array.dataSize());
+        if (e == ErrorNone)
+            e = writer.finish();
+    } else if (array.dataSize() > 0 && std::fwrite(array.data(), array.dataSize(), 1, dataF) != 1) {
+        e = ErrorSysErrno;
+    }
+    if (dataF != _f && std::fclose(dataF) != 0 && e == ErrorNone)
+        e = ErrorSysErrno;
+    if (e == ErrorNone && std::fflush(_f) != 0)
+        e = ErrorSysErrno;
+    return e;
+}
+
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TGD_IO_NRRD_HPP
+#define TGD_IO_NRRD_HPP
+
+/*
+ * NRRD files (.nrrd), and detached headers (.nhdr) with a separate data file.
+ * Supported encodings are raw, gzip (requires zlib) and ascii.
+ *
+ * NRRD axis 0 is TGD dimension 0 and so on, except that axis 0 becomes the
+ * components if its kind is not a domain kind (e.g. vector or RGB-color) or
+ * if it has no space direction. Raw data in regular files is memory-mapped;
+ * gzip data is decompressed directly into the array.
+ *
+ * Space directions and spacings are stored in the dimension tags DIRECTION
+ * (unit vector) and SAMPLE_DISTANCE (with unit), the space and space origin
+ * in the global tags SPACE (e.g. RAS or LPS) and ORIGIN, and the content in
+ * DESCRIPTION. Key/value pairs become global tags. Writing does the reverse.
+ *
+ * Output tags: COMPRESSION (none or gzip; default none), LEVEL. Writing a
+ * .nhdr file writes the data to a .raw or .raw.gz file next to it.
+ */
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+
+#include "io.hpp"
+#include "io-gzip.hpp"
+
+namespace TGD {
+
+class FormatImportExportNRRD : public FormatImportExport {
+private:
+    FILE* _f;
+    FILE* _dataF;           // the detached data file, or _f
+    GzipReader _gzipReader;
+    std::string _fileName;
+    TagList _hints;
+    ArrayDescription _desc;
+    std::string _encoding;
+    bool _swap;
+    int64_t _lineSkip;
+    int64_t _byteSkip;
+    bool _done;
+
+    Error readHeader();
+    Error readAscii(ArrayContainer& array);
+
+public:
+    FormatImportExportNRRD();
+    ~FormatImportExportNRRD();
+
+    virtual Error openForReading(const std::string& fileName, const TagList& hints) override;
+    virtual Error openForWriting(const std::string& fileName, bool append, const TagList& hints) override;
+    virtual void close() override;
+
+    // for reading:
+    virtual int arrayCount() override;
+    virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+    virtual bool hasMore() override;
+    virtual ArrayDescription readDescription(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+
+    // for writing / appending:
+    virtual Error writeArray(const ArrayContainer& array) override;
+};
+
+}
+
+#endif
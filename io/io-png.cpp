@@ -23,6 +23,7 @@
  */
 
 #include <cstdio>
+#include <cstring>
 
 #include <png.h>
 
@@ -44,7 +45,7 @@ static void my_png_warning(png_structp /* png_ptr */, png_const_charp /* warning
 }
 
 FormatImportExportPNG::FormatImportExportPNG() :
-    _f(nullptr), _arrayWasReadOrWritten(false)
+    _f(nullptr), _indexed(false), _arrayWasReadOrWritten(false)
 {
 }
 
@@ -53,8 +54,9 @@ FormatImportExportPNG::~FormatImportExportPNG()
     close();
 }
 
-Error FormatImportExportPNG::openForReading(const std::string& fileName, const TagList&)
+Error FormatImportExportPNG::openForReading(const std::string& fileName, const TagList& hints)
 {
+    _indexed = (hints.value("INDEXED", 0) != 0);
     if (fileName == "-") {
         _f = stdin;
     } else {
@@ -96,58 +98,100 @@ int FormatImportExportPNG::arrayCount()
     return (_f ? 1 : -1);
 }
 
-ArrayContainer FormatImportExportPNG::readArray(Error* error, int arrayIndex)
+// Whether text chunks follow the image data. Only then the image data must be
+// decoded to get all tags when reading the description. The file must be seekable.
+static bool textAfterImageData(FILE* f)
+{
+    unsigned char chunk[8];
+    bool afterImageData = false;
+    if (fseeko(f, 8, SEEK_SET) != 0)
+        return true;
+    while (std::fread(chunk, 8, 1, f) == 1) {
+        uint32_t length = (uint32_t(chunk[0]) << 24) | (uint32_t(chunk[1]) << 16) | (uint32_t(chunk[2]) << 8) | chunk[3];
+        if (std::memcmp(chunk + 4, "IDAT", 4) == 0)
+            afterImageData = true;
+        else if (std::memcmp(chunk + 4, "IEND", 4) == 0)
+            break;
+        else if (afterImageData && (std::memcmp(chunk + 4, "tEXt", 4) == 0
+                    || std::memcmp(chunk + 4, "zTXt", 4) == 0 || std::memcmp(chunk + 4, "iTXt", 4) == 0))
+            return true;
+        if (fseeko(f, off_t(length) + 4, SEEK_CUR) != 0)
+            return true;
+    }
+    return false;
+}
+
+Error FormatImportExportPNG::readPng(int arrayIndex, ArrayDescription& desc, ArrayContainer* array)
 {
     if (arrayIndex > 0) {
-        *error = ErrorSeekingNotSupported;
-        return ArrayContainer();
+        return ErrorSeekingNotSupported;
     }
+    // Pipes cannot be scanned in advance, so their image data is always decoded
+    bool skipImageData = (!array && (fseeko(_f, 0, SEEK_SET) != 0 || textAfterImageData(_f)));
     std::rewind(_f);
 
     png_byte header[8];
     if (std::fread(header, 8, 1, _f) != 1) {
-        *error = std::ferror(_f) ? ErrorSysErrno : ErrorInvalidData;
-        return ArrayContainer();
+        return std::ferror(_f) ? ErrorSysErrno : ErrorInvalidData;
     }
     if (png_sig_cmp(header, 0, 8)) {
-        *error = ErrorInvalidData;
-        return ArrayContainer();
+        return ErrorInvalidData;
     }
     png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png_ptr) {
-        *error = ErrorLibrary;
-        return ArrayContainer();
+        return ErrorLibrary;
     }
     png_set_user_limits(png_ptr, 0x7fffffffL, 0x7fffffffL);
-    png_set_palette_to_rgb(png_ptr);
-    png_set_expand_gray_1_2_4_to_8(png_ptr);
     png_infop info_ptr = png_create_info_struct(png_ptr);
     if (!info_ptr) {
         png_destroy_read_struct(&png_ptr, NULL, NULL);
-        *error = ErrorLibrary;
-        return ArrayContainer();
+        return ErrorLibrary;
     }
+    std::vector<png_bytep> row_pointers;
+    std::vector<png_byte> scratchRow;
+    ImageOriginLocation originLocation = getImageOriginLocation(_fileName);
     png_set_error_fn(png_ptr, NULL, my_png_error, my_png_warning);
     if (setjmp(png_jmpbuf(png_ptr))) {
         png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-        *error = ErrorLibrary;
-        return ArrayContainer();
+        return ErrorLibrary;
     }
     png_init_io(png_ptr, _f);
     png_set_sig_bytes(png_ptr, 8);
+    png_read_info(png_ptr, info_ptr);
     // TODO: ??? png_set_gamma(png_ptr, 2.2, 0.45455);
-    png_read_png(png_ptr, info_ptr,
-            PNG_TRANSFORM_EXPAND | PNG_TRANSFORM_PACKING | PNG_TRANSFORM_SWAP_ENDIAN,
-            NULL);
+    bool keepIndices = (_indexed && png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_PALETTE);
+    if (!keepIndices)
+        png_set_expand(png_ptr);
+    png_set_packing(png_ptr);
+    png_set_swap(png_ptr);
+    png_set_interlace_handling(png_ptr);
+    png_read_update_info(png_ptr, info_ptr);
     unsigned int width = png_get_image_width(png_ptr, info_ptr);
     unsigned int height = png_get_image_height(png_ptr, info_ptr);
     unsigned int channels = png_get_channels(png_ptr, info_ptr);
     png_byte bit_depth = png_get_bit_depth(png_ptr, info_ptr);
-    png_bytep *row_pointers = png_get_rows(png_ptr, info_ptr);
+    desc = ArrayDescription({ width, height }, channels, bit_depth <= 8 ? uint8 : uint16);
+
+    if (array) {
+        // read the rows directly into the array
+        *array = ArrayContainer(desc);
+        row_pointers.resize(height);
+        for (size_t i = 0; i < height; i++) {
+            size_t y = (originLocation == OriginTopLeft ? height - 1 - i : i);
+            row_pointers[i] = static_cast<png_bytep>(array->get(y * width));
+        }
+        png_read_image(png_ptr, row_pointers.data());
+        png_read_end(png_ptr, info_ptr);
+    } else if (skipImageData) {
+        // decode all rows into one scratch row to get to the chunks after the image data
+        scratchRow.resize(png_get_rowbytes(png_ptr, info_ptr));
+        row_pointers.assign(height, scratchRow.data());
+        png_read_image(png_ptr, row_pointers.data());
+        png_read_end(png_ptr, info_ptr);
+    }
+
     png_textp text_ptr;
     png_uint_32 num_text = png_get_text(png_ptr, info_ptr, &text_ptr, NULL);
-
-    ArrayContainer r({ width, height }, channels, bit_depth <= 8 ? uint8 : uint16);
     for (unsigned int i = 0; i < num_text; i++) {
         if (std::strncmp(text_ptr[i].text, "\nexif\n", 6) == 0) {
             // This is EXIF data encoded in a string with control characters.
@@ -156,45 +200,108 @@ ArrayContainer FormatImportExportPNG::readArray(Error* error, int arrayIndex)
             // that does not seem useful.
             continue;
         }
-        r.globalTagList().set(text_ptr[i].key, text_ptr[i].text);
+        desc.globalTagList().set(text_ptr[i].key, text_ptr[i].text);
     }
-    if (channels == 1) {
-        r.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
+    if (keepIndices) {
+        png_colorp plte = nullptr;
+        int num_plte = 0;
+        png_bytep trns = nullptr;
+        int num_trns = 0;
+        png_get_PLTE(png_ptr, info_ptr, &plte, &num_plte);
+        if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
+            png_get_tRNS(png_ptr, info_ptr, &trns, &num_trns, NULL);
+        size_t paletteChannels = (num_trns > 0 ? 4 : 3);
+        std::vector<uint8_t> palette(num_plte * paletteChannels);
+        for (int i = 0; i < num_plte; i++) {
+            palette[i * paletteChannels + 0] = plte[i].red;
+            palette[i * paletteChannels + 1] = plte[i].green;
+            palette[i * paletteChannels + 2] = plte[i].blue;
+            if (paletteChannels == 4)
+                palette[i * paletteChannels + 3] = (i < num_trns ? trns[i] : 255);
+        }
+        desc.componentTagList(0).set("INTERPRETATION", "INDEX");
+        desc.componentTagList(0).set("PALETTE", paletteToString(palette, paletteChannels));
+    } else if (channels == 1) {
+        desc.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
     } else if (channels == 2) {
-        r.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
-        r.componentTagList(1).set("INTERPRETATION", "ALPHA");
+        desc.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
+        desc.componentTagList(1).set("INTERPRETATION", "ALPHA");
     } else if (channels == 3) {
-        r.componentTagList(0).set("INTERPRETATION", "SRGB/R");
-        r.componentTagList(1).set("INTERPRETATION", "SRGB/G");
-        r.componentTagList(2).set("INTERPRETATION", "SRGB/B");
+        desc.componentTagList(0).set("INTERPRETATION", "SRGB/R");
+        desc.componentTagList(1).set("INTERPRETATION", "SRGB/G");
+        desc.componentTagList(2).set("INTERPRETATION", "SRGB/B");
     } else if (channels == 4) {
-        r.componentTagList(0).set("INTERPRETATION", "SRGB/R");
-        r.componentTagList(1).set("INTERPRETATION", "SRGB/G");
-        r.componentTagList(2).set("INTERPRETATION", "SRGB/B");
-        r.componentTagList(3).set("INTERPRETATION", "ALPHA");
-    }
-    ImageOriginLocation originLocation = getImageOriginLocation(_fileName);
-    for (size_t i = 0; i < height; i++) {
-        if (originLocation == OriginTopLeft)
-            std::memcpy(r.get(i * width), row_pointers[height - 1 - i], r.elementSize() * width);
-        else
-            std::memcpy(r.get(i * width), row_pointers[i], r.elementSize() * width);
+        desc.componentTagList(0).set("INTERPRETATION", "SRGB/R");
+        desc.componentTagList(1).set("INTERPRETATION", "SRGB/G");
+        desc.componentTagList(2).set("INTERPRETATION", "SRGB/B");
+        desc.componentTagList(3).set("INTERPRETATION", "ALPHA");
     }
     png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
 
-    if (originLocation != OriginTopLeft)
-        fixImageOrientation(r, originLocation);
+    if (array) {
+        static_cast<ArrayDescription&>(*array) = desc;
+        if (originLocation != OriginTopLeft)
+            fixImageOrientation(*array, originLocation);
+    } else {
+        desc = orientedImageDescription(desc, originLocation);
+    }
 
     _arrayWasReadOrWritten = true;
+    return ErrorNone;
+}
 
+ArrayContainer FormatImportExportPNG::readArray(Error* error, int arrayIndex)
+{
+    ArrayDescription desc;
+    ArrayContainer r;
+    Error e = readPng(arrayIndex, desc, &r);
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
+    }
     return r;
 }
 
+ArrayDescription FormatImportExportPNG::readDescription(Error* error, int arrayIndex)
+{
+    ArrayDescription desc;
+    Error e = readPng(arrayIndex, desc, nullptr);
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayDescription();
+    }
+    return desc;
+}
+
 bool FormatImportExportPNG::hasMore()
 {
     return !_arrayWasReadOrWritten;
 }
 
+// Get the palette of an indexed image, i.e. of an array with a single uint8 component
+// that has a PALETTE tag, and check that all indices are valid
+static bool getPalette(const ArrayContainer& array, std::vector<uint8_t>& palette, size_t& paletteChannels)
+{
+    if (array.componentCount() != 1 || array.componentType() != uint8
+            || !array.componentTagList(0).contains("PALETTE"))
+        return true;
+    if (!paletteFromString(array.componentTagList(0).value("PALETTE"), palette, &paletteChannels))
+        return false;
+    size_t paletteSize = palette.size() / paletteChannels;
+    const uint8_t* indices = static_cast<const uint8_t*>(array.data());
+    for (size_t i = 0; i < array.elementCount(); i++)
+        if (indices[i] >= paletteSize)
+            return false;
+    return true;
+}
+
+static int pngBitDepth(const ArrayContainer& array, size_t paletteSize)
+{
+    if (paletteSize > 0)
+        return (paletteSize <= 2 ? 1 : paletteSize <= 4 ? 2 : paletteSize <= 16 ? 4 : 8);
+    return (array.componentType() == uint8 ? 8 : 16);
+}
+
 Error FormatImportExportPNG::writeArray(const ArrayContainer& array)
 {
     if (array.dimensionCount() != 2
@@ -206,6 +313,24 @@ Error FormatImportExportPNG::writeArray(const ArrayContainer& array)
         return ErrorFeaturesUnsupported;
     }
 
+    // Indexed images: a single uint8 component with a PALETTE tag
+    std::vector<uint8_t> palette;
+    size_t paletteChannels = 0;
+    if (!getPalette(array, palette, paletteChannels))
+        return ErrorInvalidData;
+    // These must not be modified after setjmp()
+    const size_t paletteSize = (paletteChannels > 0 ? palette.size() / paletteChannels : 0);
+    const int bitDepth = pngBitDepth(array, paletteSize);
+    std::vector<png_color> plte(paletteSize);
+    std::vector<png_byte> trns(paletteChannels == 4 ? paletteSize : 0);
+    for (size_t i = 0; i < paletteSize; i++) {
+        plte[i].red = palette[i * paletteChannels + 0];
+        plte[i].green = palette[i * paletteChannels + 1];
+        plte[i].blue = palette[i * paletteChannels + 2];
+        if (paletteChannels == 4)
+            trns[i] = palette[i * paletteChannels + 3];
+    }
+
     std::vector<png_bytep> row_pointers(array.dimension(1));
     for (size_t i = 0; i < array.dimension(1); i++)
         row_pointers[i] = static_cast<unsigned char*>(const_cast<void*>(array.get((array.dimension(1) - 1 - i) * array.dimension(0))));
@@ -238,8 +363,9 @@ Error FormatImportExportPNG::writeArray(const ArrayContainer& array)
     png_init_io(png_ptr, _f);
     png_set_IHDR(png_ptr, info_ptr,
             array.dimension(0), array.dimension(1),
-            array.componentType() == uint8 ? 8 : 16,
-            array.componentCount() == 1 ? PNG_COLOR_TYPE_GRAY
+            bitDepth,
+            paletteSize > 0 ? PNG_COLOR_TYPE_PALETTE
+            : array.componentCount() == 1 ? PNG_COLOR_TYPE_GRAY
             : array.componentCount() == 2 ? PNG_COLOR_TYPE_GRAY_ALPHA
             : array.componentCount() == 3 ? PNG_COLOR_TYPE_RGB
             : PNG_COLOR_TYPE_RGB_ALPHA,
@@ -248,11 +374,16 @@ Error FormatImportExportPNG::writeArray(const ArrayContainer& array)
             PNG_FILTER_TYPE_DEFAULT);
     png_set_compression_level(png_ptr, 6);
     png_set_sRGB(png_ptr, info_ptr, PNG_sRGB_INTENT_ABSOLUTE);
+    if (paletteSize > 0) {
+        png_set_PLTE(png_ptr, info_ptr, plte.data(), paletteSize);
+        if (trns.size() > 0)
+            png_set_tRNS(png_ptr, info_ptr, trns.data(), trns.size(), NULL);
+    }
     if (text.size() > 0)
         png_set_text(png_ptr, info_ptr, &(text[0]), text.size());
     png_set_rows(png_ptr, info_ptr, &(row_pointers[0]));
     png_write_png(png_ptr, info_ptr,
-            PNG_TRANSFORM_SWAP_ENDIAN,
+            PNG_TRANSFORM_SWAP_ENDIAN | PNG_TRANSFORM_PACKING,
             NULL);
     png_destroy_write_struct(&png_ptr, &info_ptr);
     if (fflush(_f) != 0) {
@@ -335,12 +335,12 @@ bool skipPnmData(FILE* f, const PNMInfo& info)
         }
         readWhitespace(f); // ignore EOF
     } else {
-        off_t bytes =
-              off_t(info.width)
-            * off_t(info.height)
-            * off_t(info.depth)
-            * off_t(info.maxval < 0 ? 4 : info.maxval > 255 ? 2 : 1);
-        if (fseeko(f, bytes, SEEK_CUR) < 0) {
+        uint64_t bytes =
+              uint64_t(info.width)
+            * uint64_t(info.height)
+            * uint64_t(info.depth)
+            * uint64_t(info.maxval < 0 ? 4 : info.maxval > 255 ? 2 : 1);
+        if (!skipBytes(f, bytes)) {
             return false;
         }
     }
@@ -397,34 +397,25 @@ int FormatImportExportPNM::arrayCount()
     return _arrayCount;
 }
 
-ArrayContainer FormatImportExportPNM::readArray(Error* error, int arrayIndex)
+Error FormatImportExportPNM::seekToArray(int arrayIndex)
 {
-    // Seek if necessary
     if (arrayIndex >= 0) {
-        if (arrayCount() < 0) {
-            *error = ErrorSeekingNotSupported;
-            return ArrayContainer();
-        }
-        if (arrayIndex >= arrayCount()) {
-            *error = ErrorInvalidData;
-            return ArrayContainer();
-        }
-        if (fseeko(_f, _arrayOffsets[arrayIndex], SEEK_SET) < 0) {
-            *error = ErrorSysErrno;
-            return ArrayContainer();
-        }
+        if (arrayCount() < 0)
+            return ErrorSeekingNotSupported;
+        if (arrayIndex >= arrayCount())
+            return ErrorInvalidData;
+        if (fseeko(_f, _arrayOffsets[arrayIndex], SEEK_SET) < 0)
+            return ErrorSysErrno;
     }
+    return ErrorNone;
+}
 
-    // Read the PNM
-    PNMInfo pnminfo = readPnmHeader(_f);
-    if (pnminfo.error != ErrorNone) {
-        *error = pnminfo.error;
-        return ArrayContainer();
-    }
+static ArrayDescription pnmDescription(const PNMInfo& pnminfo)
+{
     Type type = (pnminfo.maxval < 0 ? float32
             : pnminfo.maxval <= 255 ? uint8
             : uint16);
-    ArrayContainer r({ size_t(pnminfo.width), size_t(pnminfo.height) },
+    ArrayDescription r({ size_t(pnminfo.width), size_t(pnminfo.height) },
             size_t(pnminfo.depth), type);
     if (pnminfo.depth <= 2) {
         if (pnminfo.maxval < 0)
@@ -448,6 +439,25 @@ ArrayContainer FormatImportExportPNM::readArray(Error* error, int arrayIndex)
             r.componentTagList(3).set("INTERPRETATION", "ALPHA");
         }
     }
+    return r;
+}
+
+ArrayContainer FormatImportExportPNM::readArray(Error* error, int arrayIndex)
+{
+    // Seek if necessary
+    Error err = seekToArray(arrayIndex);
+    if (err != ErrorNone) {
+        *error = err;
+        return ArrayContainer();
+    }
+
+    // Read the PNM
+    PNMInfo pnminfo = readPnmHeader(_f);
+    if (pnminfo.error != ErrorNone) {
+        *error = pnminfo.error;
+        return ArrayContainer();
+    }
+    ArrayContainer r(pnmDescription(pnminfo));
     if (!readPnmData(_f, pnminfo, r)) {
         *error = ErrorInvalidData;
         return ArrayContainer();
@@ -455,7 +465,7 @@ ArrayContainer FormatImportExportPNM::readArray(Error* error, int arrayIndex)
     if (pnminfo.needsEndianFix) {
         swapEndianness(r);
     }
-    if (type == float32) {
+    if (r.componentType() == float32) {
         for (size_t e = 0; e < r.elementCount(); e++)
             for (size_t c = 0; c < r.componentCount(); c++)
                 r.set<float>(e, c, r.get<float>(e, c) * pnminfo.factor);
@@ -465,6 +475,25 @@ ArrayContainer FormatImportExportPNM::readArray(Error* error, int arrayIndex)
     return r;
 }
 
+ArrayDescription FormatImportExportPNM::readDescription(Error* error, int arrayIndex)
+{
+    Error e = seekToArray(arrayIndex);
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayDescription();
+    }
+    PNMInfo pnminfo = readPnmHeader(_f);
+    if (pnminfo.error != ErrorNone) {
+        *error = pnminfo.error;
+        return ArrayDescription();
+    }
+    if (!skipPnmData(_f, pnminfo)) {
+        *error = ErrorInvalidData;
+        return ArrayDescription();
+    }
+    return pnmDescription(pnminfo);
+}
+
 bool FormatImportExportPNM::hasMore()
 {
     int c = fgetc(_f);
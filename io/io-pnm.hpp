@@ -37,6 +37,8 @@ private:
     int _arrayCount;
     std::vector<off_t> _arrayOffsets;
 
+    Error seekToArray(int arrayIndex);
+
 public:
     FormatImportExportPNM();
     ~FormatImportExportPNM();
@@ -49,6 +51,7 @@ public:
     virtual int arrayCount() override;
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
+    virtual ArrayDescription readDescription(Error* error, int arrayIndex = -1 /* -1 means next */) override;
 
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
@@ -0,0 +1,432 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <algorithm>
+
+#include "io-qoi.hpp"
+#include "io-utils.hpp"
+
+
+namespace TGD {
+
+enum {
+    QOI_OP_INDEX = 0x00,
+    QOI_OP_DIFF  = 0x40,
+    QOI_OP_LUMA  = 0x80,
+    QOI_OP_RUN   = 0xc0,
+    QOI_OP_RGB   = 0xfe,
+    QOI_OP_RGBA  = 0xff,
+    QOI_MASK_2   = 0xc0
+};
+
+static const unsigned char qoiEndMarker[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+struct QOIPixel {
+    unsigned char r, g, b, a;
+
+    bool operator==(const QOIPixel& p) const
+    {
+        return r == p.r && g == p.g && b == p.b && a == p.a;
+    }
+};
+
+static unsigned int qoiHash(const QOIPixel& p)
+{
+    return (p.r * 3 + p.g * 5 + p.b * 7 + p.a * 11) % 64;
+}
+
+struct QOIInfo {
+    uint32_t width;
+    uint32_t height;
+    unsigned int channels;
+    unsigned int colorspace;
+};
+
+static Error readQoiHeader(FILE* f, QOIInfo& info)
+{
+    unsigned char h[14];
+    if (std::fread(h, 14, 1, f) != 1)
+        return std::ferror(f) ? ErrorSysErrno : ErrorInvalidData;
+    info.width = (uint32_t(h[4]) << 24) | (uint32_t(h[5]) << 16) | (uint32_t(h[6]) << 8) | h[7];
+    info.height = (uint32_t(h[8]) << 24) | (uint32_t(h[9]) << 16) | (uint32_t(h[10]) << 8) | h[11];
+    info.channels = h[12];
+    info.colorspace = h[13];
+    if (std::memcmp(h, "qoif", 4) != 0 || info.width == 0 || info.height == 0
+            || (info.channels != 3 && info.channels != 4) || info.colorspace > 1)
+        return ErrorInvalidData;
+    return ErrorNone;
+}
+
+static ArrayDescription qoiDescription(const QOIInfo& info)
+{
+    ArrayDescription r({ info.width, info.height }, info.channels, uint8);
+    if (info.colorspace == 0) {
+        r.componentTagList(0).set("INTERPRETATION", "SRGB/R");
+        r.componentTagList(1).set("INTERPRETATION", "SRGB/G");
+        r.componentTagList(2).set("INTERPRETATION", "SRGB/B");
+    } else {
+        r.componentTagList(0).set("INTERPRETATION", "RED");
+        r.componentTagList(1).set("INTERPRETATION", "GREEN");
+        r.componentTagList(2).set("INTERPRETATION", "BLUE");
+    }
+    if (info.channels == 4)
+        r.componentTagList(3).set("INTERPRETATION", "ALPHA");
+    return r;
+}
+
+/* Decode the chunks of an image directly into the array, or just skip them
+ * if array is null. Rows are stored top to bottom in the file. */
+static Error readQoiData(FILE* f, const QOIInfo& info, ArrayContainer* array)
+{
+    QOIPixel index[64];
+    std::memset(index, 0, sizeof(index));
+    QOIPixel px = { 0, 0, 0, 255 };
+    size_t rowSize = size_t(info.width) * info.channels;
+    unsigned int run = 0;
+    Error e = ErrorNone;
+    flockfile(f);
+    for (size_t y = 0; e == ErrorNone && y < info.height; y++) {
+        unsigned char* dst = (array ? static_cast<unsigned char*>(array->data())
+                + (info.height - 1 - y) * rowSize : nullptr);
+        for (size_t x = 0; x < info.width; x++) {
+            if (run > 0) {
+                run--;
+            } else {
+                int b1 = getc_unlocked(f);
+                if (b1 == EOF) {
+                    e = ErrorInvalidData;
+                    break;
+                }
+                if (b1 == QOI_OP_RGB || b1 == QOI_OP_RGBA) {
+                    int c[4] = { 0, 0, 0, px.a };
+                    for (int i = 0; i < (b1 == QOI_OP_RGB ? 3 : 4); i++)
+                        c[i] = getc_unlocked(f);
+                    if (c[0] == EOF || c[1] == EOF || c[2] == EOF || c[3] == EOF) {
+                        e = ErrorInvalidData;
+                        break;
+                    }
+                    px = { (unsigned char)c[0], (unsigned char)c[1], (unsigned char)c[2], (unsigned char)c[3] };
+                } else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+                    px = index[b1];
+                } else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+                    px.r += ((b1 >> 4) & 0x03) - 2;
+                    px.g += ((b1 >> 2) & 0x03) - 2;
+                    px.b += (b1 & 0x03) - 2;
+                } else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+                    int b2 = getc_unlocked(f);
+                    if (b2 == EOF) {
+                        e = ErrorInvalidData;
+                        break;
+                    }
+                    int vg = (b1 & 0x3f) - 32;
+                    px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+                    px.g += vg;
+                    px.b += vg - 8 + (b2 & 0x0f);
+                } else {
+                    run = b1 & 0x3f;
+                }
+                index[qoiHash(px)] = px;
+            }
+            if (dst) {
+                *dst++ = px.r;
+                *dst++ = px.g;
+                *dst++ = px.b;
+                if (info.channels == 4)
+                    *dst++ = px.a;
+            }
+        }
+    }
+    // Images end with a fixed marker
+    for (int i = 0; e == ErrorNone && i < 8; i++) {
+        if (getc_unlocked(f) != qoiEndMarker[i])
+            e = ErrorInvalidData;
+    }
+    if (e != ErrorNone && std::ferror(f))
+        e = ErrorSysErrno;
+    funlockfile(f);
+    return e;
+}
+
+/* Encode the image rows [firstRow, firstRow + rows) (top to bottom). Stripes
+ * after the first know nothing about the decoder state at their start, so
+ * their first pixel is stored explicitly and they only refer to index entries
+ * they have set themselves. Their concatenation is a valid QOI stream. */
+static void encodeQoiRows(const ArrayContainer& array, size_t firstRow, size_t rows,
+        std::vector<unsigned char>& out)
+{
+    const size_t width = array.dimension(0);
+    const size_t height = array.dimension(1);
+    const unsigned int channels = array.componentCount();
+    const size_t rowSize = width * channels;
+    out.resize(width * rows * (channels + 1));
+    unsigned char* o = out.data();
+
+    QOIPixel index[64];
+    std::memset(index, 0, sizeof(index));
+    uint64_t indexValid = (firstRow == 0 ? ~uint64_t(0) : 0);
+    QOIPixel prev = { 0, 0, 0, 255 };
+    bool prevValid = (firstRow == 0);
+    unsigned int run = 0;
+    for (size_t y = firstRow; y < firstRow + rows; y++) {
+        const unsigned char* src = static_cast<const unsigned char*>(array.data())
+            + (height - 1 - y) * rowSize;
+        for (size_t x = 0; x < width; x++) {
+            QOIPixel px = { src[0], src[1], src[2], (unsigned char)(channels == 4 ? src[3] : 255) };
+            src += channels;
+            if (prevValid && px == prev) {
+                run++;
+                if (run == 62) {
+                    *o++ = QOI_OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0) {
+                *o++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+            unsigned int h = qoiHash(px);
+            if ((indexValid >> h & 1) && index[h] == px) {
+                *o++ = QOI_OP_INDEX | h;
+            } else {
+                index[h] = px;
+                indexValid |= uint64_t(1) << h;
+                if (!prevValid || px.a != prev.a) {
+                    // RGB suffices for 3 channels since the alpha value is always 255
+                    *o++ = (channels == 4 ? QOI_OP_RGBA : QOI_OP_RGB);
+                    *o++ = px.r;
+                    *o++ = px.g;
+                    *o++ = px.b;
+                    if (channels == 4)
+                        *o++ = px.a;
+                } else {
+                    signed char vr = px.r - prev.r;
+                    signed char vg = px.g - prev.g;
+                    signed char vb = px.b - prev.b;
+                    signed char vgr = vr - vg;
+                    signed char vgb = vb - vg;
+                    if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                        *o++ = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+                    } else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8) {
+                        *o++ = QOI_OP_LUMA | (vg + 32);
+                        *o++ = (vgr + 8) << 4 | (vgb + 8);
+                    } else {
+                        *o++ = QOI_OP_RGB;
+                        *o++ = px.r;
+                        *o++ = px.g;
+                        *o++ = px.b;
+                    }
+                }
+            }
+            prev = px;
+            prevValid = true;
+        }
+    }
+    if (run > 0)
+        *o++ = QOI_OP_RUN | (run - 1);
+    out.resize(o - out.data());
+}
+
+FormatImportExportQOI::FormatImportExportQOI() :
+    _f(nullptr),
+    _arrayCount(-2)
+{
+}
+
+FormatImportExportQOI::~FormatImportExportQOI()
+{
+    close();
+}
+
+Error FormatImportExportQOI::openForReading(const std::string& fileName, const TagList&)
+{
+    if (fileName == "-")
+        _f = stdin;
+    else
+        _f = fopen(fileName.c_str(), "rb");
+    return _f ? ErrorNone : ErrorSysErrno;
+}
+
+Error FormatImportExportQOI::openForWriting(const std::string& fileName, bool append, const TagList& hints)
+{
+    if (fileName == "-")
+        _f = stdout;
+    else
+        _f = fopen(fileName.c_str(), append ? "ab" : "wb");
+    _hints = hints;
+    return _f ? ErrorNone : ErrorSysErrno;
+}
+
+void FormatImportExportQOI::close()
+{
+    if (_f) {
+        if (_f != stdin && _f != stdout) {
+            fclose(_f);
+        }
+        _f = nullptr;
+    }
+    _arrayCount = -2;
+    _arrayOffsets.clear();
+}
+
+int FormatImportExportQOI::arrayCount()
+{
+    if (_arrayCount >= -1)
+        return _arrayCount;
+
+    // find offsets of all images in the file
+    off_t curPos = ftello(_f);
+    if (curPos < 0) {
+        _arrayCount = -1;
+        return _arrayCount;
+    }
+    rewind(_f);
+    while (hasMore()) {
+        off_t arrayPos = ftello(_f);
+        QOIInfo info;
+        if (arrayPos < 0 || readQoiHeader(_f, info) != ErrorNone || readQoiData(_f, info, nullptr) != ErrorNone
+                || _arrayOffsets.size() == size_t(std::numeric_limits<int>::max())) {
+            _arrayOffsets.clear();
+            _arrayCount = -1;
+            return -1;
+        }
+        _arrayOffsets.push_back(arrayPos);
+    }
+    if (fseeko(_f, curPos, SEEK_SET) < 0) {
+        _arrayOffsets.clear();
+        _arrayCount = -1;
+        return -1;
+    }
+    _arrayCount = _arrayOffsets.size();
+    return _arrayCount;
+}
+
+Error FormatImportExportQOI::seekToArray(int arrayIndex)
+{
+    if (arrayIndex >= 0) {
+        if (arrayCount() < 0)
+            return ErrorSeekingNotSupported;
+        if (arrayIndex >= arrayCount())
+            return ErrorInvalidData;
+        if (fseeko(_f, _arrayOffsets[arrayIndex], SEEK_SET) < 0)
+            return ErrorSysErrno;
+    }
+    return ErrorNone;
+}
+
+ArrayContainer FormatImportExportQOI::readArray(Error* error, int arrayIndex)
+{
+    QOIInfo info;
+    Error e = seekToArray(arrayIndex);
+    if (e == ErrorNone)
+        e = readQoiHeader(_f, info);
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
+    }
+    ArrayContainer r(qoiDescription(info));
+    if ((e = readQoiData(_f, info, &r)) != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
+    }
+    return r;
+}
+
+ArrayDescription FormatImportExportQOI::readDescription(Error* error, int arrayIndex)
+{
+    QOIInfo info;
+    Error e = seekToArray(arrayIndex);
+    if (e == ErrorNone)
+        e = readQoiHeader(_f, info);
+    if (e == ErrorNone)
+        e = readQoiData(_f, info, nullptr);
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayDescription();
+    }
+    return qoiDescription(info);
+}
+
+bool FormatImportExportQOI::hasMore()
+{
+    int c = fgetc(_f);
+    if (c == EOF) {
+        return false;
+    } else {
+        ungetc(c, _f);
+        return true;
+    }
+}
+
+Error FormatImportExportQOI::writeArray(const ArrayContainer& array)
+{
+    if (array.dimensionCount() != 2
+            || array.dimension(0) > std::numeric_limits<uint32_t>::max()
+            || array.dimension(1) > std::numeric_limits<uint32_t>::max()
+            || (array.componentCount() != 3 && array.componentCount() != 4)
+            || array.componentType() != uint8) {
+        return ErrorFeaturesUnsupported;
+    }
+    const size_t width = array.dimension(0);
+    const size_t height = array.dimension(1);
+
+    unsigned char header[14] = { 'q', 'o', 'i', 'f',
+        (unsigned char)(width >> 24), (unsigned char)(width >> 16), (unsigned char)(width >> 8), (unsigned char)width,
+        (unsigned char)(height >> 24), (unsigned char)(height >> 16), (unsigned char)(height >> 8), (unsigned char)height,
+        (unsigned char)array.componentCount(),
+        (unsigned char)(array.componentTagList(0).value("INTERPRETATION") == "RED" ? 1 : 0) };
+
+    // Encode stripes of rows in parallel; small images are not worth it
+    size_t threadCount = _hints.value("THREADS", std::max(1u, std::thread::hardware_concurrency()));
+    threadCount = std::max(size_t(1), std::min(threadCount, width * height / 65536));
+    size_t rowsPerStripe = (height + threadCount - 1) / threadCount;
+    size_t stripeCount = (height + rowsPerStripe - 1) / rowsPerStripe;
+    std::vector<std::vector<unsigned char>> stripes(stripeCount);
+    std::vector<std::thread> threads;
+    for (size_t s = 1; s < stripeCount; s++) {
+        threads.push_back(std::thread([&, s]() {
+            encodeQoiRows(array, s * rowsPerStripe, std::min(rowsPerStripe, height - s * rowsPerStripe), stripes[s]);
+        }));
+    }
+    encodeQoiRows(array, 0, std::min(rowsPerStripe, height), stripes[0]);
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+
+    if (fwrite(header, sizeof(header), 1, _f) != 1)
+        return ErrorSysErrno;
+    for (size_t s = 0; s < stripeCount; s++) {
+        if (stripes[s].size() > 0 && fwrite(stripes[s].data(), stripes[s].size(), 1, _f) != 1)
+            return ErrorSysErrno;
+    }
+    if (fwrite(qoiEndMarker, sizeof(qoiEndMarker), 1, _f) != 1 || fflush(_f) != 0)
+        return ErrorSysErrno;
+    return ErrorNone;
+}
+
+}
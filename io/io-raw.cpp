@@ -28,6 +28,7 @@
 #include <sys/stat.h>
 
 #include "io-raw.hpp"
+#include "io-utils.hpp"
 
 
 namespace TGD {
@@ -44,7 +45,7 @@ FormatImportExportRAW::~FormatImportExportRAW()
     close();
 }
 
-Error FormatImportExportRAW::openForReading(const std::string& fileName, const TagList& hints)
+static Error templateFromHints(const TagList& hints, ArrayDescription& desc)
 {
     // The following attributes define an array. Since they are not stored in raw binary files,
     // we need to get them from the hints.
@@ -84,13 +85,24 @@ Error FormatImportExportRAW::openForReading(const std::string& fileName, const T
     else if (!typeFromString(hints.value("TYPE"), &type))
         return ErrorInvalidData;
 
-    _template = ArrayDescription(dimensions, components, type);
+    desc = ArrayDescription(dimensions, components, type);
+    return ErrorNone;
+}
+
+Error FormatImportExportRAW::openForReading(const std::string& fileName, const TagList& hints)
+{
+    Error e = templateFromHints(hints, _template);
+    if (e != ErrorNone)
+        return e;
 
     // We have the metadata, now try and open the file
-    if (fileName == "-")
+    if (fileName == "-") {
         _f = stdin;
-    else
+    } else {
         _f = fopen(fileName.c_str(), "rb");
+        if (_f)
+            _directIO.open(fileName, _f, false, hints);
+    }
     if (_f) {
         struct stat statbuf;
         if (fstat(fileno(_f), &statbuf) != 0) {
@@ -102,17 +114,35 @@ Error FormatImportExportRAW::openForReading(const std::string& fileName, const T
     return _f ? ErrorNone : ErrorSysErrno;
 }
 
-Error FormatImportExportRAW::openForWriting(const std::string& fileName, bool append, const TagList&)
+Error FormatImportExportRAW::openForWriting(const std::string& fileName, bool append, const TagList& hints)
 {
-    if (fileName == "-")
+    if (fileName == "-") {
         _f = stdout;
-    else
-        _f = fopen(fileName.c_str(), append ? "ab" : "wb");
+    } else {
+        // with read access, for mapArray()
+        _f = fopen(fileName.c_str(), append ? "a+b" : "w+b");
+        // the initial position of a+ streams is the beginning of the file
+        if (_f && append && fseeko(_f, 0, SEEK_END) != 0) {
+            fclose(_f);
+            _f = nullptr;
+        }
+        if (_f) {
+            _directIO.open(fileName, _f, true, hints);
+            _fileName = fileName;
+        }
+    }
+    // This is only needed for writeBox()
+    if (templateFromHints(hints, _template) != ErrorNone)
+        _template = ArrayDescription();
     return _f ? ErrorNone : ErrorSysErrno;
 }
 
 void FormatImportExportRAW::close()
 {
+    _directIO.close();
+    _fileMapper.close();
+    _boxWriter.close();
+    _fileName.clear();
     if (_f) {
         if (_f != stdin && _f != stdout) {
             fclose(_f);
@@ -135,13 +165,51 @@ ArrayContainer FormatImportExportRAW::readArray(Error* error, int arrayIndex)
         }
     }
     ArrayContainer r(_template);
-    if (fread(r.data(), r.dataSize(), 1, _f) != 1) {
-        *error = ferror(_f) ? ErrorSysErrno : ErrorInvalidData;
+    Error e = _directIO.read(_f, r.data(), r.dataSize());
+    if (e != ErrorNone) {
+        *error = e;
         return ArrayContainer();
     }
     return r;
 }
 
+ArrayDescription FormatImportExportRAW::readDescription(Error* error, int arrayIndex)
+{
+    if (arrayIndex >= 0) {
+        if (fseeko(_f, arrayIndex * _template.dataSize(), SEEK_SET) != 0) {
+            *error = ErrorSysErrno;
+            return ArrayDescription();
+        }
+    }
+    if (!skipBytes(_f, _template.dataSize())) {
+        *error = ferror(_f) ? ErrorSysErrno : ErrorInvalidData;
+        return ArrayDescription();
+    }
+    return _template;
+}
+
+std::vector<ArrayContainer> FormatImportExportRAW::readBoxes(Error* error,
+        const std::vector<std::vector<size_t>>& boxes, int arrayIndex)
+{
+    // Reading parts of the data requires random access
+    struct stat statbuf;
+    if (fstat(fileno(_f), &statbuf) != 0 || (statbuf.st_mode & S_IFMT) != S_IFREG)
+        return FormatImportExport::readBoxes(error, boxes, arrayIndex);
+
+    std::vector<ArrayContainer> r;
+    off_t dataOffset = (arrayIndex >= 0 ? off_t(arrayIndex * _template.dataSize()) : ftello(_f));
+    Error e = (dataOffset < 0 ? ErrorSysErrno : ErrorNone);
+    if (e == ErrorNone)
+        e = _batchReader.readBoxes(fileno(_f), dataOffset, _template, boxes, r);
+    if (e == ErrorNone && fseeko(_f, dataOffset + _template.dataSize(), SEEK_SET) != 0)
+        e = ErrorSysErrno;
+    if (e != ErrorNone) {
+        *error = e;
+        return std::vector<ArrayContainer>();
+    }
+    return r;
+}
+
 bool FormatImportExportRAW::hasMore()
 {
     int c = fgetc(_f);
@@ -155,9 +223,27 @@ bool FormatImportExportRAW::hasMore()
 
 Error FormatImportExportRAW::writeArray(const ArrayContainer& array)
 {
-    if (fwrite(array.data(), array.dataSize(), 1, _f) != 1 || fflush(_f) != 0)
-        return ErrorSysErrno;
-    return ErrorNone;
+    Error e = _directIO.write(_f, array.data(), array.dataSize());
+    if (e == ErrorNone && fflush(_f) != 0)
+        e = ErrorSysErrno;
+    return e;
+}
+
+ArrayContainer FormatImportExportRAW::mapArray(Error* error, const ArrayDescription& desc)
+{
+    return _fileMapper.map(_f, desc, error);
+}
+
+Error FormatImportExportRAW::writeBox(const ArrayContainer& box, const std::vector<size_t>& index, int arrayIndex)
+{
+    if (_fileName.empty() || arrayIndex < 0)
+        return ErrorFeaturesUnsupported;
+    if (_template.dimensionCount() == 0)
+        return ErrorMissingHints;
+    Error e;
+    if (!_boxWriter.isOpen() && (e = _boxWriter.open(_fileName)) != ErrorNone)
+        return e;
+    return _boxWriter.write(arrayIndex * _template.dataSize(), _template, box, index);
 }
 
 }
@@ -28,6 +28,10 @@
 #include <cstdio>
 
 #include "io.hpp"
+#include "io-directio.hpp"
+#include "io-batchread.hpp"
+#include "io-mmap.hpp"
+#include "io-boxwrite.hpp"
 
 namespace TGD {
 
@@ -36,6 +40,11 @@ private:
     ArrayDescription _template;
     FILE* _f;
     int _arrayCount;
+    DirectIO _directIO;
+    BatchReader _batchReader;
+    FileMapper _fileMapper;
+    std::string _fileName;
+    BoxWriter _boxWriter;
 
 public:
     FormatImportExportRAW();
@@ -49,9 +58,14 @@ public:
     virtual int arrayCount() override;
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
+    virtual ArrayDescription readDescription(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+    virtual std::vector<ArrayContainer> readBoxes(Error* error, const std::vector<std::vector<size_t>>& boxes,
+            int arrayIndex = -1 /* -1 means next */) override;
 
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
+    virtual ArrayContainer mapArray(Error* error, const ArrayDescription& desc) override;
+    virtual Error writeBox(const ArrayContainer& box, const std::vector<size_t>& index, int arrayIndex) override;
 };
 
 }
@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cerrno>
+#include <fstream>
+#include <limits>
+
+#include <glob.h>
+#include <unistd.h>
+
+#include "io-sequence.hpp"
+
+
+namespace TGD {
+
+/* Split a pattern with a single %d, %0Nd or %Nd conversion (and optional %%
+ * escapes) into prefix, suffix, zero padding flag and width. */
+static bool parsePrintfPattern(const std::string& pattern,
+        std::string& prefix, std::string& suffix, bool& zeroPad, size_t& width)
+{
+    std::string* part = &prefix;
+    bool haveConversion = false;
+    zeroPad = false;
+    width = 0;
+    for (size_t i = 0; i < pattern.length(); i++) {
+        if (pattern[i] != '%') {
+            part->push_back(pattern[i]);
+            continue;
+        }
+        i++;
+        if (i < pattern.length() && pattern[i] == '%') {
+            part->push_back('%');
+            continue;
+        }
+        if (haveConversion)
+            return false;
+        zeroPad = (i < pattern.length() && pattern[i] == '0');
+        width = 0;
+        for (; i < pattern.length() && pattern[i] >= '0' && pattern[i] <= '9'; i++)
+            width = 10 * width + (pattern[i] - '0');
+        if (i >= pattern.length() || (pattern[i] != 'd' && pattern[i] != 'i' && pattern[i] != 'u') || width > 64)
+            return false;
+        haveConversion = true;
+        part = &suffix;
+    }
+    return haveConversion;
+}
+
+static std::string patternFileName(const std::string& prefix, const std::string& suffix,
+        bool zeroPad, size_t width, size_t number)
+{
+    std::string n = std::to_string(number);
+    if (n.length() < width)
+        n.insert(0, width - n.length(), zeroPad ? '0' : ' ');
+    return prefix + n + suffix;
+}
+
+static bool fileExists(const std::string& fileName)
+{
+    return access(fileName.c_str(), F_OK) == 0;
+}
+
+FormatImportExportSequence::FormatImportExportSequence() :
+    _next(0), _windowStart(0), _windowEnd(0), _quit(false)
+{
+}
+
+FormatImportExportSequence::~FormatImportExportSequence()
+{
+    close();
+}
+
+Error sequenceFileNames(const std::string& spec, const TagList& hints, std::vector<std::string>& fileNames)
+{
+    std::string prefix, suffix;
+    bool zeroPad = false;
+    size_t width = 0;
+    fileNames.clear();
+    if (spec.length() > 0 && spec[0] == '@') {
+        std::ifstream listFile(spec.substr(1));
+        if (!listFile)
+            return ErrorSysErrno;
+        std::string line;
+        while (std::getline(listFile, line)) {
+            if (line.length() > 0 && line.back() == '\r')
+                line.pop_back();
+            if (line.length() > 0)
+                fileNames.push_back(line);
+        }
+        if (listFile.bad())
+            return ErrorSysErrno;
+    } else if (parsePrintfPattern(spec, prefix, suffix, zeroPad, width)) {
+        size_t number;
+        if (!hints.value("SEQUENCE_START", &number)) {
+            number = 0;
+            if (!fileExists(patternFileName(prefix, suffix, zeroPad, width, number)))
+                number = 1;
+        }
+        for (;; number++) {
+            std::string name = patternFileName(prefix, suffix, zeroPad, width, number);
+            if (!fileExists(name))
+                break;
+            fileNames.push_back(name);
+        }
+    } else if (spec.find_first_of("*?[") != std::string::npos) {
+        glob_t g;
+        int r = glob(spec.c_str(), 0, nullptr, &g);
+        if (r == 0) {
+            for (size_t i = 0; i < g.gl_pathc; i++)
+                fileNames.push_back(g.gl_pathv[i]);
+        }
+        globfree(&g);
+        if (r != 0 && r != GLOB_NOMATCH)
+            return ErrorSysErrno;
+    } else if (fileExists(spec)) {
+        fileNames.push_back(spec);
+    }
+    if (fileNames.size() == 0) {
+        errno = ENOENT;
+        return ErrorSysErrno;
+    }
+    if (fileNames.size() > size_t(std::numeric_limits<int>::max()))
+        return ErrorFeaturesUnsupported;
+    return ErrorNone;
+}
+
+Error FormatImportExportSequence::openForReading(const std::string& fileName, const TagList& hints)
+{
+    Error e = sequenceFileNames(fileName.substr(4), hints, _fileNames);
+    if (e != ErrorNone)
+        return e;
+    _hints = hints;
+    _next = 0;
+    _quit = false;
+    size_t threadCount = _hints.value("THREADS", std::max(1u, std::thread::hardware_concurrency()));
+    threadCount = std::min(threadCount, _fileNames.size() - 1);
+    for (size_t i = 0; i < threadCount; i++)
+        _threads.push_back(std::thread(&FormatImportExportSequence::worker, this));
+    return ErrorNone;
+}
+
+Error FormatImportExportSequence::openForWriting(const std::string&, bool, const TagList&)
+{
+    return ErrorFeaturesUnsupported;
+}
+
+void FormatImportExportSequence::close()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+    _workCond.notify_all();
+    for (size_t i = 0; i < _threads.size(); i++)
+        _threads[i].join();
+    _threads.clear();
+    _queue.clear();
+    _slots.clear();
+    _fileNames.clear();
+}
+
+ArrayContainer FormatImportExportSequence::load(size_t index, Error* error)
+{
+    Error e;
+    ArrayContainer r = Importer(_fileNames[index], _hints).readArray(&e);
+    if (e != ErrorNone)
+        *error = e;
+    return r;
+}
+
+void FormatImportExportSequence::worker()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+        _workCond.wait(lock, [&] { return _quit || !_queue.empty(); });
+        if (_quit)
+            return;
+        size_t index = _queue.front();
+        _queue.pop_front();
+        if (index < _windowStart || index >= _windowEnd) {
+            // not needed anymore after a seek
+            _slots.erase(index);
+            continue;
+        }
+        lock.unlock();
+        Error e = ErrorNone;
+        ArrayContainer array = load(index, &e);
+        lock.lock();
+        auto it = _slots.find(index);
+        if (it != _slots.end()) {
+            it->second.array = array;
+            it->second.error = e;
+            it->second.done = true;
+        }
+        _doneCond.notify_all();
+    }
+}
+
+// Must be called with the mutex locked
+void FormatImportExportSequence::prefetch(size_t start)
+{
+    if (_threads.size() == 0)
+        return;
+    _windowStart = start;
+    _windowEnd = std::min(start + 2 * _threads.size(), _fileNames.size());
+    for (auto it = _slots.begin(); it != _slots.end(); ) {
+        if (it->second.done && (it->first < _windowStart || it->first >= _windowEnd))
+            it = _slots.erase(it);
+        else
+            it++;
+    }
+    for (size_t i = _windowStart; i < _windowEnd; i++) {
+        if (_slots.find(i) == _slots.end()) {
+            _slots[i] = { false, ErrorNone, ArrayContainer() };
+            _queue.push_back(i);
+        }
+    }
+    _workCond.notify_all();
+}
+
+int FormatImportExportSequence::arrayCount()
+{
+    return _fileNames.size();
+}
+
+ArrayContainer FormatImportExportSequence::readArray(Error* error, int arrayIndex)
+{
+    size_t index = (arrayIndex >= 0 ? arrayIndex : _next);
+    if (index >= _fileNames.size()) {
+        *error = ErrorInvalidData;
+        return ArrayContainer();
+    }
+    _next = index + 1;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto it = _slots.find(index);
+    if (it != _slots.end() && (index >= _windowStart && index < _windowEnd)) {
+        // decoded or being decoded by a worker
+        _doneCond.wait(lock, [&] { return it->second.done; });
+        ArrayContainer r = it->second.array;
+        Error e = it->second.error;
+        _slots.erase(it);
+        prefetch(index + 1);
+        if (e != ErrorNone)
+            *error = e;
+        return r;
+    }
+    prefetch(index + 1);
+    lock.unlock();
+    return load(index, error);
+}
+
+ArrayDescription FormatImportExportSequence::readDescription(Error* error, int arrayIndex)
+{
+    size_t index = (arrayIndex >= 0 ? arrayIndex : _next);
+    if (index >= _fileNames.size()) {
+        *error = ErrorInvalidData;
+        return ArrayDescription();
+    }
+    _next = index + 1;
+    Error e;
+    ArrayDescription r = Importer(_fileNames[index], _hints).readDescription(&e);
+    if (e != ErrorNone)
+        *error = e;
+    return r;
+}
+
+bool FormatImportExportSequence::hasMore()
+{
+    return _next < _fileNames.size();
+}
+
+Error FormatImportExportSequence::writeArray(const ArrayContainer&)
+{
+    return ErrorFeaturesUnsupported;
+}
+
+}
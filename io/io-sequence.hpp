@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TGD_IO_SEQUENCE_HPP
+#define TGD_IO_SEQUENCE_HPP
+
+/*
+ * A sequence of files, presented as one multi-array file.
+ *
+ * File names of the form seq:SPEC select this format. SPEC can be
+ * - a pattern with one printf-style integer conversion such as %d or %06d,
+ *   e.g. seq:frame_%06d.png. The sequence starts at number 0 or 1 (or at the
+ *   number given by the hint SEQUENCE_START) and ends before the first number
+ *   for which no file exists.
+ * - a glob pattern, e.g. seq:frame_*.png. Matching files are sorted by name.
+ * - @LISTFILE, e.g. seq:@frames.txt, where the list file contains one file
+ *   name per line.
+ *
+ * Each file provides one array (its first). The hints are passed on to the
+ * importers of the files. While the arrays are read in order, the following
+ * files are decoded in advance by a pool of THREADS threads.
+ */
+
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+#include "io.hpp"
+
+namespace TGD {
+
+inline bool isSequenceName(const std::string& fileName)
+{
+    return fileName.compare(0, 4, "seq:") == 0;
+}
+
+/* Get the file names described by SPEC (see above). */
+Error sequenceFileNames(const std::string& spec, const TagList& hints, std::vector<std::string>& fileNames);
+
+class FormatImportExportSequence : public FormatImportExport {
+private:
+    struct Slot {
+        bool done;
+        Error error;
+        ArrayContainer array;
+    };
+
+    std::vector<std::string> _fileNames;
+    TagList _hints;
+    size_t _next;
+    // prefetching:
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _workCond;
+    std::condition_variable _doneCond;
+    std::deque<size_t> _queue;
+    std::map<size_t, Slot> _slots;
+    size_t _windowStart, _windowEnd;
+    bool _quit;
+
+    ArrayContainer load(size_t index, Error* error);
+    void worker();
+    void prefetch(size_t start);
+
+public:
+    FormatImportExportSequence();
+    ~FormatImportExportSequence();
+
+    virtual Error openForReading(const std::string& fileName, const TagList& hints) override;
+    virtual Error openForWriting(const std::string& fileName, bool append, const TagList& hints) override;
+    virtual void close() override;
+
+    // for reading:
+    virtual int arrayCount() override;
+    virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+    virtual bool hasMore() override;
+    virtual ArrayDescription readDescription(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+
+    // for writing / appending:
+    virtual Error writeArray(const ArrayContainer& array) override;
+};
+
+}
+
+#endif
@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "io-shm.hpp"
+#include "io-tgd.hpp"
+
+
+namespace TGD {
+
+static std::string shmName(const std::string& fileName)
+{
+    std::string name = fileName.substr(4);
+    if (name.length() == 0 || name[0] != '/')
+        name = '/' + name;
+    return name;
+}
+
+FormatImportExportSHM::FormatImportExportSHM() :
+    _f(nullptr), _mapSize(0), _pos(0), _arrayCount(-2)
+{
+}
+
+FormatImportExportSHM::~FormatImportExportSHM()
+{
+    close();
+}
+
+Error FormatImportExportSHM::openForReading(const std::string& fileName, const TagList& hints)
+{
+    std::string name = shmName(fileName);
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return ErrorSysErrno;
+    if (hints.value("UNLINK", 0) != 0)
+        shm_unlink(name.c_str());
+    _f = fdopen(fd, "rb");
+    if (!_f) {
+        ::close(fd);
+        return ErrorSysErrno;
+    }
+    _pos = 0;
+    return updateMap();
+}
+
+Error FormatImportExportSHM::openForWriting(const std::string& fileName, bool append, const TagList&)
+{
+    int fd = shm_open(shmName(fileName).c_str(), O_RDWR | O_CREAT | (append ? 0 : O_TRUNC), 0666);
+    if (fd < 0)
+        return ErrorSysErrno;
+    _f = fdopen(fd, "w+b");
+    if (!_f) {
+        ::close(fd);
+        return ErrorSysErrno;
+    }
+    if (append && fseeko(_f, 0, SEEK_END) != 0)
+        return ErrorSysErrno;
+    return ErrorNone;
+}
+
+void FormatImportExportSHM::close()
+{
+    _fileMapper.close();
+    _map.reset();
+    _mapSize = 0;
+    _arrayCount = -2;
+    _arrayOffsets.clear();
+    if (_f) {
+        fclose(_f);
+        _f = nullptr;
+    }
+}
+
+Error FormatImportExportSHM::updateMap()
+{
+    // The object may have grown since we mapped it. Arrays that were returned
+    // before keep the old mapping alive.
+    struct stat statbuf;
+    if (fstat(fileno(_f), &statbuf) != 0)
+        return ErrorSysErrno;
+    size_t size = statbuf.st_size;
+    if (size == _mapSize)
+        return ErrorNone;
+    _map.reset();
+    _mapSize = 0;
+    _arrayCount = -2;
+    _arrayOffsets.clear();
+    if (size > 0) {
+        // Private writable mapping: no copy, but modifications stay in this process
+        void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(_f), 0);
+        if (addr == MAP_FAILED)
+            return ErrorSysErrno;
+        _map = std::shared_ptr<unsigned char[]>(static_cast<unsigned char*>(addr),
+                [size] (unsigned char* p) { munmap(p, size); });
+        _mapSize = size;
+    }
+    return ErrorNone;
+}
+
+int FormatImportExportSHM::arrayCount()
+{
+    if (_arrayCount >= -1)
+        return _arrayCount;
+    if (updateMap() != ErrorNone)
+        return -1;
+    // Only count complete arrays
+    off_t offset = 0;
+    while (size_t(offset) < _mapSize) {
+        ArrayDescription desc;
+        if (fseeko(_f, offset, SEEK_SET) != 0 || readTgdHeader(_f, desc) != ErrorNone)
+            break;
+        off_t dataOffset = ftello(_f);
+        if (dataOffset < 0 || dataOffset + desc.dataSize() > _mapSize)
+            break;
+        _arrayOffsets.push_back(offset);
+        offset = dataOffset + desc.dataSize();
+    }
+    _arrayCount = _arrayOffsets.size();
+    return _arrayCount;
+}
+
+Error FormatImportExportSHM::readHeader(int arrayIndex, ArrayDescription& desc, off_t& dataOffset)
+{
+    if (arrayIndex >= 0) {
+        if (arrayCount() < 0)
+            return ErrorSeekingNotSupported;
+        if (arrayIndex >= arrayCount())
+            return ErrorInvalidData;
+        _pos = _arrayOffsets[arrayIndex];
+    }
+    Error e;
+    if (size_t(_pos) >= _mapSize && (e = updateMap()) != ErrorNone)
+        return e;
+    if (fseeko(_f, _pos, SEEK_SET) != 0)
+        return ErrorSysErrno;
+    if ((e = readTgdHeader(_f, desc)) != ErrorNone)
+        return e;
+    dataOffset = ftello(_f);
+    if (dataOffset < 0)
+        return ErrorSysErrno;
+    if (dataOffset + desc.dataSize() > _mapSize && (e = updateMap()) != ErrorNone)
+        return e;
+    if (dataOffset + desc.dataSize() > _mapSize)
+        return ErrorInvalidData;
+    _pos = dataOffset + desc.dataSize();
+    return ErrorNone;
+}
+
+ArrayContainer FormatImportExportSHM::readArray(Error* error, int arrayIndex)
+{
+    ArrayDescription desc;
+    off_t dataOffset;
+    Error e = readHeader(arrayIndex, desc, dataOffset);
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
+    }
+    if (desc.dataSize() == 0)
+        return ArrayContainer(desc);
+    // The array shares ownership of the mapping
+    return ArrayContainer(desc, std::shared_ptr<unsigned char[]>(_map, _map.get() + dataOffset));
+}
+
+ArrayDescription FormatImportExportSHM::readDescription(Error* error, int arrayIndex)
+{
+    ArrayDescription desc;
+    off_t dataOffset;
+    Error e = readHeader(arrayIndex, desc, dataOffset);
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayDescription();
+    }
+    return desc;
+}
+
+bool FormatImportExportSHM::hasMore()
+{
+    if (size_t(_pos) >= _mapSize)
+        updateMap();
+    return size_t(_pos) < _mapSize;
+}
+
+Error FormatImportExportSHM::writeArray(const ArrayContainer& array)
+{
+    // Write instead of mapping: the object then only grows as the data is
+    // written, so importers never see an array that is not complete
+    Error e = writeTgdHeader(_f, array);
+    if (e == ErrorNone && (std::fwrite(array.data(), array.dataSize(), 1, _f) != 1 || std::fflush(_f) != 0))
+        e = ErrorSysErrno;
+    return e;
+}
+
+ArrayContainer FormatImportExportSHM::mapArray(Error* error, const ArrayDescription& desc)
+{
+    if (!FileMapper::isSupported(_f)) {
+        *error = ErrorFeaturesUnsupported;
+        return ArrayContainer();
+    }
+    Error e = writeTgdHeader(_f, desc);
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
+    }
+    return _fileMapper.map(_f, desc, error);
+}
+
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TGD_IO_SHM_HPP
+#define TGD_IO_SHM_HPP
+
+/*
+ * Arrays in POSIX shared memory objects, for exchanging arrays between
+ * processes on the same machine without copying.
+ *
+ * File names of the form shm:/name refer to the shared memory object /name.
+ * Its contents are the same as those of a TGD file. The exporter can
+ * provide arrays that live in the shared memory object via mapArray(), and
+ * the importer returns arrays that alias the shared memory object. Such
+ * arrays are copy-on-write: modifying them does not modify the shared memory
+ * object.
+ *
+ * Importers see the arrays that are complete when they open the object or
+ * when they reach its end. Arrays written with writeArray() are complete once
+ * their data is written. Arrays provided by mapArray() are complete, but
+ * zero-filled, as soon as they are mapped, so for them synchronization
+ * between writers and readers, e.g. by signaling that the data is written,
+ * is up to the application.
+ * The shared memory object persists until it is removed with shm_unlink();
+ * the input hint UNLINK=1 removes it after it has been opened for reading.
+ */
+
+#include <cstdio>
+#include <memory>
+
+#include "io.hpp"
+#include "io-mmap.hpp"
+
+namespace TGD {
+
+inline bool isSharedMemoryName(const std::string& fileName)
+{
+    return fileName.compare(0, 4, "shm:") == 0;
+}
+
+class FormatImportExportSHM : public FormatImportExport {
+private:
+    FILE* _f;
+    // for reading:
+    std::shared_ptr<unsigned char[]> _map;
+    size_t _mapSize;
+    off_t _pos;
+    int _arrayCount;
+    std::vector<off_t> _arrayOffsets;
+    // for writing:
+    FileMapper _fileMapper;
+
+    Error updateMap();
+    Error readHeader(int arrayIndex, ArrayDescription& desc, off_t& dataOffset);
+
+public:
+    FormatImportExportSHM();
+    ~FormatImportExportSHM();
+
+    virtual Error openForReading(const std::string& fileName, const TagList& hints) override;
+    virtual Error openForWriting(const std::string& fileName, bool append, const TagList& hints) override;
+    virtual void close() override;
+
+    // for reading:
+    virtual int arrayCount() override;
+    virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+    virtual bool hasMore() override;
+    virtual ArrayDescription readDescription(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+
+    // for writing / appending:
+    virtual Error writeArray(const ArrayContainer& array) override;
+    virtual ArrayContainer mapArray(Error* error, const ArrayDescription& desc) override;
+};
+
+}
+
+#endif
@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+
+#include "io-stack.hpp"
+#include "io-sequence.hpp"
+
+
+namespace TGD {
+
+FormatImportExportStack::FormatImportExportStack() :
+    _done(false), _cacheSize(0)
+{
+}
+
+FormatImportExportStack::~FormatImportExportStack()
+{
+    close();
+}
+
+Error FormatImportExportStack::openForReading(const std::string& fileName, const TagList& hints)
+{
+    Error e = sequenceFileNames(fileName.substr(6), hints, _fileNames);
+    if (e != ErrorNone)
+        return e;
+    _hints = hints;
+    _sliceDesc = Importer(_fileNames[0], _hints).readDescription(&e);
+    if (e != ErrorNone)
+        return e;
+    std::vector<size_t> dimensions = _sliceDesc.dimensions();
+    dimensions.push_back(_fileNames.size());
+    _desc = ArrayDescription(dimensions, _sliceDesc.componentCount(), _sliceDesc.componentType());
+    _desc.globalTagList() = _sliceDesc.globalTagList();
+    for (size_t d = 0; d < _sliceDesc.dimensionCount(); d++)
+        _desc.dimensionTagList(d) = _sliceDesc.dimensionTagList(d);
+    for (size_t c = 0; c < _sliceDesc.componentCount(); c++)
+        _desc.componentTagList(c) = _sliceDesc.componentTagList(c);
+    _done = false;
+    _cacheSize = _hints.value("STACK_CACHE", size_t(16));
+    return ErrorNone;
+}
+
+Error FormatImportExportStack::openForWriting(const std::string&, bool, const TagList&)
+{
+    return ErrorFeaturesUnsupported;
+}
+
+void FormatImportExportStack::close()
+{
+    _fileNames.clear();
+    _cache.clear();
+}
+
+Error FormatImportExportStack::loadSlice(size_t z, ArrayContainer& slice)
+{
+    Error e;
+    slice = Importer(_fileNames[z], _hints).readArray(&e);
+    if (e != ErrorNone)
+        return e;
+    if (slice.dimensions() != _sliceDesc.dimensions()
+            || slice.componentCount() != _sliceDesc.componentCount()
+            || slice.componentType() != _sliceDesc.componentType()) {
+        return ErrorInvalidData;
+    }
+    return ErrorNone;
+}
+
+bool FormatImportExportStack::isCached(size_t z) const
+{
+    for (auto it = _cache.begin(); it != _cache.end(); it++)
+        if (it->first == z)
+            return true;
+    return false;
+}
+
+Error FormatImportExportStack::cachedSlice(size_t z, ArrayContainer& slice)
+{
+    for (auto it = _cache.begin(); it != _cache.end(); it++) {
+        if (it->first == z) {
+            _cache.splice(_cache.begin(), _cache, it);
+            slice = _cache.front().second;
+            return ErrorNone;
+        }
+    }
+    Error e = loadSlice(z, slice);
+    if (e != ErrorNone)
+        return e;
+    if (_cacheSize > 0) {
+        _cache.emplace_front(z, slice);
+        if (_cache.size() > _cacheSize)
+            _cache.pop_back();
+    }
+    return ErrorNone;
+}
+
+Error FormatImportExportStack::checkIndex(int arrayIndex)
+{
+    if (arrayIndex > 0 || (arrayIndex < 0 && _done))
+        return ErrorInvalidData;
+    _done = true;
+    return ErrorNone;
+}
+
+int FormatImportExportStack::arrayCount()
+{
+    return 1;
+}
+
+ArrayContainer FormatImportExportStack::readArray(Error* error, int arrayIndex)
+{
+    Error e = checkIndex(arrayIndex);
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
+    }
+
+    // Load the slices in parallel, each directly into its place in the result.
+    // Only one slice per thread is in memory in addition to the result.
+    ArrayContainer array(_desc);
+    size_t sliceSize = _sliceDesc.dataSize();
+    std::atomic<size_t> nextSlice(0);
+    std::mutex errorMutex;
+    auto work = [&] () {
+        for (;;) {
+            size_t z = nextSlice++;
+            if (z >= _fileNames.size())
+                break;
+            ArrayContainer slice;
+            Error sliceError = loadSlice(z, slice);
+            if (sliceError != ErrorNone) {
+                std::unique_lock<std::mutex> lock(errorMutex);
+                e = sliceError;
+                nextSlice = _fileNames.size();
+                break;
+            }
+            std::memcpy(static_cast<unsigned char*>(array.data()) + z * sliceSize, slice.data(), sliceSize);
+        }
+    };
+    size_t threadCount = _hints.value("THREADS", std::max(1u, std::thread::hardware_concurrency()));
+    threadCount = std::max(size_t(1), std::min(threadCount, _fileNames.size()));
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; i++)
+        threads.push_back(std::thread(work));
+    work();
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
+    }
+    return array;
+}
+
+ArrayDescription FormatImportExportStack::readDescription(Error* error, int arrayIndex)
+{
+    Error e = checkIndex(arrayIndex);
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayDescription();
+    }
+    return _desc;
+}
+
+std::vector<ArrayContainer> FormatImportExportStack::readBoxes(Error* error,
+        const std::vector<std::vector<size_t>>& boxes, int arrayIndex)
+{
+    Error e = checkIndex(arrayIndex);
+    if (e != ErrorNone) {
+        *error = e;
+        return std::vector<ArrayContainer>();
+    }
+    for (size_t i = 0; i < boxes.size(); i++) {
+        if (!boxIsInside(boxes[i], _desc)) {
+            *error = ErrorInvalidData;
+            return std::vector<ArrayContainer>();
+        }
+    }
+
+    // For each box: its result, the part of it inside one slice, and whether
+    // that part is the complete slice
+    std::vector<ArrayContainer> r;
+    size_t n = _sliceDesc.dimensionCount();
+    std::vector<std::vector<size_t>> sliceBoxes(boxes.size());
+    std::vector<bool> fullSlice(boxes.size());
+    size_t zBegin = _desc.dimension(n), zEnd = 0;
+    for (size_t i = 0; i < boxes.size(); i++) {
+        const std::vector<size_t>& box = boxes[i];
+        r.emplace_back(boxDescription(box, _desc));
+        sliceBoxes[i].assign(box.begin(), box.begin() + n);
+        sliceBoxes[i].insert(sliceBoxes[i].end(), box.begin() + n + 1, box.end() - 1);
+        fullSlice[i] = true;
+        for (size_t d = 0; d < n; d++)
+            if (box[d] != 0 || box[n + 1 + d] != _sliceDesc.dimension(d))
+                fullSlice[i] = false;
+        if (box[2 * n + 1] > 0) {
+            zBegin = std::min(zBegin, box[n]);
+            zEnd = std::max(zEnd, box[n] + box[2 * n + 1]);
+        }
+    }
+
+    // Slices that a box covers completely, or that are cached anyway, are read
+    // completely and cached. Otherwise only the parts inside the boxes are read.
+    for (size_t z = zBegin; z < zEnd; z++) {
+        std::vector<size_t> needed;
+        bool full = false;
+        for (size_t i = 0; i < boxes.size(); i++) {
+            if (z >= boxes[i][n] && z < boxes[i][n] + boxes[i][2 * n + 1]) {
+                needed.push_back(i);
+                full = full || fullSlice[i];
+            }
+        }
+        if (needed.empty())
+            continue;
+        auto dst = [&] (size_t i) {
+            size_t partSize = r[i].dataSize() / boxes[i][2 * n + 1];
+            return static_cast<unsigned char*>(r[i].data()) + (z - boxes[i][n]) * partSize;
+        };
+        if (full || isCached(z)) {
+            ArrayContainer slice;
+            if ((e = cachedSlice(z, slice)) != ErrorNone) {
+                *error = e;
+                return std::vector<ArrayContainer>();
+            }
+            for (size_t i : needed) {
+                unsigned char* d = dst(i);
+                if (n == 0) {
+                    std::memcpy(d, slice.data(), slice.dataSize());
+                } else {
+                    size_t rowSize = sliceBoxes[i][n] * _sliceDesc.elementSize();
+                    forEachBoxRow(sliceBoxes[i], slice, [&] (size_t element) {
+                            std::memcpy(d, slice.get(element), rowSize);
+                            d += rowSize;
+                            });
+                }
+            }
+        } else {
+            std::vector<std::vector<size_t>> parts;
+            for (size_t i : needed)
+                parts.push_back(sliceBoxes[i]);
+            std::vector<ArrayContainer> partData = Importer(_fileNames[z], _hints).readBoxes(parts, &e, 0);
+            for (size_t k = 0; e == ErrorNone && k < needed.size(); k++) {
+                if (partData[k].componentCount() != _sliceDesc.componentCount()
+                        || partData[k].componentType() != _sliceDesc.componentType())
+                    e = ErrorInvalidData;
+                else
+                    std::memcpy(dst(needed[k]), partData[k].data(), partData[k].dataSize());
+            }
+            if (e != ErrorNone) {
+                *error = e;
+                return std::vector<ArrayContainer>();
+            }
+        }
+    }
+    return r;
+}
+
+bool FormatImportExportStack::hasMore()
+{
+    return !_done;
+}
+
+Error FormatImportExportStack::writeArray(const ArrayContainer&)
+{
+    return ErrorFeaturesUnsupported;
+}
+
+}
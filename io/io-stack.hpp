@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TGD_IO_STACK_HPP
+#define TGD_IO_STACK_HPP
+
+/*
+ * A stack of files with arrays of the same size and type, e.g. 2D slices,
+ * presented as one array with an additional last dimension, e.g. a 3D volume.
+ *
+ * File names of the form stack:SPEC select this format. SPEC describes the
+ * files in the same way as for seq: (see io-sequence.hpp). The description
+ * and tags are taken from the first file. The hints are passed on to the
+ * importers of the files.
+ *
+ * Files are only read when their data is needed: reading the whole array
+ * loads the slices with THREADS threads directly into the result, and reading
+ * boxes only reads the parts of the slices inside the boxes. Slices that a box
+ * covers completely are kept in a cache of STACK_CACHE slices (default 16),
+ * and boxes inside cached slices are copied from there.
+ */
+
+#include <string>
+#include <vector>
+#include <list>
+#include <utility>
+
+#include "io.hpp"
+
+namespace TGD {
+
+inline bool isStackName(const std::string& fileName)
+{
+    return fileName.compare(0, 6, "stack:") == 0;
+}
+
+class FormatImportExportStack : public FormatImportExport {
+private:
+    std::vector<std::string> _fileNames;
+    TagList _hints;
+    ArrayDescription _sliceDesc;
+    ArrayDescription _desc;
+    bool _done;
+    size_t _cacheSize;
+    std::list<std::pair<size_t, ArrayContainer>> _cache; // most recently used first
+
+    Error loadSlice(size_t z, ArrayContainer& slice);
+    bool isCached(size_t z) const;
+    Error cachedSlice(size_t z, ArrayContainer& slice);
+    Error checkIndex(int arrayIndex);
+
+public:
+    FormatImportExportStack();
+    ~FormatImportExportStack();
+
+    virtual Error openForReading(const std::string& fileName, const TagList& hints) override;
+    virtual Error openForWriting(const std::string& fileName, bool append, const TagList& hints) override;
+    virtual void close() override;
+
+    // for reading:
+    virtual int arrayCount() override;
+    virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+    virtual bool hasMore() override;
+    virtual ArrayDescription readDescription(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+    virtual std::vector<ArrayContainer> readBoxes(Error* error, const std::vector<std::vector<size_t>>& boxes,
+            int arrayIndex = -1 /* -1 means next */) override;
+
+    // for writing / appending:
+    virtual Error writeArray(const ArrayContainer& array) override;
+};
+
+}
+
+#endif
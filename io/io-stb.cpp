@@ -92,6 +92,25 @@ int FormatImportExportSTB::arrayCount()
     return 1;
 }
 
+static void setInterpretation(ArrayDescription& r)
+{
+    if (r.componentCount() == 1) {
+        r.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
+    } else if (r.componentCount() == 2) {
+        r.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
+        r.componentTagList(1).set("INTERPRETATION", "ALPHA");
+    } else if (r.componentCount() == 3) {
+        r.componentTagList(0).set("INTERPRETATION", "SRGB/R");
+        r.componentTagList(1).set("INTERPRETATION", "SRGB/G");
+        r.componentTagList(2).set("INTERPRETATION", "SRGB/B");
+    } else {
+        r.componentTagList(0).set("INTERPRETATION", "SRGB/R");
+        r.componentTagList(1).set("INTERPRETATION", "SRGB/G");
+        r.componentTagList(2).set("INTERPRETATION", "SRGB/B");
+        r.componentTagList(3).set("INTERPRETATION", "ALPHA");
+    }
+}
+
 ArrayContainer FormatImportExportSTB::readArray(Error* error, int arrayIndex)
 {
     if (arrayIndex >= arrayCount()) {
@@ -121,22 +140,27 @@ ArrayContainer FormatImportExportSTB::readArray(Error* error, int arrayIndex)
         stbi_image_free(data);
     }
 
-    if (r.componentCount() == 1) {
-        r.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
-    } else if (r.componentCount() == 2) {
-        r.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
-        r.componentTagList(1).set("INTERPRETATION", "ALPHA");
-    } else if (r.componentCount() == 3) {
-        r.componentTagList(0).set("INTERPRETATION", "SRGB/R");
-        r.componentTagList(1).set("INTERPRETATION", "SRGB/G");
-        r.componentTagList(2).set("INTERPRETATION", "SRGB/B");
-    } else {
-        r.componentTagList(0).set("INTERPRETATION", "SRGB/R");
-        r.componentTagList(1).set("INTERPRETATION", "SRGB/G");
-        r.componentTagList(2).set("INTERPRETATION", "SRGB/B");
-        r.componentTagList(3).set("INTERPRETATION", "ALPHA");
+    setInterpretation(r);
+    _hasMore = false;
+    return r;
+}
+
+ArrayDescription FormatImportExportSTB::readDescription(Error* error, int arrayIndex)
+{
+    if (arrayIndex >= arrayCount()) {
+        *error = ErrorInvalidData;
+        return ArrayDescription();
     }
 
+    // stbi_info_from_file() only parses the header and restores the file position
+    int width, height, channels;
+    bool is16Bit = stbi_is_16_bit_from_file(_f);
+    if (!stbi_info_from_file(_f, &width, &height, &channels)) {
+        *error = ErrorInvalidData;
+        return ArrayDescription();
+    }
+    ArrayDescription r({ size_t(width), size_t(height) }, channels, is16Bit ? uint16 : uint8);
+    setInterpretation(r);
     _hasMore = false;
     return r;
 }
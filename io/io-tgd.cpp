@@ -23,15 +23,32 @@
  */
 
 #include <cstdio>
+#include <cerrno>
+#include <thread>
+#include <atomic>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "io-tgd.hpp"
+#include "io-utils.hpp"
+#include "parallel.hpp"
 
 
 namespace TGD {
 
 FormatImportExportTGD::FormatImportExportTGD() :
     _f(nullptr),
-    _arrayCount(-2)
+    _arrayCount(-2),
+    _dedup(false),
+    _arrayIndex(0),
+    _delta(false),
+    _keyframeInterval(0),
+    _sinceKeyframe(0),
+    _threadCount(1),
+    _prevIndex(-1),
+    _readIndex(0)
 {
 }
 
@@ -40,26 +57,81 @@ FormatImportExportTGD::~FormatImportExportTGD()
     close();
 }
 
-Error FormatImportExportTGD::openForReading(const std::string& fileName, const TagList&)
+Error FormatImportExportTGD::openForReading(const std::string& fileName, const TagList& hints)
 {
-    if (fileName == "-")
+    if (fileName == "-") {
         _f = stdin;
-    else
+    } else {
         _f = fopen(fileName.c_str(), "rb");
+        if (_f)
+            _directIO.open(fileName, _f, false, hints);
+    }
+    _threadCount = hints.value("THREADS", std::max(1u, std::thread::hardware_concurrency()));
     return _f ? ErrorNone : ErrorSysErrno;
 }
 
-Error FormatImportExportTGD::openForWriting(const std::string& fileName, bool append, const TagList&)
+Error FormatImportExportTGD::openForWriting(const std::string& fileName, bool append, const TagList& hints)
 {
-    if (fileName == "-")
+    // References to earlier data and differences to the previous array
+    // cannot be combined
+    if (hints.value("DELTA", 0) != 0 && hints.value("DEDUP", 0) != 0)
+        return ErrorFeaturesUnsupported;
+    if (fileName == "-") {
         _f = stdout;
-    else
-        _f = fopen(fileName.c_str(), append ? "ab" : "wb");
+    } else {
+        // with read access, for mapArray()
+        _f = fopen(fileName.c_str(), append ? "a+b" : "w+b");
+        // the initial position of a+ streams is the beginning of the file
+        if (_f && append && fseeko(_f, 0, SEEK_END) != 0) {
+            fclose(_f);
+            _f = nullptr;
+        }
+        if (_f) {
+            _directIO.open(fileName, _f, true, hints);
+            _fileName = fileName;
+        }
+    }
+    _threadCount = hints.value("THREADS", std::max(1u, std::thread::hardware_concurrency()));
+    // Deltas only need the previous array, so unlike deduplication they
+    // also work with pipes
+    if (hints.value("DELTA", 0) != 0) {
+        _delta = true;
+        _keyframeInterval = std::max(1, hints.value("KEYFRAME_INTERVAL", 16));
+        _sinceKeyframe = 0;
+    }
+    // Deduplication needs to read back earlier data, and readers need to
+    // seek to it, so it is only done for regular files
+    struct stat statbuf;
+    if (_f && hints.value("DEDUP", 0) != 0
+            && fstat(fileno(_f), &statbuf) == 0 && (statbuf.st_mode & S_IFMT) == S_IFREG) {
+        _dedup = true;
+        _arrayIndex = 0;
+        if (append) {
+            _arrayIndex = arrayCount();
+            _arrayCount = -2;
+            _arrayOffsets.clear();
+            if (_arrayIndex < 0)
+                _dedup = false;
+        }
+    }
     return _f ? ErrorNone : ErrorSysErrno;
 }
 
 void FormatImportExportTGD::close()
 {
+    _directIO.close();
+    _fileMapper.close();
+    _boxWriter.close();
+    _fileName.clear();
+    _dedup = false;
+    _arrayIndex = 0;
+    _dataLocations.clear();
+    _delta = false;
+    _prevDesc = ArrayDescription();
+    _prevData.clear();
+    _prevData.shrink_to_fit();
+    _prevIndex = -1;
+    _readIndex = 0;
     if (_f) {
         if (_f != stdin && _f != stdout) {
             fclose(_f);
@@ -80,13 +152,13 @@ static bool writeTgdTagList(FILE* f, const TagList& tl)
     return std::fwrite(data.data(), data.size(), 1, f) == 1;
 }
 
-static bool writeTgd(FILE* f, const ArrayContainer& array)
+static Error writeTgdHeader(FILE* f, const ArrayDescription& array, uint8_t version)
 {
     std::vector<uint8_t> start(5 + 2 * sizeof(uint64_t) + array.dimensionCount() * sizeof(uint64_t));
     start[0] = 'T';
     start[1] = 'G';
     start[2] = 'D';
-    start[3] = 0;
+    start[3] = version;
     start[4] = array.componentType();
     uint64_t v;
     v = array.componentCount();
@@ -99,20 +171,43 @@ static bool writeTgd(FILE* f, const ArrayContainer& array)
     }
     if (std::fwrite(start.data(), start.size(), 1, f) != 1
             || !writeTgdTagList(f, array.globalTagList())) {
-        return false;
+        return ErrorSysErrno;
     }
     for (size_t c = 0; c < array.componentCount(); c++) {
         if (!writeTgdTagList(f, array.componentTagList(c)))
-            return false;
+            return ErrorSysErrno;
     }
     for (size_t d = 0; d < array.dimensionCount(); d++) {
         if (!writeTgdTagList(f, array.dimensionTagList(d)))
-            return false;
-    }
-    if (std::fwrite(array.data(), array.dataSize(), 1, f) != 1 || std::fflush(f) != 0) {
-        return false;
+            return ErrorSysErrno;
     }
-    return true;
+    return ErrorNone;
+}
+
+Error writeTgdHeader(FILE* f, const ArrayDescription& array)
+{
+    return writeTgdHeader(f, array, 0);
+}
+
+static Error writeTgdReference(FILE* f, const ArrayDescription& array, int64_t reference)
+{
+    uint64_t v = reference;
+    Error e = writeTgdHeader(f, array, 1);
+    if (e == ErrorNone && std::fwrite(&v, sizeof(uint64_t), 1, f) != 1)
+        e = ErrorSysErrno;
+    if (e == ErrorNone && std::fflush(f) != 0)
+        e = ErrorSysErrno;
+    return e;
+}
+
+static Error writeTgd(FILE* f, DirectIO& directIO, const ArrayContainer& array, uint8_t version = 0)
+{
+    Error e = writeTgdHeader(f, array, version);
+    if (e == ErrorNone)
+        e = directIO.write(f, array.data(), array.dataSize());
+    if (e == ErrorNone && std::fflush(f) != 0)
+        e = ErrorSysErrno;
+    return e;
 }
 
 static bool readString(const char* data, std::string& s, size_t& len)
@@ -158,7 +253,10 @@ static Error readTgdTagList(FILE* f, TagList& tl)
     return ErrorNone;
 }
 
-static Error readTgdHeader(FILE* f, ArrayContainer& array)
+/* Read a header of any format version. For references (version 1), value is
+ * set to the index of the referenced array; for deltas (version 3), it is set
+ * to the size of the encoded data that follows. */
+static Error readTgdHeader(FILE* f, ArrayDescription& array, uint8_t* version, uint64_t* value)
 {
     uint8_t start[5 + 2 * sizeof(uint64_t)];
     if (std::fread(start, 5 + 2 * sizeof(uint64_t), 1, f) != 1)
@@ -167,7 +265,7 @@ static Error readTgdHeader(FILE* f, ArrayContainer& array)
     uint64_t dimCount;
     std::memcpy(&compCount, start + 5, sizeof(uint64_t));
     std::memcpy(&dimCount, start + 5 + sizeof(uint64_t), sizeof(uint64_t));
-    if (start[0] != 'T' || (start[1] != 'G' && start[1] != 'A') || start[2] != 'D' || start[3] != 0
+    if (start[0] != 'T' || (start[1] != 'G' && start[1] != 'A') || start[2] != 'D' || start[3] > 3
             || start[4] > 15
             || compCount > std::numeric_limits<size_t>::max()
             || dimCount > std::numeric_limits<size_t>::max()) {
@@ -185,7 +283,7 @@ static Error readTgdHeader(FILE* f, ArrayContainer& array)
             dimensions[d] = origDimensions[d];
     }
 
-    array = ArrayContainer(dimensions, compCount, static_cast<Type>(start[4]));
+    array = ArrayDescription(dimensions, compCount, static_cast<Type>(start[4]));
     Error e;
     if ((e = readTgdTagList(f, array.globalTagList())) != ErrorNone)
         return e;
@@ -195,17 +293,121 @@ static Error readTgdHeader(FILE* f, ArrayContainer& array)
     for (size_t d = 0; d < array.dimensionCount(); d++)
         if ((e = readTgdTagList(f, array.dimensionTagList(d))) != ErrorNone)
             return e;
+    *version = start[3];
+    *value = 0;
+    if (*version == 1 || *version == 3) {
+        if (std::fread(value, sizeof(uint64_t), 1, f) != 1)
+            return std::ferror(f) ? ErrorSysErrno : ErrorInvalidData;
+        if ((*version == 1 && *value > uint64_t(std::numeric_limits<int>::max()))
+                || (*version == 3 && *value > std::numeric_limits<size_t>::max())) {
+            return ErrorInvalidData;
+        }
+    }
+    return ErrorNone;
+}
+
+Error readTgdHeader(FILE* f, ArrayDescription& array, int64_t* reference)
+{
+    uint8_t version;
+    uint64_t value;
+    Error e = readTgdHeader(f, array, &version, &value);
+    if (e != ErrorNone)
+        return e;
+    if (version == 3 || (version == 1 && !reference))
+        return ErrorFeaturesUnsupported;
+    if (reference)
+        *reference = (version == 1 ? int64_t(value) : -1);
     return ErrorNone;
 }
 
-static bool readTgdData(FILE *f, ArrayContainer& array)
+static bool skipTgdData(FILE *f, const ArrayDescription& array, uint8_t version, uint64_t value)
+{
+    return version == 1 || skipBytes(f, version == 3 ? value : array.dataSize());
+}
+
+/* Deltas store the XOR of the data with the data of the previous array in
+ * blocks of deltaBlockSize bytes, each preceded by its encoded size as uint32.
+ * Within a block, the bytes are shuffled so that byte k of all components is
+ * contiguous, and then stored as pairs of zero run length and literal run
+ * length (as variable length integers), each followed by the literal bytes.
+ * Slowly changing data thus gives long zero runs, especially in the high
+ * bytes. */
+static const size_t deltaBlockSize = size_t(1) << 20;
+
+static void appendVarint(std::vector<uint8_t>& out, size_t v)
+{
+    while (v >= 128) {
+        out.push_back((v & 127) | 128);
+        v >>= 7;
+    }
+    out.push_back(v);
+}
+
+static bool readVarint(const uint8_t*& p, const uint8_t* end, size_t& v)
 {
-    return (std::fread(array.data(), array.dataSize(), 1, f) == 1);
+    v = 0;
+    for (unsigned int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        v |= size_t(b & 127) << shift;
+        if (!(b & 128))
+            return true;
+    }
+    return false;
 }
 
-static bool skipTgdData(FILE *f, const ArrayContainer& array)
+static bool zeroRunStarts(const uint8_t* s, size_t i, size_t n)
 {
-    return (fseeko(f, array.dataSize(), SEEK_CUR) == 0 ? true : false);
+    // runs shorter than 3 are cheaper to store as literals
+    return s[i] == 0 && (i + 1 >= n || s[i + 1] == 0) && (i + 2 >= n || s[i + 2] == 0);
+}
+
+static void encodeDeltaBlock(const uint8_t* cur, const uint8_t* prev, size_t n, size_t typeSize,
+        std::vector<uint8_t>& shuffled, std::vector<uint8_t>& out)
+{
+    size_t elements = n / typeSize;
+    shuffled.resize(n);
+    for (size_t k = 0; k < typeSize; k++)
+        for (size_t e = 0; e < elements; e++)
+            shuffled[k * elements + e] = cur[e * typeSize + k] ^ prev[e * typeSize + k];
+    out.clear();
+    for (size_t i = 0; i < n; ) {
+        size_t start = i;
+        while (i < n && shuffled[i] == 0)
+            i++;
+        appendVarint(out, i - start);
+        start = i;
+        while (i < n && !zeroRunStarts(shuffled.data(), i, n))
+            i++;
+        appendVarint(out, i - start);
+        out.insert(out.end(), shuffled.data() + start, shuffled.data() + i);
+    }
+}
+
+static bool decodeDeltaBlock(const uint8_t* in, size_t inSize, const uint8_t* prev, size_t n, size_t typeSize,
+        std::vector<uint8_t>& shuffled, uint8_t* out)
+{
+    const uint8_t* end = in + inSize;
+    shuffled.resize(n);
+    for (size_t i = 0; i < n; ) {
+        size_t zeros, literals;
+        if (!readVarint(in, end, zeros) || !readVarint(in, end, literals)
+                || zeros > n - i || literals > n - i - zeros || literals > size_t(end - in)
+                || zeros + literals == 0) {
+            return false;
+        }
+        std::memset(shuffled.data() + i, 0, zeros);
+        i += zeros;
+        std::memcpy(shuffled.data() + i, in, literals);
+        i += literals;
+        in += literals;
+    }
+    if (in != end)
+        return false;
+    size_t elements = n / typeSize;
+    for (size_t k = 0; k < typeSize; k++)
+        for (size_t e = 0; e < elements; e++)
+            out[e * typeSize + k] = shuffled[k * elements + e] ^ prev[e * typeSize + k];
+    return true;
 }
 
 int FormatImportExportTGD::arrayCount()
@@ -230,9 +432,11 @@ int FormatImportExportTGD::arrayCount()
             _arrayCount = -1;
             return -1;
         }
-        ArrayContainer array;
-        Error e = readTgdHeader(_f, array);
-        if (e != ErrorNone || !skipTgdData(_f, array)) {
+        ArrayDescription array;
+        uint8_t version;
+        uint64_t value;
+        Error e = readTgdHeader(_f, array, &version, &value);
+        if (e != ErrorNone || !skipTgdData(_f, array, version, value)) {
             _arrayOffsets.clear();
             _arrayCount = -1;
             return -1;
@@ -253,45 +457,263 @@ int FormatImportExportTGD::arrayCount()
     return _arrayCount;
 }
 
-ArrayContainer FormatImportExportTGD::readArray(Error* error, int arrayIndex)
+Error FormatImportExportTGD::seekToArray(int arrayIndex)
 {
-    // Seek if necessary
     if (arrayIndex >= 0) {
-        if (arrayCount() < 0) {
-            *error = ErrorSeekingNotSupported;
-            return ArrayContainer();
-        }
-        if (arrayIndex >= arrayCount()) {
-            *error = ErrorInvalidData;
-            return ArrayContainer();
+        if (arrayCount() < 0)
+            return ErrorSeekingNotSupported;
+        if (arrayIndex >= arrayCount())
+            return ErrorInvalidData;
+        if (fseeko(_f, _arrayOffsets[arrayIndex], SEEK_SET) < 0)
+            return ErrorSysErrno;
+        _readIndex = arrayIndex;
+    }
+    return ErrorNone;
+}
+
+Error FormatImportExportTGD::findReferencedData(const ArrayDescription& desc, int64_t reference, off_t* dataOffset)
+{
+    off_t pos = ftello(_f);
+    if (pos < 0 || arrayCount() < 0)
+        return ErrorSeekingNotSupported;
+    if (reference >= arrayCount() || _arrayOffsets[reference] >= pos)
+        return ErrorInvalidData;
+    if (fseeko(_f, _arrayOffsets[reference], SEEK_SET) != 0)
+        return ErrorSysErrno;
+    ArrayDescription refDesc;
+    uint8_t refVersion;
+    uint64_t refValue;
+    Error e = readTgdHeader(_f, refDesc, &refVersion, &refValue);
+    if (e == ErrorNone && (refVersion != 0 || refDesc.dataSize() != desc.dataSize()))
+        e = ErrorInvalidData;
+    if (e == ErrorNone && (*dataOffset = ftello(_f)) < 0)
+        e = ErrorSysErrno;
+    if (fseeko(_f, pos, SEEK_SET) != 0 && e == ErrorNone)
+        e = ErrorSysErrno;
+    return e;
+}
+
+Error FormatImportExportTGD::readDeltaData(const ArrayDescription& desc, uint64_t encodedSize, unsigned char* data)
+{
+    if (_prevData.size() != desc.dataSize())
+        return ErrorInvalidData;
+    std::vector<uint8_t> encoded(encodedSize);
+    Error e = _directIO.read(_f, encoded.data(), encoded.size());
+    if (e != ErrorNone)
+        return e;
+
+    // Find the blocks, then decode them in parallel
+    size_t blockCount = (desc.dataSize() + deltaBlockSize - 1) / deltaBlockSize;
+    std::vector<size_t> blockOffsets(blockCount);
+    std::vector<size_t> blockSizes(blockCount);
+    size_t offset = 0;
+    for (size_t b = 0; b < blockCount; b++) {
+        uint32_t size;
+        if (encoded.size() - offset < sizeof(uint32_t))
+            return ErrorInvalidData;
+        std::memcpy(&size, encoded.data() + offset, sizeof(uint32_t));
+        offset += sizeof(uint32_t);
+        if (encoded.size() - offset < size)
+            return ErrorInvalidData;
+        blockOffsets[b] = offset;
+        blockSizes[b] = size;
+        offset += size;
+    }
+    if (offset != encoded.size())
+        return ErrorInvalidData;
+    std::atomic<bool> ok(true);
+    size_t typeSize = desc.componentSize();
+    parallelForChunks<std::vector<uint8_t>>(blockCount, std::max(size_t(1), _threadCount), [&] (size_t b, std::vector<uint8_t>& buffer) {
+            size_t start = b * deltaBlockSize;
+            size_t n = std::min(deltaBlockSize, desc.dataSize() - start);
+            if (!decodeDeltaBlock(encoded.data() + blockOffsets[b], blockSizes[b],
+                        _prevData.data() + start, n, typeSize, buffer, data + start))
+                ok = false;
+            });
+    return ok ? ErrorNone : ErrorInvalidData;
+}
+
+Error FormatImportExportTGD::restoreArrayData(int64_t arrayIndex)
+{
+    if (_prevIndex == arrayIndex)
+        return ErrorNone;
+
+    // Random access: decode from the last keyframe up to the requested array,
+    // or from the array we already have if it is in between
+    off_t pos = ftello(_f);
+    if (pos < 0 || arrayCount() < 0)
+        return ErrorSeekingNotSupported;
+    if (arrayIndex >= arrayCount())
+        return ErrorInvalidData;
+    ArrayDescription desc;
+    uint8_t version;
+    uint64_t value;
+    int64_t first = arrayIndex;
+    for (;;) {
+        if (_prevIndex >= 0 && _prevIndex == first - 1)
+            break;
+        if (fseeko(_f, _arrayOffsets[first], SEEK_SET) != 0)
+            return ErrorSysErrno;
+        Error e = readTgdHeader(_f, desc, &version, &value);
+        if (e != ErrorNone)
+            return e;
+        if (version == 2)
+            break;
+        if (version != 3 || first == 0)
+            return ErrorInvalidData;
+        first--;
+    }
+    for (int64_t i = first; i <= arrayIndex; i++) {
+        if (fseeko(_f, _arrayOffsets[i], SEEK_SET) != 0)
+            return ErrorSysErrno;
+        Error e = readTgdHeader(_f, desc, &version, &value);
+        if (e == ErrorNone) {
+            if (version == 2) {
+                _prevData.resize(desc.dataSize());
+                e = _directIO.read(_f, _prevData.data(), _prevData.size());
+            } else if (version == 3) {
+                std::vector<unsigned char> data(desc.dataSize());
+                e = readDeltaData(desc, value, data.data());
+                _prevData.swap(data);
+            } else {
+                e = ErrorInvalidData;
+            }
         }
-        if (fseeko(_f, _arrayOffsets[arrayIndex], SEEK_SET) < 0) {
-            *error = ErrorSysErrno;
-            return ArrayContainer();
+        if (e != ErrorNone) {
+            _prevIndex = -1;
+            return e;
         }
+        _prevIndex = i;
+    }
+    return fseeko(_f, pos, SEEK_SET) == 0 ? ErrorNone : ErrorSysErrno;
+}
+
+ArrayContainer FormatImportExportTGD::readArray(Error* error, int arrayIndex)
+{
+    // Seek if necessary
+    Error e = seekToArray(arrayIndex);
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
     }
 
     // Read the TGD header
-    ArrayContainer array;
-    Error e = readTgdHeader(_f, array);
+    ArrayDescription desc;
+    uint8_t version;
+    uint64_t value;
+    e = readTgdHeader(_f, desc, &version, &value);
     if (e != ErrorNone) {
         *error = e;
         return ArrayContainer();
     }
 
-    // Read the data
-    if (!readTgdData(_f, array)) {
-        e = (std::ferror(_f) ? ErrorSysErrno : ErrorInvalidData);
+    // Read the data: it follows the header, or belongs to a referenced array,
+    // or is a delta to the previous array
+    ArrayContainer array(desc);
+    if (version == 0 || version == 2) {
+        e = _directIO.read(_f, array.data(), array.dataSize());
+    } else if (version == 1) {
+        off_t dataOffset = -1;
+        off_t pos = ftello(_f);
+        e = findReferencedData(desc, value, &dataOffset);
+        if (e == ErrorNone && fseeko(_f, dataOffset, SEEK_SET) != 0)
+            e = ErrorSysErrno;
+        if (e == ErrorNone)
+            e = _directIO.read(_f, array.data(), array.dataSize());
+        if (pos >= 0 && fseeko(_f, pos, SEEK_SET) != 0 && e == ErrorNone)
+            e = ErrorSysErrno;
+    } else {
+        if (_readIndex == 0)
+            e = ErrorInvalidData;
+        if (e == ErrorNone)
+            e = restoreArrayData(_readIndex - 1);
+        if (e == ErrorNone)
+            e = readDeltaData(desc, value, static_cast<unsigned char*>(array.data()));
     }
     if (e != ErrorNone) {
         *error = e;
         return ArrayContainer();
     }
+    if (version >= 2) {
+        // keep the data for the next delta
+        _prevData.resize(array.dataSize());
+        std::memcpy(_prevData.data(), array.data(), array.dataSize());
+        _prevIndex = _readIndex;
+    }
+    _readIndex++;
 
     // Return the array
     return array;
 }
 
+ArrayDescription FormatImportExportTGD::readDescription(Error* error, int arrayIndex)
+{
+    Error e = seekToArray(arrayIndex);
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayDescription();
+    }
+    ArrayDescription desc;
+    uint8_t version;
+    uint64_t value;
+    e = readTgdHeader(_f, desc, &version, &value);
+    if (e == ErrorNone && !skipTgdData(_f, desc, version, value))
+        e = (std::ferror(_f) ? ErrorSysErrno : ErrorInvalidData);
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayDescription();
+    }
+    _readIndex++;
+    return desc;
+}
+
+std::vector<ArrayContainer> FormatImportExportTGD::readBoxes(Error* error,
+        const std::vector<std::vector<size_t>>& boxes, int arrayIndex)
+{
+    // Reading parts of the data requires random access
+    struct stat statbuf;
+    if (fstat(fileno(_f), &statbuf) != 0 || (statbuf.st_mode & S_IFMT) != S_IFREG)
+        return FormatImportExport::readBoxes(error, boxes, arrayIndex);
+
+    std::vector<ArrayContainer> r;
+    Error e = seekToArray(arrayIndex);
+    if (e != ErrorNone) {
+        *error = e;
+        return r;
+    }
+    off_t arrayOffset = ftello(_f);
+    ArrayDescription desc;
+    uint8_t version = 0;
+    uint64_t value = 0;
+    e = readTgdHeader(_f, desc, &version, &value);
+    off_t endOffset = ftello(_f);
+    if (e == ErrorNone && (arrayOffset < 0 || endOffset < 0))
+        e = ErrorSysErrno;
+    if (e == ErrorNone && version == 3) {
+        // deltas must be decoded completely
+        if (fseeko(_f, arrayOffset, SEEK_SET) != 0) {
+            *error = ErrorSysErrno;
+            return r;
+        }
+        return FormatImportExport::readBoxes(error, boxes, -1);
+    }
+    off_t dataOffset = endOffset;
+    if (e == ErrorNone && version == 1)
+        e = findReferencedData(desc, value, &dataOffset);
+    else
+        endOffset += desc.dataSize();
+    if (e == ErrorNone)
+        e = _batchReader.readBoxes(fileno(_f), dataOffset, desc, boxes, r);
+    if (e == ErrorNone && fseeko(_f, endOffset, SEEK_SET) != 0)
+        e = ErrorSysErrno;
+    if (e != ErrorNone) {
+        *error = e;
+        return std::vector<ArrayContainer>();
+    }
+    _readIndex++;
+    return r;
+}
+
 bool FormatImportExportTGD::hasMore()
 {
     int c = fgetc(_f);
@@ -303,9 +725,199 @@ bool FormatImportExportTGD::hasMore()
     }
 }
 
+bool FormatImportExportTGD::fileDataEquals(off_t dataOffset, const ArrayContainer& array)
+{
+    if (std::fflush(_f) != 0)
+        return false;
+    const unsigned char* data = static_cast<const unsigned char*>(array.data());
+    std::vector<unsigned char> buffer(std::min(array.dataSize(), size_t(1) << 20));
+    for (size_t i = 0; i < array.dataSize(); ) {
+        size_t n = std::min(buffer.size(), array.dataSize() - i);
+        ssize_t r = pread(fileno(_f), buffer.data(), n, dataOffset + i);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0 || std::memcmp(buffer.data(), data + i, r) != 0)
+            return false;
+        i += r;
+    }
+    return true;
+}
+
+Error FormatImportExportTGD::writeDelta(const ArrayContainer& array)
+{
+    // Write a delta to the previous array if it has the same description
+    // and the keyframe interval allows it; otherwise write a keyframe
+    bool delta = (_sinceKeyframe + 1 < _keyframeInterval
+            && array.dataSize() > 0
+            && _prevData.size() == array.dataSize()
+            && _prevDesc.componentType() == array.componentType()
+            && _prevDesc.componentCount() == array.componentCount()
+            && _prevDesc.dimensions() == array.dimensions());
+    if (delta) {
+        size_t typeSize = array.componentSize();
+        const uint8_t* data = static_cast<const uint8_t*>(array.data());
+        std::vector<std::vector<uint8_t>> blocks((array.dataSize() + deltaBlockSize - 1) / deltaBlockSize);
+        parallelForChunks<std::vector<uint8_t>>(blocks.size(), std::max(size_t(1), _threadCount), [&] (size_t b, std::vector<uint8_t>& buffer) {
+                size_t start = b * deltaBlockSize;
+                size_t n = std::min(deltaBlockSize, array.dataSize() - start);
+                encodeDeltaBlock(data + start, _prevData.data() + start, n, typeSize, buffer, blocks[b]);
+                });
+        uint64_t encodedSize = 0;
+        for (size_t b = 0; b < blocks.size(); b++)
+            encodedSize += sizeof(uint32_t) + blocks[b].size();
+        // a delta that does not save space is not worth decoding
+        if (encodedSize >= array.dataSize()) {
+            delta = false;
+        } else {
+            Error e = writeTgdHeader(_f, array, 3);
+            if (e == ErrorNone && std::fwrite(&encodedSize, sizeof(uint64_t), 1, _f) != 1)
+                e = ErrorSysErrno;
+            for (size_t b = 0; e == ErrorNone && b < blocks.size(); b++) {
+                uint32_t size = blocks[b].size();
+                if (std::fwrite(&size, sizeof(uint32_t), 1, _f) != 1
+                        || std::fwrite(blocks[b].data(), blocks[b].size(), 1, _f) != 1) {
+                    e = ErrorSysErrno;
+                }
+            }
+            if (e == ErrorNone && std::fflush(_f) != 0)
+                e = ErrorSysErrno;
+            if (e != ErrorNone)
+                return e;
+            _sinceKeyframe++;
+        }
+    }
+    if (!delta) {
+        Error e = writeTgd(_f, _directIO, array, 2);
+        if (e != ErrorNone)
+            return e;
+        _sinceKeyframe = 0;
+    }
+    _prevDesc = array.description();
+    _prevData.resize(array.dataSize());
+    std::memcpy(_prevData.data(), array.data(), array.dataSize());
+    return ErrorNone;
+}
+
 Error FormatImportExportTGD::writeArray(const ArrayContainer& array)
 {
-    return (writeTgd(_f, array) ? ErrorNone : ErrorSysErrno);
+    _arrayCount = -2;
+    _arrayOffsets.clear();
+    if (_delta) {
+        _arrayIndex++;
+        return writeDelta(array);
+    }
+    if (!_dedup || array.dataSize() == 0) {
+        _arrayIndex++;
+        return writeTgd(_f, _directIO, array);
+    }
+
+    // Write a reference if we already wrote the same data. The hash only
+    // finds candidates; the data is compared before it is shared.
+    Hash hash = hashData(array.data(), array.dataSize());
+    auto it = _dataLocations.find(hash);
+    if (it != _dataLocations.end()
+            && it->second.dataSize == array.dataSize()
+            && fileDataEquals(it->second.dataOffset, array)) {
+        Error e = writeTgdReference(_f, array, it->second.arrayIndex);
+        _arrayIndex++;
+        return e;
+    }
+    Error e = writeTgdHeader(_f, array);
+    off_t dataOffset = ftello(_f);
+    if (e == ErrorNone && dataOffset < 0)
+        e = ErrorSysErrno;
+    if (e == ErrorNone)
+        e = _directIO.write(_f, array.data(), array.dataSize());
+    if (e == ErrorNone && std::fflush(_f) != 0)
+        e = ErrorSysErrno;
+    if (e == ErrorNone && it == _dataLocations.end())
+        _dataLocations[hash] = { _arrayIndex, dataOffset, array.dataSize() };
+    _arrayIndex++;
+    return e;
+}
+
+ArrayContainer FormatImportExportTGD::mapArray(Error* error, const ArrayDescription& desc)
+{
+    // Check this before we write the header
+    if (!FileMapper::isSupported(_f)) {
+        *error = ErrorFeaturesUnsupported;
+        return ArrayContainer();
+    }
+    off_t start = ftello(_f);
+    if (start < 0) {
+        *error = ErrorSysErrno;
+        return ArrayContainer();
+    }
+    _arrayCount = -2;
+    _arrayOffsets.clear();
+    // the mapped data is not known yet, so a following delta needs a new keyframe
+    _prevData.clear();
+    Error e = writeTgdHeader(_f, desc);
+    ArrayContainer r;
+    if (e == ErrorNone)
+        r = _fileMapper.map(_f, desc, &e);
+    if (e != ErrorNone) {
+        // do not leave a header without data behind
+        int mapErrno = errno;
+        std::fflush(_f);
+        if (ftruncate(fileno(_f), start) == 0)
+            fseeko(_f, start, SEEK_SET);
+        errno = mapErrno;
+        *error = e;
+        return ArrayContainer();
+    }
+    _arrayIndex++;
+    return r;
+}
+
+Error FormatImportExportTGD::writeBox(const ArrayContainer& box, const std::vector<size_t>& index, int arrayIndex)
+{
+    if (_fileName.empty() || arrayIndex < 0)
+        return ErrorFeaturesUnsupported;
+
+    // Find the array data. The stream is readable, and writes always go to
+    // the end of the file, so we can move the position and restore it after.
+    if (std::fflush(_f) != 0)
+        return ErrorSysErrno;
+    ArrayDescription desc;
+    uint8_t version = 0;
+    uint64_t value;
+    Error e = seekToArray(arrayIndex);
+    if (e == ErrorNone)
+        e = readTgdHeader(_f, desc, &version, &value);
+    // references, keyframes and deltas depend on the data of other arrays
+    if (e == ErrorNone && version != 0)
+        e = ErrorFeaturesUnsupported;
+    off_t dataOffset = ftello(_f);
+    if (e == ErrorNone && dataOffset < 0)
+        e = ErrorSysErrno;
+    // arrays that reference this data would silently change as well
+    for (int i = arrayIndex + 1; e == ErrorNone && i < arrayCount(); i++) {
+        ArrayDescription refDesc;
+        uint8_t refVersion;
+        uint64_t refValue;
+        e = seekToArray(i);
+        if (e == ErrorNone)
+            e = readTgdHeader(_f, refDesc, &refVersion, &refValue);
+        if (e == ErrorNone && refVersion == 1 && refValue == uint64_t(arrayIndex))
+            e = ErrorFeaturesUnsupported;
+    }
+    if (fseeko(_f, 0, SEEK_END) != 0 && e == ErrorNone)
+        e = ErrorSysErrno;
+    if (e != ErrorNone)
+        return e;
+
+    // The data changes, so it must not be shared by arrays written later.
+    for (auto it = _dataLocations.begin(); it != _dataLocations.end(); ) {
+        if (it->second.arrayIndex == arrayIndex)
+            it = _dataLocations.erase(it);
+        else
+            it++;
+    }
+
+    if (!_boxWriter.isOpen() && (e = _boxWriter.open(_fileName)) != ErrorNone)
+        return e;
+    return _boxWriter.write(dataOffset, desc, box, index);
 }
 
 }
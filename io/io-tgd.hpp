@@ -38,7 +38,8 @@
  *
  * TGD file:
  * - 3 bytes: 'T', 'G', 'D' (84, 71, 68)
- * - 1 byte: format version, must be 0
+ * - 1 byte: format version: 0 for arrays with data, 1 for references,
+ *   2 for keyframes, 3 for deltas
  * - 1 byte: component type:
  *   `int8` = 0, `uint8` = 1, `int16` = 2, `uint16` = 3, `int32` = 4, `uint32` =
  *   5, `int64` = 6, `uint64` = 7, `float32` = 8, `float64` = 9
@@ -48,20 +49,81 @@
  * - 1 global tag list
  * - C component tag lists
  * - D dimension tag lists
- * - the data, packed (no fill bytes)
+ * - version 0 and 2: the data, packed (no fill bytes)
+ * - version 1: 1 uint64: the index of an earlier version 0 array in the same
+ *   file that has the same data (which must have the same size)
+ * - version 3: 1 uint64: the size of the encoded delta data, followed by the
+ *   encoded XOR of the data with the data of the previous array (which must
+ *   be a keyframe or a delta with the same dimensions, components and type);
+ *   see io-tgd.cpp for the encoding
+ *
+ * References are written instead of repeated data if the output hint
+ * DEDUP=1 is given and the output is a regular file. Reading them requires
+ * seeking, so they cannot be read from pipes.
+ *
+ * Keyframes and deltas are written if the output hint DELTA=1 is given, with
+ * a keyframe at least every KEYFRAME_INTERVAL arrays (default 16), so that
+ * random access needs to decode only few deltas.
  */
 
 #include <cstdio>
+#include <cstdint>
+#include <map>
 
 #include "io.hpp"
+#include "hash.hpp"
+#include "io-directio.hpp"
+#include "io-batchread.hpp"
+#include "io-mmap.hpp"
+#include "io-boxwrite.hpp"
 
 namespace TGD {
 
+/* Read or write a TGD header at the current position of f,
+ * for other converters that use TGD as their container format.
+ * If reference is not null, reading sets it to the index of the referenced
+ * array for references (the stream is then positioned at the next array),
+ * and to -1 otherwise. If it is null, references are reported as
+ * ErrorFeaturesUnsupported. Deltas are always reported as
+ * ErrorFeaturesUnsupported. */
+Error readTgdHeader(FILE* f, ArrayDescription& array, int64_t* reference = nullptr);
+Error writeTgdHeader(FILE* f, const ArrayDescription& array);
+
 class FormatImportExportTGD : public FormatImportExport {
 private:
     FILE* _f;
     int _arrayCount;
     std::vector<off_t> _arrayOffsets;
+    DirectIO _directIO;
+    BatchReader _batchReader;
+    FileMapper _fileMapper;
+    std::string _fileName;
+    BoxWriter _boxWriter;
+    // deduplication when writing
+    struct DataLocation {
+        int64_t arrayIndex;
+        off_t dataOffset;
+        size_t dataSize;
+    };
+    bool _dedup;
+    int64_t _arrayIndex;
+    std::map<Hash, DataLocation> _dataLocations;
+    // deltas: the previous array is kept for encoding or decoding the next one
+    bool _delta;
+    int _keyframeInterval;
+    int _sinceKeyframe;
+    size_t _threadCount;
+    ArrayDescription _prevDesc;
+    std::vector<unsigned char> _prevData;
+    int64_t _prevIndex;
+    int64_t _readIndex;
+
+    Error seekToArray(int arrayIndex);
+    Error findReferencedData(const ArrayDescription& desc, int64_t reference, off_t* dataOffset);
+    Error readDeltaData(const ArrayDescription& desc, uint64_t encodedSize, unsigned char* data);
+    Error restoreArrayData(int64_t arrayIndex);
+    bool fileDataEquals(off_t dataOffset, const ArrayContainer& array);
+    Error writeDelta(const ArrayContainer& array);
 
 public:
     FormatImportExportTGD();
@@ -75,9 +137,14 @@ public:
     virtual int arrayCount() override;
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
+    virtual ArrayDescription readDescription(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+    virtual std::vector<ArrayContainer> readBoxes(Error* error, const std::vector<std::vector<size_t>>& boxes,
+            int arrayIndex = -1 /* -1 means next */) override;
 
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
+    virtual ArrayContainer mapArray(Error* error, const ArrayDescription& desc) override;
+    virtual Error writeBox(const ArrayContainer& box, const std::vector<size_t>& index, int arrayIndex) override;
 };
 
 }
@@ -24,11 +24,23 @@
 
 #include <cstdio>
 #include <cstring>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
 
 #include "io-tiff.hpp"
 #include "io-utils.hpp"
 
 #include <tiffio.h>
+#ifdef TGD_TIFF_WITH_ZLIB
+# include <zlib.h>
+#endif
+#ifdef TGD_TIFF_WITH_ZSTD
+# include <zstd.h>
+#endif
 
 
 namespace TGD {
@@ -59,7 +71,7 @@ Error FormatImportExportTIFF::openForReading(const std::string& fileName, const
     return ErrorNone;
 }
 
-Error FormatImportExportTIFF::openForWriting(const std::string& fileName, bool append, const TagList&)
+Error FormatImportExportTIFF::openForWriting(const std::string& fileName, bool append, const TagList& hints)
 {
     if (append)
         return ErrorFeaturesUnsupported;
@@ -72,6 +84,7 @@ Error FormatImportExportTIFF::openForWriting(const std::string& fileName, bool a
     _tiff = TIFFOpen(fileName.c_str(), "w");
     if (!_tiff)
         return ErrorLibrary;
+    _hints = hints;
     return ErrorNone;
 }
 
@@ -97,96 +110,99 @@ int FormatImportExportTIFF::arrayCount()
     return _dirCount;
 }
 
-ArrayContainer FormatImportExportTIFF::readArray(Error* error, int arrayIndex)
+Error FormatImportExportTIFF::setDirectory(int arrayIndex)
 {
     if (arrayIndex >= arrayCount()) {
-        *error = ErrorInvalidData;
-        return ArrayContainer();
+        return ErrorInvalidData;
     } else if (arrayIndex < 0) {
         if (_readCount > 0) {
             if (!TIFFSetDirectory(_tiff, _readCount)) {
-                *error = ErrorLibrary;
-                return ArrayContainer();
+                return ErrorLibrary;
             }
         }
     } else {
         if (!TIFFSetDirectory(_tiff, arrayIndex)) {
-            *error = ErrorLibrary;
-            return ArrayContainer();
+            return ErrorLibrary;
         }        
     }
 
-    uint32_t width = 0, height = 0;
-    TIFFGetField(_tiff, TIFFTAG_IMAGEWIDTH, &width);
-    TIFFGetField(_tiff, TIFFTAG_IMAGELENGTH, &height);
+    return ErrorNone;
+}
+
+struct TiffLayout
+{
+    uint32_t width, height;
+    uint32_t tileWidth, tileHeight;
+    uint16_t config;
+    uint16_t orientation;
+};
+
+/* Reads the description of the current directory without touching image data */
+static Error readTiffHeader(TIFF* tiff, ArrayDescription& desc, TiffLayout& layout)
+{
+    uint32_t& width = layout.width;
+    uint32_t& height = layout.height;
+    width = height = 0;
+    TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &width);
+    TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &height);
     if (width == 0 || height == 0) {
-        *error = ErrorInvalidData;
-        return ArrayContainer();
+        return ErrorInvalidData;
     }
 
-    uint32_t tileWidth = 0, tileHeight = 0;
-    TIFFGetField(_tiff, TIFFTAG_TILEWIDTH, &tileWidth);
-    TIFFGetField(_tiff, TIFFTAG_TILELENGTH, &tileHeight);
+    layout.tileWidth = layout.tileHeight = 0;
+    TIFFGetField(tiff, TIFFTAG_TILEWIDTH, &layout.tileWidth);
+    TIFFGetField(tiff, TIFFTAG_TILELENGTH, &layout.tileHeight);
 
-    uint16_t config;
-    if (!TIFFGetField(_tiff, TIFFTAG_PLANARCONFIG, &config)) {
-        *error = ErrorLibrary;
-        return ArrayContainer();
+    uint16_t& config = layout.config;
+    if (!TIFFGetField(tiff, TIFFTAG_PLANARCONFIG, &config)) {
+        return ErrorLibrary;
     }
     if (config != PLANARCONFIG_CONTIG && config != PLANARCONFIG_SEPARATE) {
-        *error = ErrorFeaturesUnsupported;
-        return ArrayContainer();
+        return ErrorFeaturesUnsupported;
     }
 
     uint16_t sampleFormat;
-    if (!TIFFGetFieldDefaulted(_tiff, TIFFTAG_SAMPLEFORMAT, &sampleFormat)) {
-        *error = ErrorLibrary;
-        return ArrayContainer();
+    if (!TIFFGetFieldDefaulted(tiff, TIFFTAG_SAMPLEFORMAT, &sampleFormat)) {
+        return ErrorLibrary;
     }
     if (sampleFormat != SAMPLEFORMAT_UINT && sampleFormat != SAMPLEFORMAT_INT && sampleFormat != SAMPLEFORMAT_IEEEFP) {
-        *error = ErrorFeaturesUnsupported;
-        return ArrayContainer();
+        return ErrorFeaturesUnsupported;
     }
 
     uint16_t bps;
-    if (!TIFFGetField(_tiff, TIFFTAG_BITSPERSAMPLE, &bps)) {
-        *error = ErrorLibrary;
-        return ArrayContainer();
+    if (!TIFFGetField(tiff, TIFFTAG_BITSPERSAMPLE, &bps)) {
+        return ErrorLibrary;
     }
     if (bps != 8 && bps != 16 && bps != 32 && bps != 64) {
-        *error = ErrorFeaturesUnsupported;
-        return ArrayContainer();
+        return ErrorFeaturesUnsupported;
     }
 
     uint16_t nSamples;
-    if (!TIFFGetField(_tiff, TIFFTAG_SAMPLESPERPIXEL, &nSamples)) {
-        *error = ErrorLibrary;
-        return ArrayContainer();
+    if (!TIFFGetField(tiff, TIFFTAG_SAMPLESPERPIXEL, &nSamples)) {
+        return ErrorLibrary;
     }
     if (nSamples < 1) {
-        *error = ErrorFeaturesUnsupported;
-        return ArrayContainer();
+        return ErrorFeaturesUnsupported;
     }
 
-    uint16_t orientation;
-    if (!TIFFGetFieldDefaulted(_tiff, TIFFTAG_ORIENTATION, &orientation)) {
+    uint16_t& orientation = layout.orientation;
+    if (!TIFFGetFieldDefaulted(tiff, TIFFTAG_ORIENTATION, &orientation)) {
         orientation = ORIENTATION_TOPLEFT;
     }
     if (orientation != ORIENTATION_TOPLEFT && orientation != ORIENTATION_BOTLEFT) {
-        *error = ErrorFeaturesUnsupported;
-        return ArrayContainer();
+        return ErrorFeaturesUnsupported;
     }
 
     uint16_t comp;
-    if (!TIFFGetField(_tiff, TIFFTAG_COMPRESSION, &comp))
+    if (!TIFFGetField(tiff, TIFFTAG_COMPRESSION, &comp))
         comp = COMPRESSION_NONE;
 
     uint16_t phot;
-    bool havePhot = TIFFGetFieldDefaulted(_tiff, TIFFTAG_PHOTOMETRIC, &phot);
+    bool havePhot = TIFFGetFieldDefaulted(tiff, TIFFTAG_PHOTOMETRIC, &phot);
 
     Type type = float32;
     if (havePhot && phot == PHOTOMETRIC_LOGLUV && (comp == COMPRESSION_SGILOG || comp == COMPRESSION_SGILOG24)) {
-        TIFFSetField(_tiff, TIFFTAG_SGILOGDATAFMT, SGILOGDATAFMT_FLOAT);
+        TIFFSetField(tiff, TIFFTAG_SGILOGDATAFMT, SGILOGDATAFMT_FLOAT);
         type = float32;
     } else if (bps == 8) {
         if (sampleFormat == SAMPLEFORMAT_UINT) {
@@ -194,8 +210,7 @@ ArrayContainer FormatImportExportTIFF::readArray(Error* error, int arrayIndex)
         } else if (sampleFormat == SAMPLEFORMAT_INT) {
             type = int8;
         } else {
-            *error = ErrorFeaturesUnsupported;
-            return ArrayContainer();
+            return ErrorFeaturesUnsupported;
         }
     } else if (bps == 16) {
         if (sampleFormat == SAMPLEFORMAT_UINT) {
@@ -203,8 +218,7 @@ ArrayContainer FormatImportExportTIFF::readArray(Error* error, int arrayIndex)
         } else if (sampleFormat == SAMPLEFORMAT_INT) {
             type = int16;
         } else {
-            *error = ErrorFeaturesUnsupported;
-            return ArrayContainer();
+            return ErrorFeaturesUnsupported;
         }
     } else if (bps == 32) {
         if (sampleFormat == SAMPLEFORMAT_UINT) {
@@ -224,47 +238,68 @@ ArrayContainer FormatImportExportTIFF::readArray(Error* error, int arrayIndex)
         }
     }
 
-    ArrayContainer r({ width, height }, nSamples, type);
-    if (r.dimension(0) * r.elementSize() != size_t(TIFFScanlineSize(_tiff))) {
-        *error = ErrorLibrary;
-        return ArrayContainer();
+    desc = ArrayDescription({ width, height }, nSamples, type);
+    if (desc.dimension(0) * desc.elementSize() != size_t(TIFFScanlineSize(tiff))) {
+        return ErrorLibrary;
     }
 
     if (havePhot && phot == PHOTOMETRIC_LOGLUV && (comp == COMPRESSION_SGILOG || comp == COMPRESSION_SGILOG24)) {
-        if (r.componentCount() == 3 || r.componentCount() == 4) {
-            r.componentTagList(0).set("INTERPRETATION", "XYZ/X");
-            r.componentTagList(1).set("INTERPRETATION", "XYZ/Y");
-            r.componentTagList(2).set("INTERPRETATION", "XYZ/Z");
-            if (r.componentCount() == 4)
-                r.componentTagList(3).set("INTERPRETATION", "ALPHA");
+        if (desc.componentCount() == 3 || desc.componentCount() == 4) {
+            desc.componentTagList(0).set("INTERPRETATION", "XYZ/X");
+            desc.componentTagList(1).set("INTERPRETATION", "XYZ/Y");
+            desc.componentTagList(2).set("INTERPRETATION", "XYZ/Z");
+            if (desc.componentCount() == 4)
+                desc.componentTagList(3).set("INTERPRETATION", "ALPHA");
         }
     } else if (havePhot && phot == PHOTOMETRIC_RGB) {
-        if (r.componentCount() == 3 || r.componentCount() == 4) {
+        if (desc.componentCount() == 3 || desc.componentCount() == 4) {
             if (type == uint8) {
-                r.componentTagList(0).set("INTERPRETATION", "SRGB/R");
-                r.componentTagList(1).set("INTERPRETATION", "SRGB/G");
-                r.componentTagList(2).set("INTERPRETATION", "SRGB/B");
+                desc.componentTagList(0).set("INTERPRETATION", "SRGB/R");
+                desc.componentTagList(1).set("INTERPRETATION", "SRGB/G");
+                desc.componentTagList(2).set("INTERPRETATION", "SRGB/B");
             } else {
-                r.componentTagList(0).set("INTERPRETATION", "RED");
-                r.componentTagList(1).set("INTERPRETATION", "GREEN");
-                r.componentTagList(2).set("INTERPRETATION", "BLUE");
+                desc.componentTagList(0).set("INTERPRETATION", "RED");
+                desc.componentTagList(1).set("INTERPRETATION", "GREEN");
+                desc.componentTagList(2).set("INTERPRETATION", "BLUE");
             }
-            if (r.componentCount() == 4)
-                r.componentTagList(3).set("INTERPRETATION", "ALPHA");
+            if (desc.componentCount() == 4)
+                desc.componentTagList(3).set("INTERPRETATION", "ALPHA");
         }
     } else if (havePhot && phot == PHOTOMETRIC_MINISBLACK) {
-        if (r.componentCount() == 1 || r.componentCount() == 2) {
+        if (desc.componentCount() == 1 || desc.componentCount() == 2) {
             if (type == uint8)
-                r.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
+                desc.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
             else
-                r.componentTagList(0).set("INTERPRETATION", "GRAY");
-            if (r.componentCount() == 2)
-                r.componentTagList(1).set("INTERPRETATION", "ALPHA");
+                desc.componentTagList(0).set("INTERPRETATION", "GRAY");
+            if (desc.componentCount() == 2)
+                desc.componentTagList(1).set("INTERPRETATION", "ALPHA");
         }
     }
 
+    return ErrorNone;
+}
+
+ArrayContainer FormatImportExportTIFF::readArray(Error* error, int arrayIndex)
+{
+    ArrayDescription desc;
+    TiffLayout layout;
+    Error err = setDirectory(arrayIndex);
+    if (err == ErrorNone)
+        err = readTiffHeader(_tiff, desc, layout);
+    if (err != ErrorNone) {
+        *error = err;
+        return ArrayContainer();
+    }
+    uint32_t width = layout.width;
+    uint32_t height = layout.height;
+    uint32_t tileWidth = layout.tileWidth;
+    uint32_t tileHeight = layout.tileHeight;
+    uint16_t nSamples = desc.componentCount();
+    uint16_t orientation = layout.orientation;
+    ArrayContainer r(desc);
+
     if (tileWidth == 0 && tileHeight == 0) {
-        if (config == PLANARCONFIG_CONTIG) {
+        if (layout.config == PLANARCONFIG_CONTIG) {
             for (uint32_t row = 0; row < height; row++) {
                 if (!TIFFReadScanline(_tiff, r.get({ 0, row }), row)) {
                     *error = ErrorLibrary;
@@ -318,11 +353,205 @@ ArrayContainer FormatImportExportTIFF::readArray(Error* error, int arrayIndex)
     return r;
 }
 
+ArrayDescription FormatImportExportTIFF::readDescription(Error* error, int arrayIndex)
+{
+    ArrayDescription desc;
+    TiffLayout layout;
+    Error err = setDirectory(arrayIndex);
+    if (err == ErrorNone)
+        err = readTiffHeader(_tiff, desc, layout);
+    if (err != ErrorNone) {
+        *error = err;
+        return ArrayDescription();
+    }
+    if (layout.orientation >= 1 && layout.orientation <= 8) {
+        desc = orientedImageDescription(desc, static_cast<ImageOriginLocation>(layout.orientation));
+    }
+    _readCount++;
+    return desc;
+}
+
 bool FormatImportExportTIFF::hasMore()
 {
     return _readCount < arrayCount();
 }
 
+/* Predictors and compressors for writing strips. These are applied by us
+ * instead of libtiff so that strips can be compressed in parallel. */
+
+template<typename T> static void horizontalDifferencing(unsigned char* row, size_t n, size_t stride)
+{
+    T* p = reinterpret_cast<T*>(row);
+    for (size_t i = n; i > stride; i--)
+        p[i - 1] -= p[i - 1 - stride];
+}
+
+static void floatingPointDifferencing(unsigned char* row, size_t n, size_t stride, size_t bytes,
+        std::vector<unsigned char>& tmp)
+{
+    // Reorder the bytes so that all most significant bytes come first,
+    // then apply byte-wise differencing. This matches libtiff's fpDiff().
+    tmp.assign(row, row + n * bytes);
+    for (size_t i = 0; i < n; i++) {
+        for (size_t b = 0; b < bytes; b++) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            row[b * n + i] = tmp[bytes * i + b];
+#else
+            row[(bytes - b - 1) * n + i] = tmp[bytes * i + b];
+#endif
+        }
+    }
+    horizontalDifferencing<uint8_t>(row, n * bytes, stride);
+}
+
+// TIFF flavour of LZW: MSB-first codes, early code width change
+class LZWEncoder
+{
+private:
+    static const unsigned int codeClear = 256;
+    static const unsigned int codeEOI = 257;
+    static const unsigned int codeFirst = 258;
+    static const unsigned int codeMax = 4095;
+    static const unsigned int hashSize = 8192;
+
+    std::vector<uint32_t> _hashKeys; // 0 means empty
+    std::vector<uint16_t> _hashCodes;
+    std::vector<unsigned char>& _out;
+    uint32_t _bitBuffer;
+    int _bitCount;
+    unsigned int _nbits;
+    unsigned int _maxCode;
+    unsigned int _freeEnt;
+
+    void putCode(unsigned int code)
+    {
+        _bitBuffer = (_bitBuffer << _nbits) | code;
+        _bitCount += _nbits;
+        while (_bitCount >= 8) {
+            _out.push_back((_bitBuffer >> (_bitCount - 8)) & 0xff);
+            _bitCount -= 8;
+        }
+    }
+
+    void clearTable()
+    {
+        std::fill(_hashKeys.begin(), _hashKeys.end(), 0);
+    }
+
+    static unsigned int hash(uint32_t key)
+    {
+        return (key * 2654435761u) >> 19;
+    }
+
+    void addEntry()
+    {
+        _freeEnt++;
+        if (_freeEnt == codeMax - 1) {
+            putCode(codeClear);
+            clearTable();
+            _freeEnt = codeFirst;
+            _nbits = 9;
+            _maxCode = 511;
+        } else if (_freeEnt > _maxCode) {
+            _nbits++;
+            _maxCode = (1u << _nbits) - 1;
+        }
+    }
+
+public:
+    LZWEncoder(std::vector<unsigned char>& out) :
+        _hashKeys(hashSize, 0), _hashCodes(hashSize), _out(out),
+        _bitBuffer(0), _bitCount(0), _nbits(9), _maxCode(511), _freeEnt(codeFirst)
+    {
+    }
+
+    void encode(const unsigned char* data, size_t size)
+    {
+        putCode(codeClear);
+        if (size > 0) {
+            unsigned int ent = data[0];
+            for (size_t i = 1; i < size; i++) {
+                uint32_t key = ((ent << 8) | data[i]) + 1;
+                unsigned int h = hash(key);
+                while (_hashKeys[h] != 0 && _hashKeys[h] != key)
+                    h = (h + 1) % hashSize;
+                if (_hashKeys[h] == key) {
+                    ent = _hashCodes[h];
+                } else {
+                    putCode(ent);
+                    ent = data[i];
+                    _hashKeys[h] = key;
+                    _hashCodes[h] = _freeEnt;
+                    addEntry();
+                }
+            }
+            putCode(ent);
+            addEntry();
+        }
+        putCode(codeEOI);
+        if (_bitCount > 0)
+            _out.push_back((_bitBuffer << (8 - _bitCount)) & 0xff);
+    }
+};
+
+static bool haveParallelCompressor(uint16_t compression)
+{
+    switch (compression) {
+    case COMPRESSION_LZW:
+        return true;
+#ifdef TGD_TIFF_WITH_ZLIB
+    case COMPRESSION_ADOBE_DEFLATE:
+        return true;
+#endif
+#if defined(TGD_TIFF_WITH_ZSTD) && defined(COMPRESSION_ZSTD)
+    case COMPRESSION_ZSTD:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+static bool compressStrip(uint16_t compression, int level,
+        const unsigned char* data, size_t size, std::vector<unsigned char>& out)
+{
+    switch (compression) {
+    case COMPRESSION_LZW:
+        {
+            out.clear();
+            out.reserve(size / 2 + 16);
+            LZWEncoder encoder(out);
+            encoder.encode(data, size);
+            return true;
+        }
+#ifdef TGD_TIFF_WITH_ZLIB
+    case COMPRESSION_ADOBE_DEFLATE:
+        {
+            uLongf outSize = compressBound(size);
+            out.resize(outSize);
+            if (compress2(out.data(), &outSize, data, size, level < 0 ? Z_DEFAULT_COMPRESSION : level) != Z_OK)
+                return false;
+            out.resize(outSize);
+            return true;
+        }
+#endif
+#if defined(TGD_TIFF_WITH_ZSTD) && defined(COMPRESSION_ZSTD)
+    case COMPRESSION_ZSTD:
+        {
+            out.resize(ZSTD_compressBound(size));
+            size_t outSize = ZSTD_compress(out.data(), out.size(), data, size, level < 0 ? 9 : level);
+            if (ZSTD_isError(outSize))
+                return false;
+            out.resize(outSize);
+            return true;
+        }
+#endif
+    default:
+        (void)level;
+        return false;
+    }
+}
+
 Error FormatImportExportTIFF::writeArray(const ArrayContainer& array)
 {
     if (array.dimensionCount() != 2
@@ -384,7 +613,44 @@ Error FormatImportExportTIFF::writeArray(const ArrayContainer& array)
     TIFFSetField(_tiff, TIFFTAG_SAMPLEFORMAT, sampleFormat);
     TIFFSetField(_tiff, TIFFTAG_BITSPERSAMPLE, bps);
 
-    TIFFSetField(_tiff, TIFFTAG_COMPRESSION, uint16_t(COMPRESSION_NONE));
+    uint16_t compression = COMPRESSION_NONE;
+    std::string compressionName = _hints.value("COMPRESSION", "none");
+    if (compressionName == "none")
+        compression = COMPRESSION_NONE;
+    else if (compressionName == "deflate")
+        compression = COMPRESSION_ADOBE_DEFLATE;
+    else if (compressionName == "lzw")
+        compression = COMPRESSION_LZW;
+#ifdef COMPRESSION_ZSTD
+    else if (compressionName == "zstd")
+        compression = COMPRESSION_ZSTD;
+#endif
+    else
+        return ErrorFeaturesUnsupported;
+    uint16_t predictor = PREDICTOR_NONE;
+    std::string predictorName = _hints.value("PREDICTOR", "none");
+    if (predictorName == "none")
+        predictor = PREDICTOR_NONE;
+    else if (predictorName == "horizontal" && sampleFormat != SAMPLEFORMAT_IEEEFP && bps <= 32)
+        predictor = PREDICTOR_HORIZONTAL;
+    else if (predictorName == "float" && sampleFormat == SAMPLEFORMAT_IEEEFP)
+        predictor = PREDICTOR_FLOATINGPOINT;
+    else
+        return ErrorFeaturesUnsupported;
+    if (predictor != PREDICTOR_NONE && compression == COMPRESSION_NONE)
+        return ErrorFeaturesUnsupported;
+    int level = _hints.value("LEVEL", -1);
+    TIFFSetField(_tiff, TIFFTAG_COMPRESSION, compression);
+    if (compression != COMPRESSION_NONE) {
+        if (predictor != PREDICTOR_NONE)
+            TIFFSetField(_tiff, TIFFTAG_PREDICTOR, predictor);
+        if (level >= 0 && compression == COMPRESSION_ADOBE_DEFLATE)
+            TIFFSetField(_tiff, TIFFTAG_ZIPQUALITY, level);
+#ifdef COMPRESSION_ZSTD
+        if (level >= 0 && compression == COMPRESSION_ZSTD)
+            TIFFSetField(_tiff, TIFFTAG_ZSTD_LEVEL, level);
+#endif
+    }
     TIFFSetField(_tiff, TIFFTAG_PLANARCONFIG, uint16_t(PLANARCONFIG_CONTIG));
     TIFFSetField(_tiff, TIFFTAG_ORIENTATION, uint16_t(ORIENTATION_TOPLEFT));
 
@@ -406,9 +672,111 @@ Error FormatImportExportTIFF::writeArray(const ArrayContainer& array)
         TIFFSetField(_tiff, TIFFTAG_PHOTOMETRIC, uint16_t(PHOTOMETRIC_MINISBLACK));
     }
 
-    for (size_t y = 0; y < array.dimension(1); y++) {
-        TIFFWriteScanline(_tiff, const_cast<void*>(array.get({ 0, array.dimension(1) - 1 - y })), y);
+    if (compression == COMPRESSION_NONE) {
+        for (size_t y = 0; y < array.dimension(1); y++) {
+            TIFFWriteScanline(_tiff, const_cast<void*>(array.get({ 0, array.dimension(1) - 1 - y })), y);
+        }
+        return (TIFFFlush(_tiff) ? ErrorNone : ErrorLibrary);
+    }
+
+    // Compressed data is written in strips of roughly 256 KiB uncompressed size
+    const size_t width = array.dimension(0);
+    const size_t height = array.dimension(1);
+    const size_t rowSize = width * array.elementSize();
+    uint32_t rowsPerStrip = std::max(size_t(1), std::min(height, size_t(256 * 1024) / rowSize));
+    rowsPerStrip = _hints.value("ROWSPERSTRIP", rowsPerStrip);
+    if (rowsPerStrip < 1)
+        return ErrorInvalidData;
+    TIFFSetField(_tiff, TIFFTAG_ROWSPERSTRIP, rowsPerStrip);
+    const size_t stripCount = (height + rowsPerStrip - 1) / rowsPerStrip;
+
+    if (!haveParallelCompressor(compression)) {
+        // Let libtiff compress the strips one after the other
+        std::vector<unsigned char> stripData;
+        for (size_t s = 0; s < stripCount; s++) {
+            size_t firstRow = s * rowsPerStrip;
+            size_t rows = std::min(size_t(rowsPerStrip), height - firstRow);
+            stripData.resize(rows * rowSize);
+            for (size_t y = 0; y < rows; y++) {
+                std::memcpy(stripData.data() + y * rowSize,
+                        array.get({ 0, height - 1 - (firstRow + y) }), rowSize);
+            }
+            if (TIFFWriteEncodedStrip(_tiff, s, stripData.data(), stripData.size()) < 0)
+                return ErrorLibrary;
+        }
+        return (TIFFFlush(_tiff) ? ErrorNone : ErrorLibrary);
+    }
+
+    // Compress strips in a pool of worker threads while this thread
+    // writes the finished strips in order
+    std::vector<std::vector<unsigned char>> strips(stripCount);
+    std::vector<int> stripState(stripCount, 0); // 0 = pending, 1 = done, -1 = failed
+    std::mutex stripMutex;
+    std::condition_variable stripCond;
+    std::atomic<size_t> nextStrip(0);
+    std::atomic<bool> stop(false);
+    auto worker = [&]() {
+        std::vector<unsigned char> stripData;
+        std::vector<unsigned char> tmp;
+        for (;;) {
+            size_t s = nextStrip++;
+            if (s >= stripCount || stop)
+                break;
+            size_t firstRow = s * rowsPerStrip;
+            size_t rows = std::min(size_t(rowsPerStrip), height - firstRow);
+            stripData.resize(rows * rowSize);
+            for (size_t y = 0; y < rows; y++) {
+                unsigned char* row = stripData.data() + y * rowSize;
+                std::memcpy(row, array.get({ 0, height - 1 - (firstRow + y) }), rowSize);
+                size_t n = width * array.componentCount();
+                if (predictor == PREDICTOR_HORIZONTAL) {
+                    if (bps == 8)
+                        horizontalDifferencing<uint8_t>(row, n, array.componentCount());
+                    else if (bps == 16)
+                        horizontalDifferencing<uint16_t>(row, n, array.componentCount());
+                    else
+                        horizontalDifferencing<uint32_t>(row, n, array.componentCount());
+                } else if (predictor == PREDICTOR_FLOATINGPOINT) {
+                    floatingPointDifferencing(row, n, array.componentCount(), array.componentSize(), tmp);
+                }
+            }
+            std::vector<unsigned char> out;
+            bool ok = compressStrip(compression, level, stripData.data(), stripData.size(), out);
+            {
+                std::unique_lock<std::mutex> lock(stripMutex);
+                strips[s] = std::move(out);
+                stripState[s] = (ok ? 1 : -1);
+            }
+            stripCond.notify_all();
+        }
+    };
+    size_t threadCount = _hints.value("THREADS", std::max(1u, std::thread::hardware_concurrency()));
+    threadCount = std::max(size_t(1), std::min(threadCount, stripCount));
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < threadCount; i++)
+        threads.push_back(std::thread(worker));
+    Error e = ErrorNone;
+    for (size_t s = 0; s < stripCount; s++) {
+        std::vector<unsigned char> out;
+        {
+            std::unique_lock<std::mutex> lock(stripMutex);
+            stripCond.wait(lock, [&] { return stripState[s] != 0; });
+            if (stripState[s] < 0) {
+                e = ErrorLibrary;
+                break;
+            }
+            out = std::move(strips[s]);
+        }
+        if (TIFFWriteRawStrip(_tiff, s, out.data(), out.size()) < 0) {
+            e = ErrorLibrary;
+            break;
+        }
     }
+    stop = true;
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    if (e != ErrorNone)
+        return e;
     return (TIFFFlush(_tiff) ? ErrorNone : ErrorLibrary);
 }
 
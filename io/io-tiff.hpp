@@ -34,9 +34,12 @@ namespace TGD {
 class FormatImportExportTIFF : public FormatImportExport {
 private:
     struct tiff* _tiff;
+    TagList _hints;
     int _dirCount;
     int _readCount;
 
+    Error setDirectory(int arrayIndex);
+
 public:
     FormatImportExportTIFF();
     ~FormatImportExportTIFF();
@@ -49,6 +52,7 @@ public:
     virtual int arrayCount() override;
     virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
     virtual bool hasMore() override;
+    virtual ArrayDescription readDescription(Error* error, int arrayIndex = -1 /* -1 means next */) override;
 
     // for writing / appending:
     virtual Error writeArray(const ArrayContainer& array) override;
@@ -87,6 +87,58 @@ int FormatImportExportTinyEXR::arrayCount()
     return (_fileName.length() == 0 ? -1 : 1);
 }
 
+/* Try to find the typical color channels and put them into the right position */
+static std::vector<size_t> exrChannelPermutation(const EXRHeader& exr_header, size_t nc)
+{
+    int indexR = -1;
+    int indexG = -1;
+    int indexB = -1;
+    int indexA = -1;
+    for (size_t c = 0; c < nc; c++) {
+        if (std::string(exr_header.channels[c].name) == "R")
+            indexR = c;
+        if (std::string(exr_header.channels[c].name) == "G")
+            indexG = c;
+        if (std::string(exr_header.channels[c].name) == "B")
+            indexB = c;
+        if (std::string(exr_header.channels[c].name) == "A")
+            indexA = c;
+    }
+    std::vector<size_t> channelPermutation;
+    channelPermutation.reserve(nc);
+    if (indexR >= 0)
+        channelPermutation.push_back(indexR);
+    if (indexG >= 0)
+        channelPermutation.push_back(indexG);
+    if (indexB >= 0)
+        channelPermutation.push_back(indexB);
+    if (indexA >= 0)
+        channelPermutation.push_back(indexA);
+    for (int c = 0; c < int(nc); c++) {
+        if (c != indexR && c != indexG && c != indexB && c != indexA)
+            channelPermutation.push_back(c);
+    }
+    return channelPermutation;
+}
+
+static std::string exrInterpretation(const char* name)
+{
+    std::string interpretation = name;
+    if (interpretation == "R")
+        interpretation = "RED";
+    else if (interpretation == "G")
+        interpretation = "GREEN";
+    else if (interpretation == "B")
+        interpretation = "BLUE";
+    else if (interpretation == "A")
+        interpretation = "ALPHA";
+    else if (interpretation == "Y")
+        interpretation = "XYZ/Y";
+    else if (interpretation == "Z")
+        interpretation = "DEPTH";
+    return interpretation;
+}
+
 ArrayContainer FormatImportExportTinyEXR::readArray(Error* error, int arrayIndex)
 {
     if (arrayIndex > 0) {
@@ -160,52 +212,11 @@ ArrayContainer FormatImportExportTinyEXR::readArray(Error* error, int arrayIndex
     size_t h = exr_image.height;
     size_t nc = exr_image.num_channels;
 
-    /* Try to find the typical color channels and put them into the right position */
-    int indexR = -1;
-    int indexG = -1;
-    int indexB = -1;
-    int indexA = -1;
-    for (size_t c = 0; c < nc; c++) {
-        if (std::string(exr_header.channels[c].name) == "R")
-            indexR = c;
-        if (std::string(exr_header.channels[c].name) == "G")
-            indexG = c;
-        if (std::string(exr_header.channels[c].name) == "B")
-            indexB = c;
-        if (std::string(exr_header.channels[c].name) == "A")
-            indexA = c;
-    }
-    std::vector<size_t> channelPermutation;
-    channelPermutation.reserve(nc);
-    if (indexR >= 0)
-        channelPermutation.push_back(indexR);
-    if (indexG >= 0)
-        channelPermutation.push_back(indexG);
-    if (indexB >= 0)
-        channelPermutation.push_back(indexB);
-    if (indexA >= 0)
-        channelPermutation.push_back(indexA);
-    for (int c = 0; c < int(nc); c++) {
-        if (c != indexR && c != indexG && c != indexB && c != indexA)
-            channelPermutation.push_back(c);
-    }
+    std::vector<size_t> channelPermutation = exrChannelPermutation(exr_header, nc);
 
     TGD::Array<float> r({ w, h }, nc);
     for (size_t c = 0; c < nc; c++) {
-        std::string interpretation = exr_header.channels[channelPermutation[c]].name;
-        if (interpretation == "R")
-            interpretation = "RED";
-        else if (interpretation == "G")
-            interpretation = "GREEN";
-        else if (interpretation == "B")
-            interpretation = "BLUE";
-        else if (interpretation == "A")
-            interpretation = "ALPHA";
-        else if (interpretation == "Y")
-            interpretation = "XYZ/Y";
-        else if (interpretation == "Z")
-            interpretation = "DEPTH";
-        r.componentTagList(c).set("INTERPRETATION", interpretation);
+        r.componentTagList(c).set("INTERPRETATION", exrInterpretation(exr_header.channels[channelPermutation[c]].name));
     }
     for (size_t y = 0; y < h; y++) {
         for (size_t x = 0; x < w; x++) {
@@ -223,6 +234,65 @@ ArrayContainer FormatImportExportTinyEXR::readArray(Error* error, int arrayIndex
     return r;
 }
 
+ArrayDescription FormatImportExportTinyEXR::readDescription(Error* error, int arrayIndex)
+{
+    if (arrayIndex > 0) {
+        *error = ErrorSeekingNotSupported;
+        return ArrayDescription();
+    }
+    if (_arrayWasReadOrWritten) {
+        *error = ErrorInvalidData;
+        return ArrayDescription();
+    }
+    _arrayWasReadOrWritten = true;
+
+    EXRVersion exr_version;
+    int ret = ParseEXRVersionFromFile(&exr_version, _fileName.c_str());
+    if (ret != 0) {
+        *error = ErrorInvalidData;
+        return ArrayDescription();
+    }
+    if (exr_version.multipart) {
+        *error = ErrorFeaturesUnsupported;
+        return ArrayDescription();
+    }
+
+    EXRHeader exr_header;
+    InitEXRHeader(&exr_header);
+    const char* err = nullptr;
+    ret = ParseEXRHeaderFromFile(&exr_header, &exr_version, _fileName.c_str(), &err);
+    if (ret != 0) {
+        *error = ErrorInvalidData;
+        FreeEXRErrorMessage(err);
+        return ArrayDescription();
+    }
+    for (int i = 0; i < exr_header.num_channels; i++) {
+        if (exr_header.pixel_types[i] == TINYEXR_PIXELTYPE_UINT) {
+            *error = ErrorFeaturesUnsupported;
+            FreeEXRHeader(&exr_header);
+            return ArrayDescription();
+        }
+    }
+    long long w = static_cast<long long>(exr_header.data_window.max_x) - exr_header.data_window.min_x + 1;
+    long long h = static_cast<long long>(exr_header.data_window.max_y) - exr_header.data_window.min_y + 1;
+    if (w < 0 || h < 0 || exr_header.num_channels < 0) {
+        *error = ErrorInvalidData;
+        FreeEXRHeader(&exr_header);
+        return ArrayDescription();
+    }
+
+    size_t nc = exr_header.num_channels;
+    std::vector<size_t> channelPermutation = exrChannelPermutation(exr_header, nc);
+    ArrayDescription r({ size_t(w), size_t(h) }, nc, float32);
+    for (size_t c = 0; c < nc; c++) {
+        r.componentTagList(c).set("INTERPRETATION", exrInterpretation(exr_header.channels[channelPermutation[c]].name));
+    }
+
+    FreeEXRHeader(&exr_header);
+
+    return r;
+}
+
 bool FormatImportExportTinyEXR::hasMore()
 {
     return !_arrayWasReadOrWritten;
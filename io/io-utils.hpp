@@ -26,6 +26,10 @@
 #define TGD_IO_UTILS_HPP
 
 #include <cstdint>
+#include <cstdio>
+
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "array.hpp"
 
@@ -39,10 +43,92 @@ inline std::string getExtension(const std::string& fileName)
         extension = fileName.substr(lastDot + 1);
         for (size_t i = 0; i < extension.size(); i++)
             extension[i] = std::tolower(extension[i]);
+        // keep the inner extension of compressed files, e.g. nii.gz
+        size_t innerDot = (lastDot > 0 ? fileName.find_last_of("./", lastDot - 1) : std::string::npos);
+        if (extension == "gz" && innerDot != std::string::npos && fileName[innerDot] == '.')
+            extension = getExtension(fileName.substr(0, lastDot)) + ".gz";
     }
     return extension;
 }
 
+/* Skip the given number of bytes in a file. This seeks when possible and
+ * reads otherwise (e.g. for pipes). Returns false if the file ends early. */
+inline bool skipBytes(FILE* f, uint64_t n)
+{
+    off_t pos = ftello(f);
+    struct stat statbuf;
+    if (pos >= 0 && fstat(fileno(f), &statbuf) == 0 && (statbuf.st_mode & S_IFMT) == S_IFREG) {
+        if (pos > statbuf.st_size || uint64_t(statbuf.st_size - pos) < n)
+            return false;
+        return (fseeko(f, n, SEEK_CUR) == 0);
+    }
+    char buf[4096];
+    while (n > 0) {
+        size_t k = (n < sizeof(buf) ? n : sizeof(buf));
+        if (std::fread(buf, 1, k, f) != k)
+            return false;
+        n -= k;
+    }
+    return true;
+}
+
+/* Palettes of indexed images are stored in the PALETTE tag of the index
+ * component, as a space-separated list of entries which are each given as
+ * R,G,B or R,G,B,A (8 bit per channel, all entries of the same kind). */
+
+inline std::string paletteToString(const std::vector<uint8_t>& palette, size_t channels)
+{
+    std::string s;
+    for (size_t i = 0; i < palette.size() / channels; i++) {
+        if (i > 0)
+            s += ' ';
+        for (size_t c = 0; c < channels; c++) {
+            if (c > 0)
+                s += ',';
+            s += std::to_string(palette[i * channels + c]);
+        }
+    }
+    return s;
+}
+
+inline bool paletteFromString(const std::string& s, std::vector<uint8_t>& palette, size_t* channels)
+{
+    palette.clear();
+    *channels = 0;
+    size_t entryChannels = 0;
+    unsigned int value = 0;
+    bool haveDigit = false;
+    for (size_t i = 0; i <= s.length(); i++) {
+        char c = (i < s.length() ? s[i] : ' ');
+        if (c >= '0' && c <= '9') {
+            value = value * 10 + (c - '0');
+            if (value > 255)
+                return false;
+            haveDigit = true;
+        } else if (c == ',' || c == ' ') {
+            if (!haveDigit) {
+                if (c == ' ' && entryChannels == 0)
+                    continue;
+                return false;
+            }
+            palette.push_back(value);
+            entryChannels++;
+            value = 0;
+            haveDigit = false;
+            if (c == ' ') {
+                if (*channels == 0)
+                    *channels = entryChannels;
+                if ((entryChannels != 3 && entryChannels != 4) || entryChannels != *channels)
+                    return false;
+                entryChannels = 0;
+            }
+        } else {
+            return false;
+        }
+    }
+    return (palette.size() > 0 && palette.size() / *channels <= 256);
+}
+
 inline void swapEndianness(ArrayContainer& array)
 {
     size_t n = array.elementCount() * array.componentCount();
@@ -80,6 +166,58 @@ inline void swapEndianness(ArrayContainer& array)
     }
 }
 
+inline bool hostIsLittleEndian()
+{
+    uint16_t x = 1;
+    return *reinterpret_cast<unsigned char*>(&x) == 1;
+}
+
+/* Type descriptions of NumPy and Zarr such as '<f4' or '|u1'. The byte order
+ * is compared to the one of the host; bool is read as uint8. */
+inline bool typeFromNumpyDescr(const std::string& descr, Type* type, bool* needsEndianFix)
+{
+    if (descr.length() < 3)
+        return false;
+    char order = descr[0];
+    char kind = descr[1];
+    std::string size = descr.substr(2);
+    if ((kind == 'b' || kind == 'u') && size == "1")
+        *type = uint8;
+    else if (kind == 'i' && size == "1")
+        *type = int8;
+    else if (kind == 'i' && size == "2")
+        *type = int16;
+    else if (kind == 'u' && size == "2")
+        *type = uint16;
+    else if (kind == 'i' && size == "4")
+        *type = int32;
+    else if (kind == 'u' && size == "4")
+        *type = uint32;
+    else if (kind == 'i' && size == "8")
+        *type = int64;
+    else if (kind == 'u' && size == "8")
+        *type = uint64;
+    else if (kind == 'f' && size == "4")
+        *type = float32;
+    else if (kind == 'f' && size == "8")
+        *type = float64;
+    else
+        return false;
+    if (order == '<' || order == '>')
+        *needsEndianFix = (typeSize(*type) > 1 && (order == '<') != hostIsLittleEndian());
+    else if (order == '|' || order == '=')
+        *needsEndianFix = false;
+    else
+        return false;
+    return true;
+}
+
+inline std::string numpyDescrFromType(Type type)
+{
+    static const char* descrs[] = { "i1", "u1", "i2", "u2", "i4", "u4", "i8", "u8", "f4", "f8" };
+    return (typeSize(type) == 1 ? '|' : hostIsLittleEndian() ? '<' : '>') + std::string(descrs[type]);
+}
+
 inline ArrayContainer transpose(const ArrayContainer& a)
 {
     std::vector<size_t> vi = a.dimensions();
@@ -134,6 +272,22 @@ inline ArrayContainer reorderMatlabInputData(const std::vector<size_t>& dims, Ty
     return r;
 }
 
+inline ArrayDescription reorderMatlabInputDescription(const std::vector<size_t>& dims, Type t)
+{
+    // same heuristic as reorderMatlabInputData(), but without touching any data
+    std::vector<size_t> rDims;
+    size_t components = 1;
+    if (dims.size() > 2 && dims[dims.size() - 1] <= 4) {
+        rDims.resize(dims.size() - 1);
+        for (size_t i = 0; i < rDims.size(); i++)
+            rDims[i] = dims[dims.size() - 2 - i];
+        components = dims[dims.size() - 1];
+    } else {
+        rDims.assign(dims.rbegin(), dims.rend());
+    }
+    return ArrayDescription(rDims, components, t);
+}
+
 inline ArrayContainer reorderMatlabOutputData(const ArrayContainer& array)
 {
     std::vector<size_t> dataDims(array.dimensionCount() + 1);
@@ -222,6 +376,21 @@ inline ArrayContainer createTransposedContainer(const ArrayContainer& array)
     return r;
 }
 
+/* The description of an image after fixImageOrientation() was applied to it */
+inline ArrayDescription orientedImageDescription(const ArrayDescription& desc, ImageOriginLocation originLocation)
+{
+    assert(desc.dimensionCount() == 2);
+    if (originLocation < OriginLeftTop)
+        return desc;
+    ArrayDescription r({ desc.dimension(1), desc.dimension(0) }, desc.componentCount(), desc.componentType());
+    r.globalTagList() = desc.globalTagList();
+    r.dimensionTagList(0) = desc.dimensionTagList(1);
+    r.dimensionTagList(1) = desc.dimensionTagList(0);
+    for (size_t i = 0; i < r.componentCount(); i++)
+        r.componentTagList(i) = desc.componentTagList(i);
+    return r;
+}
+
 inline void fixImageOrientation(ArrayContainer& array, ImageOriginLocation originLocation)
 {
     assert(array.dimensionCount() == 2);
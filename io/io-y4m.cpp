@@ -0,0 +1,532 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <numeric>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "io-y4m.hpp"
+#include "io-utils.hpp"
+
+
+namespace TGD {
+
+FormatImportExportY4M::FormatImportExportY4M() :
+    _f(nullptr),
+    _info({ 0, 0, 0, 0, false, 0 }),
+    _dataOffset(-1),
+    _frameStride(0),
+    _arrayCount(-2),
+    _headerWritten(false)
+{
+}
+
+FormatImportExportY4M::~FormatImportExportY4M()
+{
+    close();
+}
+
+static size_t chromaWidth(const FormatImportExportY4M::Info& info)
+{
+    return info.chroma == 420 ? (info.width + 1) / 2 : info.chroma == 444 ? info.width : 0;
+}
+
+static size_t chromaHeight(const FormatImportExportY4M::Info& info)
+{
+    return info.chroma == 420 ? (info.height + 1) / 2 : info.chroma == 444 ? info.height : 0;
+}
+
+static void computeFrameSize(FormatImportExportY4M::Info& info)
+{
+    size_t bytes = (info.bits > 8 ? 2 : 1);
+    info.frameSize = (info.width * info.height + 2 * chromaWidth(info) * chromaHeight(info)) * bytes;
+}
+
+/* Read a line of at most maxLength characters without the newline. */
+static Error readLine(FILE* f, std::string& line, size_t maxLength)
+{
+    line.clear();
+    for (;;) {
+        int c = getc(f);
+        if (c == EOF)
+            return std::ferror(f) ? ErrorSysErrno : ErrorInvalidData;
+        if (c == '\n')
+            return ErrorNone;
+        if (line.length() == maxLength)
+            return ErrorInvalidData;
+        line.push_back(c);
+    }
+}
+
+static bool parseColorspace(const std::string& c, FormatImportExportY4M::Info& info)
+{
+    std::string variant;
+    if (c.compare(0, 4, "mono") == 0) {
+        info.chroma = 0;
+        variant = c.substr(4);
+        info.bits = (variant.empty() ? 8 : std::atoi(variant.c_str()));
+    } else if (c.compare(0, 3, "420") == 0 || c.compare(0, 3, "444") == 0) {
+        info.chroma = std::atoi(c.substr(0, 3).c_str());
+        variant = c.substr(3);
+        if (variant.empty() || variant == "jpeg" || variant == "paldv" || variant == "mpeg2")
+            info.bits = 8;
+        else if (variant[0] == 'p')
+            info.bits = std::atoi(variant.c_str() + 1);
+        else
+            return false;
+    } else {
+        return false;
+    }
+    return info.bits >= 8 && info.bits <= 16;
+}
+
+Error FormatImportExportY4M::openForReading(const std::string& fileName, const TagList&)
+{
+    if (fileName == "-")
+        _f = stdin;
+    else
+        _f = fopen(fileName.c_str(), "rb");
+    if (!_f)
+        return ErrorSysErrno;
+
+    std::string header;
+    Error e = readLine(_f, header, 4096);
+    if (e != ErrorNone)
+        return e;
+    if (header.compare(0, 10, "YUV4MPEG2 ") != 0)
+        return ErrorInvalidData;
+    _info.width = 0;
+    _info.height = 0;
+    _info.chroma = 420;
+    _info.bits = 8;
+    _info.fullRange = false;
+    size_t pos = 10;
+    while (pos < header.length()) {
+        size_t end = header.find(' ', pos);
+        if (end == std::string::npos)
+            end = header.length();
+        std::string token = header.substr(pos, end - pos);
+        if (token.length() > 1 && token[0] == 'W') {
+            _info.width = std::strtoull(token.c_str() + 1, nullptr, 10);
+        } else if (token.length() > 1 && token[0] == 'H') {
+            _info.height = std::strtoull(token.c_str() + 1, nullptr, 10);
+        } else if (token.length() > 1 && token[0] == 'C') {
+            if (!parseColorspace(token.substr(1), _info))
+                return ErrorFeaturesUnsupported;
+        } else if (token == "XCOLORRANGE=FULL") {
+            _info.fullRange = true;
+        }
+        pos = end + 1;
+    }
+    if (_info.width == 0 || _info.height == 0)
+        return ErrorInvalidData;
+    computeFrameSize(_info);
+
+    struct stat statbuf;
+    if (fstat(fileno(_f), &statbuf) == 0 && (statbuf.st_mode & S_IFMT) == S_IFREG)
+        _dataOffset = ftello(_f);
+    return ErrorNone;
+}
+
+Error FormatImportExportY4M::openForWriting(const std::string& fileName, bool append, const TagList& hints)
+{
+    // We would have to match the existing stream header
+    if (append)
+        return ErrorAppendingNotSupported;
+    if (fileName == "-")
+        _f = stdout;
+    else
+        _f = fopen(fileName.c_str(), "wb");
+    _hints = hints;
+    return _f ? ErrorNone : ErrorSysErrno;
+}
+
+void FormatImportExportY4M::close()
+{
+    if (_f) {
+        if (_f != stdin && _f != stdout) {
+            fclose(_f);
+        }
+        _f = nullptr;
+    }
+    _buffer.clear();
+    _dataOffset = -1;
+    _frameStride = 0;
+    _arrayCount = -2;
+    _arrayOffsets.clear();
+    _headerWritten = false;
+}
+
+Error FormatImportExportY4M::readFrameHeader()
+{
+    // Frame parameters are rarely used and can be ignored
+    std::string line;
+    Error e = readLine(_f, line, 4096);
+    if (e != ErrorNone)
+        return e;
+    if (line.compare(0, 5, "FRAME") != 0 || (line.length() > 5 && line[5] != ' '))
+        return ErrorInvalidData;
+    return ErrorNone;
+}
+
+ArrayDescription FormatImportExportY4M::description() const
+{
+    ArrayDescription r({ _info.width, _info.height }, _info.chroma == 0 ? 1 : 3, _info.bits > 8 ? uint16 : uint8);
+    if (_info.chroma == 0) {
+        r.componentTagList(0).set("INTERPRETATION", "SRGB/GRAY");
+    } else {
+        r.componentTagList(0).set("INTERPRETATION", "SRGB/R");
+        r.componentTagList(1).set("INTERPRETATION", "SRGB/G");
+        r.componentTagList(2).set("INTERPRETATION", "SRGB/B");
+    }
+    return r;
+}
+
+int FormatImportExportY4M::arrayCount()
+{
+    if (_arrayCount >= -1)
+        return _arrayCount;
+    _arrayCount = -1;
+    off_t curPos = ftello(_f);
+    if (_dataOffset < 0 || curPos < 0)
+        return _arrayCount;
+    struct stat statbuf;
+    if (fstat(fileno(_f), &statbuf) != 0)
+        return _arrayCount;
+
+    // Frames usually all have the same size, which we get from the first one.
+    // Then the number of frames follows from the file size.
+    char marker[5];
+    if (fseeko(_f, _dataOffset, SEEK_SET) == 0 && readFrameHeader() == ErrorNone) {
+        _frameStride = ftello(_f) - _dataOffset + _info.frameSize;
+        off_t n = (statbuf.st_size - _dataOffset) / _frameStride;
+        if ((statbuf.st_size - _dataOffset) % _frameStride == 0
+                && fseeko(_f, _dataOffset + (n - 1) * _frameStride, SEEK_SET) == 0
+                && std::fread(marker, 5, 1, _f) == 1 && std::memcmp(marker, "FRAME", 5) == 0
+                && n <= std::numeric_limits<int>::max()) {
+            _arrayCount = n;
+        }
+    }
+    if (_arrayCount < 0) {
+        // Otherwise, find all frames
+        _frameStride = 0;
+        if (fseeko(_f, _dataOffset, SEEK_SET) == 0) {
+            while (hasMore()) {
+                off_t offset = ftello(_f);
+                if (offset < 0 || readFrameHeader() != ErrorNone || !skipBytes(_f, _info.frameSize)
+                        || _arrayOffsets.size() == size_t(std::numeric_limits<int>::max())) {
+                    _arrayOffsets.clear();
+                    break;
+                }
+                _arrayOffsets.push_back(offset);
+            }
+            if (!hasMore())
+                _arrayCount = _arrayOffsets.size();
+        }
+    }
+    if (fseeko(_f, curPos, SEEK_SET) != 0)
+        _arrayCount = -1;
+    return _arrayCount;
+}
+
+Error FormatImportExportY4M::seekToArray(int arrayIndex)
+{
+    if (arrayIndex >= 0) {
+        if (arrayCount() < 0)
+            return ErrorSeekingNotSupported;
+        if (arrayIndex >= arrayCount())
+            return ErrorInvalidData;
+        off_t offset = (_frameStride > 0 ? _dataOffset + arrayIndex * _frameStride : _arrayOffsets[arrayIndex]);
+        if (fseeko(_f, offset, SEEK_SET) < 0)
+            return ErrorSysErrno;
+    }
+    return ErrorNone;
+}
+
+/* Conversion between Y'CbCr planes and RGB arrays, one row at a time. The
+ * loops work on plain float rows so that the compiler can vectorize them. */
+
+struct YCbCrRange {
+    float yOffset, yRange, cOffset, cRange, maxValue;
+
+    YCbCrRange(int bits, bool fullRange)
+    {
+        float s = std::ldexp(1.0f, bits - 8);
+        maxValue = std::ldexp(1.0f, bits) - 1.0f;
+        yOffset = (fullRange ? 0.0f : 16.0f * s);
+        yRange = (fullRange ? maxValue : 219.0f * s);
+        cOffset = 128.0f * s;
+        cRange = (fullRange ? maxValue : 224.0f * s);
+    }
+};
+
+static void loadPlaneRow(const unsigned char* src, size_t n, int bits, float offset, float range, float* dst)
+{
+    const float scale = 1.0f / range;
+    if (bits == 8) {
+        for (size_t i = 0; i < n; i++)
+            dst[i] = (src[i] - offset) * scale;
+    } else {
+        for (size_t i = 0; i < n; i++)
+            dst[i] = ((src[2 * i] | (src[2 * i + 1] << 8)) - offset) * scale;
+    }
+}
+
+static void storePlaneRow(const float* src, size_t n, int bits, float offset, float range, float maxValue,
+        unsigned char* dst)
+{
+    if (bits == 8) {
+        for (size_t i = 0; i < n; i++)
+            dst[i] = std::min(std::max(src[i] * range + offset, 0.0f), maxValue) + 0.5f;
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            unsigned int v = std::min(std::max(src[i] * range + offset, 0.0f), maxValue) + 0.5f;
+            dst[2 * i] = v & 0xff;
+            dst[2 * i + 1] = v >> 8;
+        }
+    }
+}
+
+template<typename T> static void yCbCrToRgb(const FormatImportExportY4M::Info& info,
+        const unsigned char* frame, ArrayContainer& array)
+{
+    const size_t w = info.width, h = info.height;
+    const size_t cw = chromaWidth(info), ch = chromaHeight(info);
+    const size_t bytes = (info.bits > 8 ? 2 : 1);
+    const YCbCrRange range(info.bits, info.fullRange);
+    const float m = std::numeric_limits<T>::max();
+    const unsigned char* yPlane = frame;
+    const unsigned char* uPlane = yPlane + w * h * bytes;
+    const unsigned char* vPlane = uPlane + cw * ch * bytes;
+    std::vector<float> yRow(w), uRow(w), vRow(w), cRow(cw);
+    for (size_t y = 0; y < h; y++) {
+        T* dst = static_cast<T*>(array.data()) + (h - 1 - y) * w * array.componentCount();
+        loadPlaneRow(yPlane + y * w * bytes, w, info.bits, range.yOffset, range.yRange, yRow.data());
+        if (info.chroma == 0) {
+            for (size_t x = 0; x < w; x++)
+                dst[x] = std::min(std::max(yRow[x] * m, 0.0f), m) + 0.5f;
+            continue;
+        }
+        size_t cy = (info.chroma == 420 ? y / 2 : y);
+        if (info.chroma == 420) {
+            loadPlaneRow(uPlane + cy * cw * bytes, cw, info.bits, range.cOffset, range.cRange, cRow.data());
+            for (size_t x = 0; x < w; x++)
+                uRow[x] = cRow[x / 2];
+            loadPlaneRow(vPlane + cy * cw * bytes, cw, info.bits, range.cOffset, range.cRange, cRow.data());
+            for (size_t x = 0; x < w; x++)
+                vRow[x] = cRow[x / 2];
+        } else {
+            loadPlaneRow(uPlane + cy * cw * bytes, cw, info.bits, range.cOffset, range.cRange, uRow.data());
+            loadPlaneRow(vPlane + cy * cw * bytes, cw, info.bits, range.cOffset, range.cRange, vRow.data());
+        }
+        for (size_t x = 0; x < w; x++) {
+            float yv = yRow[x] * m, u = uRow[x] * m, v = vRow[x] * m;
+            float r = yv + 1.402f * v;
+            float g = yv - 0.344136f * u - 0.714136f * v;
+            float b = yv + 1.772f * u;
+            dst[3 * x + 0] = std::min(std::max(r, 0.0f), m) + 0.5f;
+            dst[3 * x + 1] = std::min(std::max(g, 0.0f), m) + 0.5f;
+            dst[3 * x + 2] = std::min(std::max(b, 0.0f), m) + 0.5f;
+        }
+    }
+}
+
+template<typename T> static void rgbToYCbCr(const FormatImportExportY4M::Info& info,
+        const ArrayContainer& array, unsigned char* frame)
+{
+    const size_t w = info.width, h = info.height;
+    const size_t cw = chromaWidth(info), ch = chromaHeight(info);
+    const size_t bytes = (info.bits > 8 ? 2 : 1);
+    const YCbCrRange range(info.bits, info.fullRange);
+    const float scale = 1.0f / std::numeric_limits<T>::max();
+    unsigned char* yPlane = frame;
+    unsigned char* uPlane = yPlane + w * h * bytes;
+    unsigned char* vPlane = uPlane + cw * ch * bytes;
+    std::vector<float> yRow(w), uRow(w), vRow(w), uSum(cw), vSum(cw);
+    for (size_t y = 0; y < h; y++) {
+        const T* src = static_cast<const T*>(array.data()) + (h - 1 - y) * w * array.componentCount();
+        if (info.chroma == 0) {
+            for (size_t x = 0; x < w; x++)
+                yRow[x] = src[x] * scale;
+        } else {
+            for (size_t x = 0; x < w; x++) {
+                float r = src[3 * x + 0] * scale;
+                float g = src[3 * x + 1] * scale;
+                float b = src[3 * x + 2] * scale;
+                float yv = 0.299f * r + 0.587f * g + 0.114f * b;
+                yRow[x] = yv;
+                uRow[x] = (b - yv) * (1.0f / 1.772f);
+                vRow[x] = (r - yv) * (1.0f / 1.402f);
+            }
+        }
+        storePlaneRow(yRow.data(), w, info.bits, range.yOffset, range.yRange, range.maxValue,
+                yPlane + y * w * bytes);
+        if (info.chroma == 444) {
+            storePlaneRow(uRow.data(), w, info.bits, range.cOffset, range.cRange, range.maxValue,
+                    uPlane + y * w * bytes);
+            storePlaneRow(vRow.data(), w, info.bits, range.cOffset, range.cRange, range.maxValue,
+                    vPlane + y * w * bytes);
+        } else if (info.chroma == 420) {
+            // average 2x2 blocks (or what is left of them at the borders)
+            if (y % 2 == 0) {
+                std::fill(uSum.begin(), uSum.end(), 0.0f);
+                std::fill(vSum.begin(), vSum.end(), 0.0f);
+            }
+            for (size_t x = 0; x < w; x++) {
+                uSum[x / 2] += uRow[x];
+                vSum[x / 2] += vRow[x];
+            }
+            if (y % 2 == 1 || y == h - 1) {
+                float rows = (y % 2 == 1 ? 2.0f : 1.0f);
+                for (size_t x = 0; x < cw; x++) {
+                    float n = rows * (2 * x + 1 < w ? 2.0f : 1.0f);
+                    uSum[x] /= n;
+                    vSum[x] /= n;
+                }
+                storePlaneRow(uSum.data(), cw, info.bits, range.cOffset, range.cRange, range.maxValue,
+                        uPlane + y / 2 * cw * bytes);
+                storePlaneRow(vSum.data(), cw, info.bits, range.cOffset, range.cRange, range.maxValue,
+                        vPlane + y / 2 * cw * bytes);
+            }
+        }
+    }
+}
+
+ArrayContainer FormatImportExportY4M::readArray(Error* error, int arrayIndex)
+{
+    Error e = seekToArray(arrayIndex);
+    if (e == ErrorNone)
+        e = readFrameHeader();
+    if (e == ErrorNone) {
+        _buffer.resize(_info.frameSize);
+        if (std::fread(_buffer.data(), _info.frameSize, 1, _f) != 1)
+            e = std::ferror(_f) ? ErrorSysErrno : ErrorInvalidData;
+    }
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayContainer();
+    }
+    ArrayContainer r(description());
+    if (r.componentType() == uint8)
+        yCbCrToRgb<uint8_t>(_info, _buffer.data(), r);
+    else
+        yCbCrToRgb<uint16_t>(_info, _buffer.data(), r);
+    return r;
+}
+
+ArrayDescription FormatImportExportY4M::readDescription(Error* error, int arrayIndex)
+{
+    Error e = seekToArray(arrayIndex);
+    if (e == ErrorNone)
+        e = readFrameHeader();
+    if (e == ErrorNone && !skipBytes(_f, _info.frameSize))
+        e = std::ferror(_f) ? ErrorSysErrno : ErrorInvalidData;
+    if (e != ErrorNone) {
+        *error = e;
+        return ArrayDescription();
+    }
+    return description();
+}
+
+bool FormatImportExportY4M::hasMore()
+{
+    int c = fgetc(_f);
+    if (c == EOF) {
+        return false;
+    } else {
+        ungetc(c, _f);
+        return true;
+    }
+}
+
+/* Convert a frame rate given as 25, 29.97 or 30000:1001 to N:D */
+static std::string frameRate(const std::string& fps)
+{
+    if (fps.find(':') != std::string::npos)
+        return fps;
+    unsigned long long num = std::llround(std::atof(fps.c_str()) * 1000.0);
+    unsigned long long den = 1000;
+    if (num == 0)
+        return "25:1";
+    unsigned long long d = std::gcd(num, den);
+    return std::to_string(num / d) + ':' + std::to_string(den / d);
+}
+
+Error FormatImportExportY4M::writeArray(const ArrayContainer& array)
+{
+    if (array.dimensionCount() != 2
+            || (array.componentCount() != 1 && array.componentCount() != 3)
+            || (array.componentType() != uint8 && array.componentType() != uint16)) {
+        return ErrorFeaturesUnsupported;
+    }
+    if (!_headerWritten) {
+        _info.width = array.dimension(0);
+        _info.height = array.dimension(1);
+        _info.chroma = (array.componentCount() == 1 ? 0 : _hints.value("CHROMA", 420));
+        _info.bits = (array.componentType() == uint8 ? 8 : 16);
+        _info.fullRange = (_hints.value("RANGE", "LIMITED") == "FULL");
+        if (_info.chroma != 0 && _info.chroma != 420 && _info.chroma != 444)
+            return ErrorInvalidData;
+        computeFrameSize(_info);
+        std::string colorspace = (_info.chroma == 0 ? "mono" : _info.chroma == 420 ? "420" : "444");
+        if (_info.bits > 8)
+            colorspace += (_info.chroma == 0 ? "16" : "p16");
+        else if (_info.chroma == 420)
+            colorspace += "jpeg";
+        std::string header = std::string("YUV4MPEG2 W") + std::to_string(_info.width)
+            + " H" + std::to_string(_info.height)
+            + " F" + frameRate(_hints.value("FPS", "25"))
+            + " Ip A1:1 C" + colorspace
+            + " XCOLORRANGE=" + (_info.fullRange ? "FULL" : "LIMITED") + "\n";
+        if (std::fwrite(header.data(), header.size(), 1, _f) != 1)
+            return ErrorSysErrno;
+        _headerWritten = true;
+    } else if (array.dimension(0) != _info.width || array.dimension(1) != _info.height
+            || array.componentCount() != (_info.chroma == 0 ? 1 : 3)
+            || array.componentType() != (_info.bits > 8 ? uint16 : uint8)) {
+        return ErrorFeaturesUnsupported;
+    }
+
+    // The frame header and the planes in one write
+    static const char frameHeader[] = "FRAME\n";
+    const size_t frameHeaderSize = sizeof(frameHeader) - 1;
+    _buffer.resize(frameHeaderSize + _info.frameSize);
+    std::memcpy(_buffer.data(), frameHeader, frameHeaderSize);
+    if (array.componentType() == uint8)
+        rgbToYCbCr<uint8_t>(_info, array, _buffer.data() + frameHeaderSize);
+    else
+        rgbToYCbCr<uint16_t>(_info, array, _buffer.data() + frameHeaderSize);
+    if (std::fwrite(_buffer.data(), _buffer.size(), 1, _f) != 1 || std::fflush(_f) != 0)
+        return ErrorSysErrno;
+    return ErrorNone;
+}
+
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TGD_IO_Y4M_HPP
+#define TGD_IO_Y4M_HPP
+
+/*
+ * YUV4MPEG2 (.y4m) uncompressed video streams, e.g. for piping frames to
+ * and from ffmpeg and video encoders.
+ *
+ * Supported are 4:2:0 and 4:4:4 with 8 to 16 bits per sample, and gray (mono).
+ * Frames are converted between Y'CbCr (BT.601) and RGB arrays of type uint8
+ * (8 bit samples) or uint16 (more than 8 bit samples, scaled to the full
+ * range). The XCOLORRANGE parameter selects full or limited (default) range.
+ *
+ * Output tags: FPS (frame rate, e.g. 25 or 30000:1001; default 25),
+ * CHROMA (420 or 444; default 420), RANGE (FULL or LIMITED; default LIMITED).
+ * All arrays written to a stream must have the same size and type.
+ */
+
+#include <cstdio>
+#include <vector>
+
+#include "io.hpp"
+
+namespace TGD {
+
+class FormatImportExportY4M : public FormatImportExport {
+public:
+    struct Info {
+        size_t width;
+        size_t height;
+        int chroma;             // 420, 444, or 0 for mono
+        int bits;
+        bool fullRange;
+        size_t frameSize;       // size of the planes of one frame
+    };
+
+private:
+    FILE* _f;
+    TagList _hints;
+    Info _info;
+    std::vector<unsigned char> _buffer;
+    // for reading:
+    off_t _dataOffset;          // of the first frame; -1 if unknown
+    off_t _frameStride;         // size of a frame including its header; 0 if unknown
+    int _arrayCount;
+    std::vector<off_t> _arrayOffsets;
+    // for writing:
+    bool _headerWritten;
+
+    Error readFrameHeader();
+    Error seekToArray(int arrayIndex);
+    ArrayDescription description() const;
+
+public:
+    FormatImportExportY4M();
+    ~FormatImportExportY4M();
+
+    virtual Error openForReading(const std::string& fileName, const TagList& hints) override;
+    virtual Error openForWriting(const std::string& fileName, bool append, const TagList& hints) override;
+    virtual void close() override;
+
+    // for reading:
+    virtual int arrayCount() override;
+    virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+    virtual bool hasMore() override;
+    virtual ArrayDescription readDescription(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+
+    // for writing / appending:
+    virtual Error writeArray(const ArrayContainer& array) override;
+};
+
+}
+
+#endif
@@ -0,0 +1,871 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cmath>
+#include <limits>
+#include <set>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef TGD_WITH_ZLIB
+# include <zlib.h>
+#endif
+
+#include "io-zarr.hpp"
+#include "io-utils.hpp"
+
+
+namespace TGD {
+
+/* A minimal JSON reader, sufficient for Zarr metadata. Numbers are kept as
+ * text so that large integers are not rounded. */
+
+struct JsonValue {
+    enum Kind { Null, Bool, Number, String, Array, Object };
+    Kind kind = Null;
+    bool boolean = false;
+    std::string text;   // numbers and strings
+    std::vector<JsonValue> elements;
+    std::vector<std::pair<std::string, JsonValue>> members;
+
+    const JsonValue* member(const std::string& name) const
+    {
+        for (size_t i = 0; i < members.size(); i++)
+            if (members[i].first == name)
+                return &(members[i].second);
+        return nullptr;
+    }
+};
+
+static void skipJsonSpace(const std::string& s, size_t& pos)
+{
+    while (pos < s.length() && (s[pos] == ' ' || s[pos] == '\t' || s[pos] == '\n' || s[pos] == '\r'))
+        pos++;
+}
+
+static bool parseJsonString(const std::string& s, size_t& pos, std::string& str)
+{
+    if (pos >= s.length() || s[pos] != '"')
+        return false;
+    pos++;
+    str.clear();
+    while (pos < s.length() && s[pos] != '"') {
+        char c = s[pos++];
+        if (c == '\\') {
+            if (pos >= s.length())
+                return false;
+            c = s[pos++];
+            switch (c) {
+            case 'b': str += '\b'; break;
+            case 'f': str += '\f'; break;
+            case 'n': str += '\n'; break;
+            case 'r': str += '\r'; break;
+            case 't': str += '\t'; break;
+            case 'u':
+                {
+                    if (pos + 4 > s.length())
+                        return false;
+                    unsigned long u = std::strtoul(s.substr(pos, 4).c_str(), nullptr, 16);
+                    pos += 4;
+                    // UTF-8 encoding; surrogate pairs are not combined
+                    if (u < 0x80) {
+                        str += char(u);
+                    } else if (u < 0x800) {
+                        str += char(0xc0 | (u >> 6));
+                        str += char(0x80 | (u & 0x3f));
+                    } else {
+                        str += char(0xe0 | (u >> 12));
+                        str += char(0x80 | ((u >> 6) & 0x3f));
+                        str += char(0x80 | (u & 0x3f));
+                    }
+                }
+                break;
+            default: str += c; break;
+            }
+        } else {
+            str += c;
+        }
+    }
+    if (pos >= s.length())
+        return false;
+    pos++;
+    return true;
+}
+
+static bool parseJson(const std::string& s, size_t& pos, JsonValue& v, int depth = 0)
+{
+    skipJsonSpace(s, pos);
+    if (pos >= s.length() || depth > 64)
+        return false;
+    char c = s[pos];
+    if (c == '{') {
+        v.kind = JsonValue::Object;
+        pos++;
+        skipJsonSpace(s, pos);
+        if (pos < s.length() && s[pos] == '}') {
+            pos++;
+            return true;
+        }
+        for (;;) {
+            std::pair<std::string, JsonValue> member;
+            skipJsonSpace(s, pos);
+            if (!parseJsonString(s, pos, member.first))
+                return false;
+            skipJsonSpace(s, pos);
+            if (pos >= s.length() || s[pos] != ':')
+                return false;
+            pos++;
+            if (!parseJson(s, pos, member.second, depth + 1))
+                return false;
+            v.members.push_back(member);
+            skipJsonSpace(s, pos);
+            if (pos < s.length() && s[pos] == ',') {
+                pos++;
+            } else if (pos < s.length() && s[pos] == '}') {
+                pos++;
+                return true;
+            } else {
+                return false;
+            }
+        }
+    } else if (c == '[') {
+        v.kind = JsonValue::Array;
+        pos++;
+        skipJsonSpace(s, pos);
+        if (pos < s.length() && s[pos] == ']') {
+            pos++;
+            return true;
+        }
+        for (;;) {
+            v.elements.emplace_back();
+            if (!parseJson(s, pos, v.elements.back(), depth + 1))
+                return false;
+            skipJsonSpace(s, pos);
+            if (pos < s.length() && s[pos] == ',') {
+                pos++;
+            } else if (pos < s.length() && s[pos] == ']') {
+                pos++;
+                return true;
+            } else {
+                return false;
+            }
+        }
+    } else if (c == '"') {
+        v.kind = JsonValue::String;
+        return parseJsonString(s, pos, v.text);
+    } else if (s.compare(pos, 4, "null") == 0) {
+        v.kind = JsonValue::Null;
+        pos += 4;
+        return true;
+    } else if (s.compare(pos, 4, "true") == 0) {
+        v.kind = JsonValue::Bool;
+        v.boolean = true;
+        pos += 4;
+        return true;
+    } else if (s.compare(pos, 5, "false") == 0) {
+        v.kind = JsonValue::Bool;
+        v.boolean = false;
+        pos += 5;
+        return true;
+    } else {
+        // numbers, and the NaN/Infinity extensions that Python writes
+        size_t end = s.find_first_of(",]} \t\r\n", pos);
+        if (end == std::string::npos)
+            end = s.length();
+        v.kind = JsonValue::Number;
+        v.text = s.substr(pos, end - pos);
+        pos = end;
+        return !v.text.empty();
+    }
+}
+
+static bool readJsonFile(const std::string& fileName, JsonValue& v)
+{
+    FILE* f = fopen(fileName.c_str(), "rb");
+    if (!f)
+        return false;
+    std::string s;
+    char buf[4096];
+    size_t n;
+    while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0)
+        s.append(buf, n);
+    bool ok = !std::ferror(f);
+    fclose(f);
+    size_t pos = 0;
+    return ok && parseJson(s, pos, v);
+}
+
+static std::string jsonString(const std::string& s)
+{
+    std::string r = "\"";
+    for (size_t i = 0; i < s.length(); i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            r += '\\';
+            r += c;
+        } else if (c < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            r += buf;
+        } else {
+            r += c;
+        }
+    }
+    return r + '"';
+}
+
+/* Write a file atomically: other readers see either the old or the new file. */
+static Error writeFileAtomically(const std::string& fileName, const void* data, size_t size)
+{
+    std::string tmpName = fileName + ".XXXXXX";
+    int fd = mkstemp(&(tmpName[0]));
+    if (fd < 0)
+        return ErrorSysErrno;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    while (size > 0) {
+        ssize_t r = ::write(fd, p, size);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            int errnoBackup = errno;
+            ::close(fd);
+            unlink(tmpName.c_str());
+            errno = errnoBackup;
+            return ErrorSysErrno;
+        }
+        p += r;
+        size -= r;
+    }
+    // mkstemp creates files that only the owner can read
+    mode_t mask = umask(0);
+    umask(mask);
+    if (fchmod(fd, 0666 & ~mask) != 0 || ::close(fd) != 0 || rename(tmpName.c_str(), fileName.c_str()) != 0) {
+        int errnoBackup = errno;
+        unlink(tmpName.c_str());
+        errno = errnoBackup;
+        return ErrorSysErrno;
+    }
+    return ErrorNone;
+}
+
+/* Region of an array with its own data, in array coordinates */
+struct ZarrRegion {
+    std::vector<size_t> start;
+    std::vector<size_t> size;
+    unsigned char* data;
+};
+
+/* Copy the intersection of two regions from src to dst */
+static void copyIntersection(const ZarrRegion& src, const ZarrRegion& dst, size_t elementSize)
+{
+    size_t n = src.start.size();
+    std::vector<size_t> start(n), size(n);
+    for (size_t d = 0; d < n; d++) {
+        start[d] = std::max(src.start[d], dst.start[d]);
+        size_t end = std::min(src.start[d] + src.size[d], dst.start[d] + dst.size[d]);
+        if (end <= start[d])
+            return;
+        size[d] = end - start[d];
+    }
+    std::vector<size_t> index = start;
+    for (;;) {
+        size_t srcOffset = 0, dstOffset = 0;
+        for (size_t d = n; d-- > 0; ) {
+            srcOffset = srcOffset * src.size[d] + (index[d] - src.start[d]);
+            dstOffset = dstOffset * dst.size[d] + (index[d] - dst.start[d]);
+        }
+        std::memcpy(dst.data + dstOffset * elementSize, src.data + srcOffset * elementSize, size[0] * elementSize);
+        size_t d = 1;
+        while (d < n && index[d] == start[d] + size[d] - 1) {
+            index[d] = start[d];
+            d++;
+        }
+        if (d >= n)
+            break;
+        index[d]++;
+    }
+}
+
+FormatImportExportZarr::FormatImportExportZarr() :
+    _cOrder(true), _componentAxis(false), _swap(false), _separator('.'), _level(-1),
+    _exists(false), _done(false)
+{
+}
+
+FormatImportExportZarr::~FormatImportExportZarr()
+{
+    close();
+}
+
+Error FormatImportExportZarr::readMetadata()
+{
+    JsonValue zarray;
+    if (!readJsonFile(_dirName + "/.zarray", zarray))
+        return errno == ENOENT ? ErrorSysErrno : ErrorInvalidData;
+    const JsonValue* format = zarray.member("zarr_format");
+    const JsonValue* shape = zarray.member("shape");
+    const JsonValue* chunks = zarray.member("chunks");
+    const JsonValue* dtype = zarray.member("dtype");
+    const JsonValue* order = zarray.member("order");
+    const JsonValue* compressor = zarray.member("compressor");
+    const JsonValue* fillValue = zarray.member("fill_value");
+    const JsonValue* filters = zarray.member("filters");
+    const JsonValue* separator = zarray.member("dimension_separator");
+    if (!format || format->text != "2" || !shape || shape->kind != JsonValue::Array
+            || !chunks || chunks->kind != JsonValue::Array || chunks->elements.size() != shape->elements.size()
+            || !dtype || dtype->kind != JsonValue::String || !order || order->kind != JsonValue::String) {
+        return ErrorInvalidData;
+    }
+    if (filters && filters->kind != JsonValue::Null && !(filters->kind == JsonValue::Array && filters->elements.empty()))
+        return ErrorFeaturesUnsupported;
+    Type type;
+    if (!typeFromNumpyDescr(dtype->text, &type, &_swap))
+        return ErrorFeaturesUnsupported;
+    if (order->text != "C" && order->text != "F")
+        return ErrorInvalidData;
+    _cOrder = (order->text == "C");
+    _separator = (separator && separator->text == "/" ? '/' : '.');
+    _compressor.clear();
+    _level = -1;
+    if (compressor && compressor->kind == JsonValue::Object) {
+        const JsonValue* id = compressor->member("id");
+        if (!id || (id->text != "zlib" && id->text != "gzip"))
+            return ErrorFeaturesUnsupported;
+#ifndef TGD_WITH_ZLIB
+        return ErrorFeaturesUnsupported;
+#endif
+        _compressor = id->text;
+        const JsonValue* level = compressor->member("level");
+        if (level)
+            _level = std::atoi(level->text.c_str());
+    }
+
+    // Axes in TGD order, fastest varying first
+    std::vector<size_t> dimensions, chunkSize;
+    for (size_t i = 0; i < shape->elements.size(); i++) {
+        dimensions.push_back(std::strtoull(shape->elements[i].text.c_str(), nullptr, 10));
+        chunkSize.push_back(std::strtoull(chunks->elements[i].text.c_str(), nullptr, 10));
+    }
+    if (_cOrder) {
+        std::reverse(dimensions.begin(), dimensions.end());
+        std::reverse(chunkSize.begin(), chunkSize.end());
+    }
+    JsonValue zattrs;
+    bool haveAttributes = readJsonFile(_dirName + "/.zattrs", zattrs) && zattrs.kind == JsonValue::Object;
+    const JsonValue* tgdComponents = (haveAttributes ? zattrs.member("tgd_components") : nullptr);
+    _componentAxis = (dimensions.size() >= 2 && (tgdComponents || _hints.value("ZARR_COMPONENTS", 0) != 0));
+    size_t componentCount = 1;
+    if (_componentAxis) {
+        componentCount = dimensions[0];
+        if (chunkSize[0] != componentCount)
+            return ErrorFeaturesUnsupported;
+        dimensions.erase(dimensions.begin());
+        chunkSize.erase(chunkSize.begin());
+    }
+    if (dimensions.size() == 0) { // a scalar
+        dimensions.push_back(1);
+        chunkSize.push_back(1);
+    }
+    for (size_t d = 0; d < dimensions.size(); d++)
+        if (dimensions[d] == 0 || chunkSize[d] == 0)
+            return ErrorFeaturesUnsupported;
+    if (componentCount == 0)
+        return ErrorFeaturesUnsupported;
+    _desc = ArrayDescription(dimensions, componentCount, type);
+    _chunkSize = chunkSize;
+    if (haveAttributes) {
+        for (size_t i = 0; i < zattrs.members.size(); i++)
+            if (zattrs.members[i].second.kind == JsonValue::String)
+                _desc.globalTagList().set(zattrs.members[i].first, zattrs.members[i].second.text);
+    }
+
+    // The fill value of one element, in host byte order
+    _fillElement.assign(_desc.elementSize(), 0);
+    if (fillValue && fillValue->kind != JsonValue::Null) {
+        unsigned char component[8];
+        std::string t = (fillValue->kind == JsonValue::Bool ? (fillValue->boolean ? "1" : "0") : fillValue->text);
+        double dv = (t == "NaN" ? std::numeric_limits<double>::quiet_NaN()
+                : t == "Infinity" ? std::numeric_limits<double>::infinity()
+                : t == "-Infinity" ? -std::numeric_limits<double>::infinity()
+                : std::strtod(t.c_str(), nullptr));
+        long long iv = std::strtoll(t.c_str(), nullptr, 10);
+        unsigned long long uv = std::strtoull(t.c_str(), nullptr, 10);
+        switch (type) {
+        case int8:    { int8_t v = iv;    std::memcpy(component, &v, sizeof(v)); } break;
+        case uint8:   { uint8_t v = uv;   std::memcpy(component, &v, sizeof(v)); } break;
+        case int16:   { int16_t v = iv;   std::memcpy(component, &v, sizeof(v)); } break;
+        case uint16:  { uint16_t v = uv;  std::memcpy(component, &v, sizeof(v)); } break;
+        case int32:   { int32_t v = iv;   std::memcpy(component, &v, sizeof(v)); } break;
+        case uint32:  { uint32_t v = uv;  std::memcpy(component, &v, sizeof(v)); } break;
+        case int64:   { int64_t v = iv;   std::memcpy(component, &v, sizeof(v)); } break;
+        case uint64:  { uint64_t v = uv;  std::memcpy(component, &v, sizeof(v)); } break;
+        case float32: { float v = dv;     std::memcpy(component, &v, sizeof(v)); } break;
+        case float64: { double v = dv;    std::memcpy(component, &v, sizeof(v)); } break;
+        }
+        for (size_t c = 0; c < componentCount; c++)
+            std::memcpy(_fillElement.data() + c * _desc.componentSize(), component, _desc.componentSize());
+    }
+    _exists = true;
+    return ErrorNone;
+}
+
+Error FormatImportExportZarr::writeMetadata()
+{
+    if (mkdir(_dirName.c_str(), 0777) != 0 && errno != EEXIST)
+        return ErrorSysErrno;
+    std::vector<size_t> shape = _desc.dimensions();
+    std::vector<size_t> chunks = _chunkSize;
+    std::reverse(shape.begin(), shape.end());
+    std::reverse(chunks.begin(), chunks.end());
+    if (_componentAxis) {
+        shape.push_back(_desc.componentCount());
+        chunks.push_back(_desc.componentCount());
+    }
+    std::string zarray = "{\n    \"chunks\": [";
+    for (size_t i = 0; i < chunks.size(); i++)
+        zarray += (i > 0 ? ", " : "") + std::to_string(chunks[i]);
+    zarray += "],\n    \"compressor\": ";
+    if (_compressor.empty())
+        zarray += "null";
+    else
+        zarray += "{\"id\": \"" + _compressor + "\", \"level\": " + std::to_string(_level < 0 ? 6 : _level) + "}";
+    zarray += ",\n    \"dimension_separator\": \".\",\n    \"dtype\": \"" + numpyDescrFromType(_desc.componentType())
+        + "\",\n    \"fill_value\": 0,\n    \"filters\": null,\n    \"order\": \"C\",\n    \"shape\": [";
+    for (size_t i = 0; i < shape.size(); i++)
+        zarray += (i > 0 ? ", " : "") + std::to_string(shape[i]);
+    zarray += "],\n    \"zarr_format\": 2\n}\n";
+
+    std::string zattrs = "{";
+    bool first = true;
+    if (_componentAxis) {
+        zattrs += "\n    \"tgd_components\": " + std::to_string(_desc.componentCount());
+        first = false;
+    }
+    for (auto it = _desc.globalTagList().cbegin(); it != _desc.globalTagList().cend(); it++) {
+        zattrs += (first ? "\n    " : ",\n    ") + jsonString(it->first) + ": " + jsonString(it->second);
+        first = false;
+    }
+    zattrs += "\n}\n";
+
+    Error e = writeFileAtomically(_dirName + "/.zarray", zarray.data(), zarray.size());
+    if (e == ErrorNone)
+        e = writeFileAtomically(_dirName + "/.zattrs", zattrs.data(), zattrs.size());
+    return e;
+}
+
+size_t FormatImportExportZarr::chunkDataSize() const
+{
+    size_t size = _desc.elementSize();
+    for (size_t d = 0; d < _chunkSize.size(); d++)
+        size *= _chunkSize[d];
+    return size;
+}
+
+std::string FormatImportExportZarr::chunkFileName(const std::vector<size_t>& chunkIndex) const
+{
+    // the key lists the chunk indices in the order of the Zarr axes
+    std::vector<size_t> key = chunkIndex;
+    if (_componentAxis)
+        key.insert(key.begin(), 0);
+    if (_cOrder)
+        std::reverse(key.begin(), key.end());
+    std::string name = _dirName + '/';
+    for (size_t i = 0; i < key.size(); i++) {
+        if (i > 0)
+            name += _separator;
+        name += std::to_string(key[i]);
+    }
+    return name;
+}
+
+Error FormatImportExportZarr::readChunk(const std::vector<size_t>& chunkIndex, std::vector<unsigned char>& data) const
+{
+    size_t size = chunkDataSize();
+    FILE* f = fopen(chunkFileName(chunkIndex).c_str(), "rb");
+    if (!f) {
+        if (errno != ENOENT)
+            return ErrorSysErrno;
+        // missing chunks consist of the fill value
+        data.resize(size);
+        for (size_t i = 0; i < size; i += _fillElement.size())
+            std::memcpy(data.data() + i, _fillElement.data(), _fillElement.size());
+        return ErrorNone;
+    }
+    std::vector<unsigned char> fileData;
+    unsigned char buf[65536];
+    size_t n;
+    while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0)
+        fileData.insert(fileData.end(), buf, buf + n);
+    bool ok = !std::ferror(f);
+    fclose(f);
+    if (!ok)
+        return ErrorSysErrno;
+    if (_compressor.empty()) {
+        if (fileData.size() != size)
+            return ErrorInvalidData;
+        data.swap(fileData);
+    } else {
+#ifdef TGD_WITH_ZLIB
+        data.resize(size);
+        z_stream strm;
+        std::memset(&strm, 0, sizeof(strm));
+        // automatic detection of zlib and gzip headers
+        if (inflateInit2(&strm, 15 + 32) != Z_OK)
+            return ErrorLibrary;
+        strm.next_in = fileData.data();
+        strm.avail_in = fileData.size();
+        strm.next_out = data.data();
+        strm.avail_out = data.size();
+        int r = inflate(&strm, Z_FINISH);
+        inflateEnd(&strm);
+        if (r != Z_STREAM_END || strm.total_out != size)
+            return ErrorInvalidData;
+#else
+        return ErrorFeaturesUnsupported;
+#endif
+    }
+    if (_swap) {
+        ArrayContainer tmp(ArrayDescription({ size / _desc.componentSize() }, 1, _desc.componentType()),
+                std::shared_ptr<unsigned char[]>(std::shared_ptr<unsigned char[]>(), data.data()));
+        swapEndianness(tmp);
+    }
+    return ErrorNone;
+}
+
+Error FormatImportExportZarr::writeChunk(const std::vector<size_t>& chunkIndex, const std::vector<unsigned char>& data) const
+{
+    std::string fileName = chunkFileName(chunkIndex);
+    if (_compressor.empty())
+        return writeFileAtomically(fileName, data.data(), data.size());
+#ifdef TGD_WITH_ZLIB
+    z_stream strm;
+    std::memset(&strm, 0, sizeof(strm));
+    if (deflateInit2(&strm, _level < 0 ? Z_DEFAULT_COMPRESSION : _level, Z_DEFLATED,
+                _compressor == "gzip" ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return ErrorLibrary;
+    std::vector<unsigned char> compressed(deflateBound(&strm, data.size()) + 32);
+    strm.next_in = const_cast<unsigned char*>(data.data());
+    strm.avail_in = data.size();
+    strm.next_out = compressed.data();
+    strm.avail_out = compressed.size();
+    int r = deflate(&strm, Z_FINISH);
+    size_t compressedSize = strm.total_out;
+    deflateEnd(&strm);
+    if (r != Z_STREAM_END)
+        return ErrorLibrary;
+    return writeFileAtomically(fileName, compressed.data(), compressedSize);
+#else
+    return ErrorFeaturesUnsupported;
+#endif
+}
+
+/* Indices of the chunks that intersect a box (see boxIsInside()) */
+std::vector<std::vector<size_t>> FormatImportExportZarr::chunksInBox(const std::vector<size_t>& box) const
+{
+    size_t n = _desc.dimensionCount();
+    std::vector<size_t> first(n), last(n);
+    for (size_t d = 0; d < n; d++) {
+        first[d] = box[d] / _chunkSize[d];
+        last[d] = (box[d] + box[n + d] - 1) / _chunkSize[d];
+    }
+    std::vector<std::vector<size_t>> chunks;
+    std::vector<size_t> index = first;
+    for (;;) {
+        chunks.push_back(index);
+        size_t d = 0;
+        while (d < n && index[d] == last[d]) {
+            index[d] = first[d];
+            d++;
+        }
+        if (d >= n)
+            break;
+        index[d]++;
+    }
+    return chunks;
+}
+
+/* Call f(chunkIndex, buffer) for each chunk with THREADS threads; stop at the first error. */
+template<typename F> Error FormatImportExportZarr::forEachChunk(
+        const std::vector<std::vector<size_t>>& chunkIndices, F f) const
+{
+    std::atomic<size_t> next(0);
+    std::mutex errorMutex;
+    Error e = ErrorNone;
+    auto work = [&] () {
+        std::vector<unsigned char> buffer;
+        for (;;) {
+            size_t i = next++;
+            if (i >= chunkIndices.size())
+                break;
+            Error chunkError = f(chunkIndices[i], buffer);
+            if (chunkError != ErrorNone) {
+                std::unique_lock<std::mutex> lock(errorMutex);
+                if (e == ErrorNone)
+                    e = chunkError;
+                next = chunkIndices.size();
+                break;
+            }
+        }
+    };
+    size_t threadCount = _hints.value("THREADS", std::max(1u, std::thread::hardware_concurrency()));
+    threadCount = std::max(size_t(1), std::min(threadCount, chunkIndices.size()));
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; i++)
+        threads.push_back(std::thread(work));
+    work();
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    return e;
+}
+
+Error FormatImportExportZarr::openForReading(const std::string& fileName, const TagList& hints)
+{
+    _dirName = fileName;
+    _hints = hints;
+    _done = false;
+    return readMetadata();
+}
+
+Error FormatImportExportZarr::openForWriting(const std::string& fileName, bool append, const TagList& hints)
+{
+    _dirName = fileName;
+    _hints = hints;
+    _exists = false;
+    // An existing array can be updated with writeBox()
+    if (append) {
+        Error e = readMetadata();
+        if (e != ErrorNone && !(e == ErrorSysErrno && errno == ENOENT))
+            return e;
+    }
+    return ErrorNone;
+}
+
+void FormatImportExportZarr::close()
+{
+    _dirName.clear();
+    _exists = false;
+}
+
+int FormatImportExportZarr::arrayCount()
+{
+    return 1;
+}
+
+ArrayContainer FormatImportExportZarr::readArray(Error* error, int arrayIndex)
+{
+    std::vector<size_t> box(2 * _desc.dimensionCount());
+    for (size_t d = 0; d < _desc.dimensionCount(); d++)
+        box[_desc.dimensionCount() + d] = _desc.dimension(d);
+    std::vector<ArrayContainer> r = readBoxes(error, { box }, arrayIndex);
+    if (r.size() != 1)
+        return ArrayContainer();
+    r[0].globalTagList() = _desc.globalTagList();
+    return r[0];
+}
+
+bool FormatImportExportZarr::hasMore()
+{
+    return !_done;
+}
+
+ArrayDescription FormatImportExportZarr::readDescription(Error* error, int arrayIndex)
+{
+    if (arrayIndex > 0 || (arrayIndex < 0 && _done)) {
+        *error = ErrorInvalidData;
+        return ArrayDescription();
+    }
+    _done = true;
+    return _desc;
+}
+
+std::vector<ArrayContainer> FormatImportExportZarr::readBoxes(Error* error,
+        const std::vector<std::vector<size_t>>& boxes, int arrayIndex)
+{
+    if (arrayIndex > 0 || (arrayIndex < 0 && _done)) {
+        *error = ErrorInvalidData;
+        return std::vector<ArrayContainer>();
+    }
+    _done = true;
+    size_t n = _desc.dimensionCount();
+    std::vector<ArrayContainer> r;
+    std::vector<ZarrRegion> regions;
+    std::set<std::vector<size_t>> chunkSet;
+    for (size_t i = 0; i < boxes.size(); i++) {
+        if (!boxIsInside(boxes[i], _desc)) {
+            *error = ErrorInvalidData;
+            return std::vector<ArrayContainer>();
+        }
+        r.emplace_back(boxDescription(boxes[i], _desc));
+        regions.push_back({ std::vector<size_t>(boxes[i].begin(), boxes[i].begin() + n),
+                std::vector<size_t>(boxes[i].begin() + n, boxes[i].end()),
+                static_cast<unsigned char*>(r.back().data()) });
+        std::vector<std::vector<size_t>> chunks = chunksInBox(boxes[i]);
+        chunkSet.insert(chunks.begin(), chunks.end());
+    }
+
+    // Chunks write to disjoint parts of the boxes, so they can be handled in parallel
+    std::vector<std::vector<size_t>> chunkIndices(chunkSet.begin(), chunkSet.end());
+    Error e = forEachChunk(chunkIndices, [&] (const std::vector<size_t>& chunkIndex, std::vector<unsigned char>& buffer) {
+            Error chunkError = readChunk(chunkIndex, buffer);
+            if (chunkError != ErrorNone)
+                return chunkError;
+            ZarrRegion chunk = { chunkIndex, _chunkSize, buffer.data() };
+            for (size_t d = 0; d < n; d++)
+                chunk.start[d] *= _chunkSize[d];
+            for (size_t i = 0; i < regions.size(); i++)
+                copyIntersection(chunk, regions[i], _desc.elementSize());
+            return ErrorNone;
+            });
+    if (e != ErrorNone) {
+        *error = e;
+        return std::vector<ArrayContainer>();
+    }
+    return r;
+}
+
+Error FormatImportExportZarr::writeArray(const ArrayContainer& array)
+{
+    if (_exists)
+        return ErrorAppendingNotSupported;
+
+    _desc = ArrayDescription(array.dimensions(), array.componentCount(), array.componentType());
+    _desc.globalTagList() = array.globalTagList();
+    size_t n = _desc.dimensionCount();
+    _componentAxis = (_desc.componentCount() > 1);
+    _cOrder = true;
+    _swap = false;
+    _separator = '.';
+    _compressor = _hints.value("COMPRESSION", "none");
+    if (_compressor == "none")
+        _compressor.clear();
+    else if (_compressor != "zlib" && _compressor != "gzip")
+        return ErrorInvalidData;
+#ifndef TGD_WITH_ZLIB
+    if (!_compressor.empty())
+        return ErrorFeaturesUnsupported;
+#endif
+    _level = _hints.value("LEVEL", -1);
+    _fillElement.assign(_desc.elementSize(), 0);
+    _chunkSize.resize(n);
+    if (_hints.contains("CHUNKS")) {
+        std::string chunks = _hints.value("CHUNKS");
+        size_t pos = 0;
+        for (size_t d = 0; d < n; d++) {
+            char* end;
+            _chunkSize[d] = std::strtoull(chunks.c_str() + pos, &end, 10);
+            pos = end - chunks.c_str();
+            if (_chunkSize[d] == 0 || (d < n - 1 && chunks[pos] != ',') || (d == n - 1 && chunks[pos] != '\0'))
+                return ErrorInvalidData;
+            pos++;
+        }
+    } else {
+        // roughly 1 MiB per chunk, with the same size in all dimensions
+        double side = std::pow(double(1 << 20) / _desc.elementSize(), 1.0 / n);
+        for (size_t d = 0; d < n; d++)
+            _chunkSize[d] = std::max(size_t(1), size_t(side));
+    }
+    for (size_t d = 0; d < n; d++)
+        _chunkSize[d] = std::min(_chunkSize[d], _desc.dimension(d));
+    Error e = writeMetadata();
+    if (e != ErrorNone)
+        return e;
+    _exists = true;
+
+    std::vector<size_t> box(2 * n);
+    for (size_t d = 0; d < n; d++)
+        box[n + d] = _desc.dimension(d);
+    ZarrRegion region = { std::vector<size_t>(n, 0), _desc.dimensions(),
+        static_cast<unsigned char*>(const_cast<void*>(array.data())) };
+    return forEachChunk(chunksInBox(box), [&] (const std::vector<size_t>& chunkIndex, std::vector<unsigned char>& buffer) {
+            buffer.assign(chunkDataSize(), 0);
+            ZarrRegion chunk = { chunkIndex, _chunkSize, buffer.data() };
+            for (size_t d = 0; d < n; d++)
+                chunk.start[d] *= _chunkSize[d];
+            copyIntersection(region, chunk, _desc.elementSize());
+            // Chunks of zeroes are equal to missing chunks
+            if (std::all_of(buffer.begin(), buffer.end(), [] (unsigned char c) { return c == 0; })) {
+                if (unlink(chunkFileName(chunkIndex).c_str()) != 0 && errno != ENOENT)
+                    return ErrorSysErrno;
+                return ErrorNone;
+            }
+            return writeChunk(chunkIndex, buffer);
+            });
+}
+
+Error FormatImportExportZarr::writeBox(const ArrayContainer& box, const std::vector<size_t>& index, int arrayIndex)
+{
+    if (!_exists)
+        return ErrorInvalidData;
+    if (arrayIndex != 0)
+        return ErrorInvalidData;
+    size_t n = _desc.dimensionCount();
+    std::vector<size_t> b(index);
+    b.insert(b.end(), box.dimensions().begin(), box.dimensions().end());
+    if (box.componentCount() != _desc.componentCount() || box.componentType() != _desc.componentType()
+            || index.size() != n || box.dimensionCount() != n || !boxIsInside(b, _desc)) {
+        return ErrorInvalidData;
+    }
+    ZarrRegion region = { index, box.dimensions(), static_cast<unsigned char*>(const_cast<void*>(box.data())) };
+    return forEachChunk(chunksInBox(b), [&] (const std::vector<size_t>& chunkIndex, std::vector<unsigned char>& buffer) {
+            ZarrRegion chunk = { chunkIndex, _chunkSize, nullptr };
+            bool covered = true;
+            for (size_t d = 0; d < n; d++) {
+                chunk.start[d] *= _chunkSize[d];
+                size_t chunkEnd = std::min(chunk.start[d] + _chunkSize[d], _desc.dimension(d));
+                if (index[d] > chunk.start[d] || index[d] + box.dimension(d) < chunkEnd)
+                    covered = false;
+            }
+            // Only partially covered chunks need their previous content
+            if (covered) {
+                buffer.resize(chunkDataSize());
+                for (size_t i = 0; i < buffer.size(); i += _fillElement.size())
+                    std::memcpy(buffer.data() + i, _fillElement.data(), _fillElement.size());
+            } else {
+                Error e = readChunk(chunkIndex, buffer);
+                if (e != ErrorNone)
+                    return e;
+            }
+            chunk.data = buffer.data();
+            copyIntersection(region, chunk, _desc.elementSize());
+            if (_swap) {
+                ArrayContainer tmp(ArrayDescription({ buffer.size() / _desc.componentSize() }, 1, _desc.componentType()),
+                        std::shared_ptr<unsigned char[]>(std::shared_ptr<unsigned char[]>(), buffer.data()));
+                swapEndianness(tmp);
+            }
+            return writeChunk(chunkIndex, buffer);
+            });
+}
+
+}
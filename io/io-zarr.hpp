@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2022
+ * Computer Graphics Group, University of Siegen
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef TGD_IO_ZARR_HPP
+#define TGD_IO_ZARR_HPP
+
+/*
+ * Zarr version 2 directory stores: the array metadata is in DIR/.zarray, and
+ * each chunk of the array is a separate file, so that threads and processes
+ * can read and write different parts of an array independently.
+ *
+ * The axes are mapped to TGD dimensions as for .npy files (see io-npy.hpp).
+ * Components are stored as an additional innermost axis that is not chunked;
+ * this is recorded in DIR/.zattrs together with the global tags. For other
+ * stores, the hint ZARR_COMPONENTS=1 maps the innermost axis to components.
+ *
+ * Reading boxes only reads the chunks that intersect them. Chunks are read,
+ * decoded, encoded and written with THREADS threads. Missing chunks consist
+ * of the fill value, and chunks that consist of zeroes are not written.
+ *
+ * Output tags: CHUNKS (chunk size per dimension, e.g. 256,256,16; the default
+ * chunks have roughly 1 MiB), COMPRESSION (none, zlib or gzip; default none),
+ * LEVEL (compression level). Compression requires zlib. Blosc and other
+ * compressors are not supported.
+ *
+ * A store holds one array. Exporter::writeBox() updates the intersecting
+ * chunks of an existing store; chunks are replaced atomically, so concurrent
+ * writers of boxes that are aligned to the chunks do not interfere.
+ */
+
+#include <string>
+#include <vector>
+
+#include "io.hpp"
+
+namespace TGD {
+
+class FormatImportExportZarr : public FormatImportExport {
+private:
+    std::string _dirName;
+    TagList _hints;
+    ArrayDescription _desc;
+    std::vector<size_t> _chunkSize;     // per TGD dimension
+    bool _cOrder;
+    bool _componentAxis;                // components are an extra innermost axis
+    bool _swap;                         // data has non-native byte order
+    char _separator;
+    std::string _compressor;            // empty, "zlib", or "gzip"
+    int _level;
+    std::vector<unsigned char> _fillElement;
+    bool _exists;                       // array metadata is known
+    bool _done;                         // the array was read
+
+    Error readMetadata();
+    Error writeMetadata();
+    size_t chunkDataSize() const;
+    std::string chunkFileName(const std::vector<size_t>& chunkIndex) const;
+    Error readChunk(const std::vector<size_t>& chunkIndex, std::vector<unsigned char>& data) const;
+    Error writeChunk(const std::vector<size_t>& chunkIndex, const std::vector<unsigned char>& data) const;
+    std::vector<std::vector<size_t>> chunksInBox(const std::vector<size_t>& box) const;
+    template<typename F> Error forEachChunk(const std::vector<std::vector<size_t>>& chunkIndices, F f) const;
+
+public:
+    FormatImportExportZarr();
+    ~FormatImportExportZarr();
+
+    virtual Error openForReading(const std::string& fileName, const TagList& hints) override;
+    virtual Error openForWriting(const std::string& fileName, bool append, const TagList& hints) override;
+    virtual void close() override;
+
+    // for reading:
+    virtual int arrayCount() override;
+    virtual ArrayContainer readArray(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+    virtual bool hasMore() override;
+    virtual ArrayDescription readDescription(Error* error, int arrayIndex = -1 /* -1 means next */) override;
+    virtual std::vector<ArrayContainer> readBoxes(Error* error, const std::vector<std::vector<size_t>>& boxes,
+            int arrayIndex = -1 /* -1 means next */) override;
+
+    // for writing / appending:
+    virtual Error writeArray(const ArrayContainer& array) override;
+    virtual Error writeBox(const ArrayContainer& box, const std::vector<size_t>& index, int arrayIndex) override;
+};
+
+}
+
+#endif
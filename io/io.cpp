@@ -32,7 +32,16 @@
 #include "io-tgd.hpp"
 #include "io-csv.hpp"
 #include "io-pnm.hpp"
+#include "io-qoi.hpp"
+#include "io-y4m.hpp"
 #include "io-raw.hpp"
+#include "io-npy.hpp"
+#include "io-zarr.hpp"
+#include "io-nifti.hpp"
+#include "io-nrrd.hpp"
+#include "io-shm.hpp"
+#include "io-sequence.hpp"
+#include "io-stack.hpp"
 #include "io-rgbe.hpp"
 #include "io-stb.hpp"
 #include "io-tinyexr.hpp"
@@ -95,6 +104,12 @@ static FormatImportExport* openFormatImportExport(const std::string& format)
     std::vector<std::string> fieNames;
     if (format == "pbm" || format == "pgm" || format == "ppm" || format == "pnm" || format == "pam" || format == "pfm") {
         fieNames.push_back("pnm");
+    } else if (format == "npy" || format == "npz") {
+        fieNames.push_back("npy");
+    } else if (format == "nii" || format == "nii.gz") {
+        fieNames.push_back("nifti");
+    } else if (format == "nrrd" || format == "nhdr") {
+        fieNames.push_back("nrrd");
     } else if (format == "hdr" || format == "pic") {
         fieNames.push_back("rgbe");
     } else if (format == "exr") {
@@ -144,8 +159,26 @@ static FormatImportExport* openFormatImportExport(const std::string& format)
             fie = new FormatImportExportCSV;
         } else if (fieName == "pnm") {
             fie = new FormatImportExportPNM;
+        } else if (fieName == "qoi") {
+            fie = new FormatImportExportQOI;
+        } else if (fieName == "y4m") {
+            fie = new FormatImportExportY4M;
         } else if (fieName == "raw") {
             fie = new FormatImportExportRAW;
+        } else if (fieName == "npy") {
+            fie = new FormatImportExportNPY;
+        } else if (fieName == "zarr") {
+            fie = new FormatImportExportZarr;
+        } else if (fieName == "nifti") {
+            fie = new FormatImportExportNIfTI;
+        } else if (fieName == "nrrd") {
+            fie = new FormatImportExportNRRD;
+        } else if (fieName == "shm") {
+            fie = new FormatImportExportSHM;
+        } else if (fieName == "seq") {
+            fie = new FormatImportExportSequence;
+        } else if (fieName == "stack") {
+            fie = new FormatImportExportStack;
         } else if (fieName == "rgbe") {
             fie = new FormatImportExportRGBE;
         } else if (fieName == "stb") {
@@ -229,6 +262,14 @@ static FormatImportExport* openFormatImportExport(const std::string& format)
     return fie;
 }
 
+bool preloadFormat(const std::string& format)
+{
+    FormatImportExport* fie = openFormatImportExport(format);
+    bool available = (fie != nullptr);
+    delete fie;
+    return available;
+}
+
 Importer::Importer()
 {
 }
@@ -242,8 +283,12 @@ void Importer::initialize(const std::string& fileName, const TagList& hints)
 {
     _fileName = fileName;
     _hints = hints;
-    _format = (hints.contains("FORMAT") ? hints.value("FORMAT")
+    // The FORMAT hint of a sequence or stack applies to its files
+    _format = (isSequenceName(fileName) ? "seq"
+            : isStackName(fileName) ? "stack"
+            : hints.contains("FORMAT") ? hints.value("FORMAT")
             : fileName == "-" ? "tgd"
+            : isSharedMemoryName(fileName) ? "shm"
             : getExtension(_fileName));
     _fie = std::shared_ptr<FormatImportExport>(openFormatImportExport(_format));
     _fileIsOpened = false;
@@ -254,7 +299,8 @@ Error Importer::checkAccess() const
     if (!_fie) {
         return ErrorFormatUnsupported;
     }
-    if (fileName() != "-") {
+    if (fileName() != "-" && !isSharedMemoryName(fileName())
+            && !isSequenceName(fileName()) && !isStackName(fileName())) {
         FILE* f = std::fopen(fileName().c_str(), "rb");
         if (!f) {
             return ErrorSysErrno;
@@ -303,6 +349,44 @@ ArrayContainer Importer::readArray(Error* error, int arrayIndex)
     return r;
 }
 
+ArrayDescription Importer::readDescription(Error* error, int arrayIndex)
+{
+    Error e = ensureFileIsOpenedForReading();
+    if (e != ErrorNone) {
+        if (error)
+            *error = e;
+        return ArrayDescription();
+    }
+    ArrayDescription r = _fie->readDescription(&e, arrayIndex);
+    if (e != ErrorNone) {
+        if (error)
+            *error = e;
+        return ArrayDescription();
+    }
+    if (error)
+        *error = ErrorNone;
+    return r;
+}
+
+std::vector<ArrayContainer> Importer::readBoxes(const std::vector<std::vector<size_t>>& boxes, Error* error, int arrayIndex)
+{
+    Error e = ensureFileIsOpenedForReading();
+    if (e != ErrorNone) {
+        if (error)
+            *error = e;
+        return std::vector<ArrayContainer>();
+    }
+    std::vector<ArrayContainer> r = _fie->readBoxes(&e, boxes, arrayIndex);
+    if (e != ErrorNone) {
+        if (error)
+            *error = e;
+        return std::vector<ArrayContainer>();
+    }
+    if (error)
+        *error = ErrorNone;
+    return r;
+}
+
 bool Importer::hasMore(Error* error)
 {
     Error e = ensureFileIsOpenedForReading();
@@ -325,8 +409,7 @@ Exporter::Exporter()
 
 Exporter::~Exporter()
 {
-    if (_fie && _fileIsOpened)
-        _fie->close();
+    finish();
 }
 
 Exporter::Exporter(const std::string& fileName, bool append, const TagList& hints)
@@ -341,23 +424,31 @@ void Exporter::initialize(const std::string& fileName, bool append, const TagLis
     _hints = hints;
     _format = (hints.contains("FORMAT") ? hints.value("FORMAT")
             : fileName == "-" ? "tgd"
+            : isSharedMemoryName(fileName) ? "shm"
             : getExtension(_fileName));
     _fie = std::shared_ptr<FormatImportExport>(openFormatImportExport(_format));
     _fileIsOpened = false;
 }
 
-Error Exporter::writeArray(const ArrayContainer& array)
+Error Exporter::ensureFileIsOpenedForWriting()
 {
     if (!_fie) {
         return ErrorFormatUnsupported;
     }
-    Error e;
+    Error e = ErrorNone;
     if (!_fileIsOpened) {
         e = _fie->openForWriting(_fileName, _append, _hints);
-        if (e != ErrorNone) {
-            return e;
-        }
-        _fileIsOpened = true;
+        if (e == ErrorNone)
+            _fileIsOpened = true;
+    }
+    return e;
+}
+
+Error Exporter::writeArray(const ArrayContainer& array)
+{
+    Error e = ensureFileIsOpenedForWriting();
+    if (e != ErrorNone) {
+        return e;
     }
     e = _fie->writeArray(array);
     if (e != ErrorNone) {
@@ -367,4 +458,55 @@ Error Exporter::writeArray(const ArrayContainer& array)
     return ErrorNone;
 }
 
+ArrayContainer Exporter::mapArray(const ArrayDescription& desc, Error* error)
+{
+    Error e = ensureFileIsOpenedForWriting();
+    if (e != ErrorNone) {
+        if (error)
+            *error = e;
+        return ArrayContainer();
+    }
+    ArrayContainer r = _fie->mapArray(&e, desc);
+    if (e != ErrorNone) {
+        if (error)
+            *error = e;
+        return ArrayContainer();
+    }
+    if (error)
+        *error = ErrorNone;
+    return r;
+}
+
+Error Exporter::createArray(const ArrayDescription& desc)
+{
+    Error e;
+    mapArray(desc, &e);
+    if (e == ErrorFeaturesUnsupported) {
+        ArrayContainer array(desc);
+        std::memset(array.data(), 0, array.dataSize());
+        e = writeArray(array);
+    }
+    return e;
+}
+
+Error Exporter::writeBox(const ArrayContainer& box, const std::vector<size_t>& index, int arrayIndex)
+{
+    Error e = ensureFileIsOpenedForWriting();
+    if (e != ErrorNone) {
+        return e;
+    }
+    return _fie->writeBox(box, index, arrayIndex);
+}
+
+Error Exporter::finish()
+{
+    Error e = ErrorNone;
+    if (_fie && _fileIsOpened) {
+        e = _fie->finish();
+        _fie->close();
+        _fileIsOpened = false;
+    }
+    return e;
+}
+
 }
@@ -1,10 +1,19 @@
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <algorithm>
 
 #include "core/array.hpp"
 #include "core/foreach.hpp"
 #include "core/operators.hpp"
 #include "core/io.hpp"
+#include "core/hash.hpp"
+#include "io/io-batchread.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/resource.h>
 
 void check_failed(const char* expr, const char* file, unsigned int line)
 {
@@ -62,5 +71,190 @@ int main(void)
         }
     }
 
+    // Reading boxes from files
+    TGD::Array<uint16_t> c({23, 11, 7}, 2);
+    for (size_t e = 0; e < c.elementCount(); e++) {
+        c.set<uint16_t>(e, 0, e);
+        c.set<uint16_t>(e, 1, 3 * e);
+    }
+    TGD::TagList rawHints;
+    rawHints.set("DIMENSIONS", "3");
+    rawHints.set("DIMENSION0", "23");
+    rawHints.set("DIMENSION1", "11");
+    rawHints.set("DIMENSION2", "7");
+    rawHints.set("COMPONENTS", "2");
+    rawHints.set("TYPE", "uint16");
+    std::vector<std::vector<size_t>> boxes = { { 0, 0, 0, 23, 11, 7 }, { 3, 4, 5, 1, 1, 1 }, { 5, 2, 1, 17, 9, 4 } };
+    for (std::string fileName : { "test-basic-boxes.tgd", "test-basic-boxes.raw" }) {
+        EXPECT(TGD::save(c, fileName));
+        EXPECT(TGD::save(c, fileName, TGD::Append));
+        TGD::Importer importer(fileName, rawHints);
+        TGD::Error error;
+        importer.readArray(&error);
+        std::vector<TGD::ArrayContainer> r = importer.readBoxes(boxes, &error);
+        EXPECT(error == TGD::ErrorNone && r.size() == boxes.size());
+        for (size_t i = 0; i < boxes.size(); i++) {
+            EXPECT(r[i].dimension(0) == boxes[i][3] && r[i].dimension(1) == boxes[i][4] && r[i].dimension(2) == boxes[i][5]);
+            for (size_t z = 0; z < r[i].dimension(2); z++)
+                for (size_t y = 0; y < r[i].dimension(1); y++)
+                    for (size_t x = 0; x < r[i].dimension(0); x++)
+                        EXPECT(std::memcmp(r[i].get({ x, y, z }), c.get({ boxes[i][0] + x, boxes[i][1] + y, boxes[i][2] + z }), 4) == 0);
+        }
+        EXPECT(!importer.hasMore());
+        r = importer.readBoxes({ { 22, 10, 6, 2, 1, 1 } }, &error, 0);
+        EXPECT(error == TGD::ErrorInvalidData && r.empty());
+        std::remove(fileName.c_str());
+    }
+
+    // Batch reads with the thread pool: batches with many requests and
+    // with a single request alternate
+    EXPECT(TGD::save(c, "test-basic-batch.raw"));
+    int fd = open("test-basic-batch.raw", O_RDONLY);
+    EXPECT(fd >= 0);
+    {
+        TGD::BatchReader reader(false);
+        std::vector<TGD::ArrayContainer> r;
+        for (int i = 0; i < 1000; i++) {
+            EXPECT(reader.readBoxes(fd, 0, c, boxes, r) == TGD::ErrorNone && r.size() == boxes.size());
+            EXPECT(std::memcmp(r[2].get({ 0, 0, 0 }), c.get({ 5, 2, 1 }), 4) == 0);
+            EXPECT(reader.readBoxes(fd, 0, c, { { 3, 4, 5, 1, 1, 1 } }, r) == TGD::ErrorNone && r.size() == 1);
+            EXPECT(std::memcmp(r[0].data(), c.get({ 3, 4, 5 }), 4) == 0);
+        }
+    }
+    close(fd);
+    std::remove("test-basic-batch.raw");
+
+    // Reading boxes from a stack of slices, with partial and complete slices
+    // and a cache that is smaller than the stack
+    for (size_t z = 0; z < c.dimension(2); z++) {
+        TGD::ArrayContainer slice({ c.dimension(0), c.dimension(1) }, c.componentCount(), c.componentType());
+        std::memcpy(slice.data(), c.get({ 0, 0, z }), slice.dataSize());
+        EXPECT(TGD::save(slice, "test-basic-slice-" + std::to_string(z) + ".tgd"));
+    }
+    {
+        TGD::TagList stackHints;
+        stackHints.set("STACK_CACHE", "2");
+        TGD::Importer importer("stack:test-basic-slice-%d.tgd", stackHints);
+        std::vector<std::vector<size_t>> stackBoxes = { { 5, 2, 1, 17, 9, 4 }, { 0, 0, 2, 23, 11, 3 },
+            { 3, 4, 5, 1, 1, 1 }, { 0, 0, 0, 23, 11, 7 }, { 1, 1, 0, 2, 2, 7 } };
+        TGD::Error error;
+        std::vector<TGD::ArrayContainer> r = importer.readBoxes(stackBoxes, &error);
+        EXPECT(error == TGD::ErrorNone && r.size() == stackBoxes.size());
+        for (size_t i = 0; i < stackBoxes.size(); i++) {
+            const std::vector<size_t>& box = stackBoxes[i];
+            for (size_t z = 0; z < box[5]; z++)
+                for (size_t y = 0; y < box[4]; y++)
+                    for (size_t x = 0; x < box[3]; x++)
+                        EXPECT(std::memcmp(r[i].get({ x, y, z }), c.get({ box[0] + x, box[1] + y, box[2] + z }), 4) == 0);
+        }
+    }
+    for (size_t z = 0; z < c.dimension(2); z++)
+        std::remove(("test-basic-slice-" + std::to_string(z) + ".tgd").c_str());
+
+    // Reading several boxes that share chunks and cross chunk borders from zarr
+    {
+        TGD::TagList zarrHints;
+        zarrHints.set("CHUNKS", "5,4,3");
+        std::system("rm -rf test-basic.zarr");
+        EXPECT(TGD::save(c, "test-basic.zarr", TGD::Overwrite, nullptr, zarrHints));
+        std::vector<std::vector<size_t>> zarrBoxes = { { 4, 3, 2, 2, 2, 2 }, { 3, 2, 1, 17, 9, 5 },
+            { 20, 8, 6, 3, 3, 1 }, { 0, 0, 0, 23, 11, 7 }, { 4, 3, 2, 2, 2, 2 } };
+        TGD::Importer importer("test-basic.zarr");
+        TGD::Error error;
+        std::vector<TGD::ArrayContainer> r = importer.readBoxes(zarrBoxes, &error);
+        EXPECT(error == TGD::ErrorNone && r.size() == zarrBoxes.size());
+        for (size_t i = 0; i < zarrBoxes.size(); i++) {
+            const std::vector<size_t>& box = zarrBoxes[i];
+            for (size_t z = 0; z < box[5]; z++)
+                for (size_t y = 0; y < box[4]; y++)
+                    for (size_t x = 0; x < box[3]; x++)
+                        EXPECT(std::memcmp(r[i].get({ x, y, z }), c.get({ box[0] + x, box[1] + y, box[2] + z }), 4) == 0);
+        }
+        std::system("rm -rf test-basic.zarr");
+    }
+
+    // Writing arrays through memory maps
+    for (std::string fileName : { "test-basic-map.tgd", "test-basic-map.raw" }) {
+        TGD::ArrayContainer mapped;
+        {
+            TGD::Exporter exporter(fileName);
+            EXPECT(exporter.writeArray(c) == TGD::ErrorNone);
+            TGD::Error error;
+            mapped = exporter.mapArray(c, &error);
+            EXPECT(error == TGD::ErrorNone && mapped.dataSize() == c.dataSize());
+            std::memcpy(mapped.data(), c.data(), c.dataSize());
+            std::memset(c.data(), 0, c.dataSize());
+            EXPECT(exporter.writeArray(c) == TGD::ErrorNone);
+        }
+        {
+            TGD::Exporter exporter(fileName, TGD::Append);
+            TGD::ArrayContainer zero = exporter.mapArray(c);
+            EXPECT(zero.dataSize() == c.dataSize() && std::memcmp(zero.data(), c.data(), c.dataSize()) == 0);
+        }
+        TGD::Importer importer(fileName, rawHints);
+        EXPECT(importer.arrayCount() == 4);
+        EXPECT(std::memcmp(importer.readArray(nullptr, 0).data(), mapped.data(), c.dataSize()) == 0);
+        EXPECT(std::memcmp(importer.readArray(nullptr, 1).data(), mapped.data(), c.dataSize()) == 0);
+        EXPECT(std::memcmp(importer.readArray(nullptr, 2).data(), c.data(), c.dataSize()) == 0);
+        EXPECT(std::memcmp(importer.readArray(nullptr, 3).data(), c.data(), c.dataSize()) == 0);
+        std::memcpy(c.data(), mapped.data(), c.dataSize());
+        std::remove(fileName.c_str());
+    }
+
+    // A mapping that fails because the file cannot grow leaves no trace
+    struct rlimit fileSizeLimit;
+    EXPECT(getrlimit(RLIMIT_FSIZE, &fileSizeLimit) == 0);
+    if (fileSizeLimit.rlim_max == RLIM_INFINITY || fileSizeLimit.rlim_max > (1 << 20)) {
+        struct rlimit smallLimit = fileSizeLimit;
+        smallLimit.rlim_cur = 1 << 20;
+        signal(SIGXFSZ, SIG_IGN);
+        EXPECT(setrlimit(RLIMIT_FSIZE, &smallLimit) == 0);
+        for (std::string fileName : { "test-basic-map.tgd", "test-basic-map.raw" }) {
+            {
+                TGD::Exporter exporter(fileName);
+                EXPECT(exporter.writeArray(c) == TGD::ErrorNone);
+                TGD::Error error;
+                exporter.mapArray(TGD::ArrayDescription({ 1024, 1024 }, 2, TGD::uint16), &error);
+                EXPECT(error != TGD::ErrorNone);
+                EXPECT(exporter.writeArray(c) == TGD::ErrorNone);
+            }
+            TGD::Importer importer(fileName, rawHints);
+            EXPECT(importer.arrayCount() == 2);
+            EXPECT(std::memcmp(importer.readArray(nullptr, 1).data(), c.data(), c.dataSize()) == 0);
+            std::remove(fileName.c_str());
+        }
+        EXPECT(setrlimit(RLIMIT_FSIZE, &fileSizeLimit) == 0);
+        signal(SIGXFSZ, SIG_DFL);
+    }
+
+    // Hashes: independent of the number of threads and of the code path,
+    // sensitive to each byte, for sizes around the 1 MiB block boundaries
+    {
+        const size_t mib = size_t(1) << 20;
+        std::vector<unsigned char> data(9 * mib + 100);
+        uint64_t x = 42;
+        for (size_t i = 0; i < data.size(); i++) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            data[i] = x >> 56;
+        }
+        for (size_t n : { size_t(0), size_t(1), size_t(63), size_t(64), size_t(1025) })
+            EXPECT(TGD::HashDetail::hashBlock(data.data(), n, true) == TGD::HashDetail::hashBlock(data.data(), n));
+        for (size_t n : { mib - 1, mib, mib + 1, 2 * mib + 63, 9 * mib + 100 }) {
+            EXPECT(TGD::HashDetail::hashBlock(data.data(), std::min(n, mib), true) == TGD::HashDetail::hashBlock(data.data(), std::min(n, mib)));
+            TGD::Hash h = TGD::hashData(data.data(), n, 1);
+            EXPECT(TGD::hashData(data.data(), n, 4) == h);
+            EXPECT(TGD::hashData(data.data(), n) == h);
+            EXPECT(TGD::hashData(data.data(), n - 1, 1) != h);
+            for (size_t i : { size_t(0), mib - 1, mib, n - 1 }) {
+                if (i >= n)
+                    continue;
+                data[i] ^= 0x10;
+                EXPECT(TGD::hashData(data.data(), n, 1) != h);
+                EXPECT(TGD::hashData(data.data(), n, 4) != h);
+                data[i] ^= 0x10;
+            }
+        }
+    }
+
     return 0;
 }
@@ -24,18 +24,33 @@
 
 #include <cassert>
 #include <cstring>
+#include <cstdlib>
+#include <cerrno>
 #include <cstdio>
 #include <cmath>
 #ifdef _WIN32
 # include <fcntl.h>
+#else
+# include <csignal>
+# include <unistd.h>
+# include <fcntl.h>
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <sys/wait.h>
+# include <sys/time.h>
+# include <sys/socket.h>
+# include <sys/un.h>
 #endif
 
 #include <string>
 #include <vector>
+#include <set>
+#include <thread>
 
 #ifdef TGD_WITH_MUPARSER
+# include <cctype>
 # include <chrono>
-# include <random>
+# include <type_traits>
 # include <muParser.h>
 #endif
 
@@ -43,6 +58,10 @@
 #include "io.hpp"
 #include "foreach.hpp"
 #include "operators.hpp"
+#include "hash.hpp"
+#include "random.hpp"
+#include "matrix.hpp"
+#include "color.hpp"
 
 #include "cmdline.hpp"
 
@@ -94,6 +113,20 @@ size_t getUInt(const std::string& value)
     return std::stoull(value);
 }
 
+bool parseDouble(const std::string& value)
+{
+    const char* str = value.c_str();
+    char* end;
+    errno = 0;
+    double v = std::strtod(str, &end);
+    return (!value.empty() && *end == '\0' && errno == 0 && std::isfinite(v));
+}
+
+double getDouble(const std::string& value)
+{
+    return std::strtod(value.c_str(), nullptr);
+}
+
 static const size_t underscoreValue = std::numeric_limits<size_t>::max();
 
 size_t getUIntUnderscore(const std::string& value)
@@ -218,6 +251,28 @@ void getUIntAndNameAndValue(const std::string& value, size_t* u, std::string* n,
     getNameAndValue(t, n, v);
 }
 
+bool parseToneMapOperator(const std::string& value)
+{
+    return (value == "none" || value == "reinhard" || value == "aces");
+}
+
+TGD::ToneMapOperator getToneMapOperator(const std::string& value)
+{
+    return (value == "reinhard" ? TGD::ToneMapReinhard
+            : value == "aces" ? TGD::ToneMapACES
+            : TGD::ToneMapNone);
+}
+
+bool parseGamma(const std::string& value)
+{
+    return (value == "srgb" || (parseDouble(value) && getDouble(value) > 0.0));
+}
+
+float getGamma(const std::string& value)
+{
+    return (value == "srgb" ? 0.0f : getDouble(value));
+}
+
 bool parseRange(const std::string& value)
 {
     bool aOk = false;
@@ -256,6 +311,45 @@ void getRange(const std::string& value, size_t* a, size_t* b, size_t* s)
     }
 }
 
+/* Matrix: rows separated by ';', values within a row by ',' */
+bool getMatrix(const std::string& value, std::vector<double>* matrix, size_t* rows)
+{
+    matrix->clear();
+    *rows = 0;
+    size_t columns = 0;
+    for (size_t i = 0; i <= value.length();) {
+        size_t j = value.find_first_of(';', i);
+        std::string row = value.substr(i, (j == std::string::npos ? std::string::npos : j - i));
+        size_t rowColumns = 0;
+        for (size_t k = 0; k <= row.length();) {
+            size_t l = row.find_first_of(',', k);
+            std::string singleValue = row.substr(k, (l == std::string::npos ? std::string::npos : l - k));
+            if (!parseDouble(singleValue))
+                return false;
+            matrix->push_back(getDouble(singleValue));
+            rowColumns++;
+            if (l == std::string::npos)
+                break;
+            k = l + 1;
+        }
+        if (*rows > 0 && rowColumns != columns)
+            return false;
+        columns = rowColumns;
+        (*rows)++;
+        if (j == std::string::npos)
+            break;
+        i = j + 1;
+    }
+    return true;
+}
+
+bool parseMatrix(const std::string& value)
+{
+    std::vector<double> matrix;
+    size_t rows;
+    return getMatrix(value, &matrix, &rows);
+}
+
 bool indexInRange(size_t i, size_t a, size_t b, size_t s)
 {
     return (i >= a && i <= b && (i - a) % s == 0);
@@ -361,9 +455,13 @@ int tgd_help(void)
             "Available commands:\n"
             "  create\n"
             "  convert\n"
+            "  merge\n"
             "  calc\n"
             "  diff\n"
+            "  tonemap\n"
             "  info\n"
+            "  serve\n"
+            "  client\n"
             "Use the --help option to get command-specific help.\n");
     return 0;
 }
@@ -382,6 +480,9 @@ int tgd_create(int argc, char* argv[])
     cmdLine.addOptionWithArg("components", 'c', parseUIntLargerThanZero);
     cmdLine.addOptionWithArg("type", 't', parseType);
     cmdLine.addOptionWithArg("n", 'n', parseUIntLargerThanZero, "1");
+    cmdLine.addOptionWithoutArg("random");
+    cmdLine.addOptionWithoutArg("gaussian");
+    cmdLine.addOptionWithArg("seed", 0, parseUInt, "0");
     std::string errMsg;
     if (!cmdLine.parse(argc, argv, 1, 1, errMsg)) {
         fprintf(stderr, "tgd create: %s\n", errMsg.c_str());
@@ -390,7 +491,7 @@ int tgd_create(int argc, char* argv[])
     if (cmdLine.isSet("help")) {
         fprintf(stderr, "Usage: tgd create [option]... <outfile|->\n"
                 "\n"
-                "Create zero-filled arrays.\n"
+                "Create zero-filled or random arrays.\n"
                 "\n"
                 "Options:\n"
                 "  -o|--output=TAG            set output hints such as FORMAT=gdal etc.\n"
@@ -398,7 +499,14 @@ int tgd_create(int argc, char* argv[])
                 "  -c|--components=C          set number of components per element\n"
                 "  -t|--type=T                set type (int8, uint8, int16, uint16, int32,\n"
                 "                             uint32, int64, uint64, float32, float64)\n"
-                "  -n|--n=N                   set number of arrays to create (default 1)\n");
+                "  -n|--n=N                   set number of arrays to create (default 1)\n"
+                "  --random                   fill with uniformly distributed random values\n"
+                "                             in [0,1) or the full range of integer types\n"
+                "  --gaussian                 fill with normally distributed random values\n"
+                "                             (mean 0 and standard deviation 1 for floating\n"
+                "                             point types, see manual for integer types)\n"
+                "  --seed=S                   set seed for random values (default 0); the\n"
+                "                             same seed gives the same values\n");
         return 0;
     }
     if (!cmdLine.isSet("dimensions")) {
@@ -413,6 +521,10 @@ int tgd_create(int argc, char* argv[])
         fprintf(stderr, "tgd create: --type is missing\n");
         return 1;
     }
+    if (cmdLine.isSet("random") && cmdLine.isSet("gaussian")) {
+        fprintf(stderr, "tgd create: --random and --gaussian are mutually exclusive\n");
+        return 1;
+    }
 
     const std::string& outFileName = cmdLine.arguments()[0];
     TGD::TagList exporterHints = createTagList(cmdLine.valueList("output"));
@@ -422,16 +534,32 @@ int tgd_create(int argc, char* argv[])
     size_t components = getUInt(cmdLine.value("components"));
     TGD::Type type = getType(cmdLine.value("type"));
     size_t n = getUInt(cmdLine.value("n"));
-    TGD::ArrayContainer array(dimensions, components, type);
-    std::memset(array.data(), 0, array.dataSize());
+    TGD::ArrayDescription desc(dimensions, components, type);
+    uint64_t seed = getUInt(cmdLine.value("seed"));
     for (size_t i = 0; i < n; i++) {
-        err = exporter.writeArray(array);
+        if (cmdLine.isSet("random") || cmdLine.isSet("gaussian")) {
+            // each array gets its own stream
+            TGD::ArrayContainer array(desc);
+            if (cmdLine.isSet("random"))
+                TGD::fillUniform(array, seed, i);
+            else
+                TGD::fillGaussian(array, seed, i);
+            err = exporter.writeArray(array);
+        } else {
+            err = exporter.createArray(desc);
+        }
         if (err != TGD::ErrorNone) {
             fprintf(stderr, "tgd create: %s: %s\n", outFileName.c_str(), TGD::strerror(err));
             break;
         }
     }
 
+    if (err == TGD::ErrorNone) {
+        err = exporter.finish();
+        if (err != TGD::ErrorNone)
+            fprintf(stderr, "tgd create: %s: %s\n", outFileName.c_str(), TGD::strerror(err));
+    }
+
     return (err == TGD::ErrorNone ? 0 : 1);
 }
 
@@ -503,6 +631,7 @@ int tgd_convert(int argc, char* argv[])
     cmdLine.addOptionWithArg("components", 'c', parseUIntUnderscoreList);
     cmdLine.addOptionWithArg("type", 't', parseType);
     cmdLine.addOptionWithoutArg("normalize", 'n');
+    cmdLine.addOptionWithArg("matrix", 'm', parseMatrix);
     cmdLine.addOrderedOptionWithoutArg("unset-all-tags");
     cmdLine.addOrderedOptionWithArg("global-tag", 0, parseNameAndValue);
     cmdLine.addOrderedOptionWithArg("unset-global-tag");
@@ -550,6 +679,10 @@ int tgd_convert(int argc, char* argv[])
                 "                             int32, uint32, int64, uint64, float32, float64)\n"
                 "  -n|--normalize             create/assume floating point values in [-1,1]/[0,1]\n"
                 "                             when converting to/from signed/unsigned integers\n"
+                "  -m|--matrix=R0;R1;...      transform the components of each element with a\n"
+                "                             matrix given as rows of comma-separated values;\n"
+                "                             an additional last column is an offset, e.g.\n"
+                "                             -m '1.5,0,0;0,1,0;0,0,0.8' for white balance\n"
                 "  --unset-all-tags           unset all tags\n"
                 "  --global-tag=N=V           set global tag N to value V\n"
                 "  --unset-global-tag=N       unset global tag N\n"
@@ -611,6 +744,16 @@ int tgd_convert(int argc, char* argv[])
         }
     }
 
+    std::vector<double> matrix;
+    size_t matrixRows = 0;
+    if (cmdLine.isSet("matrix")) {
+        if (cmdLine.isSet("normalize")) {
+            fprintf(stderr, "tgd convert: cannot use both --matrix and --normalize\n");
+            return 1;
+        }
+        getMatrix(cmdLine.value("matrix"), &matrix, &matrixRows);
+    }
+
     std::vector<size_t> A, B, S;
     std::vector<std::string> ranges;
     if (cmdLine.isSet("keep")) {
@@ -919,7 +1062,17 @@ int tgd_convert(int argc, char* argv[])
                             arrayNew.componentTagList(i) = array.componentTagList(components[i]);
                     array = arrayNew;
                 }
-                if (cmdLine.isSet("type")) {
+                if (cmdLine.isSet("matrix")) {
+                    size_t matrixColumns = matrix.size() / matrixRows;
+                    if (matrixColumns != array.componentCount() && matrixColumns != array.componentCount() + 1) {
+                        fprintf(stderr, "tgd convert: %s: matrix does not match components\n", inputName.c_str());
+                        err = TGD::ErrorInvalidData;
+                        break;
+                    }
+                    // convert to the new type in the same pass
+                    array = TGD::transformComponents(array, matrix, matrixRows,
+                            cmdLine.isSet("type") ? type : array.componentType());
+                } else if (cmdLine.isSet("type")) {
                     TGD::Type oldType = array.componentType();
                     if (cmdLine.isSet("normalize")) {
                         if (type == TGD::float32) {
@@ -1026,6 +1179,11 @@ int tgd_convert(int argc, char* argv[])
                     break;
                 }
                 if (cmdLine.isSet("split")) {
+                    err = exporter.finish();
+                    if (err != TGD::ErrorNone) {
+                        fprintf(stderr, "tgd convert: %s: %s\n", outFileName.c_str(), TGD::strerror(err));
+                        break;
+                    }
                     std::string arrayIndexString = std::to_string(arrayIndex);
                     outFileName = splitTemplate.substr(0, splitTemplateFirstIndex);
                     if (arrayIndexString.length() < splitTemplateFieldWidth)
@@ -1047,6 +1205,12 @@ int tgd_convert(int argc, char* argv[])
         }
     }
 
+    if (err == TGD::ErrorNone) {
+        err = exporter.finish();
+        if (err != TGD::ErrorNone)
+            fprintf(stderr, "tgd convert: %s: %s\n", outFileName.c_str(), TGD::strerror(err));
+    }
+
     return (err == TGD::ErrorNone ? 0 : 1);
 }
 
@@ -1069,10 +1233,11 @@ private:
     // user-defined variable management
     size_t expressionIndex;
     std::vector<std::vector<std::pair<std::string, std::unique_ptr<double>>>> added_vars;
-    // pseudo-random numbers
-    std::mt19937_64 prng;
-    std::uniform_real_distribution<double> uniform_distrib;
-    std::normal_distribution<double> gaussian_distrib;
+    // pseudo-random numbers: counter-based, so that each value only depends
+    // on the seed, the array, the element, and the number of the call
+    uint64_t random_seed;
+    uint64_t random_element;
+    uint64_t random_call;
     // variables
     double var_array_count;
     double var_stream_index;
@@ -1121,9 +1286,10 @@ private:
 
     static double unary_plus(double x) { return x; }
 
-    static double seed(double x) { calcSingleton->prng.seed(x); return 0.0; }
-    static double random() { return calcSingleton->uniform_distrib(calcSingleton->prng); }
-    static double gaussian() { return calcSingleton->gaussian_distrib(calcSingleton->prng); }
+    static double seed(double x) { calcSingleton->random_seed = x; return 0.0; }
+    static uint64_t random_stream() { return uint64_t(calcSingleton->var_stream_index) << 32 | calcSingleton->random_call++; }
+    static double random() { return TGD::randomUniform(calcSingleton->random_seed, random_stream(), calcSingleton->random_element); }
+    static double gaussian() { return TGD::randomGaussian(calcSingleton->random_seed, random_stream(), calcSingleton->random_element); }
 
     static double* add_var(const char* name, void* expressionIndexVoid)
     {
@@ -1280,8 +1446,8 @@ public:
         expressions(expressions),
         parsers(expressions.size()),
         added_vars(expressions.size()),
-        uniform_distrib(0.0, 1.0),
-        gaussian_distrib(0.0, 1.0),
+        random_element(0),
+        random_call(0),
         var_dim(maxDimensionCount),
         var_box(maxDimensionCount),
         var_boxdim(maxDimensionCount),
@@ -1342,7 +1508,7 @@ public:
         }
 
         // initialize random number generator
-        prng.seed(std::chrono::system_clock::now().time_since_epoch().count());
+        random_seed = std::chrono::system_clock::now().time_since_epoch().count();
     }
 
     void init(size_t arrayIndex, const std::vector<size_t>& box)
@@ -1367,6 +1533,8 @@ public:
     void setIndex(const std::vector<size_t>& index, size_t e)
     {
         var_index = e;
+        random_element = e;
+        random_call = 0;
         for (size_t i = 0; i < maxDimensionCount; i++) {
             if (i < input_arrays[0].dimensionCount())
                 var_i[i] = index[i];
@@ -1415,6 +1583,109 @@ public:
         return ok;
     }
 
+    static bool isNumberedVariable(const std::string& name, const char* prefix)
+    {
+        size_t n = std::strlen(prefix);
+        return name.size() > n && name.compare(0, n, prefix) == 0
+            && name.find_first_not_of("0123456789", n) == std::string::npos;
+    }
+
+    static bool usesFunction(const std::string& expression, const std::string& function)
+    {
+        // look for the name as a complete identifier followed by '('
+        for (size_t i = expression.find(function); i != std::string::npos; i = expression.find(function, i + 1)) {
+            if (i > 0 && (std::isalnum(static_cast<unsigned char>(expression[i - 1])) || expression[i - 1] == '_'))
+                continue;
+            size_t j = i + function.size();
+            while (j < expression.size() && std::isspace(static_cast<unsigned char>(expression[j])))
+                j++;
+            if (j < expression.size() && expression[j] == '(')
+                return true;
+        }
+        return false;
+    }
+
+    /* Check whether each output component depends only on the value of the
+     * same component of the current input element, so that the expressions can
+     * be evaluated once per possible input value into a lookup table. This
+     * requires a single 8 or 16 bit integer input. User-defined variables
+     * might carry state from one element to the next, so they are only
+     * accepted if the user asked for a lookup table explicitly. */
+    bool lutIsPossible(bool allowUserVariables)
+    {
+        if (input_arrays.size() != 1 || input_arrays[0].componentSize() > 2
+                || input_arrays[0].componentType() == TGD::float32
+                || input_arrays[0].componentType() == TGD::float64) {
+            return false;
+        }
+        for (size_t i = 0; i < parsers.size(); i++) {
+            for (const char* f : { "v", "copy", "random", "gaussian", "seed" })
+                if (usesFunction(expressions[i], f))
+                    return false;
+            expressionIndex = i;
+            size_t componentVariables = 0;
+            try {
+                const mu::varmap_type& usedVars = parsers[i].GetUsedVar();
+                for (auto it = usedVars.cbegin(); it != usedVars.cend(); it++) {
+                    const std::string& name = it->first;
+                    if (name == "index" || isNumberedVariable(name, "i")) {
+                        return false;
+                    } else if (isNumberedVariable(name, "v")) {
+                        componentVariables++;
+                    } else if (name == "array_count" || name == "stream_index"
+                            || name == "dimensions" || name == "components"
+                            || isNumberedVariable(name, "dim")
+                            || isNumberedVariable(name, "box")
+                            || isNumberedVariable(name, "boxdim")) {
+                        // constant for the whole array
+                    } else if (!allowUserVariables) {
+                        return false;
+                    }
+                }
+            }
+            catch (mu::Parser::exception_type&) {
+                // evaluate() will report the error
+                return false;
+            }
+            if (componentVariables > 1)
+                return false;
+        }
+        return true;
+    }
+
+    /* Fill the table that has one element per possible input value.
+     * Only call this if lutIsPossible() returned true. */
+    bool computeLut(TGD::ArrayContainer& table)
+    {
+        std::vector<double> results(table.componentCount());
+        for (size_t x = 0; x < table.elementCount(); x++) {
+            double value;
+            switch (table.componentType()) {
+            case TGD::int8:
+                value = static_cast<int8_t>(x);
+                break;
+            case TGD::int16:
+                value = static_cast<int16_t>(x);
+                break;
+            default:
+                value = x;
+                break;
+            }
+            for (size_t c = 0; c < table.componentCount(); c++) {
+                for (size_t i = 0; i < maxComponentCount; i++)
+                    var_v[i] = std::numeric_limits<double>::quiet_NaN();
+                var_v[c] = value;
+                if (!evaluate())
+                    return false;
+                results[c] = var_v[c];
+            }
+            for (size_t c = 0; c < table.componentCount(); c++)
+                var_v[c] = results[c];
+            getElement(table, x);
+        }
+        return true;
+    }
+
     void getElement(TGD::ArrayContainer& array, size_t e)
     {
         for (size_t i = 0; i < array.componentCount(); i++) {
@@ -1455,6 +1726,28 @@ public:
 };
 #endif
 
+#ifdef TGD_WITH_MUPARSER
+template<typename T> static void applyLut(const TGD::ArrayContainer& table,
+        TGD::ArrayContainer& array, const std::vector<size_t>& box)
+{
+    typedef typename std::make_unsigned<T>::type U;
+    const T* lut = static_cast<const T*>(table.data());
+    size_t components = array.componentCount();
+    size_t rowLength = box[array.dimensionCount()];
+    forEachBoxRow(box, array, [&] (size_t e) {
+            T* data = array.get<T>(e);
+            if (components == 1) {
+                for (size_t i = 0; i < rowLength; i++)
+                    data[i] = lut[U(data[i])];
+            } else {
+                for (size_t i = 0; i < rowLength; i++)
+                    for (size_t c = 0; c < components; c++)
+                        data[i * components + c] = lut[size_t(U(data[i * components + c])) * components + c];
+            }
+            });
+}
+#endif
+
 int tgd_calc(int argc, char* argv[])
 {
     CmdLine cmdLine;
@@ -1462,6 +1755,7 @@ int tgd_calc(int argc, char* argv[])
     cmdLine.addOptionWithArg("output", 'o');
     cmdLine.addOptionWithArg("box", 'b', parseUIntList);
     cmdLine.addOptionWithArg("expression", 'e');
+    cmdLine.addOptionWithoutArg("lut");
     std::string errMsg;
     if (!cmdLine.parse(argc, argv, 2, -1, errMsg)) {
         fprintf(stderr, "tgd calc: %s\n", errMsg.c_str());
@@ -1480,6 +1774,11 @@ int tgd_calc(int argc, char* argv[])
                 "available and can be used in the calculations.\n"
                 "The first input defines the output dimensions and components.\n"
                 "\n"
+                "If there is a single 8 or 16 bit integer input and each output component\n"
+                "only depends on the same component of the current input element, the\n"
+                "expressions are evaluated once per possible input value into a lookup table\n"
+                "which is then applied to all elements (see option --lut).\n"
+                "\n"
                 "Available constants:\n"
                 "  pi, e\n"
                 "Available functions:\n"
@@ -1538,7 +1837,10 @@ int tgd_calc(int argc, char* argv[])
                 "  -i|--input=TAG             set input hints such as FORMAT=gdal, DPI=300 etc.\n"
                 "  -o|--output=TAG            set output hints such as FORMAT=gdal etc.\n"
                 "  -b|--box=INDEX,SIZE        set box to operate on, e.g. X,Y,WIDTH,HEIGHT for 2D\n"
-                "  -e|--expression=E          evaluate expression E (can be used more than once)\n");
+                "  -e|--expression=E          evaluate expression E (can be used more than once)\n"
+                "  --lut                      always use a lookup table, even for small arrays\n"
+                "                             and with user-defined variables (which must then\n"
+                "                             not carry values from one element to the next)\n");
         return 0;
     }
     if (!cmdLine.isSet("expression")) {
@@ -1628,8 +1930,48 @@ int tgd_calc(int argc, char* argv[])
         /* setup calculator for this array */
         calc.init(arrayIndex, localBox);
 
-        /* calc */
+        /* use a lookup table if that is possible and cheaper */
+        bool useLut = false;
         if (!boxIsEmpty(localBox)) {
+            size_t lutSize = size_t(1) << (array.componentSize() * 8);
+            size_t boxElementCount = 1;
+            for (size_t d = 0; d < array.dimensionCount(); d++)
+                boxElementCount *= localBox[array.dimensionCount() + d];
+            bool lutPossible = calc.lutIsPossible(cmdLine.isSet("lut"));
+            if (cmdLine.isSet("lut") && !lutPossible) {
+                fprintf(stderr, "tgd calc: --lut requires a single 8 or 16 bit integer input and expressions "
+                        "that use only the current element\n");
+                err = TGD::ErrorInvalidData;
+                break;
+            }
+            useLut = lutPossible && (cmdLine.isSet("lut") || boxElementCount > lutSize * array.componentCount());
+            if (useLut) {
+                TGD::ArrayContainer table({ lutSize }, array.componentCount(), array.componentType());
+                if (!calc.computeLut(table)) {
+                    err = TGD::ErrorInvalidData;
+                    break;
+                }
+                switch (array.componentType()) {
+                case TGD::int8:
+                    applyLut<int8_t>(table, array, localBox);
+                    break;
+                case TGD::uint8:
+                    applyLut<uint8_t>(table, array, localBox);
+                    break;
+                case TGD::int16:
+                    applyLut<int16_t>(table, array, localBox);
+                    break;
+                case TGD::uint16:
+                    applyLut<uint16_t>(table, array, localBox);
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+
+        /* calc */
+        if (!useLut && !boxIsEmpty(localBox)) {
             /* initialize box index */
             initBoxIndex(localBox, index);
             for (;;) {
@@ -1661,6 +2003,12 @@ int tgd_calc(int argc, char* argv[])
         arrayIndex++;
     }
 
+    if (err == TGD::ErrorNone) {
+        err = exporter.finish();
+        if (err != TGD::ErrorNone)
+            fprintf(stderr, "tgd calc: %s: %s\n", outFileName.c_str(), TGD::strerror(err));
+    }
+
     return (err == TGD::ErrorNone ? 0 : 1);
 #endif
 }
@@ -1736,6 +2084,170 @@ int tgd_diff(int argc, char* argv[])
         }
     }
 
+    if (err == TGD::ErrorNone) {
+        err = exporter.finish();
+        if (err != TGD::ErrorNone)
+            fprintf(stderr, "tgd diff: %s: %s\n", outFileName.c_str(), TGD::strerror(err));
+    }
+
+    return (err == TGD::ErrorNone ? 0 : 1);
+}
+
+int tgd_tonemap(int argc, char* argv[])
+{
+    CmdLine cmdLine;
+    cmdLine.addOptionWithArg("input", 'i');
+    cmdLine.addOptionWithArg("output", 'o');
+    cmdLine.addOptionWithArg("method", 'm', parseToneMapOperator, "none");
+    cmdLine.addOptionWithArg("exposure", 'e', parseDouble, "0");
+    cmdLine.addOptionWithArg("gamma", 'g', parseGamma, "srgb");
+    cmdLine.addOptionWithoutArg("linear", 'l');
+    cmdLine.addOptionWithArg("type", 't', parseType);
+    std::string errMsg;
+    if (!cmdLine.parse(argc, argv, 2, 2, errMsg)) {
+        fprintf(stderr, "tgd tonemap: %s\n", errMsg.c_str());
+        return 1;
+    }
+    if (cmdLine.isSet("help")) {
+        fprintf(stderr, "Usage: tgd tonemap [option]... <infile|-> <outfile|->\n"
+                "\n"
+                "Map linear values to display values, or convert display values back to\n"
+                "linear values with --linear.\n"
+                "\n"
+                "Options:\n"
+                "  -i|--input=TAG             set input hints such as FORMAT=gdal, DPI=300 etc.\n"
+                "  -o|--output=TAG            set output hints such as FORMAT=gdal etc.\n"
+                "  -m|--method=M              tone mapping operator: none (default; clamp to\n"
+                "                             [0,1]), reinhard, aces\n"
+                "  -e|--exposure=E            scale values by 2^E before tone mapping\n"
+                "  -g|--gamma=G               transfer function: srgb (default), or x^(1/G)\n"
+                "  -l|--linear                decode to linear values instead of tone mapping\n"
+                "  -t|--type=T                output type (default uint8, or float32 with\n"
+                "                             --linear)\n");
+        return 0;
+    }
+    bool linear = cmdLine.isSet("linear");
+    if (linear && (cmdLine.isSet("method") || cmdLine.isSet("exposure"))) {
+        fprintf(stderr, "tgd tonemap: cannot use --method or --exposure with --linear\n");
+        return 1;
+    }
+    TGD::ToneMapOperator op = getToneMapOperator(cmdLine.value("method"));
+    float exposure = getDouble(cmdLine.value("exposure"));
+    float gamma = getGamma(cmdLine.value("gamma"));
+    TGD::Type type = (cmdLine.isSet("type") ? getType(cmdLine.value("type"))
+            : linear ? TGD::float32 : TGD::uint8);
+
+    const std::string& inFileName = cmdLine.arguments()[0];
+    const std::string& outFileName = cmdLine.arguments()[1];
+    TGD::TagList importerHints = createTagList(cmdLine.valueList("input"));
+    TGD::TagList exporterHints = createTagList(cmdLine.valueList("output"));
+    TGD::Importer importer(inFileName, importerHints);
+    TGD::Exporter exporter(outFileName, TGD::Overwrite, exporterHints);
+    TGD::Error err = TGD::ErrorNone;
+    for (;;) {
+        if (!importer.hasMore(&err)) {
+            if (err != TGD::ErrorNone) {
+                fprintf(stderr, "tgd tonemap: %s: %s\n", inFileName.c_str(), TGD::strerror(err));
+            }
+            break;
+        }
+        TGD::ArrayContainer array = importer.readArray(&err);
+        if (err != TGD::ErrorNone) {
+            fprintf(stderr, "tgd tonemap: %s: %s\n", inFileName.c_str(), TGD::strerror(err));
+            break;
+        }
+        TGD::ArrayContainer result = (linear
+                ? TGD::toLinear(array, gamma, type)
+                : TGD::toneMap(array, op, exposure, gamma, type));
+        err = exporter.writeArray(result);
+        if (err != TGD::ErrorNone) {
+            fprintf(stderr, "tgd tonemap: %s: %s\n", outFileName.c_str(), TGD::strerror(err));
+            break;
+        }
+    }
+
+    if (err == TGD::ErrorNone) {
+        err = exporter.finish();
+        if (err != TGD::ErrorNone)
+            fprintf(stderr, "tgd tonemap: %s: %s\n", outFileName.c_str(), TGD::strerror(err));
+    }
+
+    return (err == TGD::ErrorNone ? 0 : 1);
+}
+
+int tgd_merge(int argc, char* argv[])
+{
+    CmdLine cmdLine;
+    cmdLine.addOptionWithArg("input", 'i');
+    cmdLine.addOptionWithArg("output", 'o');
+    cmdLine.addOptionWithArg("index", 'I', parseUIntList);
+    cmdLine.addOptionWithArg("array", 'A', parseUInt, "0");
+    std::string errMsg;
+    if (!cmdLine.parse(argc, argv, 2, 2, errMsg)) {
+        fprintf(stderr, "tgd merge: %s\n", errMsg.c_str());
+        return 1;
+    }
+    if (cmdLine.isSet("help")) {
+        fprintf(stderr, "Usage: tgd merge [option]... <infile|-> <outfile>\n"
+                "\n"
+                "Write the input arrays into existing arrays of the output file, e.g. to\n"
+                "combine partial results that were computed separately. Input array i is\n"
+                "written into output array A+i. The output file must exist, e.g. created\n"
+                "with tgd create, and must be in tgd or raw format. Several processes can\n"
+                "write disjoint parts of the output at the same time.\n"
+                "\n"
+                "Options:\n"
+                "  -i|--input=TAG             set input hints such as FORMAT=gdal etc.\n"
+                "  -o|--output=TAG            set output hints, e.g. the array description\n"
+                "                             for raw files\n"
+                "  -I|--index=INDEX           element index at which to place the input arrays,\n"
+                "                             e.g. X,Y for 2D (default all zero)\n"
+                "  -A|--array=A               index of the first output array (default 0)\n");
+        return 0;
+    }
+
+    const std::string& inFileName = cmdLine.arguments()[0];
+    const std::string& outFileName = cmdLine.arguments()[1];
+    TGD::TagList importerHints = createTagList(cmdLine.valueList("input"));
+    TGD::TagList exporterHints = createTagList(cmdLine.valueList("output"));
+    TGD::Importer importer(inFileName, importerHints);
+    TGD::Exporter exporter(outFileName, TGD::Append, exporterHints);
+    std::vector<size_t> index;
+    if (cmdLine.isSet("index"))
+        index = getUIntList(cmdLine.value("index"));
+    size_t arrayIndex = getUInt(cmdLine.value("array"));
+    TGD::Error err = TGD::ErrorNone;
+    for (;;) {
+        if (!importer.hasMore(&err)) {
+            if (err != TGD::ErrorNone) {
+                fprintf(stderr, "tgd merge: %s: %s\n", inFileName.c_str(), TGD::strerror(err));
+            }
+            break;
+        }
+        TGD::ArrayContainer array = importer.readArray(&err);
+        if (err != TGD::ErrorNone) {
+            fprintf(stderr, "tgd merge: %s: %s\n", inFileName.c_str(), TGD::strerror(err));
+            break;
+        }
+        if (index.size() == 0) {
+            index.resize(array.dimensionCount(), 0);
+        } else if (index.size() != array.dimensionCount()) {
+            fprintf(stderr, "tgd merge: %s: index does not match dimensions\n", inFileName.c_str());
+            err = TGD::ErrorInvalidData;
+            break;
+        }
+        if (arrayIndex > size_t(std::numeric_limits<int>::max())) {
+            err = TGD::ErrorInvalidData;
+        } else {
+            err = exporter.writeBox(array, index, arrayIndex);
+        }
+        if (err != TGD::ErrorNone) {
+            fprintf(stderr, "tgd merge: %s: %s\n", outFileName.c_str(), TGD::strerror(err));
+            break;
+        }
+        arrayIndex++;
+    }
+
     return (err == TGD::ErrorNone ? 0 : 1);
 }
 
@@ -1784,6 +2296,7 @@ int tgd_info(int argc, char* argv[])
     cmdLine.addOrderedOptionWithArg("dimension-tags", 0, parseUInt);
     cmdLine.addOrderedOptionWithArg("component-tag", 0, parseUIntAndName);
     cmdLine.addOrderedOptionWithArg("component-tags", 0, parseUInt);
+    cmdLine.addOrderedOptionWithoutArg("hash");
     std::string errMsg;
     if (!cmdLine.parse(argc, argv, 1, -1, errMsg)) {
         fprintf(stderr, "tgd info: %s\n", errMsg.c_str());
@@ -1812,7 +2325,9 @@ int tgd_info(int argc, char* argv[])
                 "  --dimension-tag=D,N        print value of tag named N of dimension D\n"
                 "  --dimension-tags=D         print all tags of dimension D\n"
                 "  --component-tag=C,N        print value of tag named N of component C\n"
-                "  --component-tags=C         print all tags of component C\n");
+                "  --component-tags=C         print all tags of component C\n"
+                "  --hash                     print a hash of the array description and data;\n"
+                "                             equal hashes indicate identical arrays\n");
         return 0;
     }
 
@@ -1829,7 +2344,9 @@ int tgd_info(int argc, char* argv[])
             || cmdLine.isSet("dimension-tag")
             || cmdLine.isSet("dimension-tags")
             || cmdLine.isSet("component-tag")
-            || cmdLine.isSet("component-tags"));
+            || cmdLine.isSet("component-tags")
+            || cmdLine.isSet("hash"));
+    bool statistics = defaultOutput && cmdLine.isSet("statistics");
     std::vector<size_t> box;
     if (cmdLine.isSet("box"))
         box = getUIntList(cmdLine.value("box"));
@@ -1844,7 +2361,15 @@ int tgd_info(int argc, char* argv[])
                 }
                 break;
             }
-            TGD::ArrayContainer array = importer.readArray(&err);
+            // Only read the data if we need it; otherwise the description is enough
+            TGD::ArrayContainer array;
+            TGD::ArrayDescription desc;
+            if (statistics || cmdLine.isSet("hash")) {
+                array = importer.readArray(&err);
+                desc = array;
+            } else {
+                desc = importer.readDescription(&err);
+            }
             if (err != TGD::ErrorNone) {
                 fprintf(stderr, "tgd info: %s: %s\n", inFileName.c_str(), TGD::strerror(err));
                 break;
@@ -1853,74 +2378,76 @@ int tgd_info(int argc, char* argv[])
                 const std::string& optName = cmdLine.orderedOptionNames()[o];
                 const std::string& optVal = cmdLine.orderedOptionValues()[o];
                 if (optName == "dimensions") {
-                    printf("%zu\n", array.dimensionCount());
+                    printf("%zu\n", desc.dimensionCount());
                 } else if (optName == "dimension") {
                     size_t dim = getUInt(optVal);
-                    if (dim >= array.dimensionCount()) {
+                    if (dim >= desc.dimensionCount()) {
                         fprintf(stderr, "tgd info: %s: no such dimension %zu\n", inFileName.c_str(), dim);
                         err = TGD::ErrorInvalidData;
                         break;
                     }
-                    printf("%zu\n", array.dimension(dim));
+                    printf("%zu\n", desc.dimension(dim));
                 } else if (optName == "components") {
-                    printf("%zu\n", array.componentCount());
+                    printf("%zu\n", desc.componentCount());
                 } else if (optName == "type") {
-                    printf("%s\n", TGD::typeToString(getType(cmdLine.value("type"))));
+                    printf("%s\n", TGD::typeToString(desc.componentType()));
                 } else if (optName == "global-tag") {
-                    if (!array.globalTagList().contains(optVal)) {
+                    if (!desc.globalTagList().contains(optVal)) {
                         fprintf(stderr, "tgd info: %s: no global tag %s\n", inFileName.c_str(), optVal.c_str());
                         err = TGD::ErrorInvalidData;
                         break;
                     }
-                    printf("%s\n", array.globalTagList().value(optVal).c_str());
+                    printf("%s\n", desc.globalTagList().value(optVal).c_str());
                 } else if (optName == "global-tags") {
-                    tgd_info_print_taglist(array.globalTagList(), false);
+                    tgd_info_print_taglist(desc.globalTagList(), false);
                 } else if (optName == "dimension-tag") {
                     size_t dim;
                     std::string name;
                     getUIntAndName(optVal, &dim, &name);
-                    if (dim >= array.dimensionCount()) {
+                    if (dim >= desc.dimensionCount()) {
                         fprintf(stderr, "tgd info: %s: no such dimension %zu\n", inFileName.c_str(), dim);
                         err = TGD::ErrorInvalidData;
                         break;
                     }
-                    if (!array.dimensionTagList(dim).contains(name)) {
+                    if (!desc.dimensionTagList(dim).contains(name)) {
                         fprintf(stderr, "tgd info: %s: no tag %s for dimension %zu\n", inFileName.c_str(), name.c_str(), dim);
                         err = TGD::ErrorInvalidData;
                         break;
                     }
-                    printf("%s\n", array.dimensionTagList(dim).value(name).c_str());
+                    printf("%s\n", desc.dimensionTagList(dim).value(name).c_str());
                 } else if (optName == "dimension-tags") {
                     size_t dim = getUInt(optVal);
-                    if (dim >= array.dimensionCount()) {
+                    if (dim >= desc.dimensionCount()) {
                         fprintf(stderr, "tgd info: %s: no such dimension %zu\n", inFileName.c_str(), dim);
                         err = TGD::ErrorInvalidData;
                         break;
                     }
-                    tgd_info_print_taglist(array.dimensionTagList(dim), false);
+                    tgd_info_print_taglist(desc.dimensionTagList(dim), false);
                 } else if (optName == "component-tag") {
                     size_t comp;
                     std::string name;
                     getUIntAndName(optVal, &comp, &name);
-                    if (comp >= array.componentCount()) {
+                    if (comp >= desc.componentCount()) {
                         fprintf(stderr, "tgd info: %s: no such component %zu\n", inFileName.c_str(), comp);
                         err = TGD::ErrorInvalidData;
                         break;
                     }
-                    if (!array.componentTagList(comp).contains(name)) {
+                    if (!desc.componentTagList(comp).contains(name)) {
                         fprintf(stderr, "tgd info: %s: no tag %s for component %zu\n", inFileName.c_str(), name.c_str(), comp);
                         err = TGD::ErrorInvalidData;
                         break;
                     }
-                    printf("%s\n", array.componentTagList(comp).value(name).c_str());
+                    printf("%s\n", desc.componentTagList(comp).value(name).c_str());
                 } else if (optName == "component-tags") {
                     size_t comp = getUInt(optVal);
-                    if (comp >= array.componentCount()) {
+                    if (comp >= desc.componentCount()) {
                         fprintf(stderr, "tgd info: %s: no such component %zu\n", inFileName.c_str(), comp);
                         err = TGD::ErrorInvalidData;
                         break;
                     }
-                    tgd_info_print_taglist(array.componentTagList(comp), false);
+                    tgd_info_print_taglist(desc.componentTagList(comp), false);
+                } else if (optName == "hash") {
+                    printf("%s\n", TGD::hashArray(array).toString().c_str());
                 }
             }
             if (err != TGD::ErrorNone) {
@@ -1928,36 +2455,36 @@ int tgd_info(int argc, char* argv[])
             }
             if (defaultOutput) {
                 std::string sizeString;
-                if (array.dimensionCount() == 0) {
+                if (desc.dimensionCount() == 0) {
                     sizeString = "0";
                 } else {
-                    sizeString = std::to_string(array.dimension(0));
-                    for (size_t i = 1; i < array.dimensionCount(); i++) {
+                    sizeString = std::to_string(desc.dimension(0));
+                    for (size_t i = 1; i < desc.dimensionCount(); i++) {
                         sizeString += 'x';
-                        sizeString += std::to_string(array.dimension(i));
+                        sizeString += std::to_string(desc.dimension(i));
                     }
                 }
                 printf("array %zu: %zu x %s, size %s (%s)\n",
-                        arrayCounter, array.componentCount(),
-                        TGD::typeToString(array.componentType()),
-                        sizeString.c_str(), tgd_info_human_readable_memsize(array.dataSize()).c_str());
-                if (array.globalTagList().size() > 0) {
+                        arrayCounter, desc.componentCount(),
+                        TGD::typeToString(desc.componentType()),
+                        sizeString.c_str(), tgd_info_human_readable_memsize(desc.dataSize()).c_str());
+                if (desc.globalTagList().size() > 0) {
                     printf("  global:\n");
-                    tgd_info_print_taglist(array.globalTagList());
+                    tgd_info_print_taglist(desc.globalTagList());
                 }
-                for (size_t i = 0; i < array.dimensionCount(); i++) {
-                    if (array.dimensionTagList(i).size() > 0) {
+                for (size_t i = 0; i < desc.dimensionCount(); i++) {
+                    if (desc.dimensionTagList(i).size() > 0) {
                         printf("  dimension %zu:\n", i);
-                        tgd_info_print_taglist(array.dimensionTagList(i));
+                        tgd_info_print_taglist(desc.dimensionTagList(i));
                     }
                 }
-                for (size_t i = 0; i < array.componentCount(); i++) {
-                    if (array.componentTagList(i).size() > 0) {
+                for (size_t i = 0; i < desc.componentCount(); i++) {
+                    if (desc.componentTagList(i).size() > 0) {
                         printf("  component %zu:\n", i);
-                        tgd_info_print_taglist(array.componentTagList(i));
+                        tgd_info_print_taglist(desc.componentTagList(i));
                     }
                 }
-                if (cmdLine.isSet("statistics")) {
+                if (statistics) {
                     std::vector<size_t> index(array.dimensionCount());
                     std::vector<size_t> localBox;
                     if (box.size() > 0) {
@@ -2036,15 +2563,398 @@ int tgd_info(int argc, char* argv[])
 }
 
 
-int main(int argc, char* argv[])
+int tgd_run(int argc, char* argv[]);
+
+#ifndef _WIN32
+/* Protocol of tgd serve: the client connects to the UNIX socket and sends the
+ * number of arguments, its working directory, and the arguments (starting
+ * with the command), each terminated by a null byte. The first message
+ * carries the standard input, output, and error file descriptors of the
+ * client. The server runs the command with these descriptors and replies with
+ * the exit status as a decimal number followed by a newline. */
+
+static const size_t serveMaxRequestSize = 1 << 20;
+static const int serveRequestTimeout = 10; // seconds
+
+static volatile sig_atomic_t serveTerminate = 0;
+
+static void serveSignalHandler(int)
 {
+    serveTerminate = 1;
+}
+
+static bool serveAddress(const std::string& socketName, struct sockaddr_un* addr)
+{
+    std::memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (socketName.size() >= sizeof(addr->sun_path)) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    std::memcpy(addr->sun_path, socketName.c_str(), socketName.size() + 1);
+    return true;
+}
+
+static bool serveWriteAll(int fd, const char* data, size_t size)
+{
+    while (size > 0) {
+        ssize_t r = write(fd, data, size);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        data += r;
+        size -= r;
+    }
+    return true;
+}
+
+/* Reads the request from the connection. Returns false on protocol errors. */
+static bool serveReadRequest(int conn, int fds[3], std::vector<std::string>& strings)
+{
+    std::vector<char> request;
+    size_t expectedStrings = 0;
+    for (;;) {
+        char buf[4096];
+        struct iovec iov;
+        iov.iov_base = buf;
+        iov.iov_len = sizeof(buf);
+        union {
+            struct cmsghdr header;
+            char space[CMSG_SPACE(3 * sizeof(int))];
+        } control;
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.space;
+        msg.msg_controllen = sizeof(control.space);
+        ssize_t r = recvmsg(conn, &msg, 0);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+                int n = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                std::vector<int> received(n);
+                std::memcpy(received.data(), CMSG_DATA(c), n * sizeof(int));
+                for (int i = 0; i < n; i++) {
+                    if (i < 3 && fds[i] < 0)
+                        fds[i] = received[i];
+                    else
+                        close(received[i]);
+                }
+            }
+        }
+        request.insert(request.end(), buf, buf + r);
+        if (request.size() > serveMaxRequestSize)
+            return false;
+        // split off complete strings
+        size_t start = 0;
+        for (size_t i = 0; i < request.size(); i++) {
+            if (request[i] == '\0') {
+                strings.push_back(std::string(request.data() + start, i - start));
+                start = i + 1;
+                if (strings.size() == 1) {
+                    if (!parseUIntLargerThanZero(strings[0]))
+                        return false;
+                    expectedStrings = 2 + getUInt(strings[0]);
+                }
+            }
+        }
+        request.erase(request.begin(), request.begin() + start);
+        if (expectedStrings > 0 && strings.size() >= expectedStrings)
+            break;
+    }
+    return (strings.size() == expectedStrings && request.empty()
+            && fds[0] >= 0 && fds[1] >= 0 && fds[2] >= 0);
+}
+
+/* Only the user running the server may send commands */
+static bool serveCheckPeer(int conn)
+{
+#if defined(SO_PEERCRED)
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    return (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid());
+#else
+    uid_t uid;
+    gid_t gid;
+    return (getpeereid(conn, &uid, &gid) == 0 && uid == getuid());
+#endif
+}
+
+/* A worker accepts one connection, runs the command, and exits */
+static void serveWorker(int listenFd)
+{
+    int conn;
+    do {
+        conn = accept(listenFd, nullptr, nullptr);
+    } while (conn < 0 && errno == EINTR);
+    if (conn < 0)
+        _exit(1);
+    close(listenFd);
+    if (!serveCheckPeer(conn))
+        _exit(1);
+    // a client that does not send its request must not block the worker
+    struct timeval timeout;
+    timeout.tv_sec = serveRequestTimeout;
+    timeout.tv_usec = 0;
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    int fds[3] = { -1, -1, -1 };
+    std::vector<std::string> strings;
+    int status = 1;
+    if (serveReadRequest(conn, fds, strings)) {
+        // move the descriptors out of the way before they become 0, 1, 2
+        for (int i = 0; i < 3; i++) {
+            int fd = fcntl(fds[i], F_DUPFD, 3);
+            close(fds[i]);
+            fds[i] = fd;
+        }
+        for (int i = 0; i < 3; i++) {
+            dup2(fds[i], i);
+            close(fds[i]);
+        }
+        std::vector<char*> args;
+        args.push_back(const_cast<char*>("tgd"));
+        for (size_t i = 2; i < strings.size(); i++)
+            args.push_back(&(strings[i][0]));
+        args.push_back(nullptr);
+        if (chdir(strings[1].c_str()) != 0) {
+            fprintf(stderr, "tgd serve: %s: %s\n", strings[1].c_str(), std::strerror(errno));
+        } else if (strings[2] == "serve" || strings[2] == "client") {
+            // a client in a worker could wait for the worker itself
+            fprintf(stderr, "tgd serve: cannot run %s command\n", strings[2].c_str());
+        } else {
+            status = tgd_run(args.size() - 1, args.data());
+        }
+        fflush(stdout);
+        fflush(stderr);
+    }
+    std::string reply = std::to_string(status) + '\n';
+    serveWriteAll(conn, reply.c_str(), reply.size());
+    _exit(0);
+}
+#endif
+
+int tgd_serve(int argc, char* argv[])
+{
+    CmdLine cmdLine;
+    cmdLine.addOptionWithArg("workers", 'w', parseUIntLargerThanZero,
+            std::to_string(std::max(1u, std::thread::hardware_concurrency())));
+    cmdLine.addOptionWithArg("preload", 'p', nullptr,
+            "dcmtk,exr,fits,ffmpeg,gdal,gta,hdf5,jpeg,mat,pdf,pfs,png,tiff,magick");
+    std::string errMsg;
+    if (!cmdLine.parse(argc, argv, 1, 1, errMsg)) {
+        fprintf(stderr, "tgd serve: %s\n", errMsg.c_str());
+        return 1;
+    }
+    if (cmdLine.isSet("help")) {
+        fprintf(stderr, "Usage: tgd serve [option]... <socket>\n"
+                "\n"
+                "Listen on a UNIX socket and run the commands sent with tgd client,\n"
+                "avoiding process startup and format plugin loading for each command.\n"
+                "\n"
+                "Options:\n"
+                "  -w|--workers=N             number of worker processes (default: number\n"
+                "                             of cores)\n"
+                "  -p|--preload=F0[,F1...]    formats to load in advance (default: all\n"
+                "                             formats implemented as plugins)\n");
+        return 0;
+    }
 #ifdef _WIN32
-    _setmode(_fileno(stdin), _O_BINARY);
-    _setmode(_fileno(stdout), _O_BINARY);
-    _fmode = _O_BINARY;
-    setbuf(stderr, NULL);
+    fprintf(stderr, "tgd serve: not supported on this platform\n");
+    return 1;
+#else
+    size_t workerCount = getUInt(cmdLine.value("workers"));
+    const std::string& socketName = cmdLine.arguments()[0];
+    std::string preload = cmdLine.value("preload");
+    for (size_t start = 0; start < preload.size(); ) {
+        size_t comma = preload.find(',', start);
+        if (comma == std::string::npos)
+            comma = preload.size();
+        if (comma > start)
+            TGD::preloadFormat(preload.substr(start, comma - start));
+        start = comma + 1;
+    }
+
+    struct sockaddr_un addr;
+    if (!serveAddress(socketName, &addr)) {
+        fprintf(stderr, "tgd serve: %s: %s\n", socketName.c_str(), std::strerror(errno));
+        return 1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        fprintf(stderr, "tgd serve: %s\n", std::strerror(errno));
+        return 1;
+    }
+    struct stat st;
+    if (lstat(socketName.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        // remove a stale socket, but not one that is in use
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool inUse = (probe >= 0 && connect(probe, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0);
+        if (probe >= 0)
+            close(probe);
+        if (inUse) {
+            fprintf(stderr, "tgd serve: %s: socket is in use\n", socketName.c_str());
+            close(fd);
+            return 1;
+        }
+        unlink(socketName.c_str());
+    }
+    // the socket must be accessible only for the user running the server
+    mode_t oldMask = umask(077);
+    int bindResult = bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    umask(oldMask);
+    if (bindResult != 0 || listen(fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "tgd serve: %s: %s\n", socketName.c_str(), std::strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    struct sigaction sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serveSignalHandler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGHUP, &sa, nullptr);
+    fflush(stdout);
+    fflush(stderr);
+
+    // Keep the pool of idle workers full: each worker handles one request
+    // and exits, so no state leaks from one command to the next, and the
+    // fork happens before the next request arrives.
+    std::set<pid_t> workers;
+    while (!serveTerminate) {
+        while (workers.size() < workerCount && !serveTerminate) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                signal(SIGTERM, SIG_DFL);
+                signal(SIGINT, SIG_DFL);
+                signal(SIGHUP, SIG_DFL);
+                serveWorker(fd);
+            } else if (pid < 0) {
+                fprintf(stderr, "tgd serve: %s\n", std::strerror(errno));
+                break;
+            }
+            workers.insert(pid);
+        }
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid > 0)
+            workers.erase(pid);
+        else if (errno == ECHILD)
+            sleep(1); // fork failed and there are no workers
+    }
+    for (pid_t pid : workers)
+        kill(pid, SIGTERM);
+    for (pid_t pid : workers)
+        waitpid(pid, nullptr, 0);
+    close(fd);
+    unlink(socketName.c_str());
+    return 0;
 #endif
+}
 
+int tgd_client(int argc, char* argv[])
+{
+    if (argc == 2 && (std::strcmp(argv[1], "--help") == 0 || std::strcmp(argv[1], "-h") == 0)) {
+        fprintf(stderr, "Usage: tgd client <socket> <command> [argument]...\n"
+                "\n"
+                "Run a tgd command in the server listening on the given socket, see tgd serve.\n"
+                "The command uses the standard input, output, and error, and the working\n"
+                "directory of the client, and its exit status is returned.\n");
+        return 0;
+    }
+    if (argc < 3) {
+        fprintf(stderr, "tgd client: missing arguments\n");
+        return 1;
+    }
+#ifdef _WIN32
+    fprintf(stderr, "tgd client: not supported on this platform\n");
+    return 1;
+#else
+    const std::string socketName = argv[1];
+    std::vector<char> cwd(256);
+    while (!getcwd(cwd.data(), cwd.size())) {
+        if (errno != ERANGE) {
+            fprintf(stderr, "tgd client: %s\n", std::strerror(errno));
+            return 1;
+        }
+        cwd.resize(2 * cwd.size());
+    }
+    std::string request = std::to_string(argc - 2);
+    request.push_back('\0');
+    request.append(cwd.data());
+    request.push_back('\0');
+    for (int i = 2; i < argc; i++) {
+        request.append(argv[i]);
+        request.push_back('\0');
+    }
+
+    struct sockaddr_un addr;
+    int fd = -1;
+    if (serveAddress(socketName, &addr))
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        fprintf(stderr, "tgd client: %s: %s\n", socketName.c_str(), std::strerror(errno));
+        return 1;
+    }
+    // the first byte carries the standard descriptors, the rest follows
+    int fds[3] = { 0, 1, 2 };
+    struct iovec iov;
+    iov.iov_base = &(request[0]);
+    iov.iov_len = 1;
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(fds))];
+    } control;
+    std::memset(&control, 0, sizeof(control));
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+    struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(c), fds, sizeof(fds));
+    ssize_t r;
+    do {
+        r = sendmsg(fd, &msg, 0);
+    } while (r < 0 && errno == EINTR);
+    if (r != 1 || !serveWriteAll(fd, request.data() + 1, request.size() - 1)) {
+        fprintf(stderr, "tgd client: %s: %s\n", socketName.c_str(), std::strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    std::string reply;
+    for (;;) {
+        char buf[64];
+        r = read(fd, buf, sizeof(buf));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break;
+        reply.append(buf, r);
+    }
+    close(fd);
+    if (reply.empty() || reply.back() != '\n' || !parseUInt(reply.substr(0, reply.size() - 1))) {
+        fprintf(stderr, "tgd client: %s: no exit status received\n", socketName.c_str());
+        return 1;
+    }
+    return getUInt(reply.substr(0, reply.size() - 1));
+#endif
+}
+
+int tgd_run(int argc, char* argv[])
+{
     int retval = 0;
     if (argc < 2) {
         tgd_help();
@@ -2057,15 +2967,36 @@ int main(int argc, char* argv[])
         retval = tgd_create(argc - 1, &(argv[1]));
     } else if (std::strcmp(argv[1], "convert") == 0) {
         retval = tgd_convert(argc - 1, &(argv[1]));
+    } else if (std::strcmp(argv[1], "merge") == 0) {
+        retval = tgd_merge(argc - 1, &(argv[1]));
     } else if (std::strcmp(argv[1], "calc") == 0) {
         retval = tgd_calc(argc - 1, &(argv[1]));
     } else if (std::strcmp(argv[1], "diff") == 0) {
         retval = tgd_diff(argc - 1, &(argv[1]));
+    } else if (std::strcmp(argv[1], "tonemap") == 0) {
+        retval = tgd_tonemap(argc - 1, &(argv[1]));
     } else if (std::strcmp(argv[1], "info") == 0) {
         retval = tgd_info(argc - 1, &(argv[1]));
+    } else if (std::strcmp(argv[1], "serve") == 0) {
+        retval = tgd_serve(argc - 1, &(argv[1]));
+    } else if (std::strcmp(argv[1], "client") == 0) {
+        retval = tgd_client(argc - 1, &(argv[1]));
     } else {
         fprintf(stderr, "tgd: invalid command %s\n", argv[1]);
         retval = 1;
     }
     return retval;
 }
+
+int main(int argc, char* argv[])
+{
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+    _fmode = _O_BINARY;
+    setbuf(stderr, NULL);
+#endif
+
+    return tgd_run(argc, argv);
+}
+